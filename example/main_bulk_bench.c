@@ -0,0 +1,408 @@
+/**
+ * Benchmark of the bulk transfer modes - request-per-chunk (pull),
+ * the sender-driven push mode, and the delta mode (sending a new version
+ * of an object the receiver already has, with a few changes). The "sparse"
+ * modes send a mostly erased flash image, with and without fill runs.
+ * The "adapt" modes use the adaptive chunk size and window, which matters
+ * on a noisy link (the noise is a random byte error rate). The "fec" modes
+ * add forward error correction to the frames.
+ *
+ * Two endpoints are connected with a simulated serial link, which has
+ * a limited baud rate and a fixed latency (like a USB-serial adapter).
+ * Time is virtual, so the results are deterministic.
+ *
+ * Before the benchmarks, the digest of chunks that don't end on a block
+ * boundary is checked (the bench exits with an error if it's wrong).
+ *
+ * Build with "make bulk_bench". Run as "bulk_bench capture.pcap" to record
+ * the traffic of the first transfer (see the replay example).
+ *
+ * This example is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/crc32.h"
+#include "sbmp/sbmp_pcap.h"
+
+#define OBJECT_LEN (64 * 1024)
+#define BUF_LEN 256
+
+// delta mode - block size of the signatures
+#define DELTA_BLOCK 256
+#define DELTA_WINDOW (2 * DELTA_BLOCK + BUF_LEN)
+
+// fixed-mode retry timeout, like an application would use
+#define FIXED_TIMEOUT_US 200000
+// give up after this much virtual time
+#define MAX_TIME_US 600e6
+
+// --- Simulated link ---
+
+#define QUEUE_LEN 65536
+
+/** One direction of the link */
+typedef struct {
+	uint8_t bytes[QUEUE_LEN];
+	double times[QUEUE_LEN]; // delivery time of each byte
+	uint32_t head, tail;
+	double busy_until;       // when the transmitter finishes the last byte
+	uint32_t total;          // bytes sent
+} Line;
+
+static Line line_ab; // sender -> receiver
+static Line line_ba; // receiver -> sender
+
+static double now_us;
+static double byte_us;
+static double latency_us;
+static double byte_error_rate;
+
+static void line_put(Line *line, uint8_t byte)
+{
+	double start = (line->busy_until > now_us ? line->busy_until : now_us);
+	line->busy_until = start + byte_us;
+
+	if (byte_error_rate > 0 && rand() < byte_error_rate * RAND_MAX) {
+		byte ^= (uint8_t)(1 << (rand() % 8));
+	}
+
+	line->bytes[line->tail % QUEUE_LEN] = byte;
+	line->times[line->tail % QUEUE_LEN] = line->busy_until + latency_us;
+	line->tail++;
+	line->total++;
+}
+
+// --- Endpoints ---
+
+static SBMP_Endpoint *sender;
+static SBMP_Endpoint *receiver;
+
+static SBMP_BulkTx *bulk_tx;
+static SBMP_BulkRx *bulk_rx;
+static SBMP_BulkState *bulk_state;
+static uint8_t bulk_bitmap[OBJECT_LEN / 8 / 8];
+static uint8_t bulk_scratch[64];
+
+static uint8_t sender_buf[BUF_LEN];
+static uint8_t receiver_buf[BUF_LEN];
+static SBMP_SessionListenerSlot sender_slots[4];
+static SBMP_SessionListenerSlot receiver_slots[4];
+static SBMP_Fec sender_fec;
+static SBMP_Fec receiver_fec;
+static uint8_t sender_fec_block[SBMP_FEC_BLOCK_MAX];
+static uint8_t receiver_fec_block[SBMP_FEC_BLOCK_MAX];
+
+static uint8_t object[OBJECT_LEN];
+static uint8_t old_object[OBJECT_LEN]; // receiver's version, for the delta mode
+static uint8_t sparse_object[OBJECT_LEN]; // mostly 0xFF
+static const uint8_t *source; // the object being sent
+static uint8_t received[OBJECT_LEN];
+
+static SBMP_Pcap *capture; // records the first transfer, if set
+
+static SBMP_BulkSig delta_sigs[OBJECT_LEN / DELTA_BLOCK];
+static uint8_t delta_window[DELTA_WINDOW];
+static uint8_t delta_buf[DELTA_BLOCK];
+
+static uint32_t bench_clock(void)
+{
+	return (uint32_t)(now_us / 1000);
+}
+
+static void sender_tx(uint8_t byte)   { line_put(&line_ab, byte); }
+static void receiver_tx(uint8_t byte) { line_put(&line_ba, byte); }
+
+static void sender_rx(SBMP_Datagram *dg) { (void)dg; }
+
+static void receiver_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BULK_OFFER) {
+		sbmp_bulk_rx_start(bulk_rx, dg);
+	}
+}
+
+static bool read_object(SBMP_BulkTx *tx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)tx;
+	memcpy(buf, source + offset, len);
+	return true;
+}
+
+static void store_data(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	(void)rx;
+	memcpy(received + offset, data, len);
+}
+
+static bool read_old(SBMP_BulkRx *rx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)rx;
+	memcpy(buf, old_object + offset, len);
+	return true;
+}
+
+/** Reset the link and the endpoints */
+static void setup(void)
+{
+	memset(&line_ab, 0, sizeof(Line));
+	memset(&line_ba, 0, sizeof(Line));
+	now_us = 0;
+
+	sender = sbmp_ep_init(sender, sender_buf, BUF_LEN, sender_rx, sender_tx);
+	receiver = sbmp_ep_init(receiver, receiver_buf, BUF_LEN, receiver_rx, receiver_tx);
+
+	memset(sender_slots, 0, sizeof(sender_slots));
+	memset(receiver_slots, 0, sizeof(receiver_slots));
+	sbmp_ep_init_listeners(sender, sender_slots, 4);
+	sbmp_ep_init_listeners(receiver, receiver_slots, 4);
+
+	// fixed origins, no handshake needed
+	sbmp_ep_set_origin(sender, 0);
+	sbmp_ep_set_origin(receiver, 1);
+
+	// no handshake - set the buffer sizes manually
+	sender->peer_buffer_size = BUF_LEN;
+	receiver->peer_buffer_size = BUF_LEN;
+
+	sbmp_ep_enable(sender, true);
+	sbmp_ep_enable(receiver, true);
+}
+
+/** Transfer mode */
+typedef struct {
+	const char *name;
+	bool push;
+	bool delta;    // needs push
+	bool sparse;   // send the sparse image
+	bool adaptive; // adaptive chunk size and window
+	bool noisy;    // also run on the noisy link
+	uint8_t flags; // offer flags
+	uint8_t fec;   // FEC parity bytes per block, 0 = no FEC
+} Mode;
+
+static const Mode modes[] = {
+	{"pull",        false, false, false, false, true,  0, 0},
+	{"push",        true,  false, false, false, true,  BULK_FLAG_PUSH, 0},
+	{"delta",       true,  true,  false, false, false, BULK_FLAG_PUSH | BULK_FLAG_DELTA, 0},
+	{"sparse-push", true,  false, true,  false, false, BULK_FLAG_PUSH, 0},
+	{"sparse-fill", true,  false, true,  false, false, BULK_FLAG_PUSH | BULK_FLAG_FILL, 0},
+	{"pull-adapt",  false, false, false, true,  true,  0, 0},
+	{"push-adapt",  true,  false, false, true,  true,  BULK_FLAG_PUSH, 0},
+	{"pull-fec",    false, false, false, true,  true,  0, 16},
+	{"push-fec",    true,  false, false, true,  true,  BULK_FLAG_PUSH, 16},
+};
+
+/**
+ * Run one transfer.
+ *
+ * @param chunk  : chunk size
+ * @param window : push window (if the mode uses push)
+ * @param mode   : the transfer mode
+ * @return transfer time in us, or negative value on failure
+ */
+static double run_transfer(uint16_t chunk, uint32_t window, const Mode *mode)
+{
+	source = (mode->sparse ? sparse_object : object);
+	srand(1); // the same noise for each run
+
+	setup();
+
+	bulk_state = sbmp_bulk_state_init(bulk_state, bulk_bitmap, sizeof(bulk_bitmap), 8);
+	bulk_rx = sbmp_bulk_rx_init(bulk_rx, receiver, bulk_state, chunk, store_data, NULL);
+	bulk_tx = sbmp_bulk_tx_init(bulk_tx, sender, bulk_scratch, sizeof(bulk_scratch), read_object, NULL);
+
+	if (mode->fec) {
+		sbmp_frm_init_fec(&sender->frm, &sender_fec, sender_fec_block, mode->fec);
+		sbmp_frm_init_fec(&receiver->frm, &receiver_fec, receiver_fec_block, mode->fec);
+	}
+
+	sbmp_bulk_rx_set_push_window(bulk_rx, mode->push ? window : 0);
+	sbmp_bulk_rx_set_adaptive(bulk_rx, mode->adaptive ? bench_clock : NULL);
+
+	if (mode->delta) {
+		sbmp_bulk_rx_set_delta(bulk_rx, OBJECT_LEN, DELTA_BLOCK, delta_buf, read_old);
+		sbmp_bulk_tx_set_delta(bulk_tx, delta_sigs, OBJECT_LEN / DELTA_BLOCK, delta_window, DELTA_WINDOW);
+	}
+
+	SBMP_BulkOffer offer = {
+		.length = OBJECT_LEN,
+		.offer_id = 1,
+		.digest_type = SBMP_BULK_DIGEST_CRC32,
+		.digest = crc32buf(source, OBJECT_LEN),
+		.flags = mode->flags,
+	};
+
+	if (capture != NULL) {
+		sbmp_pcap_attach(capture, &receiver->frm);
+	}
+
+	sbmp_bulk_tx_offer(bulk_tx, &offer);
+	memset(received, 0, OBJECT_LEN);
+
+	while (bulk_rx->status == SBMP_BULK_RX_IDLE || bulk_rx->status == SBMP_BULK_RX_BUSY) {
+		// the sender pushes data when its UART is idle
+		if (line_ab.busy_until <= now_us && sbmp_bulk_tx_poll(bulk_tx)) {
+			continue;
+		}
+
+		// deliver the next byte
+		Line *line = NULL;
+		bool ab = (line_ab.head != line_ab.tail);
+		bool ba = (line_ba.head != line_ba.tail);
+
+		if (ab && (!ba || line_ab.times[line_ab.head % QUEUE_LEN] <= line_ba.times[line_ba.head % QUEUE_LEN])) {
+			line = &line_ab;
+		} else if (ba) {
+			line = &line_ba;
+		} else {
+			if (line_ab.busy_until > now_us) {
+				now_us = line_ab.busy_until;
+				continue;
+			}
+
+			// nothing in flight, a frame was lost
+			if (now_us > MAX_TIME_US) return -1;
+
+			// line idle timeout - drop a frame with a damaged length
+			sbmp_frm_reset_rx(&sender->frm);
+			sbmp_frm_reset_rx(&receiver->frm);
+
+			if (mode->adaptive) {
+				now_us += 1000;
+				sbmp_bulk_rx_poll(bulk_rx);
+			} else {
+				now_us += FIXED_TIMEOUT_US;
+				sbmp_bulk_rx_request_next(bulk_rx);
+			}
+			continue;
+		}
+
+		uint32_t i = line->head++ % QUEUE_LEN;
+		if (line->times[i] > now_us) now_us = line->times[i];
+
+		sbmp_ep_receive(line == &line_ab ? receiver : sender, line->bytes[i]);
+	}
+
+	if (bulk_rx->status != SBMP_BULK_RX_DONE || memcmp(source, received, OBJECT_LEN) != 0) {
+		return -1;
+	}
+
+	return now_us;
+}
+
+/**
+ * Check the digest of chunks that don't end on a block boundary - the part
+ * of a block must not be added twice when the rest of it arrives.
+ *
+ * @return digest correct
+ */
+static bool check_unaligned_digest(void)
+{
+	// 1000 B in 64 B blocks, the last block is shorter
+	const uint32_t len = 1000;
+	static uint8_t bitmap[2];
+	static SBMP_BulkState state;
+
+	sbmp_bulk_state_init(&state, bitmap, sizeof(bitmap), 64);
+
+	SBMP_BulkOffer offer = {
+		.length = len,
+		.offer_id = 1,
+		.digest_type = SBMP_BULK_DIGEST_CRC32,
+		.digest = crc32buf(object, len),
+	};
+	sbmp_bulk_state_reset(&state, &offer);
+
+	// ends in the middle of block 1, then the rest from the start of block 1
+	sbmp_bulk_state_mark_data(&state, 0, object, 100, NULL);
+	sbmp_bulk_state_mark_data(&state, 64, object + 64, len - 64, NULL);
+
+	return sbmp_bulk_state_complete(&state) && sbmp_bulk_state_verify(&state);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		capture = sbmp_pcap_open(argv[1], 0);
+		if (capture == NULL) return 1;
+	}
+
+	const uint32_t bauds[] = {115200, 1000000};
+	const double latencies[] = {0, 1000, 4000};
+	const uint16_t chunks[] = {64, 128, 248};
+	const double noises[] = {0, 2e-4, 1e-3};
+
+	for (int i = 0; i < OBJECT_LEN; i++) {
+		old_object[i] = (uint8_t)rand();
+	}
+
+	// the new version - a few patched places, and 10 bytes inserted in the middle
+	memcpy(object, old_object, 20000);
+	memset(object + 20000, 0xAA, 10);
+	memcpy(object + 20010, old_object + 20000, OBJECT_LEN - 20010);
+	for (int i = 0; i < 4; i++) {
+		memset(object + 5000 + i * 12000, 0x55, 16);
+	}
+
+	// sparse image - a few KB of code at the start, a config record in the middle
+	memset(sparse_object, 0xFF, OBJECT_LEN);
+	memcpy(sparse_object, object, 6000);
+	memcpy(sparse_object + 32768, object, 300);
+
+	if (!check_unaligned_digest()) {
+		fprintf(stderr, "Bulk digest of unaligned chunks is wrong!\n");
+		return 1;
+	}
+
+	printf("mode,baud,latency_us,byte_err,chunk,window,time_ms,goodput_Bps,efficiency,wire_bytes\n");
+
+	for (size_t n = 0; n < sizeof(noises) / sizeof(noises[0]); n++) {
+		byte_error_rate = noises[n];
+
+		for (size_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++) {
+			byte_us = 10e6 / bauds[b]; // 8N1 - 10 bits per byte
+
+			for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++) {
+				latency_us = latencies[l];
+
+				for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+					for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+						const Mode *mode = &modes[m];
+						uint32_t window = mode->push ? chunks[c] * 4 : 0;
+
+						if (byte_error_rate > 0 && !mode->noisy) continue;
+
+						double t = run_transfer(chunks[c], window, mode);
+
+						if (capture != NULL) {
+							sbmp_frm_set_capture(&receiver->frm, NULL, NULL, NULL, 0);
+							sbmp_pcap_close(capture);
+							capture = NULL;
+						}
+						if (t < 0) {
+							printf("%s,%u,%.0f,%g,%u,%u,FAILED\n", mode->name,
+								   bauds[b], latency_us, byte_error_rate, chunks[c], window);
+							continue;
+						}
+
+						double goodput = OBJECT_LEN / (t / 1e6);
+						double line_rate = 1e6 / byte_us;
+
+						printf("%s,%u,%.0f,%g,%u,%u,%.1f,%.0f,%.3f,%u\n", mode->name,
+							   bauds[b], latency_us, byte_error_rate, chunks[c], window,
+							   t / 1000, goodput, goodput / line_rate,
+							   line_ab.total + line_ba.total);
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+/**
+ * Many ports served by one event loop (see sbmp_loop.h).
+ *
+ * Each port is a socketpair or a pty pair. The "host" endpoints all run in
+ * one loop in the main thread, the "device" endpoints in a second loop in
+ * another thread, echoing the requests back. Every host port sends a request
+ * at a fixed interval from a loop timer; the round trip times of all ports
+ * go into one histogram, and the CPU time of the host thread is measured.
+ *
+ * This is run with the epoll and the io_uring backend, for comparison.
+ *
+ * Usage: loop_bench [-n ports] [-t seconds] [-i interval_ms] [-s payload] [-b backend] [-p]
+ *
+ *   -n : number of ports (default 64)
+ *   -t : measurement time (default 5 s)
+ *   -i : request interval of each port (default 10 ms)
+ *   -s : request payload size (default 32, min. 10)
+ *   -b : epoll, uring or both (default both)
+ *   -p : pty pairs instead of socketpairs
+ *
+ * Build with "make loop_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_transport_posix.h"
+#include "sbmp/sbmp_loop.h"
+
+#define BUF_LEN 1024
+#define MAX_PORTS 1024
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+
+/** Request header: port index (2 B) + send time in ns (8 B) */
+#define HEADER_LEN 10
+
+// options
+static int port_count = 64;
+static int seconds = 5;
+static uint32_t interval = 10;
+static uint16_t payload = 32;
+static const char *backend = "both";
+static bool use_pty = false;
+
+/** One end of a port */
+typedef struct {
+	SBMP_Endpoint ep;
+	uint8_t rx_buf[BUF_LEN];
+	SBMP_Transport *tp;
+} Side;
+
+static Side hosts[MAX_PORTS];
+static Side devices[MAX_PORTS];
+
+static SBMP_Loop *host_loop;
+static SBMP_Loop *device_loop;
+static volatile bool devices_running;
+
+static SBMP_Histogram hist; // us
+static uint64_t requests;
+static uint64_t responses;
+static bool measuring;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void device_rx(SBMP_Datagram *dg)
+{
+	if (dg->type != DG_BENCH_REQUEST || dg->length < HEADER_LEN) return;
+
+	uint16_t index;
+	memcpy(&index, dg->payload, 2);
+	if (index >= port_count) return;
+
+	sbmp_ep_send_response(&devices[index].ep, DG_BENCH_RESPONSE, dg->payload, dg->length, dg->session, NULL);
+}
+
+static void host_rx(SBMP_Datagram *dg)
+{
+	if (dg->type != DG_BENCH_RESPONSE || dg->length < HEADER_LEN || !measuring) return;
+
+	uint64_t sent;
+	memcpy(&sent, dg->payload + 2, 8);
+
+	sbmp_hist_add(&hist, (uint32_t)((now_ns() - sent) / 1000));
+	responses++;
+}
+
+/** Timer of a host port - send a request */
+static void send_request(SBMP_Loop *loop, void *arg)
+{
+	(void)loop;
+	uint16_t index = (uint16_t)((Side *)arg - hosts);
+	uint8_t buf[BUF_LEN];
+
+	memset(buf, 0xA5, payload);
+	memcpy(buf, &index, 2);
+	uint64_t t = now_ns();
+	memcpy(buf + 2, &t, 8);
+
+	if (sbmp_ep_send_message(&hosts[index].ep, DG_BENCH_REQUEST, buf, payload, NULL, NULL) && measuring) {
+		requests++;
+	}
+}
+
+static void stop_measuring(SBMP_Loop *loop, void *arg)
+{
+	(void)arg;
+	measuring = false;
+	sbmp_loop_stop(loop);
+}
+
+static void port_closed(SBMP_Loop *loop, SBMP_Transport *tp, void *arg)
+{
+	(void)loop;
+	(void)tp;
+	fprintf(stderr, "Port %d closed\n", (int)((Side *)arg - hosts));
+}
+
+static void *device_thread(void *arg)
+{
+	(void)arg;
+
+	while (devices_running) {
+		if (!sbmp_loop_run_once(device_loop, 100)) break;
+	}
+
+	return NULL;
+}
+
+static bool all_connected(void)
+{
+	for (int i = 0; i < port_count; i++) {
+		if (sbmp_ep_handshake_status(&hosts[i].ep) != SBMP_HSK_SUCCESS) return false;
+	}
+	return true;
+}
+
+static SBMP_Loop *create_loop(bool uring)
+{
+	return uring ? sbmp_loop_create_uring() : sbmp_loop_create();
+}
+
+/** One measurement, prints a CSV line */
+static bool run(bool uring)
+{
+	host_loop = create_loop(uring);
+	device_loop = create_loop(uring);
+	if (host_loop == NULL || device_loop == NULL) return false;
+
+	memset(&hist, 0, sizeof(hist));
+	requests = 0;
+	responses = 0;
+
+	for (int i = 0; i < port_count; i++) {
+		Side *h = &hosts[i];
+		Side *d = &devices[i];
+
+		bool ok = use_pty ? sbmp_tp_pty_pair(&h->tp, &d->tp, 0) : sbmp_tp_socketpair(&h->tp, &d->tp, 0);
+		if (!ok) return false;
+
+		sbmp_ep_init(&h->ep, h->rx_buf, BUF_LEN, host_rx, NULL);
+		sbmp_ep_init(&d->ep, d->rx_buf, BUF_LEN, device_rx, NULL);
+		sbmp_tp_attach(h->tp, &h->ep.frm);
+		sbmp_tp_attach(d->tp, &d->ep.frm);
+		sbmp_ep_enable(&h->ep, true);
+		sbmp_ep_enable(&d->ep, true);
+
+		if (!sbmp_loop_add(host_loop, h->tp, port_closed, h)) return false;
+		if (!sbmp_loop_add(device_loop, d->tp, NULL, NULL)) return false;
+
+		sbmp_loop_poll_endpoint(host_loop, &h->ep, 10);
+	}
+
+	devices_running = true;
+	pthread_t thread;
+	pthread_create(&thread, NULL, device_thread, NULL);
+
+	for (int i = 0; i < port_count; i++) {
+		sbmp_ep_start_handshake(&hosts[i].ep);
+	}
+
+	uint64_t deadline = now_ns() + 5000000000ULL;
+	while (!all_connected()) {
+		if (now_ns() > deadline) {
+			fprintf(stderr, "Handshake timeout\n");
+			return false;
+		}
+		sbmp_loop_run_once(host_loop, 100);
+	}
+
+	// spread the ports over the interval
+	for (int i = 0; i < port_count; i++) {
+		sbmp_loop_timer(host_loop, 1 + (uint32_t) i * interval / (uint32_t) port_count, interval,
+						send_request, &hosts[i]);
+	}
+
+	measuring = true;
+	sbmp_loop_timer(host_loop, (uint32_t) seconds * 1000, 0, stop_measuring, NULL);
+
+	uint64_t start = now_ns();
+	uint64_t cpu_start = cpu_ns();
+	sbmp_loop_run(host_loop);
+	double elapsed = (double)(now_ns() - start) / 1e9;
+	double cpu = (double)(cpu_ns() - cpu_start) / 1e9;
+
+	devices_running = false;
+	pthread_join(thread, NULL);
+
+	printf("%s,%s,%d,%u,%u,%.2f,%llu,%llu,%u,%u,%u,%u,%.0f,%.1f,%.2f\n",
+		   uring ? "uring" : "epoll", use_pty ? "pty" : "socket",
+		   port_count, interval, payload, elapsed,
+		   (unsigned long long) requests, (unsigned long long) responses,
+		   sbmp_hist_percentile(&hist, 50), sbmp_hist_percentile(&hist, 90),
+		   sbmp_hist_percentile(&hist, 99), hist.max,
+		   (double) responses / elapsed,
+		   100.0 * cpu / elapsed,
+		   responses ? cpu * 1e6 / (double) responses : 0.0);
+
+	sbmp_loop_close(host_loop);
+	sbmp_loop_close(device_loop);
+
+	for (int i = 0; i < port_count; i++) {
+		sbmp_tp_close(hosts[i].tp);
+		sbmp_tp_close(devices[i].tp);
+	}
+
+	return true;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [-n ports] [-t seconds] [-i interval_ms] [-s payload] [-b epoll|uring|both] [-p]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:t:i:s:b:p")) != -1) {
+		switch (opt) {
+			case 'n': port_count = atoi(optarg); break;
+			case 't': seconds = atoi(optarg); break;
+			case 'i': interval = (uint32_t) atoi(optarg); break;
+			case 's': payload = (uint16_t) atoi(optarg); break;
+			case 'b': backend = optarg; break;
+			case 'p': use_pty = true; break;
+			default: usage(argv);
+		}
+	}
+
+	bool do_epoll = !strcmp(backend, "epoll") || !strcmp(backend, "both");
+	bool do_uring = !strcmp(backend, "uring") || !strcmp(backend, "both");
+
+	if (port_count < 1 || port_count > MAX_PORTS || seconds < 1 || interval < 1
+		|| payload < HEADER_LEN || payload > BUF_LEN - 16 || (!do_epoll && !do_uring)) {
+		usage(argv);
+	}
+
+	printf("backend,link,ports,interval_ms,payload,seconds,requests,responses,"
+		   "p50_us,p90_us,p99_us,max_us,msgs_per_s,host_cpu_pct,host_cpu_us_per_msg\n");
+
+	bool ok = true;
+	if (do_epoll) ok &= run(false);
+	if (do_uring) ok &= run(true);
+
+	return ok ? 0 : 1;
+}
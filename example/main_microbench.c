@@ -0,0 +1,502 @@
+/**
+ * Microbenchmarks of the hot paths - the frame parser and builder, the checksums,
+ * the datagram parser and the payload builder / parser.
+ *
+ * Each benchmark is calibrated to run for a while, and the best of several runs
+ * is reported. The results are printed as CSV (or JSON with -j):
+ *
+ *   bench,param,bytes,ns_per_op,ns_per_byte,MB_per_s,cycles_per_byte
+ *
+ * "bytes" is the number of bytes processed per operation (the whole frame
+ * for the framing layer). cycles_per_byte is measured with the TSC on x86
+ * (reference cycles), and left empty elsewhere.
+ *
+ * To check for regressions, save the output of a run and compare with it later:
+ *
+ *   ./microbench > baseline.csv
+ *   ./microbench -c baseline.csv [-t 10]
+ *
+ * The comparison prints the change of each benchmark (ns/byte, or ns/op for those
+ * without a byte count), and exits with 1 if any is slower by more than
+ * the threshold (in percent, default 10).
+ *
+ * Other options: -f filter (run only benchmarks whose name contains it),
+ * -q (quick - shorter runs, less accurate).
+ *
+ * Build with "make microbench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "sbmp/sbmp.h"
+#include "sbmp/crc32.h"
+
+#define MAX_RESULTS 64
+#define MAX_PAYLOAD 4096
+#define RUNS 5
+
+/** One benchmark result */
+typedef struct {
+	char bench[32];
+	char param[32];
+	size_t bytes;
+	double ns_per_op;
+	double cycles_per_op; // 0 = not measured
+} Result;
+
+static Result results[MAX_RESULTS];
+static int result_count;
+
+static double run_time_ns = 50e6; // time of one measured run
+static const char *filter;
+
+/** Keeps the compiler from optimizing the work away */
+static volatile uint32_t sink;
+
+typedef void (*BenchFunc)(uint64_t iterations);
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#if HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/** Run a benchmark, store the result */
+static void measure(const char *bench, const char *param, size_t bytes, BenchFunc func)
+{
+	if (filter != NULL && strstr(bench, filter) == NULL) return;
+
+	if (result_count == MAX_RESULTS) {
+		fprintf(stderr, "Too many benchmarks\n");
+		return;
+	}
+
+	// calibrate - find the iteration count for the run time
+	uint64_t iters = 1;
+	while (true) {
+		uint64_t t0 = now_ns();
+		func(iters);
+		uint64_t t = now_ns() - t0;
+
+		if (t > run_time_ns / 10) {
+			iters = (uint64_t)(iters * run_time_ns / (double)t) + 1;
+			break;
+		}
+
+		iters *= 4;
+	}
+
+	// best of several runs
+	double best_ns = 0, best_cycles = 0;
+	for (int r = 0; r < RUNS; r++) {
+		uint64_t c0 = cycles();
+		uint64_t t0 = now_ns();
+		func(iters);
+		uint64_t t = now_ns() - t0;
+		uint64_t c = cycles() - c0;
+
+		double ns = (double)t / (double)iters;
+		if (r == 0 || ns < best_ns) {
+			best_ns = ns;
+			best_cycles = (double)c / (double)iters;
+		}
+	}
+
+	Result *res = &results[result_count++];
+	snprintf(res->bench, sizeof(res->bench), "%s", bench);
+	snprintf(res->param, sizeof(res->param), "%s", param);
+	res->bytes = bytes;
+	res->ns_per_op = best_ns;
+	res->cycles_per_op = HAVE_TSC ? best_cycles : 0;
+}
+
+
+// --- Framing layer ---
+
+static SBMP_FrmInst frm_rx;
+static SBMP_FrmInst frm_tx;
+static uint8_t frm_rx_buf[MAX_PAYLOAD];
+static uint8_t frm_tx_buf[16]; // the Tx instance doesn't receive
+static uint8_t payload[MAX_PAYLOAD];
+static uint16_t payload_len;
+static SBMP_CksumType cksum_type;
+
+static uint8_t wire[MAX_PAYLOAD + 16]; // an encoded frame
+static size_t wire_len;
+
+static void wire_tx(uint8_t b)
+{
+	wire[wire_len++] = b;
+}
+
+static void nop_tx(uint8_t b)
+{
+	(void)b;
+}
+
+static void count_rx(uint8_t *buf, uint16_t len, void *token)
+{
+	(void)token;
+	sink += buf[0] + len;
+}
+
+/** Encode the test frame into wire[] */
+static void encode_frame(void)
+{
+	sbmp_frm_init(&frm_tx, frm_tx_buf, sizeof(frm_tx_buf), count_rx, wire_tx);
+	sbmp_frm_enable(&frm_tx, true);
+
+	wire_len = 0;
+	sbmp_frm_start(&frm_tx, cksum_type, payload_len);
+	sbmp_frm_send_buffer(&frm_tx, payload, payload_len);
+}
+
+static void bench_frm_receive(uint64_t iterations)
+{
+	for (uint64_t i = 0; i < iterations; i++) {
+		for (size_t j = 0; j < wire_len; j++) {
+			sbmp_frm_receive(&frm_rx, wire[j]);
+		}
+	}
+}
+
+static void bench_frm_send(uint64_t iterations)
+{
+	for (uint64_t i = 0; i < iterations; i++) {
+		sbmp_frm_start(&frm_tx, cksum_type, payload_len);
+		sbmp_frm_send_buffer(&frm_tx, payload, payload_len);
+	}
+}
+
+static void framing_benchmarks(void)
+{
+	const uint16_t sizes[] = {16, 64, 256, 1024, 4096};
+	const SBMP_CksumType cksums[] = {SBMP_CKSUM_NONE, SBMP_CKSUM_XOR, SBMP_CKSUM_CRC32};
+	const char *cksum_names[] = {"none", "xor", "crc32"};
+
+	for (size_t c = 0; c < sizeof(cksums) / sizeof(cksums[0]); c++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			char param[32];
+			snprintf(param, sizeof(param), "%s-%u", cksum_names[c], sizes[s]);
+
+			cksum_type = cksums[c];
+			payload_len = sizes[s];
+			encode_frame();
+
+			sbmp_frm_init(&frm_rx, frm_rx_buf, sizeof(frm_rx_buf), count_rx, NULL);
+			sbmp_frm_enable(&frm_rx, true);
+			measure("frm_receive", param, wire_len, bench_frm_receive);
+
+			sbmp_frm_init(&frm_tx, frm_tx_buf, sizeof(frm_tx_buf), count_rx, nop_tx);
+			sbmp_frm_enable(&frm_tx, true);
+			measure("frm_send_buffer", param, wire_len, bench_frm_send);
+		}
+	}
+}
+
+
+// --- Checksums ---
+
+static size_t crc_len;
+
+static void bench_crc32buf(uint64_t iterations)
+{
+	for (uint64_t i = 0; i < iterations; i++) {
+		sink += crc32buf(payload, crc_len);
+	}
+}
+
+static void bench_crc32_update(uint64_t iterations)
+{
+	for (uint64_t i = 0; i < iterations; i++) {
+		uint32_t crc = crc32_begin();
+		for (size_t j = 0; j < crc_len; j++) {
+			crc = crc32_update(crc, payload[j]);
+		}
+		sink += crc32_end(crc);
+	}
+}
+
+static void checksum_benchmarks(void)
+{
+	const size_t sizes[] = {16, 256, 4096};
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		char param[32];
+		snprintf(param, sizeof(param), "%zu", sizes[s]);
+
+		crc_len = sizes[s];
+		measure("crc32buf", param, crc_len, bench_crc32buf);
+		measure("crc32_update", param, crc_len, bench_crc32_update);
+	}
+}
+
+
+// --- Datagrams & payloads ---
+
+static uint8_t dg_buf[MAX_PAYLOAD];
+static uint16_t dg_len;
+
+static void bench_dg_parse(uint64_t iterations)
+{
+	SBMP_Datagram dg;
+	for (uint64_t i = 0; i < iterations; i++) {
+		dg_buf[0] = (uint8_t)i; // vary the session
+		sbmp_dg_parse(&dg, dg_buf, dg_len);
+		sink += dg.session + dg.type;
+	}
+}
+
+/** Queue a datagram and take it out, as the endpoint and sbmp_ep_poll() do */
+static void bench_dgq_push_pop(uint64_t iterations)
+{
+	static uint8_t ring[4096];
+	SBMP_DgQueue q;
+	sbmp_dgq_init(&q, ring, sizeof(ring));
+
+	SBMP_Datagram dg = {.payload = dg_buf, .type = 100, .length = dg_len};
+	SBMP_Datagram out;
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		dg.session = (uint16_t)i;
+		sbmp_dgq_push(&q, &dg);
+		sbmp_dgq_peek(&q, &out);
+		sink += out.session + out.payload[0];
+		sbmp_dgq_pop(&q);
+	}
+}
+
+/** Number of records in the payload round-trip */
+#define PB_RECORDS 16
+/** Bytes per record: u8, u16, u32, i8, i16, i32, float */
+#define PB_RECORD_LEN (1 + 2 + 4 + 1 + 2 + 4 + 4)
+
+static void bench_payload_roundtrip(uint64_t iterations)
+{
+	uint8_t buf[PB_RECORDS * PB_RECORD_LEN];
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		PayloadBuilder pb = pb_start(buf, sizeof(buf));
+		for (uint32_t r = 0; r < PB_RECORDS; r++) {
+			uint32_t v = (uint32_t)i + r;
+			pb_u8(&pb, (uint8_t)v);
+			pb_u16(&pb, (uint16_t)v);
+			pb_u32(&pb, v);
+			pb_i8(&pb, (int8_t)v);
+			pb_i16(&pb, (int16_t)v);
+			pb_i32(&pb, (int32_t)v);
+			pb_float(&pb, (float)v);
+		}
+
+		PayloadParser pp = pp_start(buf, pb_length(&pb));
+		uint32_t acc = 0;
+		for (uint32_t r = 0; r < PB_RECORDS; r++) {
+			acc += pp_u8(&pp);
+			acc += pp_u16(&pp);
+			acc += pp_u32(&pp);
+			acc += (uint32_t)pp_i8(&pp);
+			acc += (uint32_t)pp_i16(&pp);
+			acc += (uint32_t)pp_i32(&pp);
+			acc += (uint32_t)pp_float(&pp);
+		}
+		sink += acc;
+	}
+}
+
+static void codec_benchmarks(void)
+{
+	const uint16_t sizes[] = {16, 256};
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		char param[32];
+		snprintf(param, sizeof(param), "%u", sizes[s]);
+
+		dg_len = sizes[s];
+		measure("dg_parse", param, 0, bench_dg_parse);
+		measure("dgq_push_pop", param, dg_len, bench_dgq_push_pop);
+	}
+
+	char param[32];
+	snprintf(param, sizeof(param), "%ux7", PB_RECORDS);
+	measure("pb_pp_roundtrip", param, PB_RECORDS * PB_RECORD_LEN, bench_payload_roundtrip);
+}
+
+
+// --- Output ---
+
+static double ns_per_byte(const Result *r)
+{
+	return r->bytes ? r->ns_per_op / (double)r->bytes : 0;
+}
+
+static void print_csv(void)
+{
+	printf("bench,param,bytes,ns_per_op,ns_per_byte,MB_per_s,cycles_per_byte\n");
+
+	for (int i = 0; i < result_count; i++) {
+		const Result *r = &results[i];
+		printf("%s,%s,%zu,%.2f,", r->bench, r->param, r->bytes, r->ns_per_op);
+
+		if (r->bytes) {
+			printf("%.4f,%.1f,", ns_per_byte(r), 1e3 / ns_per_byte(r));
+			if (r->cycles_per_op > 0) printf("%.3f", r->cycles_per_op / (double)r->bytes);
+		} else {
+			printf(",,");
+		}
+		printf("\n");
+	}
+}
+
+static void print_json(void)
+{
+	printf("{\"tsc\":%s,\"results\":[\n", HAVE_TSC ? "true" : "false");
+
+	for (int i = 0; i < result_count; i++) {
+		const Result *r = &results[i];
+		printf("  {\"bench\":\"%s\",\"param\":\"%s\",\"bytes\":%zu,\"ns_per_op\":%.2f",
+			   r->bench, r->param, r->bytes, r->ns_per_op);
+
+		if (r->bytes) {
+			printf(",\"ns_per_byte\":%.4f,\"MB_per_s\":%.1f", ns_per_byte(r), 1e3 / ns_per_byte(r));
+			if (r->cycles_per_op > 0) {
+				printf(",\"cycles_per_byte\":%.3f", r->cycles_per_op / (double)r->bytes);
+			}
+		}
+
+		printf("}%s\n", (i + 1 < result_count) ? "," : "");
+	}
+
+	printf("]}\n");
+}
+
+/**
+ * Compare with a baseline (CSV output of an earlier run)
+ * @return number of regressions, -1 if the file can't be read
+ */
+static int compare(const char *path, double threshold)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return -1;
+	}
+
+	int regressions = 0;
+	bool matched[MAX_RESULTS] = {false};
+	char line[256];
+
+	printf("bench,param,baseline,current,change_pct,status\n");
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char bench[32], param[32];
+		size_t bytes;
+		double ns_op, ns_byte = 0;
+
+		// header and other lines don't match
+		int n = sscanf(line, "%31[^,],%31[^,],%zu,%lf,%lf", bench, param, &bytes, &ns_op, &ns_byte);
+		if (n < 4) continue;
+
+		for (int i = 0; i < result_count; i++) {
+			const Result *r = &results[i];
+			if (strcmp(r->bench, bench) != 0 || strcmp(r->param, param) != 0) continue;
+
+			double base = (bytes && n == 5) ? ns_byte : ns_op;
+			double cur = (bytes && n == 5) ? ns_per_byte(r) : r->ns_per_op;
+			double change = (base > 0) ? (cur - base) / base * 100 : 0;
+
+			const char *status = "ok";
+			if (change > threshold) {
+				status = "REGRESSION";
+				regressions++;
+			} else if (change < -threshold) {
+				status = "improved";
+			}
+
+			printf("%s,%s,%.4f,%.4f,%+.1f,%s\n", bench, param, base, cur, change, status);
+			matched[i] = true;
+		}
+	}
+
+	fclose(f);
+
+	for (int i = 0; i < result_count; i++) {
+		if (!matched[i]) printf("%s,%s,,,,new\n", results[i].bench, results[i].param);
+	}
+
+	return regressions;
+}
+
+int main(int argc, char **argv)
+{
+	bool json = false;
+	const char *baseline = NULL;
+	double threshold = 10;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "jc:t:f:q")) != -1) {
+		switch (opt) {
+			case 'j': json = true; break;
+			case 'c': baseline = optarg; break;
+			case 't': threshold = strtod(optarg, NULL); break;
+			case 'f': filter = optarg; break;
+			case 'q': run_time_ns = 10e6; break;
+			default:
+				fprintf(stderr, "Usage: %s [-j] [-c baseline.csv] [-t threshold_pct] [-f filter] [-q]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(payload); i++) {
+		payload[i] = (uint8_t)rand();
+	}
+	memcpy(dg_buf, payload, sizeof(dg_buf));
+
+	framing_benchmarks();
+	checksum_benchmarks();
+	codec_benchmarks();
+
+	if (baseline != NULL) {
+		int regressions = compare(baseline, threshold);
+		if (regressions != 0) {
+			if (regressions > 0) fprintf(stderr, "%d regression(s) over %.0f %%\n", regressions, threshold);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (json) {
+		print_json();
+	} else {
+		print_csv();
+	}
+
+	return 0;
+}
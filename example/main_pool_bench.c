@@ -0,0 +1,246 @@
+/**
+ * Received datagrams handled by a worker pool (see sbmp_pool.h).
+ *
+ * The host sends requests in a number of sessions over a socketpair; the
+ * device answers each one from a handler that takes a while (it sleeps, like
+ * a handler waiting on a disk or a database would). The handler checks that
+ * the requests of each session come in order, and answers through a
+ * transmit queue (see sbmp_txq.h).
+ *
+ * With -p 0, the handler runs in the receiving thread (no pool), for
+ * comparison.
+ *
+ * Usage: pool_bench [-p workers] [-c sessions] [-n count] [-w work_us]
+ *
+ *   -p : worker threads (default 4, 0 = no pool)
+ *   -c : sessions (default 64)
+ *   -n : requests per session (default 200)
+ *   -w : handler run time in us (default 200)
+ *
+ * Build with "make pool_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_transport_posix.h"
+#include "sbmp/sbmp_txq.h"
+#include "sbmp/sbmp_pool.h"
+
+#define BUF_LEN 1024
+#define MAX_SESSIONS 4096
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+
+/** Request payload: sequence number in the session (4 B) */
+#define REQUEST_LEN 4
+
+// options
+static int workers = 4;
+static int sessions = 64;
+static uint32_t count = 200;
+static uint32_t work_us = 200;
+
+/** One end of the link */
+typedef struct {
+	SBMP_Endpoint ep;
+	uint8_t rx_buf[BUF_LEN];
+	SBMP_Transport *tp;
+	SBMP_TxQueue *txq;
+} Side;
+
+static Side host;
+static Side device;
+static SBMP_Pool *pool;
+
+// host state
+static uint64_t responses;
+
+// device state (a session is handled by one worker at a time)
+static uint32_t next_seq[MAX_SESSIONS];
+static uint64_t order_errors;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void handle_request(SBMP_Endpoint *ep, SBMP_Datagram *dg, void *token)
+{
+	(void)ep;
+	(void)token;
+
+	if (dg->type != DG_BENCH_REQUEST || dg->length != REQUEST_LEN || dg->session >= sessions) return;
+
+	uint32_t seq;
+	memcpy(&seq, dg->payload, 4);
+
+	if (seq != next_seq[dg->session]) {
+		__atomic_fetch_add(&order_errors, 1, __ATOMIC_RELAXED);
+	}
+	next_seq[dg->session] = seq + 1;
+
+	struct timespec ts = {.tv_sec = 0, .tv_nsec = (long) work_us * 1000};
+	nanosleep(&ts, NULL);
+
+	sbmp_txq_send_response(device.txq, DG_BENCH_RESPONSE, dg->payload, REQUEST_LEN, dg->session);
+}
+
+static void device_rx(SBMP_Datagram *dg)
+{
+	handle_request(&device.ep, dg, NULL); // without a pool
+}
+
+static void host_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_RESPONSE) responses++;
+}
+
+static void *device_thread(void *arg)
+{
+	(void)arg;
+	while (sbmp_tp_receive(device.tp) >= 0) {}
+	return NULL;
+}
+
+/** Sends the requests, one of each session in turn */
+static void *sender_thread(void *arg)
+{
+	(void)arg;
+
+	for (uint32_t seq = 0; seq < count; seq++) {
+		for (int s = 0; s < sessions; s++) {
+			sbmp_txq_send_response(host.txq, DG_BENCH_REQUEST, (uint8_t *) &seq, REQUEST_LEN, (uint16_t) s);
+		}
+	}
+
+	return NULL;
+}
+
+/** Receive on the host endpoint, wait at most timeout_ms for data */
+static bool host_receive(int timeout_ms)
+{
+	if (sbmp_tp_rx_pending(host.tp) == 0) {
+		struct pollfd pfd = {.fd = sbmp_tp_fd(host.tp), .events = POLLIN};
+		if (poll(&pfd, 1, timeout_ms) <= 0) return true;
+	}
+
+	return sbmp_tp_receive(host.tp) >= 0;
+}
+
+static void side_init(Side *side, SBMP_Transport *tp, void (*rx)(SBMP_Datagram *dg))
+{
+	side->tp = tp;
+	sbmp_ep_init(&side->ep, side->rx_buf, BUF_LEN, rx, NULL);
+	sbmp_tp_attach(tp, &side->ep.frm);
+	sbmp_ep_enable(&side->ep, true);
+	side->txq = sbmp_txq_create(&side->ep);
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [-p workers] [-c sessions] [-n count] [-w work_us]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "p:c:n:w:")) != -1) {
+		switch (opt) {
+			case 'p': workers = atoi(optarg); break;
+			case 'c': sessions = atoi(optarg); break;
+			case 'n': count = (uint32_t) atol(optarg); break;
+			case 'w': work_us = (uint32_t) atol(optarg); break;
+			default: usage(argv);
+		}
+	}
+
+	if (workers < 0 || workers > SBMP_POOL_MAX_WORKERS || sessions < 1 || sessions > MAX_SESSIONS || count < 1) {
+		usage(argv);
+	}
+
+	SBMP_Transport *a, *b;
+	if (!sbmp_tp_socketpair(&a, &b, 0)) {
+		perror("socketpair");
+		return 1;
+	}
+	sbmp_tp_set_buffers(a, 65536, 65536);
+	sbmp_tp_set_buffers(b, 65536, 65536);
+
+	side_init(&host, a, host_rx);
+	side_init(&device, b, device_rx);
+
+	if (workers > 0) {
+		pool = sbmp_pool_create((uint8_t) workers, handle_request, NULL);
+		if (pool == NULL) return 1;
+		sbmp_pool_attach(pool, &device.ep);
+	}
+
+	pthread_t dev_thread;
+	pthread_create(&dev_thread, NULL, device_thread, NULL);
+
+	sbmp_ep_start_handshake(&host.ep);
+	while (sbmp_ep_handshake_status(&host.ep) == SBMP_HSK_AWAIT_REPLY) {
+		if (!host_receive(100)) break;
+	}
+
+	if (sbmp_ep_handshake_status(&host.ep) != SBMP_HSK_SUCCESS) {
+		fprintf(stderr, "Handshake failed\n");
+		return 1;
+	}
+
+	uint64_t total = (uint64_t) sessions * count;
+	uint64_t start = now_ns();
+
+	pthread_t sender;
+	pthread_create(&sender, NULL, sender_thread, NULL);
+
+	uint64_t deadline = start + 120000000000ULL;
+	while (responses < total && now_ns() < deadline) {
+		if (!host_receive(100)) break;
+	}
+
+	double elapsed = (double)(now_ns() - start) / 1e9;
+	pthread_join(sender, NULL);
+
+	printf("workers,sessions,count,work_us,seconds,responses,order_errors,msgs_per_s");
+	if (pool != NULL) printf(",max_depth,steals,wait_p50_us,wait_p99_us,run_p50_us,run_p99_us");
+	printf("\n%d,%d,%u,%u,%.2f,%llu,%llu,%.0f", workers, sessions, count, work_us, elapsed,
+		   (unsigned long long) responses, (unsigned long long) order_errors, (double) responses / elapsed);
+
+	if (pool != NULL) {
+		static SBMP_PoolStats stats;
+		sbmp_pool_stats(pool, &stats);
+		printf(",%u,%llu,%u,%u,%u,%u", stats.max_depth, (unsigned long long) stats.steals,
+			   sbmp_hist_percentile(&stats.wait, 50), sbmp_hist_percentile(&stats.wait, 99),
+			   sbmp_hist_percentile(&stats.run, 50), sbmp_hist_percentile(&stats.run, 99));
+
+		sbmp_ep_set_dispatch(&device.ep, NULL, NULL);
+		sbmp_pool_close(pool);
+	}
+	printf("\n");
+
+	sbmp_txq_close(host.txq);
+	sbmp_tp_close(host.tp); // the device sees EOF
+	pthread_join(dev_thread, NULL);
+	sbmp_txq_close(device.txq);
+	sbmp_tp_close(device.tp);
+
+	return (responses == total && order_errors == 0) ? 0 : 1;
+}
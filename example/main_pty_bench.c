@@ -0,0 +1,380 @@
+/**
+ * Round-trip latency and throughput over a pseudo-terminal pair.
+ *
+ * The "host" endpoint runs in the main thread on the pty master, the
+ * "device" endpoint in a second thread on the slave, which is set to raw
+ * mode like a real serial port. The host sends requests and the device
+ * echoes them back; the round trip times go into a histogram. Then the host
+ * streams messages as fast as it can, to measure the sustained throughput.
+ * This is run for each checksum type and payload size.
+ *
+ * The termios options only affect the slave (device) side - reads on the
+ * master return whatever is available.
+ *
+ * Usage: pty_bench [-n count] [-r read_size] [-m vmin] [-t vtime] [-p] [-b]
+ *
+ *   -n : requests per measurement (default 2000)
+ *   -r : bytes per read() call (default 4096, 1 = byte by byte)
+ *   -m : VMIN of the slave (default 1)
+ *   -t : VTIME of the slave, in 0.1 s (default 0)
+ *   -p : poll() before each read()
+ *   -b : write() each byte separately (default: one write per frame)
+ *
+ * Build with "make pty_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+
+#define BUF_LEN 4200
+#define OUT_LEN 4200
+#define READ_MAX 65536
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+#define DG_BENCH_STREAM 102
+
+/** Bytes sent during the throughput test */
+#define STREAM_BYTES (1024 * 1024)
+
+// options
+static long count = 2000;
+static size_t read_size = 4096;
+static int vmin = 1;
+static int vtime = 0;
+static bool use_poll = false;
+static bool byte_writes = false;
+
+/** One side of the link */
+typedef struct {
+	SBMP_Endpoint ep;
+	uint8_t rx_buf[BUF_LEN];
+	int fd;
+	uint8_t out[OUT_LEN];   // frame being sent
+	size_t out_len;
+	uint8_t in[READ_MAX];
+} Side;
+
+static Side host;
+static Side device;
+
+static volatile bool running;
+
+// host state
+static uint16_t pending_sesn;
+static volatile bool answered;
+static volatile uint64_t stream_received; // counted by the device
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("write");
+			exit(1);
+		}
+
+		buf += n;
+		len -= (size_t)n;
+	}
+}
+
+static void side_put(Side *side, uint8_t byte)
+{
+	if (byte_writes) {
+		write_all(side->fd, &byte, 1);
+		return;
+	}
+
+	if (side->out_len == OUT_LEN) {
+		write_all(side->fd, side->out, side->out_len);
+		side->out_len = 0;
+	}
+
+	side->out[side->out_len++] = byte;
+}
+
+/** Send the buffered frame */
+static void side_flush(Side *side)
+{
+	if (side->out_len == 0) return;
+
+	write_all(side->fd, side->out, side->out_len);
+	side->out_len = 0;
+}
+
+static void host_tx(uint8_t byte)   { side_put(&host, byte); }
+static void device_tx(uint8_t byte) { side_put(&device, byte); }
+
+/**
+ * Read what's available and pass it to the endpoint
+ * @return false on EOF or an error
+ */
+static bool side_read(Side *side)
+{
+	if (use_poll) {
+		struct pollfd pfd = {.fd = side->fd, .events = POLLIN};
+		if (poll(&pfd, 1, 100) <= 0) return true;
+	}
+
+	ssize_t n = read(side->fd, side->in, read_size);
+	if (n < 0) {
+		return (errno == EINTR || errno == EAGAIN);
+	}
+
+	for (ssize_t i = 0; i < n; i++) {
+		sbmp_ep_receive(&side->ep, side->in[i]);
+	}
+
+	return true;
+}
+
+static void host_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_RESPONSE && dg->session == pending_sesn) {
+		answered = true;
+	}
+}
+
+static void device_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_REQUEST) {
+		sbmp_ep_send_response(&device.ep, DG_BENCH_RESPONSE, dg->payload, dg->length, dg->session, NULL);
+	} else if (dg->type == DG_BENCH_STREAM) {
+		stream_received += dg->length;
+	}
+}
+
+static void *device_thread(void *arg)
+{
+	(void)arg;
+
+	while (running) {
+		if (!side_read(&device)) break;
+		side_flush(&device); // responses
+	}
+
+	return NULL;
+}
+
+/** Set up an endpoint */
+static void side_init(Side *side, int fd, void (*rx)(SBMP_Datagram *dg), void (*tx)(uint8_t), bool origin)
+{
+	side->fd = fd;
+	side->out_len = 0;
+
+	sbmp_ep_init(&side->ep, side->rx_buf, BUF_LEN, rx, tx);
+	sbmp_ep_set_origin(&side->ep, origin);
+	side->ep.peer_buffer_size = BUF_LEN;
+	sbmp_ep_enable(&side->ep, true);
+}
+
+/** Open the pty pair, the slave in raw mode */
+static bool open_pty(int *master, int *slave)
+{
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master < 0 || grantpt(*master) != 0 || unlockpt(*master) != 0) {
+		perror("posix_openpt");
+		return false;
+	}
+
+	*slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror("open slave");
+		return false;
+	}
+
+	struct termios tio;
+	if (tcgetattr(*slave, &tio) != 0) {
+		perror("tcgetattr");
+		return false;
+	}
+
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = (cc_t) vmin;
+	tio.c_cc[VTIME] = (cc_t) vtime;
+
+	if (tcsetattr(*slave, TCSANOW, &tio) != 0) {
+		perror("tcsetattr");
+		return false;
+	}
+
+	return true;
+}
+
+/** Wait for the response to the pending request */
+static bool wait_answer(void)
+{
+	while (!answered) {
+		if (!side_read(&host)) return false;
+	}
+
+	return true;
+}
+
+/**
+ * Measure the round trip times
+ * @return false on failure
+ */
+static bool measure_rtt(uint16_t payload, SBMP_Histogram *hist)
+{
+	static uint8_t buf[BUF_LEN];
+	memset(buf, 0x5A, payload);
+
+	for (long i = 0; i < count; i++) {
+		answered = false;
+
+		uint64_t start = now_ns();
+		if (!sbmp_ep_send_message(&host.ep, DG_BENCH_REQUEST, buf, payload, &pending_sesn, NULL)) return false;
+		side_flush(&host);
+
+		if (!wait_answer()) return false;
+		sbmp_hist_add(hist, (uint32_t)(now_ns() - start));
+	}
+
+	return true;
+}
+
+/**
+ * Stream messages, finish with a request (answered after all of them were received)
+ * @return throughput in bytes/s, negative on failure
+ */
+static double measure_throughput(uint16_t payload)
+{
+	static uint8_t buf[BUF_LEN];
+	memset(buf, 0xA5, payload);
+
+	uint32_t messages = STREAM_BYTES / payload;
+	stream_received = 0;
+
+	uint64_t start = now_ns();
+
+	for (uint32_t i = 0; i < messages; i++) {
+		if (!sbmp_ep_send_message(&host.ep, DG_BENCH_STREAM, buf, payload, NULL, NULL)) return -1;
+		side_flush(&host);
+	}
+
+	answered = false;
+	if (!sbmp_ep_send_message(&host.ep, DG_BENCH_REQUEST, buf, 1, &pending_sesn, NULL)) return -1;
+	side_flush(&host);
+	if (!wait_answer()) return -1;
+
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	// the device thread is done with the stream once it answered
+	if (stream_received != (uint64_t)messages * payload) {
+		fprintf(stderr, "Stream incomplete: %llu of %llu bytes\n",
+				(unsigned long long) stream_received, (unsigned long long)messages * payload);
+		return -1;
+	}
+
+	return (double)stream_received / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:m:t:pb")) != -1) {
+		switch (opt) {
+			case 'n': count = strtol(optarg, NULL, 10); break;
+			case 'r': read_size = (size_t) strtoul(optarg, NULL, 10); break;
+			case 'm': vmin = (int) strtol(optarg, NULL, 10); break;
+			case 't': vtime = (int) strtol(optarg, NULL, 10); break;
+			case 'p': use_poll = true; break;
+			case 'b': byte_writes = true; break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (count < 1 || read_size < 1 || read_size > READ_MAX
+		|| vmin < 0 || vmin > 255 || vtime < 0 || vtime > 255) {
+		goto usage;
+	}
+
+	const SBMP_CksumType cksums[] = {SBMP_CKSUM_NONE, SBMP_CKSUM_XOR, SBMP_CKSUM_CRC32};
+	const char *const cksum_names[] = {"none", "xor", "crc32"};
+	const uint16_t payloads[] = {16, 64, 256, 1024, 4096};
+
+	printf("cksum,payload,read_size,vmin,vtime,poll,byte_writes,"
+		   "rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_max_us,throughput_MBps\n");
+
+	static SBMP_Histogram hist;
+
+	for (size_t c = 0; c < sizeof(cksums) / sizeof(cksums[0]); c++) {
+		for (size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); p++) {
+			int master, slave;
+			if (!open_pty(&master, &slave)) return 1;
+
+			side_init(&host, master, host_rx, host_tx, 0);
+			side_init(&device, slave, device_rx, device_tx, 1);
+			host.ep.peer_pref_cksum = cksums[c];
+			device.ep.peer_pref_cksum = cksums[c];
+
+			running = true;
+
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, device_thread, NULL) != 0) {
+				perror("pthread_create");
+				return 1;
+			}
+
+			memset(&hist, 0, sizeof(hist));
+			bool ok = measure_rtt(payloads[p], &hist);
+			double throughput = ok ? measure_throughput(payloads[p]) : -1;
+
+			// wake up the device thread, if it's blocked in read()
+			running = false;
+			close(master);
+			pthread_join(thread, NULL);
+			close(slave);
+
+			printf("%s,%u,%zu,%d,%d,%d,%d,", cksum_names[c], payloads[p],
+				   read_size, vmin, vtime, use_poll, byte_writes);
+
+			if (!ok || throughput < 0) {
+				printf("FAILED\n");
+				continue;
+			}
+
+			printf("%.1f,%.1f,%.1f,%.1f,%.2f\n",
+				   sbmp_hist_percentile(&hist, 50) / 1000.0,
+				   sbmp_hist_percentile(&hist, 90) / 1000.0,
+				   sbmp_hist_percentile(&hist, 99) / 1000.0,
+				   hist.max / 1000.0,
+				   throughput / 1e6);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n count] [-r read_size] [-m vmin] [-t vtime] [-p] [-b]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,201 @@
+/**
+ * Received datagrams queued and handled in batches (see sbmp_ep_init_queue()).
+ *
+ * Alice sends requests over a socketpair as fast as the flow control lets
+ * her; Bob answers them. Bob either handles each datagram as it arrives
+ * (inline), or lets the endpoint queue them and handles them in batches
+ * with sbmp_ep_poll() after each read (queue). In the queue mode, the credit
+ * is given back only after polling, so the queue never overflows.
+ *
+ * Usage: queue_bench [-n count] [-s payload] [-w window]
+ *
+ *   -n : requests (default 200000)
+ *   -s : payload size (default 32)
+ *   -w : flow control window (default 32)
+ *
+ * Build with "make queue_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_transport_posix.h"
+
+#define BUF_LEN 512
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+
+// options
+static uint32_t count = 200000;
+static uint16_t payload = 32;
+static uint8_t window = 32;
+
+static SBMP_Endpoint alice;
+static SBMP_Endpoint bob;
+static uint8_t alice_buf[BUF_LEN];
+static uint8_t bob_buf[BUF_LEN];
+
+static uint32_t responses;
+static uint32_t next_seq;
+static uint32_t order_errors;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void alice_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_RESPONSE) responses++;
+}
+
+static void bob_rx(SBMP_Datagram *dg)
+{
+	if (dg->type != DG_BENCH_REQUEST || dg->length < 4) return;
+
+	uint32_t seq;
+	memcpy(&seq, dg->payload, 4);
+	if (seq != next_seq) order_errors++;
+	next_seq = seq + 1;
+
+	sbmp_ep_send_response(&bob, DG_BENCH_RESPONSE, dg->payload, 4, dg->session, NULL);
+}
+
+/**
+ * Wait for data and pass it to the endpoints
+ * @return false on an error or a timeout
+ */
+static bool pump(SBMP_Transport *a, SBMP_Transport *b, bool queued, uint32_t *polls, uint32_t *max_batch)
+{
+	struct pollfd pfd[2] = {
+		{.fd = sbmp_tp_fd(a), .events = POLLIN},
+		{.fd = sbmp_tp_fd(b), .events = POLLIN},
+	};
+
+	if (poll(pfd, 2, 1000) <= 0) {
+		fprintf(stderr, "Timeout\n");
+		return false;
+	}
+
+	if ((pfd[0].revents & POLLIN) && sbmp_tp_receive(a) < 0) return false;
+	if ((pfd[1].revents & POLLIN) && sbmp_tp_receive(b) < 0) return false;
+
+	if (queued) {
+		uint16_t n = sbmp_ep_poll(&bob, NULL, 0);
+		if (n > 0) (*polls)++;
+		if (n > *max_batch) *max_batch = n;
+	}
+
+	return true;
+}
+
+static bool run(bool queued)
+{
+	SBMP_Transport *a, *b;
+	if (!sbmp_tp_socketpair(&a, &b, 0)) return false;
+
+	sbmp_ep_init(&alice, alice_buf, BUF_LEN, alice_rx, NULL);
+	sbmp_ep_init(&bob, bob_buf, BUF_LEN, bob_rx, NULL);
+	sbmp_tp_attach(a, &alice.frm);
+	sbmp_tp_attach(b, &bob.frm);
+
+	sbmp_ep_init_credit(&alice, window, false);
+	sbmp_ep_init_credit(&bob, window, false);
+
+	static SBMP_DgQueue queue;
+	static uint8_t ring[65535];
+	if (queued) {
+		// the whole window of the largest datagrams, and the end of the ring skipped on a wrap
+		uint32_t size = (uint32_t)(window + 1) * (BUF_LEN + SBMP_DGQ_OVERHEAD) + 1;
+		if (size > sizeof(ring) || !sbmp_ep_init_queue(&bob, &queue, ring, (uint16_t) size)) return false;
+	}
+
+	sbmp_ep_enable(&alice, true);
+	sbmp_ep_enable(&bob, true);
+
+	uint32_t polls = 0;
+	uint32_t max_batch = 0;
+
+	sbmp_ep_start_handshake(&alice);
+	while (sbmp_ep_handshake_status(&alice) != SBMP_HSK_SUCCESS) {
+		if (!pump(a, b, queued, &polls, &max_batch)) return false;
+	}
+
+	uint8_t buf[BUF_LEN];
+	memset(buf, 0x5A, payload);
+
+	responses = 0;
+	next_seq = 0;
+	order_errors = 0;
+	polls = 0;
+	max_batch = 0;
+
+	uint64_t start = now_ns();
+
+	for (uint32_t seq = 0; seq < count; seq++) {
+		memcpy(buf, &seq, 4);
+
+		while (!sbmp_ep_send_message(&alice, DG_BENCH_REQUEST, buf, payload, NULL, NULL)) {
+			if (!pump(a, b, queued, &polls, &max_batch)) return false;
+		}
+	}
+
+	while (responses < count) {
+		if (!pump(a, b, queued, &polls, &max_batch)) return false;
+	}
+
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	printf("%s,%u,%u,%u,%.2f,%.0f,%u,%.1f,%u,%u\n", queued ? "queue" : "inline",
+		   count, payload, window, elapsed, (double) count / elapsed, order_errors,
+		   polls ? (double) count / polls : 0.0, max_batch, queued ? queue.dropped : 0);
+
+	sbmp_tp_close(a);
+	sbmp_tp_close(b);
+
+	return order_errors == 0 && (!queued || queue.dropped == 0);
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-s payload] [-w window]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:w:")) != -1) {
+		switch (opt) {
+			case 'n': count = (uint32_t) atol(optarg); break;
+			case 's': payload = (uint16_t) atoi(optarg); break;
+			case 'w': window = (uint8_t) atoi(optarg); break;
+			default: usage(argv);
+		}
+	}
+
+	if (count < 1 || payload < 4 || payload > BUF_LEN - 16 || window < 1 || window > SBMP_CREDIT_MAX_WINDOW) {
+		usage(argv);
+	}
+
+	printf("mode,count,payload,window,seconds,msgs_per_s,order_errors,avg_batch,max_batch,dropped\n");
+
+	bool ok = run(false);
+	ok &= run(true);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/**
+ * Replay of a SBMP capture (see sbmp_pcap.h).
+ *
+ * The captured frames are fed to an endpoint byte by byte, through
+ * sbmp_ep_receive(), either with the recorded timing (to reproduce a problem
+ * with the logging enabled) or as fast as possible (as a throughput benchmark
+ * with a realistic traffic mix).
+ *
+ * By default, the frames received by the capturing party are replayed.
+ * The replaying endpoint doesn't take part in the reliable mode or the flow
+ * control, so their headers are removed (unless -r is given). Frames with
+ * a bad checksum are replayed as captured.
+ *
+ * Usage: replay [-m] [-n repeat] [-d rx|tx|all] [-r] capture.pcap
+ *
+ *   -m : maximum speed (default: the recorded timing)
+ *   -n : replay the capture N times (with -m)
+ *   -d : which frames to replay
+ *   -r : raw - don't remove the reliable mode and flow control headers
+ *
+ * Build with "make replay". Create a capture eg. with "./bulk_bench capture.pcap".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_pcap.h"
+
+#define RX_BUF_LEN 0xFFFF
+
+/** The frames to replay, encoded back to back */
+static uint8_t *wire;
+static size_t wire_len;
+static size_t wire_cap;
+
+/** Frame start offsets (+ the end) and timestamps */
+static size_t *frame_start;
+static uint64_t *frame_time;
+static size_t frame_count;
+static size_t frame_cap;
+
+static uint32_t dg_count;
+static uint64_t dg_bytes;
+
+static void replay_rx(SBMP_Datagram *dg)
+{
+	dg_count++;
+	dg_bytes += dg->length;
+}
+
+static void replay_tx(uint8_t byte)
+{
+	(void)byte; // responses (eg. to a handshake) are discarded
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void wire_put(uint8_t b)
+{
+	if (wire_len == wire_cap) {
+		wire_cap = wire_cap ? wire_cap * 2 : 65536;
+		wire = realloc(wire, wire_cap);
+		if (wire == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	wire[wire_len++] = b;
+}
+
+static void frame_begin(uint64_t time_ns)
+{
+	if (frame_count + 1 >= frame_cap) {
+		frame_cap = frame_cap ? frame_cap * 2 : 1024;
+		frame_start = realloc(frame_start, frame_cap * sizeof(size_t));
+		frame_time = realloc(frame_time, frame_cap * sizeof(uint64_t));
+		if (frame_start == NULL || frame_time == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	frame_start[frame_count] = wire_len;
+	frame_time[frame_count] = time_ns;
+	frame_count++;
+}
+
+/**
+ * Add a captured frame, without the reliable mode & flow control headers
+ * @return false if nothing is left to replay
+ */
+static bool add_plain_frame(const SBMP_PcapRecord *rec)
+{
+	const uint8_t *f = rec->frame;
+	SBMP_CksumType cksum_type = f[1] & ~SBMP_FRM_FLAGS_MASK;
+	uint8_t flags = f[1] & SBMP_FRM_FLAGS_MASK;
+	uint16_t length = (uint16_t)(f[2] | (f[3] << 8));
+
+	const uint8_t *payload = f + SBMP_PCAP_FRM_HEADER;
+
+	if (flags & SBMP_FRM_FLAG_CREDIT) {
+		if (length < SBMP_CREDIT_HEADER_LEN) return false;
+		payload += SBMP_CREDIT_HEADER_LEN;
+		length -= SBMP_CREDIT_HEADER_LEN;
+	}
+
+	if (flags & SBMP_FRM_FLAG_RELIABLE) {
+		if (length < SBMP_REL_HEADER_LEN) return false;
+		payload += SBMP_REL_HEADER_LEN;
+		length -= SBMP_REL_HEADER_LEN;
+	}
+
+	if (length == 0) return false; // just an ack or a credit update
+
+	frame_begin(rec->time_ns);
+
+	uint8_t hdr[4] = {0x01, cksum_type, length & 0xFF, (length >> 8) & 0xFF};
+	for (int i = 0; i < 4; i++) wire_put(hdr[i]);
+	wire_put(hdr[0] ^ hdr[1] ^ hdr[2] ^ hdr[3]);
+
+	uint32_t scratch;
+	cksum_begin(cksum_type, &scratch);
+	for (uint16_t i = 0; i < length; i++) {
+		wire_put(payload[i]);
+		cksum_update(cksum_type, &scratch, payload[i]);
+	}
+	cksum_end(cksum_type, &scratch);
+
+	for (uint8_t i = 0; i < chksum_length(cksum_type); i++) {
+		wire_put((scratch >> (i * 8)) & 0xFF);
+	}
+
+	return true;
+}
+
+/** Load the capture */
+static bool load(const char *path, int direction, bool raw)
+{
+	SBMP_PcapReader *reader = sbmp_pcap_reader_open(path);
+	if (reader == NULL) return false;
+
+	uint32_t truncated = 0, skipped = 0, total = 0;
+
+	SBMP_PcapRecord rec;
+	while (sbmp_pcap_read(reader, &rec)) {
+		total++;
+
+		bool tx = (rec.info & SBMP_PCAP_TX);
+		if ((direction == 0 && tx) || (direction == 1 && !tx)) continue;
+
+		if (rec.length < rec.orig_length) {
+			truncated++;
+			continue;
+		}
+
+		if (raw || (rec.info & SBMP_PCAP_CKSUM_BAD)) {
+			// as captured
+			frame_begin(rec.time_ns);
+			for (uint32_t i = 0; i < rec.length; i++) wire_put(rec.frame[i]);
+		} else if (!add_plain_frame(&rec)) {
+			skipped++;
+		}
+	}
+
+	sbmp_pcap_reader_close(reader);
+
+	if (frame_count > 0) frame_start[frame_count] = wire_len; // end of the last frame
+
+	fprintf(stderr, "%"PRIu32" records, %zu frames to replay (%zu bytes)", total, frame_count, wire_len);
+	if (skipped) fprintf(stderr, ", %"PRIu32" header-only frames skipped", skipped);
+	if (truncated) fprintf(stderr, ", %"PRIu32" truncated frames skipped", truncated);
+	fprintf(stderr, "\n");
+
+	return true;
+}
+
+static void sleep_until(uint64_t t)
+{
+	uint64_t now = now_ns();
+	if (t <= now) return;
+
+	struct timespec ts = {
+		.tv_sec = (time_t)((t - now) / 1000000000),
+		.tv_nsec = (long)((t - now) % 1000000000),
+	};
+	nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	bool max_speed = false, raw = false;
+	int direction = 0; // 0 = rx, 1 = tx, 2 = all
+	long repeat = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "mn:d:r")) != -1) {
+		switch (opt) {
+			case 'm': max_speed = true; break;
+			case 'n': repeat = strtol(optarg, NULL, 10); break;
+			case 'r': raw = true; break;
+			case 'd':
+				if (strcmp(optarg, "rx") == 0) direction = 0;
+				else if (strcmp(optarg, "tx") == 0) direction = 1;
+				else if (strcmp(optarg, "all") == 0) direction = 2;
+				else goto usage;
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || repeat < 1) goto usage;
+
+	if (!load(argv[optind], direction, raw)) return 1;
+	if (frame_count == 0) return 0;
+
+	SBMP_Endpoint *ep = sbmp_ep_init(NULL, NULL, RX_BUF_LEN, replay_rx, replay_tx);
+	if (ep == NULL) return 1;
+	sbmp_ep_enable(ep, true);
+
+	uint64_t start = now_ns();
+
+	for (long r = 0; r < repeat; r++) {
+		for (size_t i = 0; i < frame_count; i++) {
+			if (!max_speed) sleep_until(start + (frame_time[i] - frame_time[0]));
+
+			for (size_t j = frame_start[i]; j < frame_start[i + 1]; j++) {
+				sbmp_ep_receive(ep, wire[j]);
+			}
+		}
+
+		if (!max_speed) break;
+	}
+
+	double elapsed = (double)(now_ns() - start) / 1e9;
+	double bytes = (double)wire_len * (max_speed ? (double)repeat : 1);
+	double frames = (double)frame_count * (max_speed ? (double)repeat : 1);
+
+	printf("frames,bytes,datagrams,payload_bytes,rejected,time_s,frames_per_s,MB_per_s,ns_per_byte\n");
+	printf("%.0f,%.0f,%"PRIu32",%"PRIu64",%"PRIu32",%.6f,%.0f,%.2f,%.2f\n",
+		   frames, bytes, dg_count, dg_bytes, ep->frm.rx_errors, elapsed,
+		   frames / elapsed, bytes / elapsed / 1e6, elapsed * 1e9 / bytes);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-m] [-n repeat] [-d rx|tx|all] [-r] capture.pcap\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,591 @@
+/**
+ * Self test of the session layer features, on simulated links (see sbmp_sim.h).
+ *
+ * Each check asserts the actual behaviour, not just that nothing crashed:
+ *
+ *   reliable  : in-order delivery without losses, with bit errors on the line
+ *   caps      : capability negotiation, and the retry without the capability
+ *               block for a peer with a short buffer
+ *   tiebreak  : simultaneous handshakes resolved in a single exchange
+ *   resume    : the resume token matches after a reset, and a reset peer
+ *               falls back to a new handshake
+ *   keepalive : the link is reported down after max_missed heartbeats on a cut
+ *               link, even with a full reliable window / no flow control credit
+ *   bulkstate : an interrupted bulk transfer saved with sbmp_bulk_state_save()
+ *               and continued after sbmp_bulk_state_load()
+ *
+ * Prints a line per check, and exits with an error if any of them failed.
+ *
+ * Usage: selftest [-n seeds]
+ *
+ * Build with "make selftest".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/crc32.h"
+#include "sbmp/sbmp_sim.h"
+
+#define BUF_LEN 256
+
+#define DG_TEST_DATA 100
+#define DG_TEST_REPLY 101
+
+#define REL_DEPTH 8
+#define REL_MESSAGES 300
+#define REL_MESSAGE_LEN 40
+// the peer replies to every n-th message
+#define REL_REPLY_EVERY 10
+
+#define KA_INTERVAL_MS 100
+#define KA_MAX_MISSED 3
+
+#define BULK_LEN (8 * 1024)
+#define BULK_CHUNK 128
+#define BULK_BLOCK 64
+
+// handshake retry timeout, like a real application would use
+#define RETRY_US 50000
+// a check gives up after this much virtual time
+#define GIVE_UP_US 30000000
+
+static const SBMP_SimLineConfig line_clean = {.baud = 115200, .latency_us = 1000};
+static const SBMP_SimLineConfig line_noisy = {.baud = 115200, .latency_us = 1000, .bit_error_rate = 1e-4};
+static const SBMP_SimLineConfig line_cut = {.baud = 115200, .latency_us = 1000, .drop_rate = 1.0};
+
+// --- Simulated setup ---
+
+static SBMP_Sim sim;
+static int line_ab; // alice -> bob, bob -> alice is the next one
+
+static SBMP_Endpoint *alice;
+static SBMP_Endpoint *bob;
+static uint8_t alice_buf[BUF_LEN];
+static uint8_t bob_buf[BUF_LEN];
+static SBMP_SessionListenerSlot alice_slots[4];
+static SBMP_SessionListenerSlot bob_slots[4];
+
+static SBMP_Reliable alice_rel;
+static SBMP_Reliable bob_rel;
+static uint8_t alice_rel_buf[2 * REL_DEPTH * BUF_LEN];
+static uint8_t bob_rel_buf[2 * REL_DEPTH * BUF_LEN];
+
+// received test datagrams
+static uint32_t bob_next;   // expected sequence number
+static uint32_t alice_next;
+static uint32_t bob_bad;    // out of order or damaged
+static uint32_t alice_bad;
+
+static uint32_t link_downs;
+static uint64_t link_down_at;
+
+static SBMP_BulkTx *bulk_tx;
+static SBMP_BulkRx *bulk_rx;
+static SBMP_BulkState *bulk_state;
+static uint8_t bulk_bitmap[BULK_LEN / BULK_BLOCK / 8];
+static uint8_t bulk_scratch[64];
+static uint8_t object[BULK_LEN];
+static uint8_t received[BULK_LEN];
+static uint32_t received_bytes;
+
+static void discard_tx(uint8_t byte) { (void)byte; } // replaced by the simulator
+
+/** Check a received test datagram - a sequence number, and a pattern derived from it */
+static bool check_test_dg(SBMP_Datagram *dg, uint32_t expected)
+{
+	if (dg->length != REL_MESSAGE_LEN) return false;
+
+	uint32_t seq;
+	memcpy(&seq, dg->payload, sizeof(seq));
+	if (seq != expected) return false;
+
+	for (int i = sizeof(seq); i < REL_MESSAGE_LEN; i++) {
+		if (dg->payload[i] != (uint8_t)(seq + i)) return false;
+	}
+
+	return true;
+}
+
+/** Build a test datagram payload */
+static void fill_test_dg(uint8_t *buf, uint32_t seq)
+{
+	memcpy(buf, &seq, sizeof(seq));
+	for (int i = sizeof(seq); i < REL_MESSAGE_LEN; i++) buf[i] = (uint8_t)(seq + i);
+}
+
+static void alice_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_TEST_REPLY) {
+		if (!check_test_dg(dg, alice_next)) alice_bad++;
+		alice_next++;
+	}
+}
+
+static void bob_rx(SBMP_Datagram *dg)
+{
+	static uint8_t reply[REL_MESSAGE_LEN];
+
+	if (dg->type == DG_TEST_DATA) {
+		if (!check_test_dg(dg, bob_next)) bob_bad++;
+		bob_next++;
+
+		if (bob_next % REL_REPLY_EVERY == 0) {
+			fill_test_dg(reply, bob_next / REL_REPLY_EVERY - 1);
+			sbmp_ep_send_response(bob, DG_TEST_REPLY, reply, REL_MESSAGE_LEN, dg->session, NULL);
+		}
+	} else if (dg->type == DG_BULK_OFFER && bulk_rx != NULL) {
+		sbmp_bulk_rx_start(bulk_rx, dg);
+	}
+}
+
+static void alice_link(SBMP_Endpoint *ep, bool up)
+{
+	(void)ep;
+	if (!up && link_downs++ == 0) link_down_at = sim.now;
+}
+
+static bool read_object(SBMP_BulkTx *tx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)tx;
+	memcpy(buf, object + offset, len);
+	return true;
+}
+
+static void store_data(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	(void)rx;
+	memcpy(received + offset, data, len);
+	received_bytes += len;
+}
+
+/** Reset an endpoint (a power cycle of the device) */
+static SBMP_Endpoint *reset_endpoint(SBMP_Endpoint *ep, uint8_t *buf, uint16_t buf_len,
+									 void (*rx)(SBMP_Datagram *), SBMP_SessionListenerSlot *slots)
+{
+	ep = sbmp_ep_init(ep, buf, buf_len, rx, discard_tx);
+
+	memset(slots, 0, 4 * sizeof(SBMP_SessionListenerSlot));
+	sbmp_ep_init_listeners(ep, slots, 4);
+
+	// different session numbers and tie-break values on each run
+	sbmp_ep_seed_session(ep, (uint16_t)sbmp_sim_random(&sim));
+	sbmp_ep_enable(ep, true);
+	return ep;
+}
+
+/** Reset the simulator and the endpoints. Connect them with connect() after enabling the modes. */
+static void setup(uint64_t seed, uint16_t bob_buf_len)
+{
+	sbmp_sim_release(&sim);
+	sbmp_sim_init(&sim, seed);
+
+	alice = reset_endpoint(alice, alice_buf, BUF_LEN, alice_rx, alice_slots);
+	bob = reset_endpoint(bob, bob_buf, bob_buf_len, bob_rx, bob_slots);
+
+	bob_next = alice_next = 0;
+	bob_bad = alice_bad = 0;
+	link_downs = 0;
+	bulk_rx = NULL;
+}
+
+/** Put the endpoints on a simulated link */
+static void connect(const SBMP_SimLineConfig *cfg)
+{
+	int a = sbmp_sim_add_node(&sim, alice);
+	int b = sbmp_sim_add_node(&sim, bob);
+	line_ab = sbmp_sim_connect(&sim, a, b, cfg);
+}
+
+/**
+ * Connect the endpoints again after resetting one of them (sbmp_ep_init()
+ * replaces the simulator's output). The link must be idle; the clock continues.
+ */
+static void reconnect(void)
+{
+	uint64_t now = sim.now;
+
+	sbmp_sim_release(&sim);
+	sbmp_sim_init(&sim, now);
+	sim.now = now;
+
+	connect(&line_clean);
+}
+
+/** Change both lines of the link */
+static void configure_link(const SBMP_SimLineConfig *cfg)
+{
+	sbmp_sim_configure(&sim, line_ab, cfg);
+	sbmp_sim_configure(&sim, line_ab + 1, cfg);
+}
+
+/** Drop partly received frames (a line idle timeout, as a UART driver would do) */
+static void idle_timeout(void)
+{
+	sbmp_frm_reset_rx(&alice->frm);
+	sbmp_frm_reset_rx(&bob->frm);
+}
+
+/** Run the simulation for a millisecond, and poll the endpoints' timers */
+static void tick(void)
+{
+	uint64_t until = sim.now + 1000;
+
+	if (sbmp_sim_next_event(&sim) >= until) idle_timeout(); // the line is idle
+	sbmp_sim_run(&sim, until);
+
+	SBMP_Endpoint *eps[2] = {alice, bob};
+	for (int i = 0; i < 2; i++) {
+		sbmp_ep_reliable_poll(eps[i]);
+		sbmp_ep_credit_poll(eps[i]);
+		sbmp_ep_keepalive_poll(eps[i]);
+	}
+}
+
+/** Check if both parties finished the handshake */
+static bool handshake_done(void)
+{
+	return sbmp_ep_handshake_status(alice) == SBMP_HSK_SUCCESS
+		   && sbmp_ep_handshake_status(bob) == SBMP_HSK_SUCCESS;
+}
+
+/**
+ * Handshake started by alice, retried after a timeout
+ * @param attempts : filled with the number of requests sent
+ * @return success
+ */
+static bool handshake(int *attempts)
+{
+	*attempts = 0;
+
+	while (sim.now < GIVE_UP_US) {
+		sbmp_ep_start_handshake(alice);
+		(*attempts)++;
+
+		uint64_t timeout = sim.now + RETRY_US;
+		while (sim.now < timeout) {
+			tick();
+			if (handshake_done()) return true;
+		}
+	}
+
+	return false;
+}
+
+// --- Checks ---
+
+/** Reliable mode - all datagrams delivered in order, with bit errors on the line */
+static bool check_reliable(uint64_t seed)
+{
+	setup(seed, BUF_LEN);
+	sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	sbmp_ep_init_reliable(bob, &bob_rel, bob_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	connect(&line_noisy);
+
+	int attempts;
+	if (!handshake(&attempts)) return false;
+	if (!sbmp_ep_is_reliable(alice) || !sbmp_ep_is_reliable(bob)) return false;
+
+	uint8_t msg[REL_MESSAGE_LEN];
+	uint32_t sent = 0;
+
+	while (bob_next < REL_MESSAGES || alice_next < REL_MESSAGES / REL_REPLY_EVERY) {
+		if (sim.now > GIVE_UP_US) return false;
+
+		// send as fast as the window allows
+		while (sent < REL_MESSAGES) {
+			fill_test_dg(msg, sent);
+			if (!sbmp_ep_send_message(alice, DG_TEST_DATA, msg, REL_MESSAGE_LEN, NULL, NULL)) break;
+			sent++;
+		}
+
+		tick();
+	}
+
+	// the line really damaged some frames
+	bool errors = (sim.lines[line_ab].stats.corrupted > 0 || sim.lines[line_ab + 1].stats.corrupted > 0);
+
+	return errors && bob_bad == 0 && alice_bad == 0
+		   && bob_next == REL_MESSAGES && alice_next == REL_MESSAGES / REL_REPLY_EVERY;
+}
+
+/** Capabilities - negotiated values, and the fallback for a short buffer */
+static bool check_caps(uint64_t seed)
+{
+	// a capable peer with different parameters
+	setup(seed, 128);
+	sbmp_ep_set_caps(alice, 4, 0x0300);
+	sbmp_ep_set_caps(bob, 2, 0x0100);
+	sbmp_ep_set_preferred_cksum(bob, SBMP_CKSUM_XOR);
+	sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	connect(&line_clean);
+
+	int attempts;
+	if (!handshake(&attempts) || attempts != 1) return false;
+
+	const SBMP_Caps *ca = &alice->common_caps;
+	const SBMP_Caps *cb = &bob->common_caps;
+
+	if (ca->version_major == 0 && ca->version_minor == 0) return false;
+	if (ca->max_frame != 128 || ca->rx_buffers != 2) return false;
+	if ((ca->features & SBMP_FEAT_APP_MASK) != 0x0100) return false;
+	if (ca->features & SBMP_FEAT_RELIABLE) return false; // bob doesn't support it
+	if (sbmp_ep_is_reliable(alice)) return false;
+	if (ca->max_frame != cb->max_frame || ca->rx_buffers != cb->rx_buffers || ca->features != cb->features) return false;
+	if (alice->peer_pref_cksum != SBMP_CKSUM_XOR || alice->peer_buffer_size != 128) return false;
+
+	// a peer that can't receive the capability block - the first request is lost,
+	// the retry without the block succeeds
+	setup(seed, 12);
+	connect(&line_clean);
+
+	if (!handshake(&attempts) || attempts != 2) return false;
+
+	return alice->peer_buffer_size == 12 && alice->common_caps.version_major == 0
+		   && bob->common_caps.version_major == 0;
+}
+
+/** Simultaneous handshakes - resolved by the tie-break values, without a conflict */
+static bool check_tiebreak(uint64_t seed)
+{
+	setup(seed, BUF_LEN);
+	connect(&line_clean);
+
+	sbmp_ep_start_handshake(alice);
+	sbmp_ep_start_handshake(bob);
+
+	for (uint64_t timeout = sim.now + RETRY_US; sim.now < timeout && !handshake_done();) {
+		tick();
+	}
+
+	return handshake_done() && alice->origin != bob->origin;
+}
+
+/** Resume - the token matches after a reset; a reset peer starts a new handshake */
+static bool check_resume(uint64_t seed)
+{
+	setup(seed, BUF_LEN);
+	sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	sbmp_ep_init_reliable(bob, &bob_rel, bob_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	connect(&line_clean);
+
+	int attempts;
+	if (!handshake(&attempts)) return false;
+	if (alice->hsk_token == 0 || alice->hsk_token != bob->hsk_token) return false;
+
+	uint8_t params[SBMP_EP_PARAMS_LEN];
+	uint16_t params_len = sbmp_ep_export_params(alice, params);
+	if (params_len == 0) return false;
+
+	uint16_t token = alice->hsk_token;
+
+	// alice resets and resumes - bob accepts the token, the traffic continues in the reliable mode
+	alice = reset_endpoint(alice, alice_buf, BUF_LEN, alice_rx, alice_slots);
+	sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	reconnect();
+	if (!sbmp_ep_import_params(alice, params, params_len) || !sbmp_ep_resume(alice)) return false;
+
+	uint8_t msg[REL_MESSAGE_LEN];
+	fill_test_dg(msg, 0);
+	if (!sbmp_ep_send_message(alice, DG_TEST_DATA, msg, REL_MESSAGE_LEN, NULL, NULL)) return false;
+
+	for (uint64_t until = sim.now + RETRY_US; sim.now < until;) tick();
+
+	if (bob_next != 1 || bob_bad != 0) return false;
+	if (!handshake_done() || bob->hsk_token != token) return false; // no new handshake
+	if (!sbmp_ep_is_reliable(alice) || !sbmp_ep_is_reliable(bob)) return false;
+
+	// a damaged record is rejected
+	params[params_len / 2] ^= 0x10;
+	if (sbmp_ep_import_params(alice, params, params_len)) return false;
+	params[params_len / 2] ^= 0x10;
+
+	// both reset - bob doesn't know the token, and starts a new handshake
+	alice = reset_endpoint(alice, alice_buf, BUF_LEN, alice_rx, alice_slots);
+	bob = reset_endpoint(bob, bob_buf, BUF_LEN, bob_rx, bob_slots);
+	sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	sbmp_ep_init_reliable(bob, &bob_rel, bob_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	reconnect();
+	if (!sbmp_ep_import_params(alice, params, params_len) || !sbmp_ep_resume(alice)) return false;
+
+	for (uint64_t until = sim.now + RETRY_US; sim.now < until;) tick();
+
+	return handshake_done() && alice->hsk_token != token && alice->hsk_token == bob->hsk_token
+		   && sbmp_ep_is_reliable(alice) && sbmp_ep_is_reliable(bob);
+}
+
+/**
+ * Keepalive on a cut link - reported down after max_missed heartbeats
+ * @param credit : use the flow control instead of the reliable mode
+ */
+static bool check_keepalive(uint64_t seed, bool credit)
+{
+	setup(seed, BUF_LEN);
+	if (credit) {
+		sbmp_ep_init_credit(alice, 4, false);
+		sbmp_ep_init_credit(bob, 4, false);
+	} else {
+		sbmp_ep_init_reliable(alice, &alice_rel, alice_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+		sbmp_ep_init_reliable(bob, &bob_rel, bob_rel_buf, REL_DEPTH, BUF_LEN, sbmp_sim_clock_ms);
+	}
+	sbmp_ep_init_keepalive(alice, sbmp_sim_clock_ms, KA_INTERVAL_MS, KA_MAX_MISSED, alice_link);
+	sbmp_ep_init_keepalive(bob, sbmp_sim_clock_ms, KA_INTERVAL_MS, KA_MAX_MISSED, NULL);
+	connect(&line_clean);
+
+	int attempts;
+	if (!handshake(&attempts)) return false;
+
+	// the link works for a while
+	for (uint64_t until = sim.now + 5 * KA_INTERVAL_MS * 1000; sim.now < until;) tick();
+	if (!sbmp_ep_link_up(alice) || sbmp_ep_rtt(alice) == 0 || link_downs != 0) return false;
+
+	// cut the link, and fill the window / use up the credit
+	configure_link(&line_cut);
+	uint64_t cut_at = sim.now;
+
+	uint8_t msg[REL_MESSAGE_LEN];
+	for (uint32_t i = 0; i < 2 * REL_DEPTH; i++) {
+		fill_test_dg(msg, i);
+		sbmp_ep_send_message(alice, DG_TEST_DATA, msg, REL_MESSAGE_LEN, NULL, NULL);
+	}
+
+	for (uint64_t until = cut_at + 20 * KA_INTERVAL_MS * 1000; sim.now < until;) tick();
+
+	// down after the max_missed heartbeats (+ one interval, they are sent on a schedule)
+	uint64_t down_after = link_down_at - cut_at;
+	return link_downs == 1 && !sbmp_ep_link_up(alice)
+		   && down_after >= (uint64_t)(KA_MAX_MISSED - 1) * KA_INTERVAL_MS * 1000
+		   && down_after <= (uint64_t)(KA_MAX_MISSED + 1) * KA_INTERVAL_MS * 1000;
+}
+
+/** Run a bulk transfer until done, or until the receiver has the given number of bytes */
+static bool run_bulk(uint32_t stop_at)
+{
+	while (bulk_rx->status == SBMP_BULK_RX_IDLE || bulk_rx->status == SBMP_BULK_RX_BUSY) {
+		if (sim.now > GIVE_UP_US) return false;
+		if (bulk_state->done_bytes >= stop_at) return true;
+
+		sbmp_bulk_tx_poll(bulk_tx);
+		tick();
+		sbmp_bulk_rx_poll(bulk_rx);
+	}
+
+	return bulk_rx->status == SBMP_BULK_RX_DONE;
+}
+
+/** Bulk transfer - interrupted, the state saved, loaded after a reset and the transfer finished */
+static bool check_bulk_state(uint64_t seed)
+{
+	setup(seed, BUF_LEN);
+	connect(&line_clean);
+
+	int attempts;
+	if (!handshake(&attempts)) return false;
+
+	for (int i = 0; i < BULK_LEN; i++) object[i] = (uint8_t) sbmp_sim_random(&sim);
+	memset(received, 0, BULK_LEN);
+	received_bytes = 0;
+
+	bulk_state = sbmp_bulk_state_init(bulk_state, bulk_bitmap, sizeof(bulk_bitmap), BULK_BLOCK);
+	bulk_rx = sbmp_bulk_rx_init(bulk_rx, bob, bulk_state, BULK_CHUNK, store_data, NULL);
+	bulk_tx = sbmp_bulk_tx_init(bulk_tx, alice, bulk_scratch, sizeof(bulk_scratch), read_object, NULL);
+	sbmp_bulk_rx_set_adaptive(bulk_rx, sbmp_sim_clock_ms);
+
+	SBMP_BulkOffer offer = {
+		.length = BULK_LEN,
+		.offer_id = 1,
+		.digest_type = SBMP_BULK_DIGEST_CRC32,
+		.digest = crc32buf(object, BULK_LEN),
+	};
+
+	sbmp_bulk_tx_offer(bulk_tx, &offer);
+	if (!run_bulk(BULK_LEN / 2)) return false;
+
+	// the receiver is reset mid-transfer
+	uint8_t record[128];
+	size_t record_len = sbmp_bulk_state_save(bulk_state, record, sizeof(record));
+	if (record_len == 0) return false;
+
+	uint32_t saved_bytes = bulk_state->done_bytes;
+
+	// a damaged record is rejected
+	record[record_len - 1] ^= 0x01;
+	if (sbmp_bulk_state_load(bulk_state, record, record_len)) return false;
+	record[record_len - 1] ^= 0x01;
+
+	memset(bulk_bitmap, 0, sizeof(bulk_bitmap));
+	bulk_state = sbmp_bulk_state_init(bulk_state, bulk_bitmap, sizeof(bulk_bitmap), BULK_BLOCK);
+	if (!sbmp_bulk_state_load(bulk_state, record, record_len)) return false;
+	if (bulk_state->done_bytes != saved_bytes) return false;
+
+	sbmp_ep_remove_listener(bob, bulk_rx->session);
+	bulk_rx = sbmp_bulk_rx_init(bulk_rx, bob, bulk_state, BULK_CHUNK, store_data, NULL);
+	sbmp_bulk_rx_set_adaptive(bulk_rx, sbmp_sim_clock_ms);
+
+	// the sender offers it again, only the rest is transferred
+	received_bytes = 0;
+	sbmp_bulk_tx_offer(bulk_tx, &offer);
+	if (!run_bulk(BULK_LEN + 1)) return false;
+
+	return received_bytes <= BULK_LEN - saved_bytes + BULK_CHUNK
+		   && sbmp_bulk_state_verify(bulk_state)
+		   && memcmp(object, received, BULK_LEN) == 0;
+}
+
+// --- Main ---
+
+/** Run a check with a number of seeds, print the result */
+static bool run_check(const char *name, bool (*check)(uint64_t seed), int seeds)
+{
+	int failed = 0;
+	for (int seed = 1; seed <= seeds; seed++) {
+		if (!check((uint64_t)seed)) {
+			printf("%s: FAILED with seed %d\n", name, seed);
+			failed++;
+		}
+	}
+
+	if (failed == 0) printf("%s: OK\n", name);
+	return failed == 0;
+}
+
+static bool check_keepalive_reliable(uint64_t seed) { return check_keepalive(seed, false); }
+static bool check_keepalive_credit(uint64_t seed) { return check_keepalive(seed, true); }
+
+int main(int argc, char **argv)
+{
+	int seeds = 5;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n':
+				seeds = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n seeds]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	bool ok = true;
+	ok &= run_check("reliable", check_reliable, seeds);
+	ok &= run_check("caps", check_caps, seeds);
+	ok &= run_check("tiebreak", check_tiebreak, seeds);
+	ok &= run_check("resume", check_resume, seeds);
+	ok &= run_check("keepalive-reliable", check_keepalive_reliable, seeds);
+	ok &= run_check("keepalive-credit", check_keepalive_credit, seeds);
+	ok &= run_check("bulkstate", check_bulk_state, seeds);
+
+	sbmp_sim_release(&sim);
+	return ok ? 0 : 1;
+}
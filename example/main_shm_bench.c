@@ -0,0 +1,353 @@
+/**
+ * Round trip and throughput between two processes, over the shared memory
+ * transport (see sbmp_shm.h) and, for comparison, over a Unix socketpair
+ * with the POSIX transport (see sbmp_transport_posix.h).
+ *
+ * The "device" runs in a child process. With shm, it gets the region over
+ * a Unix socket, like a separate program would. It echoes the requests
+ * back, and counts the streamed bytes. For each payload size, the host
+ * measures the round trip times, and then streams messages as fast as it
+ * can.
+ *
+ * Usage: shm_bench [-n count] [-r ring_size] [-s spin_us] [-l link]
+ *
+ *   -n : requests per measurement (default 10000)
+ *   -r : shm ring size (default 65536)
+ *   -s : shm busy-wait before sleeping, in us (default 0)
+ *   -l : shm, socket or both (default both)
+ *
+ * Build with "make shm_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_shm.h"
+#include "sbmp/sbmp_transport_posix.h"
+
+#define BUF_LEN 4200
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+#define DG_BENCH_STREAM 102
+#define DG_BENCH_STREAM_END 103
+
+/** Bytes sent during the throughput test */
+#define STREAM_BYTES (64 * 1024 * 1024)
+
+/** Stop sending when this much is waiting for the peer */
+#define MAX_PENDING (256 * 1024)
+
+// options
+static long count = 10000;
+static size_t ring_size = 65536;
+static uint32_t spin_us = 0;
+static const char *link_name = "both";
+
+/** One side of the link */
+typedef struct {
+	SBMP_Shm *shm;          // or:
+	SBMP_Transport *tp;
+	SBMP_Endpoint ep;
+	uint8_t rx_buf[BUF_LEN];
+} Side;
+
+static Side side;
+
+// host state
+static uint16_t pending_sesn;
+static bool answered;
+static uint32_t stream_total; // reported by the device
+
+// device state
+static uint32_t stream_received;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Pass the received data to the endpoint, wait at most timeout_ms for it
+ * @return false if the peer is gone
+ */
+static bool side_receive(int timeout_ms)
+{
+	if (side.shm != NULL) {
+		return sbmp_shm_receive(side.shm, timeout_ms) >= 0;
+	}
+
+	if (sbmp_tp_rx_pending(side.tp) == 0) {
+		struct pollfd pfd = {.fd = sbmp_tp_fd(side.tp), .events = POLLIN};
+		if (poll(&pfd, 1, timeout_ms) <= 0) return true;
+	}
+
+	return sbmp_tp_receive(side.tp) >= 0;
+}
+
+static size_t side_tx_pending(void)
+{
+	return side.shm != NULL ? sbmp_shm_tx_pending(side.shm) : sbmp_tp_tx_pending(side.tp);
+}
+
+static void side_init(void (*rx)(SBMP_Datagram *dg))
+{
+	sbmp_ep_init(&side.ep, side.rx_buf, BUF_LEN, rx, NULL);
+
+	if (side.shm != NULL) {
+		sbmp_shm_attach(side.shm, &side.ep.frm);
+	} else {
+		sbmp_tp_attach(side.tp, &side.ep.frm);
+	}
+
+	sbmp_ep_enable(&side.ep, true);
+}
+
+// --- Device (child process) ---
+
+static void device_rx(SBMP_Datagram *dg)
+{
+	switch (dg->type) {
+		case DG_BENCH_REQUEST:
+			sbmp_ep_send_response(&side.ep, DG_BENCH_RESPONSE, dg->payload, dg->length, dg->session, NULL);
+			break;
+
+		case DG_BENCH_STREAM:
+			stream_received += dg->length;
+			break;
+
+		case DG_BENCH_STREAM_END:
+			sbmp_ep_send_response(&side.ep, DG_BENCH_RESPONSE, (uint8_t *) &stream_received, 4, dg->session, NULL);
+			stream_received = 0;
+			break;
+	}
+}
+
+static void device_main(void)
+{
+	side_init(device_rx);
+
+	while (side_receive(-1)) {}
+
+	_exit(0);
+}
+
+// --- Host ---
+
+static void host_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_RESPONSE && dg->session == pending_sesn) {
+		if (dg->length == 4) memcpy(&stream_total, dg->payload, 4);
+		answered = true;
+	}
+}
+
+/** Wait for the response to the pending request */
+static bool wait_answer(void)
+{
+	uint64_t deadline = now_ns() + 5000000000ULL;
+
+	while (!answered) {
+		if (!side_receive(100) || now_ns() > deadline) return false;
+	}
+
+	return true;
+}
+
+static bool measure_rtt(uint16_t payload, SBMP_Histogram *hist)
+{
+	static uint8_t buf[BUF_LEN];
+	memset(buf, 0x5A, payload);
+
+	for (long i = 0; i < count; i++) {
+		answered = false;
+		uint64_t start = now_ns();
+
+		if (!sbmp_ep_send_message(&side.ep, DG_BENCH_REQUEST, buf, payload, &pending_sesn, NULL)) return false;
+		if (!wait_answer()) return false;
+
+		sbmp_hist_add(hist, (uint32_t)(now_ns() - start));
+	}
+
+	return true;
+}
+
+/** @return MB/s, < 0 on failure */
+static double measure_stream(uint16_t payload)
+{
+	static uint8_t buf[BUF_LEN];
+	memset(buf, 0xA5, payload);
+
+	uint32_t sent = 0;
+	uint64_t start = now_ns();
+
+	while (sent < STREAM_BYTES) {
+		if (!sbmp_ep_send_message(&side.ep, DG_BENCH_STREAM, buf, payload, NULL, NULL)) return -1;
+		sent += payload;
+
+		do {
+			if (!side_receive(side_tx_pending() > MAX_PENDING ? 10 : 0)) return -1;
+		} while (side_tx_pending() > MAX_PENDING);
+	}
+
+	answered = false;
+	if (!sbmp_ep_send_message(&side.ep, DG_BENCH_STREAM_END, NULL, 0, &pending_sesn, NULL)) return -1;
+	if (!wait_answer() || stream_total != sent) {
+		fprintf(stderr, "Stream incomplete: %u of %u bytes\n", stream_total, sent);
+		return -1;
+	}
+
+	return (double) sent / ((double)(now_ns() - start) / 1e3);
+}
+
+/** Start the device process; the host side is set up in `side` */
+static pid_t start(bool use_shm)
+{
+	memset(&side, 0, sizeof(side));
+
+	int sock[2];
+	SBMP_Transport *peer_tp = NULL;
+
+	if (use_shm) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) != 0) return -1;
+
+		side.shm = sbmp_shm_create(ring_size);
+		if (side.shm == NULL) return -1;
+	} else {
+		if (!sbmp_tp_socketpair(&side.tp, &peer_tp, 0)) return -1;
+		sbmp_tp_set_buffers(side.tp, 65536, 65536);
+		sbmp_tp_set_buffers(peer_tp, 65536, 65536);
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) return -1;
+
+	if (pid == 0) {
+		// the parent's shm side is left alone (closing it would tell us to quit)
+		if (use_shm) {
+			side.shm = sbmp_shm_open_peer(sock[1]);
+			if (side.shm == NULL) _exit(1);
+			sbmp_shm_set_spin(side.shm, spin_us);
+		} else {
+			sbmp_tp_close(side.tp); // or we'd never see EOF
+			side.tp = peer_tp;
+		}
+
+		device_main();
+	}
+
+	if (use_shm) {
+		if (!sbmp_shm_send_peer(side.shm, sock[0])) return -1;
+		sbmp_shm_set_spin(side.shm, spin_us);
+		close(sock[0]);
+		close(sock[1]);
+	} else {
+		sbmp_tp_close(peer_tp);
+	}
+
+	side_init(host_rx);
+	return pid;
+}
+
+static void stop(pid_t pid)
+{
+	if (side.shm != NULL) {
+		sbmp_shm_close(side.shm);
+	} else {
+		sbmp_tp_close(side.tp);
+	}
+
+	waitpid(pid, NULL, 0);
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-r ring_size] [-s spin_us] [-l shm|socket|both]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:s:l:")) != -1) {
+		switch (opt) {
+			case 'n': count = atol(optarg); break;
+			case 'r': ring_size = (size_t) atol(optarg); break;
+			case 's': spin_us = (uint32_t) atol(optarg); break;
+			case 'l': link_name = optarg; break;
+			default: usage(argv);
+		}
+	}
+
+	bool do_shm = !strcmp(link_name, "shm") || !strcmp(link_name, "both");
+	bool do_socket = !strcmp(link_name, "socket") || !strcmp(link_name, "both");
+
+	if (count < 1 || (!do_shm && !do_socket)) usage(argv);
+
+	static const uint16_t payloads[] = {16, 256, 1024, 4096};
+	static SBMP_Histogram hist;
+	bool ok = true;
+
+	printf("link,payload,p50_us,p90_us,p99_us,max_us,stream_MBps,wakeups\n");
+
+	for (int s = 0; s < 2; s++) {
+		bool use_shm = (s == 0);
+		if (use_shm ? !do_shm : !do_socket) continue;
+
+		pid_t pid = start(use_shm);
+		if (pid < 0) {
+			perror("start");
+			return 1;
+		}
+
+		sbmp_ep_start_handshake(&side.ep);
+		while (sbmp_ep_handshake_status(&side.ep) == SBMP_HSK_AWAIT_REPLY) {
+			if (!side_receive(100)) break;
+		}
+
+		for (size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); p++) {
+			printf("%s,%u,", use_shm ? "shm" : "socket", payloads[p]);
+
+			memset(&hist, 0, sizeof(hist));
+			uint32_t wakeups = use_shm ? sbmp_shm_stats(side.shm)->wakeups : 0;
+
+			double mbps = -1;
+			if (measure_rtt(payloads[p], &hist)) mbps = measure_stream(payloads[p]);
+
+			if (mbps < 0) {
+				printf("FAILED\n");
+				ok = false;
+				break;
+			}
+
+			printf("%.1f,%.1f,%.1f,%.1f,%.0f,", sbmp_hist_percentile(&hist, 50) / 1000.0,
+				   sbmp_hist_percentile(&hist, 90) / 1000.0, sbmp_hist_percentile(&hist, 99) / 1000.0,
+				   hist.max / 1000.0, mbps);
+
+			if (use_shm) {
+				printf("%u\n", sbmp_shm_stats(side.shm)->wakeups - wakeups);
+			} else {
+				printf("-\n");
+			}
+		}
+
+		stop(pid);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,458 @@
+/**
+ * End-to-end scenarios on simulated links (see sbmp_sim.h).
+ *
+ * Two endpoints are connected with a simulated serial link, and each scenario
+ * is run with a number of random seeds on each line profile:
+ *
+ *   handshake : time to a finished handshake (retried after a timeout)
+ *   request   : request / response round trip time, and the request goodput
+ *   bulk      : a bulk transfer in the adaptive push mode
+ *   recovery  : time to the first answered request after a link outage
+ *
+ * Times are virtual, so the results only depend on the seeds. The output
+ * is CSV, with percentiles over all the seeds.
+ *
+ * Usage: sim_bench [-n seeds] [-s scenario] [-p profile]
+ *
+ * Build with "make sim_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/crc32.h"
+#include "sbmp/sbmp_sim.h"
+
+#define BUF_LEN 256
+
+#define DG_BENCH_REQUEST 100
+#define DG_BENCH_RESPONSE 101
+
+#define REQUEST_LEN 32
+#define RESPONSE_LEN 64
+#define REQUESTS_PER_SEED 50
+
+#define BULK_LEN (16 * 1024)
+#define BULK_CHUNK 128
+
+// application retry timeout, like a real one would use
+#define RETRY_US 50000
+// a failed scenario gives up after this much virtual time
+#define GIVE_UP_US 60000000
+
+#define OUTAGE_AT_US 100000
+#define OUTAGE_US 200000
+
+/** Line profile */
+typedef struct {
+	const char *name;
+	SBMP_SimLineConfig cfg;
+} Profile;
+
+static const Profile profiles[] = {
+	{"clean-115k", {.baud = 115200,  .latency_us = 1000}},
+	{"jitter",     {.baud = 115200,  .latency_us = 1000, .jitter_us = 4000}},
+	{"ber1e-5",    {.baud = 115200,  .latency_us = 1000, .bit_error_rate = 1e-5}},
+	{"ber1e-4",    {.baud = 115200,  .latency_us = 1000, .bit_error_rate = 1e-4}},
+	{"drop1e-4",   {.baud = 115200,  .latency_us = 1000, .drop_rate = 1e-4}},
+	{"bursts",     {.baud = 115200,  .latency_us = 1000, .burst_rate = 5e-5, .burst_len = 8}},
+	{"usb-1M",     {.baud = 1000000, .latency_us = 4000, .jitter_us = 1000}},
+};
+
+// --- Simulated setup ---
+
+static SBMP_Sim sim;
+static int line_ab; // alice -> bob, bob -> alice is the next one
+
+static SBMP_Endpoint *alice;
+static SBMP_Endpoint *bob;
+static uint8_t alice_buf[BUF_LEN];
+static uint8_t bob_buf[BUF_LEN];
+static SBMP_SessionListenerSlot alice_slots[4];
+static SBMP_SessionListenerSlot bob_slots[4];
+
+static uint8_t request[REQUEST_LEN];
+static uint16_t pending_sesn;  // the request alice waits for
+static uint64_t request_start;
+static uint64_t retry_at;
+static bool answered;
+static uint64_t payload_bytes; // request & response payload delivered
+
+static SBMP_BulkTx *bulk_tx;
+static SBMP_BulkRx *bulk_rx;
+static SBMP_BulkState *bulk_state;
+static uint8_t bulk_bitmap[BULK_LEN / 8 / 8];
+static uint8_t bulk_scratch[64];
+static uint8_t object[BULK_LEN];
+static uint8_t received[BULK_LEN];
+
+static void discard_tx(uint8_t byte) { (void)byte; } // replaced by the simulator
+
+static void alice_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_RESPONSE && dg->session == pending_sesn && !answered) {
+		answered = true;
+		payload_bytes += dg->length;
+	}
+}
+
+static void bob_rx(SBMP_Datagram *dg)
+{
+	static uint8_t response[RESPONSE_LEN];
+
+	if (dg->type == DG_BENCH_REQUEST) {
+		payload_bytes += dg->length;
+		memcpy(response, dg->payload, dg->length < RESPONSE_LEN ? dg->length : RESPONSE_LEN);
+		sbmp_ep_send_response(bob, DG_BENCH_RESPONSE, response, RESPONSE_LEN, dg->session, NULL);
+	} else if (dg->type == DG_BULK_OFFER) {
+		sbmp_bulk_rx_start(bulk_rx, dg);
+	}
+}
+
+static bool read_object(SBMP_BulkTx *tx, uint32_t offset, uint8_t *buf, uint16_t len)
+{
+	(void)tx;
+	memcpy(buf, object + offset, len);
+	return true;
+}
+
+static void store_data(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	(void)rx;
+	memcpy(received + offset, data, len);
+}
+
+/** Reset the simulator and the endpoints */
+static void setup(const Profile *profile, uint64_t seed, bool handshake)
+{
+	sbmp_sim_release(&sim);
+	sbmp_sim_init(&sim, seed);
+
+	alice = sbmp_ep_init(alice, alice_buf, BUF_LEN, alice_rx, discard_tx);
+	bob = sbmp_ep_init(bob, bob_buf, BUF_LEN, bob_rx, discard_tx);
+
+	memset(alice_slots, 0, sizeof(alice_slots));
+	memset(bob_slots, 0, sizeof(bob_slots));
+	sbmp_ep_init_listeners(alice, alice_slots, 4);
+	sbmp_ep_init_listeners(bob, bob_slots, 4);
+
+	// different session numbers on each run
+	sbmp_ep_seed_session(alice, (uint16_t)sbmp_sim_random(&sim));
+	sbmp_ep_seed_session(bob, (uint16_t)sbmp_sim_random(&sim));
+
+	if (!handshake) {
+		sbmp_ep_set_origin(alice, 0);
+		sbmp_ep_set_origin(bob, 1);
+		alice->peer_buffer_size = BUF_LEN;
+		bob->peer_buffer_size = BUF_LEN;
+	}
+
+	sbmp_ep_enable(alice, true);
+	sbmp_ep_enable(bob, true);
+
+	int a = sbmp_sim_add_node(&sim, alice);
+	int b = sbmp_sim_add_node(&sim, bob);
+	line_ab = sbmp_sim_connect(&sim, a, b, &profile->cfg);
+
+	payload_bytes = 0;
+}
+
+/** Drop partly received frames (a line idle timeout, as a UART driver would do) */
+static void idle_timeout(void)
+{
+	sbmp_frm_reset_rx(&alice->frm);
+	sbmp_frm_reset_rx(&bob->frm);
+}
+
+/** Run the simulation until the flag is set, or until a time */
+static void run_until(const bool *flag, uint64_t until)
+{
+	while (!*flag && sim.now < until) {
+		uint64_t next = sbmp_sim_next_event(&sim);
+		sbmp_sim_run(&sim, next < until ? next : until);
+	}
+}
+
+/** Send a new request */
+static bool send_request(void)
+{
+	for (int i = 0; i < REQUEST_LEN; i++) request[i] = (uint8_t) sbmp_sim_random(&sim);
+
+	answered = false;
+	request_start = sim.now;
+	retry_at = sim.now + RETRY_US;
+
+	return sbmp_ep_send_message(alice, DG_BENCH_REQUEST, request, REQUEST_LEN, &pending_sesn, NULL);
+}
+
+/**
+ * Wait for the response, sending the request again after a timeout
+ * @return true if answered
+ */
+static bool wait_response(uint64_t until)
+{
+	while (!answered && sim.now < until) {
+		run_until(&answered, retry_at < until ? retry_at : until);
+
+		if (!answered && sim.now >= retry_at) {
+			idle_timeout();
+			sbmp_ep_send_response(alice, DG_BENCH_REQUEST, request, REQUEST_LEN, pending_sesn, NULL);
+			retry_at = sim.now + RETRY_US;
+		}
+	}
+
+	return answered;
+}
+
+// --- Scenarios ---
+
+/**
+ * Time to a finished handshake
+ * @return time in us, 0 on failure
+ */
+static uint64_t scenario_handshake(const Profile *profile, uint64_t seed)
+{
+	setup(profile, seed, true);
+
+	bool done = false;
+
+	while (sim.now < GIVE_UP_US) {
+		idle_timeout();
+		sbmp_ep_start_handshake(alice);
+
+		uint64_t timeout = sim.now + RETRY_US;
+		while (!done && sim.now < timeout) {
+			uint64_t next = sbmp_sim_next_event(&sim);
+			sbmp_sim_run(&sim, next < timeout ? next : timeout);
+			done = (sbmp_ep_handshake_status(alice) == SBMP_HSK_SUCCESS);
+		}
+
+		if (done) return sim.now;
+	}
+
+	return 0;
+}
+
+/**
+ * A series of requests
+ * @param hist : histogram for the round trip times
+ * @return time of the whole series in us, 0 on failure
+ */
+static uint64_t scenario_requests(const Profile *profile, uint64_t seed, SBMP_Histogram *hist)
+{
+	setup(profile, seed, false);
+
+	for (int i = 0; i < REQUESTS_PER_SEED; i++) {
+		if (!send_request() || !wait_response(GIVE_UP_US)) return 0;
+
+		sbmp_hist_add(hist, (uint32_t)(sim.now - request_start));
+	}
+
+	return sim.now;
+}
+
+/**
+ * Bulk transfer (adaptive push mode)
+ * @return transfer time in us, 0 on failure
+ */
+static uint64_t scenario_bulk(const Profile *profile, uint64_t seed)
+{
+	setup(profile, seed, false);
+
+	for (int i = 0; i < BULK_LEN; i++) object[i] = (uint8_t) sbmp_sim_random(&sim);
+	memset(received, 0, BULK_LEN);
+
+	bulk_state = sbmp_bulk_state_init(bulk_state, bulk_bitmap, sizeof(bulk_bitmap), 8);
+	bulk_rx = sbmp_bulk_rx_init(bulk_rx, bob, bulk_state, BULK_CHUNK, store_data, NULL);
+	bulk_tx = sbmp_bulk_tx_init(bulk_tx, alice, bulk_scratch, sizeof(bulk_scratch), read_object, NULL);
+
+	sbmp_bulk_rx_set_push_window(bulk_rx, BULK_CHUNK * 4);
+	sbmp_bulk_rx_set_adaptive(bulk_rx, sbmp_sim_clock_ms);
+
+	SBMP_BulkOffer offer = {
+		.length = BULK_LEN,
+		.offer_id = 1,
+		.digest_type = SBMP_BULK_DIGEST_CRC32,
+		.digest = crc32buf(object, BULK_LEN),
+		.flags = BULK_FLAG_PUSH,
+	};
+
+	sbmp_bulk_tx_offer(bulk_tx, &offer);
+
+	const SBMP_SimLine *tx_line = &sim.lines[line_ab];
+
+	while (bulk_rx->status == SBMP_BULK_RX_IDLE || bulk_rx->status == SBMP_BULK_RX_BUSY) {
+		if (sim.now > GIVE_UP_US) return 0;
+
+		// the sender pushes data when its UART is idle
+		if (tx_line->busy_until <= sim.now && sbmp_bulk_tx_poll(bulk_tx)) continue;
+
+		uint64_t next = sbmp_sim_next_event(&sim);
+		if (tx_line->busy_until > sim.now && tx_line->busy_until < next) {
+			next = tx_line->busy_until;
+		}
+
+		if (next == UINT64_MAX) {
+			// nothing in flight, a frame was lost
+			idle_timeout();
+			sbmp_sim_run(&sim, sim.now + 1000);
+			sbmp_bulk_rx_poll(bulk_rx);
+			continue;
+		}
+
+		sbmp_sim_run(&sim, next);
+	}
+
+	if (bulk_rx->status != SBMP_BULK_RX_DONE || memcmp(object, received, BULK_LEN) != 0) {
+		return 0;
+	}
+
+	return sim.now;
+}
+
+/**
+ * Requests with an outage of the link
+ * @return time from the end of the outage to the first answered request in us, 0 on failure
+ */
+static uint64_t scenario_recovery(const Profile *profile, uint64_t seed)
+{
+	setup(profile, seed, false);
+
+	while (sim.now < OUTAGE_AT_US) {
+		if (!send_request() || !wait_response(GIVE_UP_US)) return 0;
+	}
+
+	SBMP_SimLineConfig dead = profile->cfg;
+	dead.drop_rate = 1;
+	sbmp_sim_configure(&sim, line_ab, &dead);
+	sbmp_sim_configure(&sim, line_ab + 1, &dead);
+
+	// keep trying during the outage
+	uint64_t end = sim.now + OUTAGE_US;
+	while (sim.now < end) {
+		if (answered && !send_request()) return 0;
+		wait_response(end);
+	}
+
+	sbmp_sim_configure(&sim, line_ab, &profile->cfg);
+	sbmp_sim_configure(&sim, line_ab + 1, &profile->cfg);
+
+	if (answered) send_request(); // answered by bytes still in flight
+
+	if (!wait_response(GIVE_UP_US)) return 0;
+	return sim.now - end;
+}
+
+// --- Output ---
+
+static void print_hist(const char *scenario, const Profile *profile, uint32_t failed,
+					   const SBMP_Histogram *hist, double goodput)
+{
+	printf("%s,%s,%u,%u,", scenario, profile->name, hist->count, failed);
+
+	if (hist->count == 0) {
+		printf(",,,,\n");
+		return;
+	}
+
+	printf("%.3f,%.3f,%.3f,%.3f,",
+		   sbmp_hist_percentile(hist, 50) / 1000.0,
+		   sbmp_hist_percentile(hist, 90) / 1000.0,
+		   sbmp_hist_percentile(hist, 99) / 1000.0,
+		   hist->max / 1000.0);
+
+	if (goodput > 0) {
+		printf("%.0f\n", goodput);
+	} else {
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	long seeds = 100;
+	const char *only_scenario = NULL;
+	const char *only_profile = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:p:")) != -1) {
+		switch (opt) {
+			case 'n': seeds = strtol(optarg, NULL, 10); break;
+			case 's': only_scenario = optarg; break;
+			case 'p': only_profile = optarg; break;
+			default:
+				fprintf(stderr, "Usage: %s [-n seeds] [-s scenario] [-p profile]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (seeds < 1) seeds = 1;
+
+	static const char *const scenarios[] = {"handshake", "request", "bulk", "recovery"};
+	static SBMP_Histogram hist;
+
+	printf("scenario,profile,runs,failed,p50_ms,p90_ms,p99_ms,max_ms,goodput_Bps\n");
+
+	for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		if (only_scenario != NULL && strcmp(only_scenario, scenarios[s]) != 0) continue;
+
+		for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+			const Profile *profile = &profiles[p];
+			if (only_profile != NULL && strcmp(only_profile, profile->name) != 0) continue;
+
+			memset(&hist, 0, sizeof(hist));
+			uint32_t failed = 0;
+			uint64_t total_bytes = 0, total_us = 0;
+
+			for (long seed = 1; seed <= seeds; seed++) {
+				uint64_t t = 0;
+
+				switch (s) {
+					case 0:
+						t = scenario_handshake(profile, (uint64_t) seed);
+						if (t) sbmp_hist_add(&hist, (uint32_t) t);
+						break;
+
+					case 1:
+						t = scenario_requests(profile, (uint64_t) seed, &hist);
+						if (t) total_bytes += payload_bytes;
+						break;
+
+					case 2:
+						t = scenario_bulk(profile, (uint64_t) seed);
+						if (t) {
+							sbmp_hist_add(&hist, (uint32_t) t);
+							total_bytes += BULK_LEN;
+						}
+						break;
+
+					case 3:
+						t = scenario_recovery(profile, (uint64_t) seed);
+						if (t) sbmp_hist_add(&hist, (uint32_t) t);
+						break;
+				}
+
+				if (t == 0) {
+					failed++;
+				} else {
+					total_us += t;
+				}
+			}
+
+			double goodput = total_us ? (double) total_bytes / ((double) total_us / 1e6) : 0;
+			print_hist(scenarios[s], profile, failed, &hist, goodput);
+		}
+	}
+
+	sbmp_sim_release(&sim);
+	return 0;
+}
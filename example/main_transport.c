@@ -0,0 +1,135 @@
+/**
+ * Two endpoints connected through the POSIX transport (see sbmp_transport_posix.h).
+ *
+ * The endpoints are connected with a socketpair, and then with a pty pair
+ * (the same as a serial port from the program's view). Each time, they do
+ * a handshake and exchange a number of messages; both run in one thread,
+ * driven by poll().
+ *
+ * Usage: transport [messages]
+ *
+ * Build with "make transport".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_transport_posix.h"
+
+#define BUF_LEN 1024
+
+#define DG_ECHO_REQUEST 100
+#define DG_ECHO_RESPONSE 101
+
+static SBMP_Endpoint *alice;
+static SBMP_Endpoint *bob;
+static uint8_t alice_buf[BUF_LEN];
+static uint8_t bob_buf[BUF_LEN];
+
+static uint32_t responses;
+static uint32_t mismatches;
+static uint8_t expected[BUF_LEN];
+
+static void alice_rx(SBMP_Datagram *dg)
+{
+	if (dg->type != DG_ECHO_RESPONSE) return;
+
+	if (memcmp(dg->payload, expected, dg->length) != 0) mismatches++;
+	responses++;
+}
+
+static void bob_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_ECHO_REQUEST) {
+		sbmp_ep_send_response(bob, DG_ECHO_RESPONSE, dg->payload, dg->length, dg->session, NULL);
+	}
+}
+
+/**
+ * Wait for data and pass it to the endpoints
+ * @return false on an error or a timeout
+ */
+static bool pump(SBMP_Transport *a, SBMP_Transport *b)
+{
+	struct pollfd pfd[2] = {
+		{.fd = sbmp_tp_fd(a), .events = POLLIN},
+		{.fd = sbmp_tp_fd(b), .events = POLLIN},
+	};
+
+	if (poll(pfd, 2, 1000) <= 0) {
+		fprintf(stderr, "Timeout\n");
+		return false;
+	}
+
+	if ((pfd[0].revents & POLLIN) && sbmp_tp_receive(a) < 0) return false;
+	if ((pfd[1].revents & POLLIN) && sbmp_tp_receive(b) < 0) return false;
+
+	return true;
+}
+
+/** Handshake and a series of messages */
+static bool run(const char *name, SBMP_Transport *a, SBMP_Transport *b, uint32_t count)
+{
+	alice = sbmp_ep_init(alice, alice_buf, BUF_LEN, alice_rx, NULL);
+	bob = sbmp_ep_init(bob, bob_buf, BUF_LEN, bob_rx, NULL);
+	sbmp_tp_attach(a, &alice->frm);
+	sbmp_tp_attach(b, &bob->frm);
+	sbmp_ep_enable(alice, true);
+	sbmp_ep_enable(bob, true);
+
+	sbmp_ep_start_handshake(alice);
+	while (sbmp_ep_handshake_status(alice) != SBMP_HSK_SUCCESS) {
+		if (!pump(a, b)) return false;
+	}
+
+	responses = 0;
+	mismatches = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint16_t len = (uint16_t)(1 + (i * 37) % 500);
+		for (uint16_t j = 0; j < len; j++) expected[j] = (uint8_t)(i + j);
+
+		if (!sbmp_ep_send_message(alice, DG_ECHO_REQUEST, expected, len, NULL, NULL)) return false;
+
+		while (responses <= i) {
+			if (!pump(a, b)) return false;
+		}
+	}
+
+	const SBMP_TransportStats *st = sbmp_tp_stats(a);
+	printf("%s: %u messages, %u bad, %llu bytes in %u writes, %llu bytes in %u reads\n",
+		   name, responses, mismatches,
+		   (unsigned long long) st->tx_bytes, st->writes,
+		   (unsigned long long) st->rx_bytes, st->reads);
+
+	return mismatches == 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t count = (argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : 1000);
+
+	SBMP_Transport *a, *b;
+	bool ok = true;
+
+	if (!sbmp_tp_socketpair(&a, &b, 0)) return 1;
+	ok &= run("socketpair", a, b, count);
+	sbmp_tp_close(a);
+	sbmp_tp_close(b);
+
+	if (!sbmp_tp_pty_pair(&a, &b, 0)) return 1;
+	ok &= run("pty", a, b, count);
+	sbmp_tp_close(a);
+	sbmp_tp_close(b);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+/**
+ * Many threads sending on one endpoint (see sbmp_txq.h).
+ *
+ * The host endpoint is on one end of a socketpair, the "device" on the other,
+ * in its own thread. Several threads send messages on the host endpoint at
+ * once, while the main thread receives the device's answers on the same
+ * endpoint. The device checks that the messages of each thread arrive
+ * complete and in order.
+ *
+ * Compared are:
+ *
+ *   mutex  : the plain endpoint, sbmp_ep_send_message() under a mutex
+ *   flag   : transmit queue, the sender that finds nobody writing writes
+ *   writer : transmit queue with a writer thread
+ *
+ * Usage: txq_bench [-t threads] [-n count] [-s payload] [-m mode]
+ *
+ *   -t : sending threads (default 4)
+ *   -n : messages per thread (default 100000)
+ *   -s : payload size (default 32, min. 6)
+ *   -m : mutex, flag, writer or all (default all)
+ *
+ * Build with "make txq_bench".
+ *
+ * This example is in the public domain.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sbmp/sbmp.h"
+#include "sbmp/sbmp_transport_posix.h"
+#include "sbmp/sbmp_txq.h"
+
+#define BUF_LEN 1024
+#define MAX_THREADS 64
+
+#define DG_BENCH_MESSAGE 100
+#define DG_BENCH_ANSWER 101
+
+/** Message header: thread index (2 B) + sequence number (4 B) */
+#define HEADER_LEN 6
+
+typedef enum {
+	MODE_MUTEX,
+	MODE_FLAG,
+	MODE_WRITER,
+} Mode;
+
+static const char *mode_names[] = {"mutex", "flag", "writer"};
+
+// options
+static int thread_count = 4;
+static uint32_t count = 100000;
+static uint16_t payload = 32;
+static const char *mode_name = "all";
+
+/** One end of the link */
+typedef struct {
+	SBMP_Endpoint ep;
+	uint8_t rx_buf[BUF_LEN];
+	SBMP_Transport *tp;
+} Side;
+
+static Side host;
+static Side device;
+
+static Mode mode;
+static SBMP_TxQueue *txq;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// host state (main thread)
+static uint64_t answers;
+
+// device state (device thread)
+static uint32_t next_seq[MAX_THREADS];
+static uint64_t received;
+static uint64_t order_errors;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void device_rx(SBMP_Datagram *dg)
+{
+	if (dg->type != DG_BENCH_MESSAGE || dg->length != payload) return;
+
+	uint16_t index;
+	uint32_t seq;
+	memcpy(&index, dg->payload, 2);
+	memcpy(&seq, dg->payload + 2, 4);
+
+	if (index >= thread_count || seq != next_seq[index]) {
+		order_errors++;
+	} else {
+		next_seq[index]++;
+	}
+	received++;
+
+	// a short answer, so the host receives while it sends
+	sbmp_ep_send_response(&device.ep, DG_BENCH_ANSWER, dg->payload, HEADER_LEN, dg->session, NULL);
+}
+
+static void host_rx(SBMP_Datagram *dg)
+{
+	if (dg->type == DG_BENCH_ANSWER) answers++;
+}
+
+static void *device_thread(void *arg)
+{
+	(void)arg;
+	while (sbmp_tp_receive(device.tp) >= 0) {}
+	return NULL;
+}
+
+static void *sender_thread(void *arg)
+{
+	uint16_t index = (uint16_t)(intptr_t) arg;
+	uint8_t buf[BUF_LEN];
+
+	memset(buf, 0xA5, payload);
+	memcpy(buf, &index, 2);
+
+	for (uint32_t seq = 0; seq < count; seq++) {
+		memcpy(buf + 2, &seq, 4);
+
+		bool ok;
+		if (mode == MODE_MUTEX) {
+			pthread_mutex_lock(&send_lock);
+			ok = sbmp_ep_send_message(&host.ep, DG_BENCH_MESSAGE, buf, payload, NULL, NULL);
+			pthread_mutex_unlock(&send_lock);
+		} else {
+			ok = sbmp_txq_send_message(txq, DG_BENCH_MESSAGE, buf, payload, NULL);
+		}
+
+		if (!ok) {
+			fprintf(stderr, "Send failed\n");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/** Receive on the host endpoint, wait at most timeout_ms for data */
+static bool host_receive(int timeout_ms)
+{
+	if (sbmp_tp_rx_pending(host.tp) == 0) {
+		struct pollfd pfd = {.fd = sbmp_tp_fd(host.tp), .events = POLLIN};
+		if (poll(&pfd, 1, timeout_ms) <= 0) return true;
+	}
+
+	return sbmp_tp_receive(host.tp) >= 0;
+}
+
+/** One measurement, prints a CSV line */
+static bool run(Mode m)
+{
+	mode = m;
+	answers = 0;
+	received = 0;
+	order_errors = 0;
+	memset(next_seq, 0, sizeof(next_seq));
+
+	if (!sbmp_tp_socketpair(&host.tp, &device.tp, 0)) return false;
+	sbmp_tp_set_buffers(host.tp, 65536, 65536);
+	sbmp_tp_set_buffers(device.tp, 65536, 65536);
+
+	sbmp_ep_init(&host.ep, host.rx_buf, BUF_LEN, host_rx, NULL);
+	sbmp_ep_init(&device.ep, device.rx_buf, BUF_LEN, device_rx, NULL);
+	sbmp_tp_attach(host.tp, &host.ep.frm);
+	sbmp_tp_attach(device.tp, &device.ep.frm);
+	sbmp_ep_enable(&host.ep, true);
+	sbmp_ep_enable(&device.ep, true);
+
+	txq = NULL;
+	if (m != MODE_MUTEX) {
+		txq = sbmp_txq_create(&host.ep);
+		if (txq == NULL) return false;
+		if (m == MODE_WRITER && !sbmp_txq_start_writer(txq)) return false;
+	}
+
+	pthread_t dev_thread;
+	pthread_create(&dev_thread, NULL, device_thread, NULL);
+
+	sbmp_ep_start_handshake(&host.ep);
+	while (sbmp_ep_handshake_status(&host.ep) == SBMP_HSK_AWAIT_REPLY) {
+		if (!host_receive(100)) break;
+	}
+
+	if (sbmp_ep_handshake_status(&host.ep) != SBMP_HSK_SUCCESS) {
+		fprintf(stderr, "Handshake failed\n");
+		return false;
+	}
+
+	pthread_t senders[MAX_THREADS];
+	uint64_t start = now_ns();
+
+	for (int i = 0; i < thread_count; i++) {
+		pthread_create(&senders[i], NULL, sender_thread, (void *)(intptr_t) i);
+	}
+
+	// receive the answers meanwhile
+	uint64_t total = (uint64_t) thread_count * count;
+	uint64_t deadline = start + 60000000000ULL;
+
+	while (answers < total && now_ns() < deadline) {
+		if (!host_receive(100)) break;
+	}
+
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	for (int i = 0; i < thread_count; i++) {
+		pthread_join(senders[i], NULL);
+	}
+
+	SBMP_TxQueueStats stats = {0};
+	if (txq != NULL) {
+		const SBMP_TxQueueStats *s = sbmp_txq_stats(txq);
+		stats.drains = __atomic_load_n(&s->drains, __ATOMIC_RELAXED);
+		stats.handoffs = __atomic_load_n(&s->handoffs, __ATOMIC_RELAXED);
+		sbmp_txq_close(txq);
+	}
+
+	sbmp_tp_close(host.tp); // the device sees EOF
+	pthread_join(dev_thread, NULL);
+	sbmp_tp_close(device.tp);
+
+	printf("%s,%d,%u,%u,%.2f,%llu,%llu,%llu,%.0f,%llu,%llu\n",
+		   mode_names[m], thread_count, count, payload, elapsed,
+		   (unsigned long long) received, (unsigned long long) answers,
+		   (unsigned long long) order_errors, (double) received / elapsed,
+		   (unsigned long long) stats.drains, (unsigned long long) stats.handoffs);
+
+	return received == total && answers == total && order_errors == 0;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-n count] [-s payload] [-m mutex|flag|writer|all]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "t:n:s:m:")) != -1) {
+		switch (opt) {
+			case 't': thread_count = atoi(optarg); break;
+			case 'n': count = (uint32_t) atol(optarg); break;
+			case 's': payload = (uint16_t) atoi(optarg); break;
+			case 'm': mode_name = optarg; break;
+			default: usage(argv);
+		}
+	}
+
+	if (thread_count < 1 || thread_count > MAX_THREADS || count < 1
+		|| payload < HEADER_LEN || payload > BUF_LEN - 16) {
+		usage(argv);
+	}
+
+	bool all = !strcmp(mode_name, "all");
+	bool any = false;
+	bool ok = true;
+
+	printf("mode,threads,count,payload,seconds,received,answers,order_errors,msgs_per_s,drains,handoffs\n");
+
+	for (int m = MODE_MUTEX; m <= MODE_WRITER; m++) {
+		if (!all && strcmp(mode_name, mode_names[m])) continue;
+		any = true;
+
+		if (!run((Mode) m)) {
+			fprintf(stderr, "%s: FAILED\n", mode_names[m]);
+			ok = false;
+		}
+	}
+
+	if (!any) usage(argv);
+
+	return ok ? 0 : 1;
+}
@@ -12,23 +12,49 @@ SOURCES += \
     sbmp/crc32.c \
     sbmp/sbmp_frame.c \
     sbmp/sbmp_datagram.c \
+    sbmp/sbmp_reliable.c \
+    sbmp/sbmp_credit.c \
+    sbmp/sbmp_caps.c \
+    sbmp/sbmp_keepalive.c \
+    sbmp/sbmp_stats.c \
+    sbmp/sbmp_fec.c \
+    sbmp/sbmp_dgqueue.c \
     sbmp/sbmp_session.c \
     main_frm_dg.c \
     sbmp/sbmp_checksum.c \
     sbmp/sbmp_bulk.c \
-    sbmp/payload_parser.c
+    sbmp/sbmp_bulk_state.c \
+    sbmp/sbmp_bulk_rx.c \
+    sbmp/sbmp_bulk_tx.c \
+    sbmp/sbmp_bulk_delta.c \
+    sbmp/sbmp_bulk_adapt.c \
+    sbmp/payload_parser.c \
+    sbmp/payload_builder.c
 
 HEADERS += \
     crc32.h \
     sbmp/sbmp.h \
     sbmp/sbmp_frame.h \
     sbmp/sbmp_datagram.h \
+    sbmp/sbmp_reliable.h \
+    sbmp/sbmp_credit.h \
+    sbmp/sbmp_caps.h \
+    sbmp/sbmp_keepalive.h \
+    sbmp/sbmp_stats.h \
+    sbmp/sbmp_fec.h \
+    sbmp/sbmp_dgqueue.h \
     sbmp/sbmp_session.h \
     sbmp/crc32.h \
     sbmp/sbmp_checksum.h \
     sbmp/sbmp_config.h \
     sbmp/sbmp_bulk.h \
+    sbmp/sbmp_bulk_state.h \
+    sbmp/sbmp_bulk_rx.h \
+    sbmp/sbmp_bulk_tx.h \
+    sbmp/sbmp_bulk_delta.h \
+    sbmp/sbmp_bulk_adapt.h \
     sbmp/payload_parser.h \
+    sbmp/payload_builder.h \
     sbmp_config.h \
     sbmp/sbmp_config.example.h
 
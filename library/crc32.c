@@ -129,7 +129,7 @@ uint32_t crc32_end(uint32_t crc_scratch)
 	return ~crc_scratch;
 }
 
-uint32_t crc32buf(uint8_t *buf, size_t len)
+uint32_t crc32buf(const uint8_t *buf, size_t len)
 {
 	uint32_t scratch = crc32_begin();
 
@@ -140,4 +140,64 @@ uint32_t crc32buf(uint8_t *buf, size_t len)
 	return crc32_end(scratch);
 }
 
+
+/* CRC combination, based on the method used in zlib.                  */
+/* CRC is linear, so the checksum of a block followed by N bytes is    */
+/* the block's checksum multiplied by x^(8N) modulo the polynomial.    */
+
+/* x^(2^n) modulo the CRC polynomial, for n = 0..31 */
+static const uint32_t x2n_tab[32] = {
+	0x40000000, 0x20000000, 0x08000000, 0x00800000, 0x00008000, 0xedb88320,
+	0xb1e6b092, 0xa06a2517, 0xed627dae, 0x88d14467, 0xd7bbfe6a, 0xec447f11,
+	0x8e7ea170, 0x6427800e, 0x4d47bae0, 0x09fe548f, 0x83852d0f, 0x30362f1a,
+	0x7b5a9cc3, 0x31fec169, 0x9fec022a, 0x6c8dedc4, 0x15d6874d, 0x5fde7a4e,
+	0xbad90e37, 0x2e4e5eef, 0x4eaba214, 0xa8a472c0, 0x429a969e, 0x148d302a,
+	0xc40ba6d0, 0xc4e22c3c
+};
+
+/** Multiply a and b modulo the CRC polynomial (reflected bit order) */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+
+	return p;
+}
+
+/** Get x^(8 * len) modulo the CRC polynomial */
+static uint32_t x8nmodp(size_t len)
+{
+	uint32_t p = (uint32_t)1 << 31; // x^0 == 1
+	unsigned int k = 3; // 8 bits per byte
+
+	while (len) {
+		if (len & 1) {
+			p = multmodp(x2n_tab[k & 31], p);
+		}
+		len >>= 1;
+		k++;
+	}
+
+	return p;
+}
+
+uint32_t crc32_shift(uint32_t crc, size_t len)
+{
+	return multmodp(x8nmodp(len), crc);
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	return crc32_shift(crc1, len2) ^ crc2;
+}
+
 #endif /* SBMP_HAS_CRC32 */
@@ -22,7 +22,7 @@
  * @param len : buffer size
  * @return the CRC32 checksum
  */
-uint32_t crc32buf(uint8_t *buf, size_t len);
+uint32_t crc32buf(const uint8_t *buf, size_t len);
 
 /**
  * @brief Start calculating a checksum of a block of data.
@@ -45,6 +45,34 @@ uint32_t crc32_update(uint32_t crc_scratch, uint8_t b);
  */
 uint32_t crc32_end(uint32_t crc_scratch);
 
+/**
+ * @brief Combine CRC32 of two consecutive blocks of data.
+ *
+ * Calculates CRC32 of A|B, given CRC32 of A, CRC32 of B and length of B.
+ * This can be used to get a checksum of a large object from checksums of its
+ * chunks, calculated in parallel or in any order.
+ *
+ * @param crc1 : CRC32 of the first block
+ * @param crc2 : CRC32 of the second block
+ * @param len2 : length of the second block
+ * @return CRC32 of the two blocks joined
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/**
+ * @brief Shift a CRC32 value over a block of zero length data.
+ *
+ * crc32_combine(crc1, crc2, len2) == crc32_shift(crc1, len2) ^ crc2
+ *
+ * This lets you accumulate a checksum of chunks arriving out of order:
+ * XOR together crc32_shift(chunk_crc, bytes_after_the_chunk) of all chunks.
+ *
+ * @param crc : CRC32 value
+ * @param len : number of bytes to shift by
+ * @return the shifted value
+ */
+uint32_t crc32_shift(uint32_t crc, size_t len);
+
 
 #endif /* SBMP_HAS_CRC32 */
 
@@ -15,12 +15,24 @@
 // Common utils & the frame parser
 #include "sbmp_checksum.h"
 
+#include "sbmp_fec.h"
 #include "sbmp_frame.h"
 
 // Datagram & session layer
 #include "sbmp_datagram.h"
+#include "sbmp_reliable.h"
+#include "sbmp_credit.h"
+#include "sbmp_caps.h"
+#include "sbmp_keepalive.h"
+#include "sbmp_stats.h"
+#include "sbmp_dgqueue.h"
 #include "sbmp_session.h"
 #include "sbmp_bulk.h"
+#include "sbmp_bulk_state.h"
+#include "sbmp_bulk_adapt.h"
+#include "sbmp_bulk_rx.h"
+#include "sbmp_bulk_delta.h"
+#include "sbmp_bulk_tx.h"
 
 #include "payload_parser.h"
 #include "payload_builder.h"
@@ -6,6 +6,11 @@
 #include "sbmp_datagram.h"
 #include "sbmp_session.h"
 #include "sbmp_bulk.h"
+#include "payload_builder.h"
+#include "payload_parser.h"
+
+// max length of the offer extension block (incl. the magic and length byte)
+#define BULK_EXT_MAX_LEN 32
 
 
 /** Offer a bulk data transfer. */
@@ -19,6 +24,120 @@ bool sbmp_bulk_offer(SBMP_Endpoint *ep, uint32_t bulk_len_bytes, const uint8_t *
 	return suc;
 }
 
+/** Build the offer extension block. Returns its length (0 if not needed) */
+static uint16_t build_offer_ext(const SBMP_BulkOffer *offer, uint8_t *buf)
+{
+	PayloadBuilder pb = pb_start(buf, BULK_EXT_MAX_LEN);
+
+	pb_u8(&pb, BULK_EXT_MAGIC);
+	pb_u8(&pb, 0); // length, filled later
+
+	if (offer->offer_id != 0) {
+		pb_u8(&pb, BULK_TAG_OFFER_ID);
+		pb_u8(&pb, 4);
+		pb_u32(&pb, offer->offer_id);
+	}
+
+	if (offer->digest_type != SBMP_BULK_DIGEST_NONE) {
+		pb_u8(&pb, BULK_TAG_DIGEST);
+		pb_u8(&pb, 5);
+		pb_u8(&pb, offer->digest_type);
+		pb_u32(&pb, offer->digest);
+	}
+
+	if (offer->flags != 0) {
+		pb_u8(&pb, BULK_TAG_FLAGS);
+		pb_u8(&pb, 1);
+		pb_u8(&pb, offer->flags);
+	}
+
+	if (pb_length(&pb) == 2) return 0; // no fields
+
+	buf[1] = (uint8_t)(pb_length(&pb) - 2);
+	return (uint16_t)pb_length(&pb);
+}
+
+/** Offer a bulk data transfer, with the extension block. */
+bool sbmp_bulk_offer_ex(SBMP_Endpoint *ep, const SBMP_BulkOffer *offer, uint16_t sesn)
+{
+	uint8_t ext[BULK_EXT_MAX_LEN];
+	uint16_t ext_len = build_offer_ext(offer, ext);
+
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_OFFER, sizeof(uint32_t) + ext_len + offer->xtra_len, sesn)
+			   && sbmp_ep_send_u32(ep, offer->length)
+			   && sbmp_ep_send_buffer(ep, ext, ext_len, NULL)
+			   && sbmp_ep_send_buffer(ep, offer->xtra, offer->xtra_len, NULL);
+
+	if (suc) sbmp_dbg("Bulk OFFER sent, len %"PRIu32", id %"PRIu32"; sesn %"PRIu16, offer->length, offer->offer_id, sesn);
+	return suc;
+}
+
+/** Parse a received offer datagram */
+bool sbmp_bulk_parse_offer(SBMP_Datagram *dg, SBMP_BulkOffer *offer)
+{
+	if (dg->type != DG_BULK_OFFER || dg->length < sizeof(uint32_t)) {
+		sbmp_error("Not a valid bulk offer.");
+		return false;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+
+	offer->length = pp_u32(&pp);
+	offer->offer_id = 0;
+	offer->digest_type = SBMP_BULK_DIGEST_NONE;
+	offer->digest = 0;
+	offer->flags = 0;
+
+	size_t rest_len;
+	const uint8_t *rest = pp_rest(&pp, &rest_len);
+
+	if (rest_len >= 2 && rest[0] == BULK_EXT_MAGIC && (size_t)rest[1] + 2 <= rest_len) {
+		uint8_t ext_len = rest[1];
+		PayloadParser ext = pp_start(rest + 2, ext_len);
+
+		while (ext.ptr + 2 <= ext.len) {
+			uint8_t tag = pp_u8(&ext);
+			uint8_t len = pp_u8(&ext);
+
+			if (ext.ptr + len > ext.len) {
+				sbmp_warn("Bulk offer extension truncated.");
+				break;
+			}
+
+			PayloadParser val = pp_start(ext.buf + ext.ptr, len);
+			ext.ptr += len;
+
+			switch (tag) {
+				case BULK_TAG_OFFER_ID:
+					if (len >= 4) offer->offer_id = pp_u32(&val);
+					break;
+
+				case BULK_TAG_DIGEST:
+					if (len >= 5) {
+						offer->digest_type = pp_u8(&val);
+						offer->digest = pp_u32(&val);
+					}
+					break;
+
+				case BULK_TAG_FLAGS:
+					if (len >= 1) offer->flags = pp_u8(&val);
+					break;
+
+				default:
+					sbmp_dbg("Unknown bulk offer tag %"PRIu8, tag);
+			}
+		}
+
+		rest += ext_len + 2;
+		rest_len -= ext_len + 2;
+	}
+
+	offer->xtra = (rest_len > 0 ? rest : NULL);
+	offer->xtra_len = (uint16_t)rest_len;
+
+	return true;
+}
+
 /** Request a chunk of the bulk data. */
 bool sbmp_bulk_request(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size, uint16_t sesn)
 {
@@ -30,6 +149,18 @@ bool sbmp_bulk_request(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size,
 	return suc;
 }
 
+/** Request a chunk of the bulk data, with request flags. */
+bool sbmp_bulk_request_ex(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size, uint8_t flags, uint16_t sesn)
+{
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_REQUEST, sizeof(uint32_t) + sizeof(uint16_t) + 1, sesn)
+			   && sbmp_ep_send_u32(ep, offset)
+			   && sbmp_ep_send_u16(ep, chunk_size)
+			   && sbmp_ep_send_u8(ep, flags);
+
+	if (suc) sbmp_dbg("Bulk REQUEST sent, offs %"PRIu32", chunk %"PRIu16", flags %"PRIu8"; sesn %"PRIu16, offset, chunk_size, flags, sesn);
+	return suc;
+}
+
 /** Send a chunk of data as requested. */
 bool sbmp_bulk_send_data(SBMP_Endpoint *ep, const uint8_t *chunk, uint16_t chunk_len, uint16_t sesn)
 {
@@ -40,6 +171,53 @@ bool sbmp_bulk_send_data(SBMP_Endpoint *ep, const uint8_t *chunk, uint16_t chunk
 	return suc;
 }
 
+/** Send a chunk of data in the push mode. */
+bool sbmp_bulk_push_data(SBMP_Endpoint *ep, uint32_t offset, const uint8_t *chunk, uint16_t chunk_len, uint16_t sesn)
+{
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_DATA, sizeof(uint32_t) + chunk_len, sesn)
+			   && sbmp_ep_send_u32(ep, offset)
+			   && sbmp_ep_send_buffer(ep, chunk, chunk_len, NULL);
+
+	if (suc) sbmp_dbg("Bulk DATA pushed, offs %"PRIu32", len %"PRIu16"; sesn %"PRIu16, offset, chunk_len, sesn);
+	return suc;
+}
+
+/** Acknowledge pushed data, grant more credit. */
+bool sbmp_bulk_ack(SBMP_Endpoint *ep, uint32_t offset, uint32_t window, uint16_t chunk_size, uint8_t flags, uint16_t sesn)
+{
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_ACK, 2 * sizeof(uint32_t) + sizeof(uint16_t) + 1, sesn)
+			   && sbmp_ep_send_u32(ep, offset)
+			   && sbmp_ep_send_u32(ep, window)
+			   && sbmp_ep_send_u16(ep, chunk_size)
+			   && sbmp_ep_send_u8(ep, flags);
+
+	if (suc) sbmp_dbg("Bulk ACK sent, offs %"PRIu32", window %"PRIu32"; sesn %"PRIu16, offset, window, sesn);
+	return suc;
+}
+
+/** Tell the receiver to copy data from its old version (delta mode). */
+bool sbmp_bulk_copy(SBMP_Endpoint *ep, uint32_t offset, uint32_t src_offset, uint32_t len, uint16_t sesn)
+{
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_COPY, 3 * sizeof(uint32_t), sesn)
+			   && sbmp_ep_send_u32(ep, offset)
+			   && sbmp_ep_send_u32(ep, src_offset)
+			   && sbmp_ep_send_u32(ep, len);
+
+	if (suc) sbmp_dbg("Bulk COPY sent, offs %"PRIu32", src %"PRIu32", len %"PRIu32"; sesn %"PRIu16, offset, src_offset, len, sesn);
+	return suc;
+}
+
+/** Send a run of the same byte, in place of the data. */
+bool sbmp_bulk_fill(SBMP_Endpoint *ep, uint32_t offset, uint32_t len, uint8_t fill, uint16_t sesn)
+{
+	bool suc = sbmp_ep_start_response(ep, DG_BULK_FILL, 2 * sizeof(uint32_t) + 1, sesn)
+			   && sbmp_ep_send_u32(ep, offset)
+			   && sbmp_ep_send_u32(ep, len)
+			   && sbmp_ep_send_u8(ep, fill);
+
+	if (suc) sbmp_dbg("Bulk FILL sent, offs %"PRIu32", len %"PRIu32", fill 0x%02"PRIx8"; sesn %"PRIu16, offset, len, fill, sesn);
+	return suc;
+}
 
 /** Abort the bulk transfer. */
 bool sbmp_bulk_abort(SBMP_Endpoint *ep, uint16_t sesn)
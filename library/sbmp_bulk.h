@@ -10,6 +10,64 @@
 #include "sbmp_datagram.h"
 #include "sbmp_session.h"
 
+/**
+ * Bulk offer extension block.
+ *
+ * The user data area of DG_BULK_OFFER can start with an extension block,
+ * which is understood by the bulk transfer helpers (sbmp_bulk_rx, sbmp_bulk_tx).
+ *
+ * [ 0xB5 | ext len 1B | TLV fields... ] [ user data ]
+ *
+ * Each TLV field is [ tag 1B | len 1B | value ]. Unknown tags are skipped.
+ */
+#define BULK_EXT_MAGIC 0xB5
+
+/** Offer identity (uint32_t), used to resume an interrupted transfer */
+#define BULK_TAG_OFFER_ID 0x01
+/** Object digest (type 1B, value uint32_t) */
+#define BULK_TAG_DIGEST   0x02
+/** Capability flags (1B) */
+#define BULK_TAG_FLAGS    0x03
+
+/** Offer flag: the sender supports the push mode (streaming under a credit window) */
+#define BULK_FLAG_PUSH 0x01
+
+/** Offer flag: the sender supports the delta mode (block signatures + copy from the receiver's old data) */
+#define BULK_FLAG_DELTA 0x02
+
+/** Offer flag: the sender can send runs of the same byte as DG_BULK_FILL */
+#define BULK_FLAG_FILL  0x04
+
+/** Ack flag: the sender should continue from the ack offset (gap, or already received data) */
+#define BULK_ACK_SEEK 0x01
+/** Ack flag: the receiver accepts DG_BULK_FILL */
+#define BULK_ACK_FILL 0x02
+
+/** Request flag: the receiver accepts DG_BULK_FILL */
+#define BULK_REQ_FILL 0x01
+
+/** Bulk object digest types */
+typedef enum {
+	SBMP_BULK_DIGEST_NONE = 0,    /*!< No digest */
+	SBMP_BULK_DIGEST_OPAQUE = 1,  /*!< Opaque value (eg. image version), used only to detect a changed object */
+	SBMP_BULK_DIGEST_CRC32 = 32,  /*!< CRC32 of the whole object, verified by the receiver */
+} SBMP_BulkDigestType;
+
+/**
+ * Bulk offer parameters.
+ *
+ * Filled by sbmp_bulk_parse_offer(), or by the user before calling sbmp_bulk_offer_ex().
+ */
+typedef struct {
+	uint32_t length;                 /*!< Total bulk data length */
+	uint32_t offer_id;               /*!< Offer identity, 0 = none */
+	SBMP_BulkDigestType digest_type; /*!< Type of the object digest */
+	uint32_t digest;                 /*!< Object digest value */
+	uint8_t flags;                   /*!< Capability flags (BULK_FLAG_*) */
+	const uint8_t *xtra;             /*!< User data following the extension block */
+	uint16_t xtra_len;               /*!< User data length */
+} SBMP_BulkOffer;
+
 /**
  * @brief Offer a bulk data transfer.
  * @param ep
@@ -21,6 +79,30 @@
  */
 bool sbmp_bulk_offer(SBMP_Endpoint *ep, uint32_t bulk_len_bytes, const uint8_t *xtra, uint16_t xtra_len, uint16_t sesn);
 
+/**
+ * @brief Offer a bulk data transfer, with the extension block.
+ *
+ * The extension block is omitted if no extension fields are set.
+ *
+ * @param ep
+ * @param offer : offer parameters
+ * @param sesn  : session number to use
+ * @return send success
+ */
+bool sbmp_bulk_offer_ex(SBMP_Endpoint *ep, const SBMP_BulkOffer *offer, uint16_t sesn);
+
+/**
+ * @brief Parse a received DG_BULK_OFFER datagram.
+ *
+ * If the user data does not start with the extension block,
+ * all of it is returned as offer->xtra.
+ *
+ * @param dg    : the offer datagram
+ * @param offer : struct to populate
+ * @return success (false if the datagram is not a valid offer)
+ */
+bool sbmp_bulk_parse_offer(SBMP_Datagram *dg, SBMP_BulkOffer *offer);
+
 /**
  * @brief Request a chunk of the bulk data.
  * @param ep
@@ -31,6 +113,17 @@ bool sbmp_bulk_offer(SBMP_Endpoint *ep, uint32_t bulk_len_bytes, const uint8_t *
  */
 bool sbmp_bulk_request(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size, uint16_t sesn);
 
+/**
+ * @brief Request a chunk of the bulk data, with request flags.
+ * @param ep
+ * @param offset     : offset of the chunk
+ * @param chunk_size : length of the chunk in bytes
+ * @param flags      : request flags (BULK_REQ_*)
+ * @param sesn       : session nr to use
+ * @return send success
+ */
+bool sbmp_bulk_request_ex(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size, uint8_t flags, uint16_t sesn);
+
 /**
  * @brief Send a chunk of data as requested.
  *
@@ -48,6 +141,65 @@ bool sbmp_bulk_request(SBMP_Endpoint *ep, uint32_t offset, uint16_t chunk_size,
  */
 bool sbmp_bulk_send_data(SBMP_Endpoint *ep, const uint8_t *chunk, uint16_t chunk_len, uint16_t sesn);
 
+/**
+ * @brief Send a chunk of data in the push mode.
+ *
+ * In push mode, the chunk is prefixed by its offset, so the receiver
+ * can detect lost chunks.
+ *
+ * @param ep
+ * @param offset    : offset of the chunk
+ * @param chunk     : buffer containing a chunk of the data
+ * @param chunk_len : length of the chunk in bytes
+ * @param sesn      : session nr to use
+ * @return send success
+ */
+bool sbmp_bulk_push_data(SBMP_Endpoint *ep, uint32_t offset, const uint8_t *chunk, uint16_t chunk_len, uint16_t sesn);
+
+/**
+ * @brief Acknowledge pushed data, grant more credit.
+ *
+ * The first ack sent in response to an offer starts the push mode.
+ *
+ * @param ep
+ * @param offset     : all data up to this offset was received
+ * @param window     : the sender may send this many bytes past the offset
+ * @param chunk_size : max chunk size
+ * @param flags      : ack flags (BULK_ACK_*)
+ * @param sesn       : session nr to use
+ * @return send success
+ */
+bool sbmp_bulk_ack(SBMP_Endpoint *ep, uint32_t offset, uint32_t window, uint16_t chunk_size, uint8_t flags, uint16_t sesn);
+
+/**
+ * @brief Tell the receiver to copy data from its old version of the object (delta mode).
+ *
+ * This replaces DG_BULK_DATA for a part of the object the receiver already has.
+ *
+ * @param ep
+ * @param offset     : target offset (same as the offset of pushed data)
+ * @param src_offset : offset in the receiver's old data
+ * @param len        : length of the copied data
+ * @param sesn       : session nr to use
+ * @return send success
+ */
+bool sbmp_bulk_copy(SBMP_Endpoint *ep, uint32_t offset, uint32_t src_offset, uint32_t len, uint16_t sesn);
+
+/**
+ * @brief Send a run of the same byte, in place of the data.
+ *
+ * Can be used if the receiver set the BULK_REQ_FILL or BULK_ACK_FILL flag.
+ * The run can be longer than the requested chunk.
+ *
+ * @param ep
+ * @param offset : offset of the run (the requested / pushed offset)
+ * @param len    : run length
+ * @param fill   : the byte value
+ * @param sesn   : session nr to use
+ * @return send success
+ */
+bool sbmp_bulk_fill(SBMP_Endpoint *ep, uint32_t offset, uint32_t len, uint8_t fill, uint16_t sesn);
+
 /**
  * @brief Abort the bulk transfer
  *
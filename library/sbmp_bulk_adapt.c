@@ -0,0 +1,129 @@
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_bulk_adapt.h"
+
+// timeout before the first RTT sample (ms)
+#define RTO_INITIAL 1000
+#define RTO_MIN 10
+#define RTO_MAX 10000
+
+
+void sbmp_bulk_adapt_init(SBMP_BulkAdapt *adapt, uint16_t step, uint16_t chunk_max, uint32_t window_max)
+{
+	if (step == 0) step = 1;
+	if (chunk_max < step) chunk_max = step;
+
+	adapt->step = step;
+	adapt->chunk_min = step;
+	adapt->chunk_max = chunk_max;
+	adapt->chunk = chunk_max;
+
+	adapt->window_max = window_max;
+	adapt->window = window_max;
+	adapt->chunk_bytes = 0;
+	adapt->round_bytes = 0;
+	adapt->hold = 0;
+
+	adapt->srtt = 0;
+	adapt->rttvar = 0;
+	adapt->rto = RTO_INITIAL;
+
+	adapt->losses = 0;
+	adapt->timeouts = 0;
+}
+
+void sbmp_bulk_adapt_rtt(SBMP_BulkAdapt *adapt, uint32_t rtt)
+{
+	// Jacobson / Karels, as in TCP (RFC 6298)
+	if (adapt->srtt == 0) {
+		adapt->srtt = rtt << 3;
+		adapt->rttvar = rtt << 1;
+	} else {
+		int32_t err = (int32_t)rtt - (int32_t)(adapt->srtt >> 3);
+		adapt->srtt += err;
+		if (adapt->srtt == 0) adapt->srtt = 1;
+
+		if (err < 0) err = -err;
+		adapt->rttvar += err - (adapt->rttvar >> 2);
+	}
+
+	uint32_t rto = (adapt->srtt >> 3) + adapt->rttvar;
+	if (rto < RTO_MIN) rto = RTO_MIN;
+	if (rto > RTO_MAX) rto = RTO_MAX;
+	adapt->rto = rto;
+}
+
+/** Length of a round - a window, or a chunk in the pull mode */
+static uint32_t round_len(SBMP_BulkAdapt *adapt)
+{
+	return (adapt->window > 0 ? adapt->window : adapt->chunk);
+}
+
+void sbmp_bulk_adapt_data(SBMP_BulkAdapt *adapt, uint32_t len)
+{
+	adapt->hold = (adapt->hold > len ? adapt->hold - len : 0);
+	adapt->chunk_bytes += len;
+	adapt->round_bytes += len;
+
+	// additive increase - the chunk after each chunk, like in the pull mode
+	// (after a window, it would keep shrinking on a noisy link)
+	if (adapt->chunk_bytes >= adapt->chunk) {
+		adapt->chunk_bytes = 0;
+
+		if (adapt->chunk + adapt->step <= adapt->chunk_max) {
+			adapt->chunk += adapt->step;
+		} else {
+			adapt->chunk = adapt->chunk_max;
+		}
+	}
+
+	if (adapt->window > 0 && adapt->round_bytes >= adapt->window) {
+		adapt->round_bytes = 0;
+
+		adapt->window += adapt->chunk;
+		if (adapt->window > adapt->window_max) adapt->window = adapt->window_max;
+	}
+}
+
+void sbmp_bulk_adapt_loss(SBMP_BulkAdapt *adapt)
+{
+	adapt->losses++;
+	adapt->chunk_bytes = 0;
+	adapt->round_bytes = 0;
+
+	// already reduced in this round
+	if (adapt->hold > 0) return;
+
+	// multiplicative decrease, in whole steps
+	uint16_t chunk = adapt->chunk / 2;
+	chunk -= chunk % adapt->step;
+	adapt->chunk = (chunk < adapt->chunk_min ? adapt->chunk_min : chunk);
+
+	// keep at least two chunks in flight
+	if (adapt->window > 0 && adapt->window < 2u * adapt->chunk) {
+		adapt->window = 2u * adapt->chunk;
+	}
+
+	adapt->hold = round_len(adapt);
+
+	sbmp_dbg("Bulk loss, chunk %"PRIu16", window %"PRIu32, adapt->chunk, adapt->window);
+}
+
+void sbmp_bulk_adapt_timeout(SBMP_BulkAdapt *adapt)
+{
+	adapt->timeouts++;
+
+	// a damaged frame only costs the chunk; a timeout may mean the window is too large
+	if (adapt->window > 0) {
+		uint32_t window = adapt->window / 2;
+		if (window < 2u * adapt->chunk_min) window = 2u * adapt->chunk_min;
+		adapt->window = window;
+	}
+
+	adapt->hold = 0;
+	sbmp_bulk_adapt_loss(adapt);
+
+	adapt->rto *= 2;
+	if (adapt->rto > RTO_MAX) adapt->rto = RTO_MAX;
+}
@@ -0,0 +1,100 @@
+#ifndef SBMP_BULK_ADAPT_H
+#define SBMP_BULK_ADAPT_H
+
+/**
+ * Adaptive chunk size and window for bulk transfers.
+ *
+ * The controller tracks the round-trip time and losses (checksum failures,
+ * gaps, timeouts), and adjusts the chunk size and the push window AIMD-style:
+ * the chunk size grows by a step after each loss-free chunk, the window
+ * after each loss-free window. The chunk size is halved
+ * on a loss, the window only on a timeout - a damaged frame doesn't mean
+ * the window is too large, and shrinking it below the bandwidth-delay
+ * product would just slow the transfer down. Losses within a round after
+ * a decrease are counted, but don't shrink the chunk again - they are
+ * usually the same event (eg. a damaged frame followed by a gap).
+ *
+ * On a clean link, the chunks stay large and the overhead low; on a noisy
+ * link, they get smaller, so a damaged frame loses less data.
+ *
+ * This module only contains the logic (no I/O), it's used by sbmp_bulk_rx.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_config.h"
+
+/**
+ * Clock function for timing the transfer.
+ * @return current time in milliseconds (can wrap around)
+ */
+typedef uint32_t (*SBMP_BulkClockFunc)(void);
+
+/** Adaptive controller state */
+typedef struct {
+	uint16_t chunk;       /*!< Current chunk size */
+	uint16_t chunk_min;   /*!< Min chunk size */
+	uint16_t chunk_max;   /*!< Max chunk size */
+	uint16_t step;        /*!< Chunk size step (block size) */
+
+	uint32_t window;      /*!< Current window (push mode), 0 = not used */
+	uint32_t window_max;  /*!< Max window */
+	uint32_t chunk_bytes; /*!< Bytes received since the last chunk size increase */
+	uint32_t round_bytes; /*!< Bytes received since the last window increase */
+	uint32_t hold;        /*!< Bytes to receive before the next decrease (one per round) */
+
+	uint32_t srtt;        /*!< Smoothed RTT (ms, scaled by 8), 0 = no sample yet */
+	uint32_t rttvar;      /*!< RTT variation (ms, scaled by 4) */
+	uint32_t rto;         /*!< Retransmission timeout (ms) */
+
+	uint32_t losses;      /*!< Number of loss events (stats) */
+	uint32_t timeouts;    /*!< Number of timeouts (stats) */
+} SBMP_BulkAdapt;
+
+
+/**
+ * @brief Initialize the controller.
+ *
+ * The chunk size and the window start at the maximum.
+ *
+ * @param adapt      : controller
+ * @param step       : chunk size step and minimum (the block size)
+ * @param chunk_max  : max chunk size
+ * @param window_max : max push window, 0 if the push mode is not used
+ */
+void sbmp_bulk_adapt_init(SBMP_BulkAdapt *adapt, uint16_t step, uint16_t chunk_max, uint32_t window_max);
+
+/**
+ * @brief Add a round-trip time sample.
+ *
+ * Don't sample replies to retried requests (Karn's rule).
+ *
+ * @param adapt : controller
+ * @param rtt   : measured RTT in ms
+ */
+void sbmp_bulk_adapt_rtt(SBMP_BulkAdapt *adapt, uint32_t rtt);
+
+/**
+ * @brief Report received data (no loss).
+ *
+ * The chunk size is increased after a chunk, the window after a window.
+ *
+ * @param adapt : controller
+ * @param len   : received bytes
+ */
+void sbmp_bulk_adapt_data(SBMP_BulkAdapt *adapt, uint32_t len);
+
+/**
+ * @brief Report a loss (damaged frame, gap in the data).
+ * @param adapt : controller
+ */
+void sbmp_bulk_adapt_loss(SBMP_BulkAdapt *adapt);
+
+/**
+ * @brief Report a timeout. Counts as a loss, also halves the window and backs off the timeout.
+ * @param adapt : controller
+ */
+void sbmp_bulk_adapt_timeout(SBMP_BulkAdapt *adapt);
+
+#endif // SBMP_BULK_ADAPT_H
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_bulk_delta.h"
+
+#if SBMP_HAS_CRC32
+
+#include "crc32.h"
+#include "payload_parser.h"
+
+// block size + first index
+#define SIG_HEADER_LEN 6
+// weak + strong
+#define SIG_ENTRY_LEN 8
+
+
+uint32_t sbmp_bulk_delta_weak(const uint8_t *buf, uint16_t len)
+{
+	uint32_t a = 0, b = 0;
+
+	for (uint16_t i = 0; i < len; i++) {
+		a += buf[i];
+		b += (uint32_t)(len - i) * buf[i];
+	}
+
+	return (a & 0xFFFF) | (b << 16);
+}
+
+uint32_t sbmp_bulk_delta_roll(uint32_t weak, uint8_t out, uint8_t in, uint16_t len)
+{
+	uint32_t a = weak & 0xFFFF;
+	uint32_t b = weak >> 16;
+
+	a = (a - out + in) & 0xFFFF;
+	b = (b - (uint32_t)len * out + a) & 0xFFFF;
+
+	return a | (b << 16);
+}
+
+bool sbmp_bulk_delta_parse_sigs(SBMP_Datagram *dg, SBMP_BulkSig *sigs, uint32_t *count, uint32_t cap, uint16_t *block_size)
+{
+	if (dg->length < SIG_HEADER_LEN || (dg->length - SIG_HEADER_LEN) % SIG_ENTRY_LEN != 0) {
+		sbmp_error("Malformed bulk signature datagram.");
+		return false;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	*block_size = pp_u16(&pp);
+	uint32_t index = pp_u32(&pp);
+
+	uint16_t n = (dg->length - SIG_HEADER_LEN) / SIG_ENTRY_LEN;
+
+	for (uint16_t i = 0; i < n; i++, index++) {
+		if (*count >= cap) {
+			sbmp_warn("Bulk signature table full, dropping %"PRIu16" sigs.", n - i);
+			break;
+		}
+
+		SBMP_BulkSig *sig = &sigs[(*count)++];
+		sig->weak = pp_u32(&pp);
+		sig->strong = pp_u32(&pp);
+		sig->index = index;
+	}
+
+	return true;
+}
+
+/** qsort comparator - by weak checksum, then by index */
+static int sig_compare(const void *a, const void *b)
+{
+	const SBMP_BulkSig *sa = a;
+	const SBMP_BulkSig *sb = b;
+
+	if (sa->weak != sb->weak) return (sa->weak < sb->weak ? -1 : 1);
+	if (sa->index != sb->index) return (sa->index < sb->index ? -1 : 1);
+	return 0;
+}
+
+void sbmp_bulk_delta_sort(SBMP_BulkSig *sigs, uint32_t count)
+{
+	qsort(sigs, count, sizeof(SBMP_BulkSig), sig_compare);
+}
+
+const SBMP_BulkSig *sbmp_bulk_delta_find(const SBMP_BulkSig *sigs, uint32_t count,
+										 uint32_t weak, const uint8_t *block, uint16_t len,
+										 uint32_t prefer)
+{
+	// find the first entry with this weak checksum
+	uint32_t lo = 0, hi = count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (sigs[mid].weak < weak) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == count || sigs[lo].weak != weak) return NULL;
+
+	uint32_t strong = crc32buf(block, len);
+	const SBMP_BulkSig *found = NULL;
+
+	for (; lo < count && sigs[lo].weak == weak; lo++) {
+		if (sigs[lo].strong != strong) continue;
+
+		if (sigs[lo].index == prefer) return &sigs[lo];
+		if (found == NULL) found = &sigs[lo];
+	}
+
+	return found;
+}
+
+#endif /* SBMP_HAS_CRC32 */
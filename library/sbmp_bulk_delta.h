@@ -0,0 +1,93 @@
+#ifndef SBMP_BULK_DELTA_H
+#define SBMP_BULK_DELTA_H
+
+/**
+ * Delta (rsync-style) bulk transfer utilities.
+ *
+ * The receiver sends signatures of the blocks of its old version of the
+ * object (eg. the current firmware image) in DG_BULK_SIGNATURE datagrams.
+ * The sender scans the new version with a rolling checksum, and only sends
+ * the parts that changed; the rest is replaced by DG_BULK_COPY references
+ * to the receiver's old data.
+ *
+ * Each signature consists of a weak rolling checksum (rsync's "checksum1"),
+ * and a strong checksum (CRC32) to confirm a match.
+ *
+ * The protocol is driven by sbmp_bulk_tx and sbmp_bulk_rx; this module
+ * contains the checksum and lookup functions.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_config.h"
+#if SBMP_HAS_CRC32
+
+#include "sbmp_datagram.h"
+
+/** Block signature */
+typedef struct {
+	uint32_t weak;   /*!< Rolling checksum */
+	uint32_t strong; /*!< CRC32 of the block */
+	uint32_t index;  /*!< Block index in the receiver's data */
+} SBMP_BulkSig;
+
+/**
+ * @brief Calculate the weak (rolling) checksum of a block.
+ * @param buf : block data
+ * @param len : block length
+ * @return the checksum
+ */
+uint32_t sbmp_bulk_delta_weak(const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Roll the weak checksum by one byte.
+ * @param weak : checksum of the block starting at the "out" byte
+ * @param out  : byte leaving the block
+ * @param in   : byte entering the block
+ * @param len  : block length
+ * @return checksum of the block shifted by one byte
+ */
+uint32_t sbmp_bulk_delta_roll(uint32_t weak, uint8_t out, uint8_t in, uint16_t len);
+
+/**
+ * @brief Parse a DG_BULK_SIGNATURE datagram, append the signatures to a table.
+ *
+ * Signatures that don't fit are dropped (the blocks are then sent as literal data).
+ *
+ * @param dg         : the datagram
+ * @param sigs       : signature table
+ * @param count      : number of signatures in the table, updated
+ * @param cap        : table capacity
+ * @param block_size : the block size, set from the datagram
+ * @return success (false if the datagram is malformed)
+ */
+bool sbmp_bulk_delta_parse_sigs(SBMP_Datagram *dg, SBMP_BulkSig *sigs, uint32_t *count, uint32_t cap, uint16_t *block_size);
+
+/**
+ * @brief Sort the signature table for lookup.
+ * @param sigs  : signature table
+ * @param count : number of signatures
+ */
+void sbmp_bulk_delta_sort(SBMP_BulkSig *sigs, uint32_t count);
+
+/**
+ * @brief Find a block in the (sorted) signature table.
+ *
+ * The strong checksum is only calculated if the weak one matches.
+ *
+ * @param sigs   : signature table
+ * @param count  : number of signatures
+ * @param weak   : weak checksum of the block
+ * @param block  : block data
+ * @param len    : block length
+ * @param prefer : index to return if more blocks match (eg. the one following the last match)
+ * @return the matching signature, or NULL
+ */
+const SBMP_BulkSig *sbmp_bulk_delta_find(const SBMP_BulkSig *sigs, uint32_t count,
+										 uint32_t weak, const uint8_t *block, uint16_t len,
+										 uint32_t prefer);
+
+#endif /* SBMP_HAS_CRC32 */
+
+#endif // SBMP_BULK_DELTA_H
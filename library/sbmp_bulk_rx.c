@@ -0,0 +1,794 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_bulk_rx.h"
+#include "payload_parser.h"
+
+#if SBMP_HAS_CRC32
+#include "crc32.h"
+#include "sbmp_bulk_delta.h"
+#endif
+
+// Datagram header length - 2 B sesn, 1 B type
+#define DATAGRAM_HEADER_LEN 3
+// Offset prepended to pushed data
+#define PUSH_HEADER_LEN 4
+// Signature datagram - block size + first index, then weak + strong per block
+#define SIG_HEADER_LEN 6
+#define SIG_ENTRY_LEN 8
+// Buffer for expanding fill runs for the data handler
+#define FILL_EXPAND_LEN 32
+
+// protos
+static void bulk_rx_listener(SBMP_Endpoint *ep, SBMP_Datagram *dg, void **obj);
+static bool check_complete(SBMP_BulkRx *rx);
+
+
+SBMP_BulkRx *sbmp_bulk_rx_init(SBMP_BulkRx *rx,
+							   SBMP_Endpoint *ep,
+							   SBMP_BulkState *state,
+							   uint16_t chunk_size,
+							   SBMP_BulkRxDataHandler data_handler,
+							   SBMP_BulkRxDoneHandler done_handler)
+{
+	if (rx == NULL) {
+		// request to allocate it
+#if SBMP_USE_MALLOC
+		rx = sbmp_malloc(sizeof(SBMP_BulkRx));
+		if (!rx) return NULL; // malloc failed
+#else
+		return NULL; // fail
+#endif
+	}
+
+	rx->ep = ep;
+	rx->state = state;
+	rx->session = 0;
+	rx->status = SBMP_BULK_RX_IDLE;
+	rx->chunk_size = chunk_size;
+	rx->req_offset = 0;
+	rx->req_len = 0;
+	rx->push_window = 0;
+	rx->push = false;
+	rx->push_acked = 0;
+	rx->push_seek_sent = false;
+	rx->push_reseek_sent = false;
+	rx->fill = false;
+	rx->clock = NULL;
+#if SBMP_HAS_CRC32
+	rx->basis_read = NULL;
+	rx->basis_len = 0;
+	rx->delta = false;
+#endif
+	rx->data_handler = data_handler;
+	rx->fill_handler = NULL;
+	rx->done_handler = done_handler;
+	rx->user = NULL;
+
+	return rx;
+}
+
+/** Get the max chunk size usable for requests */
+static uint16_t max_chunk_size(SBMP_BulkRx *rx)
+{
+	uint16_t block = rx->state->block_size;
+	uint16_t chunk = rx->chunk_size;
+
+	// the data must fit in our rx buffer
+	uint16_t buf_max = rx->ep->buffer_size - DATAGRAM_HEADER_LEN;
+	if (rx->push) buf_max -= PUSH_HEADER_LEN;
+	if (chunk > buf_max) chunk = buf_max;
+
+	// align to whole blocks
+	chunk -= chunk % block;
+	if (chunk == 0) chunk = block;
+
+	return chunk;
+}
+
+/** Get the chunk size to use now */
+static uint16_t effective_chunk_size(SBMP_BulkRx *rx)
+{
+	uint16_t chunk = max_chunk_size(rx);
+
+	if (rx->clock != NULL && rx->adapt.chunk < chunk) {
+		chunk = rx->adapt.chunk;
+	}
+
+	return chunk;
+}
+
+/** Get the push window to grant now, in whole blocks */
+static uint32_t effective_window(SBMP_BulkRx *rx)
+{
+	uint32_t window = rx->push_window;
+
+	if (rx->clock != NULL && rx->adapt.window < window) {
+		window = rx->adapt.window;
+	}
+
+	// whole blocks only, so the chunk at the credit limit isn't split in the middle of a block
+	window -= window % rx->state->block_size;
+	if (window == 0) window = rx->state->block_size;
+
+	return window;
+}
+
+/** Note a sent request (or seek), for the RTT measurement */
+static void note_request(SBMP_BulkRx *rx)
+{
+	if (rx->clock == NULL) return;
+
+	rx->req_time = rx->clock();
+	rx->last_activity = rx->req_time;
+	rx->rtt_pending = true;
+}
+
+/**
+ * Note received data - measure the RTT, and feed the adaptive controller.
+ * Damaged frames seen since the last call are counted as a loss.
+ */
+static void note_data(SBMP_BulkRx *rx, uint32_t len)
+{
+	if (rx->clock == NULL) return;
+
+	uint32_t now = rx->clock();
+	rx->last_activity = now;
+
+	if (rx->rtt_pending) {
+		if (!rx->req_retry) {
+			sbmp_bulk_adapt_rtt(&rx->adapt, now - rx->req_time);
+		}
+		rx->rtt_pending = false;
+		rx->req_retry = false;
+	}
+
+	if (rx->ep->frm.rx_errors != rx->frm_errors) {
+		rx->frm_errors = rx->ep->frm.rx_errors;
+		sbmp_bulk_adapt_loss(&rx->adapt);
+	} else {
+		sbmp_bulk_adapt_data(&rx->adapt, len);
+	}
+}
+
+void sbmp_bulk_rx_set_adaptive(SBMP_BulkRx *rx, SBMP_BulkClockFunc clock)
+{
+	rx->clock = clock;
+}
+
+bool sbmp_bulk_rx_poll(SBMP_BulkRx *rx)
+{
+	if (rx->status != SBMP_BULK_RX_BUSY || rx->clock == NULL) {
+		return false;
+	}
+
+	if (rx->clock() - rx->last_activity < rx->adapt.rto) {
+		return false;
+	}
+
+	sbmp_dbg("Bulk rx timeout (%"PRIu32" ms), sesn %"PRIu16, rx->adapt.rto, rx->session);
+
+	// damaged frames are the likely cause, don't count them again
+	rx->frm_errors = rx->ep->frm.rx_errors;
+	sbmp_bulk_adapt_timeout(&rx->adapt);
+
+	rx->req_retry = true;
+	rx->push_seek_sent = false;
+	rx->push_reseek_sent = false;
+
+	return sbmp_bulk_rx_request_next(rx);
+}
+
+/** End the transfer, notify the user */
+static void finish(SBMP_BulkRx *rx, SBMP_BulkRxStatus status)
+{
+	sbmp_ep_remove_listener(rx->ep, rx->session);
+
+	rx->status = status;
+	rx->req_len = 0;
+
+	if (rx->done_handler != NULL) {
+		rx->done_handler(rx);
+	}
+}
+
+void sbmp_bulk_rx_set_push_window(SBMP_BulkRx *rx, uint32_t window)
+{
+	rx->push_window = window;
+}
+
+#if SBMP_HAS_CRC32
+void sbmp_bulk_rx_set_delta(SBMP_BulkRx *rx, uint32_t basis_len, uint16_t block_size, uint8_t *buffer, SBMP_BulkRxBasisFunc basis_read)
+{
+	rx->basis_len = basis_len;
+	rx->delta_block = block_size;
+	rx->delta_buf = buffer;
+	rx->basis_read = basis_read;
+}
+
+/** Send signatures of the old data blocks (delta mode) */
+static bool send_signatures(SBMP_BulkRx *rx)
+{
+	uint16_t bs = rx->delta_block;
+	uint32_t blocks = rx->basis_len / bs; // the last partial block is not used
+
+	if (rx->ep->peer_buffer_size < DATAGRAM_HEADER_LEN + SIG_HEADER_LEN + SIG_ENTRY_LEN) {
+		return false; // peer's buffer is too small
+	}
+
+	uint16_t per_dg = (rx->ep->peer_buffer_size - DATAGRAM_HEADER_LEN - SIG_HEADER_LEN) / SIG_ENTRY_LEN;
+	if (per_dg > 64) per_dg = 64;
+
+	for (uint32_t first = 0; first < blocks; first += per_dg) {
+		uint16_t n = per_dg;
+		if (n > blocks - first) n = (uint16_t)(blocks - first);
+
+		bool suc = sbmp_ep_start_response(rx->ep, DG_BULK_SIGNATURE, SIG_HEADER_LEN + n * SIG_ENTRY_LEN, rx->session)
+				   && sbmp_ep_send_u16(rx->ep, bs)
+				   && sbmp_ep_send_u32(rx->ep, first);
+
+		if (!suc) return false;
+
+		for (uint32_t i = first; i < first + n; i++) {
+			uint32_t weak = 0, strong = 0;
+
+			// unreadable block gets a zero signature, it's unlikely to match anything
+			if (rx->basis_read(rx, i * bs, rx->delta_buf, bs)) {
+				weak = sbmp_bulk_delta_weak(rx->delta_buf, bs);
+				strong = crc32buf(rx->delta_buf, bs);
+			}
+
+			sbmp_ep_send_u32(rx->ep, weak);
+			sbmp_ep_send_u32(rx->ep, strong);
+		}
+	}
+
+	sbmp_dbg("Sent %"PRIu32" bulk signatures, block %"PRIu16, blocks, bs);
+	return true;
+}
+#endif
+
+bool sbmp_bulk_rx_start(SBMP_BulkRx *rx, SBMP_Datagram *offer_dg)
+{
+	SBMP_BulkOffer offer;
+	if (!sbmp_bulk_parse_offer(offer_dg, &offer)) {
+		return false;
+	}
+
+	bool push = (rx->push_window > 0 && (offer.flags & BULK_FLAG_PUSH));
+	uint16_t hdr_len = DATAGRAM_HEADER_LEN + (push ? PUSH_HEADER_LEN : 0);
+
+	if (rx->state->block_size > rx->ep->buffer_size - hdr_len) {
+		sbmp_error("Bulk block size %"PRIu16" doesn't fit in the rx buffer.", rx->state->block_size);
+		return false;
+	}
+
+	if (rx->status == SBMP_BULK_RX_BUSY) {
+		// drop the old session (eg. the peer re-offered after reconnecting)
+		sbmp_ep_remove_listener(rx->ep, rx->session);
+		rx->status = SBMP_BULK_RX_IDLE;
+	}
+
+	if (sbmp_bulk_state_matches(rx->state, &offer)) {
+		sbmp_dbg("Resuming bulk id %"PRIu32", %"PRIu32" of %"PRIu32" B done.",
+				 offer.offer_id, rx->state->done_bytes, offer.length);
+	} else if (!sbmp_bulk_state_reset(rx->state, &offer)) {
+		// the object doesn't fit
+		sbmp_bulk_abort(rx->ep, offer_dg->session);
+		return false;
+	}
+
+	rx->session = offer_dg->session;
+	rx->req_offset = 0;
+	rx->req_len = 0;
+	rx->push = push;
+	rx->push_acked = 0;
+	rx->push_seek_sent = false;
+	rx->push_reseek_sent = false;
+	rx->fill = (offer.flags & BULK_FLAG_FILL);
+
+	if (rx->clock != NULL) {
+		sbmp_bulk_adapt_init(&rx->adapt, rx->state->block_size, max_chunk_size(rx), push ? rx->push_window : 0);
+		rx->last_activity = rx->clock();
+		rx->rtt_pending = false;
+		rx->req_retry = false;
+		rx->frm_errors = rx->ep->frm.rx_errors;
+	}
+
+#if SBMP_HAS_CRC32
+	rx->delta = (push && (offer.flags & BULK_FLAG_DELTA)
+				 && rx->basis_read != NULL && rx->basis_len >= rx->delta_block && rx->delta_block > 0);
+	rx->delta_crc = 0;
+#endif
+
+	if (!sbmp_ep_add_listener(rx->ep, rx->session, bulk_rx_listener, rx)) {
+		return false;
+	}
+
+	rx->status = SBMP_BULK_RX_BUSY;
+
+	sbmp_dbg("Bulk rx started, sesn %"PRIu16"%s", rx->session, rx->push ? ", push mode" : "");
+
+	if (check_complete(rx)) {
+		// nothing left to read (also a 0-length object)
+		return true;
+	}
+
+#if SBMP_HAS_CRC32
+	if (rx->delta) {
+		// the sender needs all the signatures before the first ack
+		send_signatures(rx);
+	}
+#endif
+
+	return sbmp_bulk_rx_request_next(rx);
+}
+
+/** Grant credit to the sender, in push mode */
+static bool send_push_ack(SBMP_BulkRx *rx, uint8_t flags)
+{
+	rx->push_acked = rx->req_offset;
+	if (flags & BULK_ACK_SEEK) rx->push_seek_sent = true;
+	if (rx->fill) flags |= BULK_ACK_FILL;
+
+	if (flags & BULK_ACK_SEEK) note_request(rx);
+
+	return sbmp_bulk_ack(rx->ep, rx->req_offset, effective_window(rx), effective_chunk_size(rx), flags, rx->session);
+}
+
+bool sbmp_bulk_rx_request_next(SBMP_BulkRx *rx)
+{
+	if (rx->status != SBMP_BULK_RX_BUSY) {
+		return false;
+	}
+
+	uint16_t chunk = effective_chunk_size(rx);
+	uint32_t offset, len;
+
+	// continue after the last request, then wrap around to fill gaps
+	if (!sbmp_bulk_state_next_missing(rx->state, rx->req_offset, chunk, &offset, &len)
+		&& !sbmp_bulk_state_next_missing(rx->state, 0, chunk, &offset, &len)) {
+		return false; // all done
+	}
+
+	rx->req_offset = offset;
+
+	if (rx->push) {
+		// tell the sender where to continue
+		return send_push_ack(rx, BULK_ACK_SEEK);
+	}
+
+	rx->req_len = (uint16_t)len;
+	note_request(rx);
+
+	if (rx->fill) {
+		return sbmp_bulk_request_ex(rx->ep, offset, (uint16_t)len, BULK_REQ_FILL, rx->session);
+	}
+
+	return sbmp_bulk_request(rx->ep, offset, (uint16_t)len, rx->session);
+}
+
+void sbmp_bulk_rx_abort(SBMP_BulkRx *rx)
+{
+	if (rx->status != SBMP_BULK_RX_BUSY) return;
+
+	sbmp_bulk_abort(rx->ep, rx->session);
+	finish(rx, SBMP_BULK_RX_ABORTED);
+}
+
+/**
+ * Store a received chunk - add it to the state and pass it to the user.
+ *
+ * The chunk's CRC32 is derived from the frame checksum if possible,
+ * so the data doesn't have to be read again to compute the digest.
+ */
+static void store_chunk(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	const uint32_t *crc_p = NULL;
+
+#if SBMP_HAS_CRC32
+	uint32_t crc;
+	SBMP_FrmInst *frm = &rx->ep->frm;
+
+	if (rx->state->digest_type == SBMP_BULK_DIGEST_CRC32
+		&& frm->rx_status == FRM_STATE_WAIT_HANDLER
+		&& frm->rx_cksum_type == SBMP_CKSUM_CRC32
+		&& data >= frm->rx_buffer
+		&& data + len == frm->rx_buffer + frm->rx_length) {
+
+		// rx_cksum_scratch holds the CRC of the whole frame; remove the datagram header from it
+		size_t hdr_len = (size_t)(data - frm->rx_buffer);
+		crc = frm->rx_cksum_scratch ^ crc32_shift(crc32buf(frm->rx_buffer, hdr_len), len);
+		crc_p = &crc;
+	}
+#endif
+
+	if (sbmp_bulk_state_mark_data(rx->state, offset, data, len, crc_p) > 0) {
+		rx->data_handler(rx, offset, data, len);
+	}
+}
+
+/**
+ * Finish the transfer if all data was received.
+ *
+ * @return true if finished
+ */
+static bool check_complete(SBMP_BulkRx *rx)
+{
+	if (!sbmp_bulk_state_complete(rx->state)) {
+		return false;
+	}
+
+	if (!sbmp_bulk_state_verify(rx->state)) {
+		sbmp_error("Bulk digest mismatch, sesn %"PRIu16, rx->session);
+
+		// the data is useless, start over next time
+		sbmp_bulk_state_reset(rx->state, NULL);
+		sbmp_ep_send_response(rx->ep, DG_FAILURE, NULL, 0, rx->session, NULL);
+		finish(rx, SBMP_BULK_RX_BAD_DIGEST);
+		return true;
+	}
+
+	sbmp_dbg("Bulk rx complete, sesn %"PRIu16, rx->session);
+	sbmp_ep_send_response(rx->ep, DG_SUCCESS, NULL, 0, rx->session, NULL);
+	finish(rx, SBMP_BULK_RX_DONE);
+	return true;
+}
+
+/** Receive a data chunk */
+static void handle_data(SBMP_BulkRx *rx, SBMP_Datagram *dg)
+{
+	if (rx->req_len == 0) {
+		sbmp_warn("Unexpected bulk data, sesn %"PRIu16, dg->session);
+		return;
+	}
+
+	if (dg->length != rx->req_len) {
+		sbmp_error("Bulk chunk length %"PRIu16" != requested %"PRIu16, dg->length, rx->req_len);
+		sbmp_bulk_abort(rx->ep, rx->session);
+		finish(rx, SBMP_BULK_RX_ERROR);
+		return;
+	}
+
+	uint32_t offset = rx->req_offset;
+	rx->req_offset += dg->length;
+	rx->req_len = 0;
+
+	note_data(rx, dg->length);
+
+	store_chunk(rx, offset, dg->payload, dg->length);
+
+	if (check_complete(rx)) return;
+
+	sbmp_bulk_rx_request_next(rx);
+}
+
+#if SBMP_HAS_CRC32
+/**
+ * Store data received in the delta mode.
+ *
+ * The literal data and copies are not aligned to the state blocks,
+ * but they arrive in order - a block is marked as received (and added
+ * to the digest) when its last byte arrives.
+ */
+static void store_delta(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	SBMP_BulkState *state = rx->state;
+
+	rx->data_handler(rx, offset, data, len);
+
+	while (len > 0) {
+		uint32_t blk_start = offset - offset % state->block_size;
+		uint32_t blk_end = blk_start + state->block_size;
+		if (blk_end > state->length) blk_end = state->length;
+
+		uint16_t part = len;
+		if (part > blk_end - offset) part = (uint16_t)(blk_end - offset);
+
+		if (offset == blk_start) rx->delta_crc = 0;
+		rx->delta_crc = crc32_combine(rx->delta_crc, crc32buf(data, part), part);
+
+		offset += part;
+		data += part;
+		len -= part;
+
+		if (offset == blk_end) {
+			// the data was already passed to the user, only the CRC is needed here
+			sbmp_bulk_state_mark_data(state, blk_start, NULL, blk_end - blk_start, &rx->delta_crc);
+		}
+	}
+}
+#endif
+
+/** Store data received in order (at req_offset), in push or delta mode */
+static void store_in_order(SBMP_BulkRx *rx, const uint8_t *data, uint16_t len)
+{
+	uint32_t offset = rx->req_offset;
+
+	rx->push_seek_sent = false;
+	rx->push_reseek_sent = false;
+	rx->req_offset += len;
+
+	note_data(rx, len);
+
+#if SBMP_HAS_CRC32
+	if (rx->delta) {
+		store_delta(rx, offset, data, len);
+		return;
+	}
+#endif
+
+	store_chunk(rx, offset, data, len);
+}
+
+/**
+ * Check if pushed data has the expected offset.
+ * If not, ask the sender to go back (unless we already did).
+ */
+static bool check_push_offset(SBMP_BulkRx *rx, uint32_t offset)
+{
+	if (offset == rx->req_offset) return true;
+
+	// data we already have - sent before the sender got our last seek
+	// (going back would make it send the following chunks again too)
+	if (offset < rx->req_offset) return false;
+
+	// a chunk was lost, or this was sent before our last seek
+	if (!rx->push_seek_sent) {
+		sbmp_dbg("Bulk push gap at %"PRIu32", got %"PRIu32, rx->req_offset, offset);
+		if (rx->clock != NULL) {
+			rx->frm_errors = rx->ep->frm.rx_errors; // the damaged frame was likely the cause
+			sbmp_bulk_adapt_loss(&rx->adapt);
+		}
+		send_push_ack(rx, BULK_ACK_SEEK);
+	}
+
+	return false;
+}
+
+/**
+ * Keep a pushed chunk that arrived after a gap (a lost chunk), so only the gap
+ * has to be sent again - the seek skips the data received meanwhile once the gap
+ * is filled. Not in the delta mode, which needs the data in order.
+ *
+ * @return false if the chunk was received before
+ */
+static bool store_past_gap(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+#if SBMP_HAS_CRC32
+	if (rx->delta) return true;
+#endif
+	if (offset >= rx->state->length) return true;
+	if (len > rx->state->length - offset) len = (uint16_t)(rx->state->length - offset);
+
+	uint32_t before = rx->state->done_bytes;
+	store_chunk(rx, offset, data, len);
+
+	if (rx->clock != NULL && rx->state->done_bytes != before) {
+		// not an RTT sample - it was sent before our seek
+		rx->last_activity = rx->clock();
+		sbmp_bulk_adapt_data(&rx->adapt, rx->state->done_bytes - before);
+	}
+
+	return rx->state->done_bytes != before;
+}
+
+/** Continue after receiving data in push mode - finish, skip received data, or grant credit */
+static void push_continue(SBMP_BulkRx *rx)
+{
+	if (check_complete(rx)) return;
+
+	uint32_t next_off, next_len;
+	if (!sbmp_bulk_state_next_missing(rx->state, rx->req_offset, 1, &next_off, &next_len)
+		|| next_off > rx->req_offset) {
+		// the following data was received before (resumed transfer), skip it
+		sbmp_bulk_rx_request_next(rx);
+		return;
+	}
+
+	// replenish the credit when half of the window is used up
+	if (rx->req_offset - rx->push_acked >= effective_window(rx) / 2) {
+		send_push_ack(rx, 0);
+	}
+}
+
+/** Receive a pushed data chunk */
+static void handle_push_data(SBMP_BulkRx *rx, SBMP_Datagram *dg)
+{
+	if (dg->length < PUSH_HEADER_LEN) {
+		sbmp_error("Pushed bulk chunk too short.");
+		return;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	uint32_t offset = pp_u32(&pp);
+	const uint8_t *data = dg->payload + PUSH_HEADER_LEN;
+	uint16_t len = dg->length - PUSH_HEADER_LEN;
+
+	if (!check_push_offset(rx, offset)) {
+		if (offset > rx->req_offset && !store_past_gap(rx, offset, data, len) && !rx->push_reseek_sent) {
+			// the sender went back after our seek, and the chunk at the gap was lost again
+			rx->push_reseek_sent = true;
+			send_push_ack(rx, BULK_ACK_SEEK);
+		}
+		return;
+	}
+
+	store_in_order(rx, data, len);
+	push_continue(rx);
+}
+
+#if SBMP_HAS_CRC32
+/** Copy a part of the old data (delta mode) */
+static void handle_copy(SBMP_BulkRx *rx, SBMP_Datagram *dg)
+{
+	if (!rx->delta || dg->length < 3 * sizeof(uint32_t)) {
+		sbmp_warn("Unexpected bulk copy, sesn %"PRIu16, dg->session);
+		return;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	uint32_t offset = pp_u32(&pp);
+	uint32_t src = pp_u32(&pp);
+	uint32_t len = pp_u32(&pp);
+
+	if (!check_push_offset(rx, offset)) return;
+
+	if (src > rx->basis_len || len > rx->basis_len - src || len > rx->state->length - offset) {
+		sbmp_error("Bulk copy out of range (src %"PRIu32", len %"PRIu32")", src, len);
+		sbmp_bulk_abort(rx->ep, rx->session);
+		finish(rx, SBMP_BULK_RX_ERROR);
+		return;
+	}
+
+	while (len > 0) {
+		uint16_t piece = rx->delta_block;
+		if (piece > len) piece = (uint16_t)len;
+
+		if (!rx->basis_read(rx, src, rx->delta_buf, piece)) {
+			sbmp_error("Bulk old data read failed at %"PRIu32, src);
+			sbmp_bulk_abort(rx->ep, rx->session);
+			finish(rx, SBMP_BULK_RX_ERROR);
+			return;
+		}
+
+		store_in_order(rx, rx->delta_buf, piece);
+
+		src += piece;
+		len -= piece;
+	}
+
+	push_continue(rx);
+}
+#endif
+
+/**
+ * Get the usable length of a fill run - whole missing blocks only
+ * (the run doesn't have to be aligned to our blocks).
+ */
+static uint32_t fill_usable_len(SBMP_BulkRx *rx, uint32_t offset, uint32_t len)
+{
+	SBMP_BulkState *state = rx->state;
+
+	if (offset % state->block_size != 0 || offset >= state->length) return 0;
+
+	if (len >= state->length - offset) {
+		len = state->length - offset;
+	} else {
+		len -= len % state->block_size;
+	}
+
+	uint32_t miss_off, miss_len;
+	if (!sbmp_bulk_state_next_missing(state, offset, len, &miss_off, &miss_len) || miss_off != offset) {
+		return 0;
+	}
+
+	return (len < miss_len ? len : miss_len);
+}
+
+/** Receive a fill run */
+static void handle_fill(SBMP_BulkRx *rx, SBMP_Datagram *dg)
+{
+	if (!rx->fill || dg->length < 2 * sizeof(uint32_t) + 1) {
+		sbmp_warn("Unexpected bulk fill, sesn %"PRIu16, dg->session);
+		return;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	uint32_t offset = pp_u32(&pp);
+	uint32_t len = pp_u32(&pp);
+	uint8_t fill = pp_u8(&pp);
+
+	if (rx->push) {
+		if (!check_push_offset(rx, offset)) return;
+	} else if (rx->req_len == 0 || offset != rx->req_offset) {
+		sbmp_warn("Unexpected bulk fill, sesn %"PRIu16, dg->session);
+		return;
+	}
+
+	len = fill_usable_len(rx, offset, len);
+
+	const uint32_t *crc_p = NULL;
+
+#if SBMP_HAS_CRC32
+	uint32_t crc;
+	if (rx->state->digest_type == SBMP_BULK_DIGEST_CRC32) {
+		crc = crc32_begin();
+		for (uint32_t i = 0; i < len; i++) {
+			crc = crc32_update(crc, fill);
+		}
+		crc = crc32_end(crc);
+		crc_p = &crc;
+	}
+#endif
+
+	// the range is all missing blocks, so the data isn't needed
+	if (len > 0) sbmp_bulk_state_mark_data(rx->state, offset, NULL, len, crc_p);
+
+	if (rx->fill_handler != NULL) {
+		rx->fill_handler(rx, offset, len, fill);
+	} else if (len > 0) {
+		uint8_t buf[FILL_EXPAND_LEN];
+		memset(buf, fill, sizeof(buf));
+
+		for (uint32_t done = 0; done < len; done += FILL_EXPAND_LEN) {
+			uint16_t piece = FILL_EXPAND_LEN;
+			if (piece > len - done) piece = (uint16_t)(len - done);
+
+			rx->data_handler(rx, offset + done, buf, piece);
+		}
+	}
+
+	rx->req_offset = offset + len;
+	note_data(rx, len);
+
+	if (rx->push) {
+		rx->push_seek_sent = false;
+		rx->push_reseek_sent = false;
+		push_continue(rx);
+		return;
+	}
+
+	rx->req_len = 0;
+
+	if (check_complete(rx)) return;
+
+	sbmp_bulk_rx_request_next(rx);
+}
+
+/** Session listener for the bulk transfer */
+static void bulk_rx_listener(SBMP_Endpoint *ep, SBMP_Datagram *dg, void **obj)
+{
+	(void)ep;
+	SBMP_BulkRx *rx = *obj;
+
+	switch (dg->type) {
+		case DG_BULK_DATA:
+			if (rx->push) {
+				handle_push_data(rx, dg);
+			} else {
+				handle_data(rx, dg);
+			}
+			break;
+
+#if SBMP_HAS_CRC32
+		case DG_BULK_COPY:
+			handle_copy(rx, dg);
+			break;
+#endif
+
+		case DG_BULK_FILL:
+			handle_fill(rx, dg);
+			break;
+
+		case DG_BULK_ABORT:
+			sbmp_info("Bulk transfer aborted by peer, sesn %"PRIu16, dg->session);
+			finish(rx, SBMP_BULK_RX_ABORTED);
+			break;
+
+		default:
+			sbmp_warn("Unexpected dg type %"PRIu8" in bulk session %"PRIu16, dg->type, dg->session);
+	}
+}
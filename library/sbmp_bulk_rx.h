@@ -0,0 +1,239 @@
+#ifndef SBMP_BULK_RX_H
+#define SBMP_BULK_RX_H
+
+/**
+ * Bulk transfer receiver.
+ *
+ * Reads a bulk object offered by the peer, using the chunked
+ * request / data protocol. Received data is tracked in a SBMP_BulkState,
+ * so an interrupted transfer can be resumed - only the missing parts
+ * are requested when the peer re-offers the same object.
+ *
+ * If the sender supports it (BULK_FLAG_PUSH in the offer) and a push window
+ * is set, the push mode is used instead: the sender streams the data without
+ * waiting for requests, and the receiver periodically grants more credit
+ * with DG_BULK_ACK. Chunks that arrive after a lost one are kept, and only
+ * the lost one is sent again - the data handler can get them out of order.
+ *
+ * Fill runs (BULK_FLAG_FILL) are accepted if the sender offers them. They are
+ * passed to the fill handler if set, otherwise expanded and passed to the
+ * data handler.
+ *
+ * In the delta mode (enabled with sbmp_bulk_rx_set_delta(), requires the push
+ * mode), the receiver first sends signatures of its old version of the object,
+ * and the sender then only pushes the changed parts. The unchanged parts
+ * are read from the old data and passed to the data handler as if they were
+ * received.
+ *
+ * With a clock set by sbmp_bulk_rx_set_adaptive(), the chunk size and the push
+ * window adapt to the link (see sbmp_bulk_adapt.h), and sbmp_bulk_rx_poll()
+ * retries lost requests after a timeout derived from the measured RTT.
+ *
+ * If the offer has a CRC32 digest, it's verified when all data is received.
+ * The digest is computed on the fly (the chunk CRCs are combined, so the
+ * order of arrival doesn't matter). On mismatch, the progress is cleared
+ * and the transfer ends with SBMP_BULK_RX_BAD_DIGEST.
+ *
+ * The receiver uses a session listener, so the endpoint must have
+ * listener slots initialized.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_config.h"
+#include "sbmp_session.h"
+#include "sbmp_bulk.h"
+#include "sbmp_bulk_state.h"
+#include "sbmp_bulk_adapt.h"
+
+/** Bulk receiver status */
+typedef enum {
+	SBMP_BULK_RX_IDLE = 0,  /*!< No transfer started */
+	SBMP_BULK_RX_BUSY,      /*!< Transfer in progress */
+	SBMP_BULK_RX_DONE,      /*!< All data received */
+	SBMP_BULK_RX_ABORTED,   /*!< Transfer aborted by either party */
+	SBMP_BULK_RX_ERROR,     /*!< Protocol error (eg. unexpected chunk length) */
+	SBMP_BULK_RX_BAD_DIGEST, /*!< All data received, but the object digest doesn't match */
+} SBMP_BulkRxStatus;
+
+typedef struct SBMP_BulkRx_struct SBMP_BulkRx;
+
+/**
+ * Bulk data handler.
+ * Called for each received chunk, in the order of arrival.
+ */
+typedef void (*SBMP_BulkRxDataHandler)(SBMP_BulkRx *rx, uint32_t offset, const uint8_t *data, uint16_t len);
+
+/**
+ * Bulk fill run handler.
+ * Called for a run of the same byte, in place of the data handler.
+ */
+typedef void (*SBMP_BulkRxFillHandler)(SBMP_BulkRx *rx, uint32_t offset, uint32_t len, uint8_t fill);
+
+/**
+ * Old data read function (delta mode).
+ *
+ * @param rx     : the receiver
+ * @param offset : offset to read from
+ * @param buf    : buffer to fill
+ * @param len    : number of bytes to read
+ * @return true on success
+ */
+typedef bool (*SBMP_BulkRxBasisFunc)(SBMP_BulkRx *rx, uint32_t offset, uint8_t *buf, uint16_t len);
+
+/**
+ * Bulk receiver end handler.
+ * Called when the transfer ends (check rx->status)
+ */
+typedef void (*SBMP_BulkRxDoneHandler)(SBMP_BulkRx *rx);
+
+/** Bulk receiver instance */
+struct SBMP_BulkRx_struct {
+	SBMP_Endpoint *ep;           /*!< Endpoint used for the transfer */
+	SBMP_BulkState *state;       /*!< Transfer progress */
+	uint16_t session;            /*!< Session of the offer */
+	SBMP_BulkRxStatus status;    /*!< Transfer status */
+
+	uint16_t chunk_size;         /*!< Max size of a requested chunk */
+	uint32_t req_offset;         /*!< Offset of the outstanding request */
+	uint16_t req_len;            /*!< Length of the outstanding request, 0 = none */
+
+	uint32_t push_window;        /*!< Credit window for the push mode (bytes), 0 = use requests only */
+	bool push;                   /*!< Push mode is active */
+	uint32_t push_acked;         /*!< Offset confirmed by the last ack */
+	bool push_seek_sent;         /*!< Seek was sent, waiting for data at req_offset */
+	bool push_reseek_sent;       /*!< Seek was repeated after a duplicate past the gap */
+	bool fill;                   /*!< The sender can send fill runs */
+
+	SBMP_BulkClockFunc clock;    /*!< Clock for the adaptive mode, NULL = fixed chunk size and window */
+	SBMP_BulkAdapt adapt;        /*!< Adaptive chunk size and window controller */
+	uint32_t req_time;           /*!< Time of the last request (or seek) */
+	uint32_t last_activity;      /*!< Time of the last request or received data, for timeouts */
+	bool rtt_pending;            /*!< Waiting for the reply to measure the RTT */
+	bool req_retry;              /*!< The last request was a retry - its RTT is not sampled */
+	uint32_t frm_errors;         /*!< Frame error count at the last check */
+
+#if SBMP_HAS_CRC32
+	SBMP_BulkRxBasisFunc basis_read; /*!< Old data read function, NULL = delta mode disabled */
+	uint32_t basis_len;          /*!< Length of the old data */
+	uint16_t delta_block;        /*!< Signature block size */
+	uint8_t *delta_buf;          /*!< Buffer for reading the old data (delta_block long) */
+	bool delta;                  /*!< Delta mode is active */
+	uint32_t delta_crc;          /*!< CRC32 of the current state block, received so far */
+#endif
+
+	SBMP_BulkRxDataHandler data_handler; /*!< Data handler */
+	SBMP_BulkRxFillHandler fill_handler; /*!< Fill run handler, NULL = pass the data to the data handler */
+	SBMP_BulkRxDoneHandler done_handler; /*!< End handler, can be NULL */
+	void *user;                  /*!< Arbitrary pointer for the user */
+};
+
+
+/**
+ * @brief Initialize the bulk receiver.
+ *
+ * @param rx         : receiver struct, NULL to allocate
+ * @param ep         : the endpoint
+ * @param state      : state object tracking the progress
+ * @param chunk_size : max chunk size to request (rounded to the state block size)
+ * @param data_handler : handler for received data
+ * @param done_handler : handler called when the transfer ends, can be NULL
+ * @return the receiver (allocated if rx was NULL), NULL on failure
+ */
+SBMP_BulkRx *sbmp_bulk_rx_init(SBMP_BulkRx *rx,
+							   SBMP_Endpoint *ep,
+							   SBMP_BulkState *state,
+							   uint16_t chunk_size,
+							   SBMP_BulkRxDataHandler data_handler,
+							   SBMP_BulkRxDoneHandler done_handler);
+
+/**
+ * @brief Enable the push mode, if supported by the sender.
+ *
+ * The window should be several chunks long, so the sender can keep
+ * the link busy while the acks are on their way.
+ *
+ * @param rx     : receiver
+ * @param window : credit window in bytes, 0 to disable the push mode
+ */
+void sbmp_bulk_rx_set_push_window(SBMP_BulkRx *rx, uint32_t window);
+
+#if SBMP_HAS_CRC32
+/**
+ * @brief Enable the delta mode, if supported by the sender.
+ *
+ * The old data is split into blocks, and their signatures are sent to the sender.
+ * Choose the block size with regard to the expected changes - smaller blocks
+ * mean more signatures, but less data re-sent around each change.
+ *
+ * The delta mode needs the push mode (set a push window as well).
+ *
+ * @param rx         : receiver
+ * @param basis_len  : length of the old data, 0 to disable the delta mode
+ * @param block_size : signature block size
+ * @param buffer     : buffer for reading the old data, block_size long
+ * @param basis_read : old data read function
+ */
+void sbmp_bulk_rx_set_delta(SBMP_BulkRx *rx, uint32_t basis_len, uint16_t block_size, uint8_t *buffer, SBMP_BulkRxBasisFunc basis_read);
+#endif
+
+/**
+ * @brief Enable the adaptive chunk size and window.
+ *
+ * The configured chunk size and push window are used as the maximum.
+ * Call sbmp_bulk_rx_poll() periodically to handle timeouts.
+ *
+ * @param rx    : receiver
+ * @param clock : millisecond clock, NULL to disable the adaptive mode
+ */
+void sbmp_bulk_rx_set_adaptive(SBMP_BulkRx *rx, SBMP_BulkClockFunc clock);
+
+/**
+ * @brief Check for a timeout (adaptive mode).
+ *
+ * If no data arrived for the retransmission timeout, the request
+ * is retried (in push mode, a seek is sent), and the chunk size
+ * and the window are reduced.
+ *
+ * @param rx : receiver
+ * @return true if the request was retried
+ */
+bool sbmp_bulk_rx_poll(SBMP_BulkRx *rx);
+
+/**
+ * @brief Start (or resume) reading an offered bulk object.
+ *
+ * If the state belongs to the same offer (matching ID, length and digest),
+ * only the missing data is requested. Otherwise the progress is cleared.
+ *
+ * @param rx       : receiver
+ * @param offer_dg : the received DG_BULK_OFFER datagram
+ * @return success
+ */
+bool sbmp_bulk_rx_start(SBMP_BulkRx *rx, SBMP_Datagram *offer_dg);
+
+/**
+ * @brief Request the next missing chunk.
+ *
+ * This is done automatically when data is received; call this
+ * to retry a request that got lost (eg. after a timeout).
+ *
+ * In the push mode, an ack is sent, telling the sender to continue
+ * from the first missing offset.
+ *
+ * @param rx : receiver
+ * @return send success
+ */
+bool sbmp_bulk_rx_request_next(SBMP_BulkRx *rx);
+
+/**
+ * @brief Abort the transfer.
+ *
+ * The progress is kept in the state object.
+ *
+ * @param rx : receiver
+ */
+void sbmp_bulk_rx_abort(SBMP_BulkRx *rx);
+
+#endif // SBMP_BULK_RX_H
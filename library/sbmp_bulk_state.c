@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_checksum.h"
+#include "sbmp_bulk_state.h"
+#include "payload_builder.h"
+#include "payload_parser.h"
+
+#if SBMP_HAS_CRC32
+#include "crc32.h"
+#endif
+
+// Record format version
+#define STATE_RECORD_VERSION 2
+
+// magic + version + digest type + id + length + digest + digest acc + block size + done + bitmap len
+#define STATE_RECORD_HEADER_LEN (2 + 1 + 1 + 4 + 4 + 4 + 4 + 2 + 4 + 4)
+// trailing checksum
+#define STATE_RECORD_CKSUM_LEN 4
+
+// checksum used to protect the record
+#if SBMP_HAS_CRC32
+#define STATE_RECORD_CKSUM SBMP_CKSUM_CRC32
+#else
+#define STATE_RECORD_CKSUM SBMP_CKSUM_XOR
+#endif
+
+
+SBMP_BulkState *sbmp_bulk_state_init(SBMP_BulkState *state, uint8_t *bitmap, uint32_t bitmap_cap, uint16_t block_size)
+{
+	bool state_mallocd = false;
+
+	if (block_size == 0) {
+		sbmp_error("Bulk state block size can't be 0.");
+		return NULL;
+	}
+
+#if SBMP_USE_MALLOC
+	if (state == NULL) {
+		// caller wants us to allocate it
+		state = sbmp_malloc(sizeof(SBMP_BulkState));
+		if (state == NULL) return NULL; // malloc failed
+		state_mallocd = true;
+	}
+
+	if (bitmap == NULL) {
+		// caller wants us to allocate it
+		bitmap = sbmp_malloc(bitmap_cap);
+		if (bitmap == NULL) { // malloc failed
+			if (state_mallocd) sbmp_free(state);
+			return NULL;
+		}
+	}
+#else
+	(void)state_mallocd;
+
+	if (state == NULL || bitmap == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	state->bitmap = bitmap;
+	state->bitmap_cap = bitmap_cap;
+	state->block_size = block_size;
+
+	sbmp_bulk_state_reset(state, NULL);
+	state->offer_id = 0;
+	state->length = 0;
+	state->digest_type = SBMP_BULK_DIGEST_NONE;
+	state->digest = 0;
+
+	return state;
+}
+
+uint32_t sbmp_bulk_state_block_count(const SBMP_BulkState *state)
+{
+	return (state->length + state->block_size - 1) / state->block_size;
+}
+
+/** Get bitmap bytes used by the current object */
+static uint32_t bitmap_used(const SBMP_BulkState *state)
+{
+	return (sbmp_bulk_state_block_count(state) + 7) / 8;
+}
+
+bool sbmp_bulk_state_reset(SBMP_BulkState *state, const SBMP_BulkOffer *offer)
+{
+	if (offer != NULL) {
+		uint32_t blocks = (offer->length + state->block_size - 1) / state->block_size;
+		if ((blocks + 7) / 8 > state->bitmap_cap) {
+			sbmp_error("Bulk state bitmap too small for %"PRIu32" B.", offer->length);
+			return false;
+		}
+
+		state->offer_id = offer->offer_id;
+		state->length = offer->length;
+		state->digest_type = offer->digest_type;
+		state->digest = offer->digest;
+	}
+
+	memset(state->bitmap, 0, state->bitmap_cap);
+	state->done_bytes = 0;
+	state->digest_acc = 0;
+
+	return true;
+}
+
+bool sbmp_bulk_state_matches(const SBMP_BulkState *state, const SBMP_BulkOffer *offer)
+{
+	// Offers without an ID can't be resumed
+	return offer->offer_id != 0
+		   && state->offer_id == offer->offer_id
+		   && state->length == offer->length
+		   && state->digest_type == offer->digest_type
+		   && state->digest == offer->digest;
+}
+
+bool sbmp_bulk_state_has_block(const SBMP_BulkState *state, uint32_t block)
+{
+	return (state->bitmap[block >> 3] >> (block & 7)) & 1;
+}
+
+uint32_t sbmp_bulk_state_mark(SBMP_BulkState *state, uint32_t offset, uint32_t len)
+{
+	if (offset >= state->length) return 0;
+	if (len > state->length - offset) len = state->length - offset;
+
+	uint32_t added = 0;
+	uint32_t block = offset / state->block_size;
+	uint32_t end = offset + len;
+
+	// only blocks fully covered by the range are marked
+	for (uint32_t pos = block * state->block_size; pos < end; block++, pos += state->block_size) {
+		uint32_t blen = state->length - pos;
+		if (blen > state->block_size) blen = state->block_size;
+
+		if (pos < offset || pos + blen > end) continue;
+
+		if (!sbmp_bulk_state_has_block(state, block)) {
+			state->bitmap[block >> 3] |= (uint8_t)(1 << (block & 7));
+			added += blen;
+		}
+	}
+
+	state->done_bytes += added;
+	return added;
+}
+
+uint32_t sbmp_bulk_state_mark_data(SBMP_BulkState *state, uint32_t offset, const uint8_t *data, uint32_t len, const uint32_t *crc)
+{
+	if (len == 0) return 0; // nothing to add (and the last block would underflow)
+
+#if SBMP_HAS_CRC32
+	if (state->digest_type == SBMP_BULK_DIGEST_CRC32 && offset < state->length) {
+		if (len > state->length - offset) len = state->length - offset;
+
+		uint32_t bs = state->block_size;
+		uint32_t first = offset / bs;
+		uint32_t last = (offset + len - 1) / bs;
+		// the fast path needs whole blocks - a partial block isn't marked, and would be added again later
+		bool all_new = (offset % bs == 0) && ((offset + len) % bs == 0 || offset + len == state->length);
+
+		for (uint32_t b = first; all_new && b <= last; b++) {
+			if (sbmp_bulk_state_has_block(state, b)) all_new = false;
+		}
+
+		if (all_new) {
+			// Fast path - whole chunk at once (with a known CRC, this costs almost nothing)
+			uint32_t chunk_crc = (crc != NULL ? *crc : crc32buf(data, len));
+			state->digest_acc ^= crc32_shift(chunk_crc, state->length - offset - len);
+		} else {
+			// Overlaps data received before; add only the new blocks
+			for (uint32_t b = first; b <= last; b++) {
+				uint32_t pos = b * bs;
+				uint32_t blen = state->length - pos;
+				if (blen > bs) blen = bs;
+
+				if (pos < offset || pos + blen > offset + len) continue; // partial block
+				if (sbmp_bulk_state_has_block(state, b)) continue;
+
+				uint32_t block_crc = crc32buf(data + (pos - offset), blen);
+				state->digest_acc ^= crc32_shift(block_crc, state->length - pos - blen);
+			}
+		}
+	}
+#else
+	(void)data;
+	(void)crc;
+#endif
+
+	return sbmp_bulk_state_mark(state, offset, len);
+}
+
+bool sbmp_bulk_state_verify(const SBMP_BulkState *state)
+{
+	if (state->digest_type != SBMP_BULK_DIGEST_CRC32) {
+		return true; // can't verify
+	}
+
+#if SBMP_HAS_CRC32
+	return state->digest_acc == state->digest;
+#else
+	sbmp_warn("CRC32 not avail, can't verify bulk digest.");
+	return true;
+#endif
+}
+
+bool sbmp_bulk_state_complete(const SBMP_BulkState *state)
+{
+	return state->done_bytes >= state->length;
+}
+
+bool sbmp_bulk_state_next_missing(const SBMP_BulkState *state, uint32_t from, uint32_t max_len, uint32_t *off_ptr, uint32_t *len_ptr)
+{
+	uint32_t count = sbmp_bulk_state_block_count(state);
+	uint32_t block = from / state->block_size;
+
+	// find first missing block
+	while (block < count) {
+		// skip completed bytes of the bitmap quickly
+		if ((block & 7) == 0 && state->bitmap[block >> 3] == 0xFF) {
+			block += 8;
+			continue;
+		}
+
+		if (!sbmp_bulk_state_has_block(state, block)) break;
+		block++;
+	}
+
+	if (block >= count) return false;
+
+	uint32_t offset = block * state->block_size;
+	uint32_t len = 0;
+
+	// extend the range while blocks are missing
+	while (block < count && !sbmp_bulk_state_has_block(state, block)) {
+		len += state->block_size;
+		block++;
+
+		if (len >= max_len) break;
+	}
+
+	// clamp to the object end
+	if (len > state->length - offset) len = state->length - offset;
+
+	*off_ptr = offset;
+	*len_ptr = len;
+	return true;
+}
+
+// ---- Serialization -----------------------------------------------------
+
+size_t sbmp_bulk_state_record_size(const SBMP_BulkState *state)
+{
+	return STATE_RECORD_HEADER_LEN + bitmap_used(state) + STATE_RECORD_CKSUM_LEN;
+}
+
+/** Calculate checksum of the record body */
+static uint32_t record_cksum(const uint8_t *buf, size_t len)
+{
+	uint32_t scratch;
+	cksum_begin(STATE_RECORD_CKSUM, &scratch);
+	for (size_t i = 0; i < len; i++) {
+		cksum_update(STATE_RECORD_CKSUM, &scratch, buf[i]);
+	}
+	cksum_end(STATE_RECORD_CKSUM, &scratch);
+	return scratch;
+}
+
+/**
+ * Count the bytes of the blocks marked in a bitmap
+ *
+ * @return false if a block past the end of the object is marked
+ */
+static bool bitmap_done_bytes(const uint8_t *bitmap, uint32_t bm_len, uint32_t length, uint16_t block_size, uint32_t *done)
+{
+	uint32_t count = (length + block_size - 1) / block_size;
+	uint32_t sum = 0;
+
+	for (uint32_t block = 0; block < bm_len * 8; block++) {
+		if (!((bitmap[block >> 3] >> (block & 7)) & 1)) continue;
+		if (block >= count) return false;
+
+		uint32_t blen = length - block * block_size;
+		sum += (blen > block_size ? block_size : blen);
+	}
+
+	*done = sum;
+	return true;
+}
+
+size_t sbmp_bulk_state_save(const SBMP_BulkState *state, uint8_t *buf, size_t cap)
+{
+	uint32_t bm_len = bitmap_used(state);
+	size_t total = sbmp_bulk_state_record_size(state);
+
+	if (cap < total) {
+		sbmp_error("Buffer too small for bulk state record (need %"PRIu32" B).", (uint32_t)total);
+		return 0;
+	}
+
+	PayloadBuilder pb = pb_start(buf, cap);
+
+	pb_u8(&pb, 'B');
+	pb_u8(&pb, 'S');
+	pb_u8(&pb, STATE_RECORD_VERSION);
+	pb_u8(&pb, state->digest_type);
+	pb_u32(&pb, state->offer_id);
+	pb_u32(&pb, state->length);
+	pb_u32(&pb, state->digest);
+	pb_u32(&pb, state->digest_acc);
+	pb_u16(&pb, state->block_size);
+	pb_u32(&pb, state->done_bytes);
+	pb_u32(&pb, bm_len);
+
+	memcpy(buf + pb.ptr, state->bitmap, bm_len);
+	pb.ptr += bm_len;
+
+	pb_u32(&pb, record_cksum(buf, pb.ptr));
+
+	return pb_length(&pb);
+}
+
+bool sbmp_bulk_state_load(SBMP_BulkState *state, const uint8_t *buf, size_t len)
+{
+	if (len < STATE_RECORD_HEADER_LEN + STATE_RECORD_CKSUM_LEN) {
+		sbmp_error("Bulk state record too short.");
+		return false;
+	}
+
+	PayloadParser pp = pp_start(buf, len);
+
+	if (pp_u8(&pp) != 'B' || pp_u8(&pp) != 'S' || pp_u8(&pp) != STATE_RECORD_VERSION) {
+		sbmp_error("Not a bulk state record.");
+		return false;
+	}
+
+	uint8_t digest_type = pp_u8(&pp);
+	uint32_t offer_id = pp_u32(&pp);
+	uint32_t length = pp_u32(&pp);
+	uint32_t digest = pp_u32(&pp);
+	uint32_t digest_acc = pp_u32(&pp);
+	uint16_t block_size = pp_u16(&pp);
+	uint32_t done_bytes = pp_u32(&pp);
+	uint32_t bm_len = pp_u32(&pp);
+
+	if (bm_len > len - STATE_RECORD_HEADER_LEN - STATE_RECORD_CKSUM_LEN) {
+		sbmp_error("Bulk state record truncated.");
+		return false;
+	}
+
+	size_t body_len = STATE_RECORD_HEADER_LEN + bm_len;
+	PayloadParser tail = pp_start(buf + body_len, STATE_RECORD_CKSUM_LEN);
+
+	if (pp_u32(&tail) != record_cksum(buf, body_len)) {
+		sbmp_error("Bulk state record checksum mismatch.");
+		return false;
+	}
+
+	if (block_size == 0 || bm_len > state->bitmap_cap
+		|| bm_len != ((length + block_size - 1) / block_size + 7) / 8) {
+		sbmp_error("Bulk state record doesn't fit the state object.");
+		return false;
+	}
+
+	// a stale or damaged record would end the transfer too early, or never
+	uint32_t bm_done;
+	if (!bitmap_done_bytes(buf + STATE_RECORD_HEADER_LEN, bm_len, length, block_size, &bm_done)
+		|| bm_done != done_bytes) {
+		sbmp_error("Bulk state record progress doesn't match its bitmap.");
+		return false;
+	}
+
+	state->digest_type = digest_type;
+	state->offer_id = offer_id;
+	state->length = length;
+	state->digest = digest;
+	state->digest_acc = digest_acc;
+	state->block_size = block_size;
+	state->done_bytes = done_bytes;
+
+	memset(state->bitmap, 0, state->bitmap_cap);
+	memcpy(state->bitmap, buf + STATE_RECORD_HEADER_LEN, bm_len);
+
+	return true;
+}
@@ -0,0 +1,161 @@
+#ifndef SBMP_BULK_STATE_H
+#define SBMP_BULK_STATE_H
+
+/**
+ * Bulk transfer progress state.
+ *
+ * Tracks which parts of a bulk object were already received, so an interrupted
+ * transfer can be resumed after the link is re-established.
+ *
+ * The data is split into blocks of a fixed size, and a bitmap of completed
+ * blocks is kept. The state can be serialized to a byte buffer, which can be
+ * written to a file (on a PC) or to a flash record (on a MCU).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbmp_config.h"
+#include "sbmp_bulk.h"
+
+/** Bulk transfer state object */
+typedef struct {
+	uint32_t offer_id;               /*!< Identity of the offer this state belongs to */
+	uint32_t length;                 /*!< Total bulk data length */
+	SBMP_BulkDigestType digest_type; /*!< Object digest type, as announced by the sender */
+	uint32_t digest;                 /*!< Object digest, as announced by the sender */
+	uint32_t digest_acc;             /*!< Digest of the received data (CRC32 digest only) */
+
+	uint16_t block_size;             /*!< Size of one block tracked by the bitmap */
+	uint32_t done_bytes;             /*!< Number of bytes received so far */
+
+	uint8_t *bitmap;                 /*!< Bitmap of completed blocks, LSB first */
+	uint32_t bitmap_cap;             /*!< Bitmap capacity (bytes) */
+} SBMP_BulkState;
+
+
+/**
+ * @brief Initialize the state object.
+ *
+ * The bitmap needs (max_blocks + 7) / 8 bytes.
+ *
+ * @param state      : state struct, NULL to allocate
+ * @param bitmap     : bitmap buffer, NULL to allocate
+ * @param bitmap_cap : bitmap buffer size in bytes (or how many bytes to allocate)
+ * @param block_size : size of one tracked block
+ * @return the state (allocated if NULL was given), NULL on failure.
+ */
+SBMP_BulkState *sbmp_bulk_state_init(SBMP_BulkState *state, uint8_t *bitmap, uint32_t bitmap_cap, uint16_t block_size);
+
+/**
+ * @brief Check if the state belongs to an offer.
+ *
+ * If the offer identity (id, length and digest) matches the stored one,
+ * the progress can be kept and the transfer resumed.
+ *
+ * @param state : state object
+ * @param offer : received offer
+ * @return true if the offer matches (can resume)
+ */
+bool sbmp_bulk_state_matches(const SBMP_BulkState *state, const SBMP_BulkOffer *offer);
+
+/**
+ * @brief Clear the progress and set a new identity.
+ * @param state : state object
+ * @param offer : offer to bind to, NULL to only clear the bitmap.
+ * @return false if the bitmap is too small for the offered length.
+ */
+bool sbmp_bulk_state_reset(SBMP_BulkState *state, const SBMP_BulkOffer *offer);
+
+/** Get number of blocks in the bulk object */
+uint32_t sbmp_bulk_state_block_count(const SBMP_BulkState *state);
+
+/** Check if a block is completed */
+bool sbmp_bulk_state_has_block(const SBMP_BulkState *state, uint32_t block);
+
+/**
+ * @brief Mark received data as completed.
+ *
+ * Only whole blocks are marked; the range should be block-aligned.
+ * The last block of the object can be shorter.
+ *
+ * @param state  : state object
+ * @param offset : offset of the received data
+ * @param len    : data length
+ * @return number of newly completed bytes
+ */
+uint32_t sbmp_bulk_state_mark(SBMP_BulkState *state, uint32_t offset, uint32_t len);
+
+/**
+ * @brief Mark received data as completed, and add it to the digest.
+ *
+ * With a CRC32 digest, the received data is added to the digest accumulator.
+ * The chunks can arrive in any order.
+ *
+ * @param state  : state object
+ * @param offset : offset of the received data
+ * @param data   : the received data. Can be NULL if crc is given and the range was not received before.
+ * @param len    : data length
+ * @param crc    : CRC32 of the data if known (eg. from the frame checksum), NULL to calculate it.
+ * @return number of newly completed bytes
+ */
+uint32_t sbmp_bulk_state_mark_data(SBMP_BulkState *state, uint32_t offset, const uint8_t *data, uint32_t len, const uint32_t *crc);
+
+/**
+ * @brief Check the received data against the object digest.
+ *
+ * Only CRC32 digest can be verified, other types always pass.
+ *
+ * @param state : state object, should be complete
+ * @return true if the digest matches
+ */
+bool sbmp_bulk_state_verify(const SBMP_BulkState *state);
+
+/** Check if all data was received */
+bool sbmp_bulk_state_complete(const SBMP_BulkState *state);
+
+/**
+ * @brief Find the next missing range.
+ *
+ * @param state   : state object
+ * @param from    : offset to start searching at
+ * @param max_len : max length of the range to return
+ * @param len_ptr : var to store the range length
+ * @param off_ptr : var to store the range offset
+ * @return true if a missing range was found
+ */
+bool sbmp_bulk_state_next_missing(const SBMP_BulkState *state, uint32_t from, uint32_t max_len, uint32_t *off_ptr, uint32_t *len_ptr);
+
+/**
+ * @brief Get size of the serialized state record.
+ * @param state : state object
+ * @return record size in bytes
+ */
+size_t sbmp_bulk_state_record_size(const SBMP_BulkState *state);
+
+/**
+ * @brief Serialize the state to a byte buffer.
+ *
+ * The record includes a checksum, so a damaged record is detected on load.
+ *
+ * @param state : state object
+ * @param buf   : target buffer
+ * @param cap   : buffer size
+ * @return number of bytes written, 0 if the buffer is too small.
+ */
+size_t sbmp_bulk_state_save(const SBMP_BulkState *state, uint8_t *buf, size_t cap);
+
+/**
+ * @brief Load the state from a serialized record.
+ *
+ * The state must be initialized with a large enough bitmap.
+ *
+ * @param state : state object
+ * @param buf   : record buffer
+ * @param len   : record length
+ * @return success (false if the record is damaged or doesn't fit)
+ */
+bool sbmp_bulk_state_load(SBMP_BulkState *state, const uint8_t *buf, size_t len);
+
+#endif // SBMP_BULK_STATE_H
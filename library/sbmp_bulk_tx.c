@@ -0,0 +1,511 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_bulk_tx.h"
+#include "payload_parser.h"
+
+// Shortest chunk worth sending as a fill run
+#define FILL_MIN_LEN 16
+// Datagram header length - 2 B sesn, 1 B type
+#define DATAGRAM_HEADER_LEN 3
+// Offset prefixed to pushed data
+#define PUSH_HEADER_LEN 4
+// Ack payload - offset 4 B, window 4 B, chunk 2 B, flags 1 B
+#define ACK_LEN 11
+
+// protos
+static void bulk_tx_listener(SBMP_Endpoint *ep, SBMP_Datagram *dg, void **obj);
+
+
+SBMP_BulkTx *sbmp_bulk_tx_init(SBMP_BulkTx *tx,
+							   SBMP_Endpoint *ep,
+							   uint8_t *buffer,
+							   uint16_t buffer_size,
+							   SBMP_BulkTxReadFunc read_func,
+							   SBMP_BulkTxDoneHandler done_handler)
+{
+	bool tx_mallocd = false;
+
+#if SBMP_USE_MALLOC
+	if (tx == NULL) {
+		// caller wants us to allocate it
+		tx = sbmp_malloc(sizeof(SBMP_BulkTx));
+		if (tx == NULL) return NULL; // malloc failed
+		tx_mallocd = true;
+	}
+
+	if (buffer == NULL) {
+		// caller wants us to allocate it
+		buffer = sbmp_malloc(buffer_size);
+		if (buffer == NULL) { // malloc failed
+			if (tx_mallocd) sbmp_free(tx);
+			return NULL;
+		}
+	}
+#else
+	(void)tx_mallocd;
+
+	if (tx == NULL || buffer == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	tx->ep = ep;
+	tx->session = 0;
+	tx->busy = false;
+	tx->push = false;
+	tx->fill_ok = false;
+#if SBMP_HAS_CRC32
+	tx->delta_sigs = NULL;
+	tx->delta_sig_cap = 0;
+	tx->delta_sig_count = 0;
+	tx->delta_win = NULL;
+	tx->delta_win_len = 0;
+#endif
+	tx->buffer = buffer;
+	tx->buffer_size = buffer_size;
+	tx->read_func = read_func;
+	tx->done_handler = done_handler;
+	tx->user = NULL;
+
+	return tx;
+}
+
+/** End the transfer, notify the user */
+static void finish(SBMP_BulkTx *tx, bool success)
+{
+	sbmp_ep_remove_listener(tx->ep, tx->session);
+	tx->busy = false;
+
+	if (tx->done_handler != NULL) {
+		tx->done_handler(tx, success);
+	}
+}
+
+bool sbmp_bulk_tx_offer(SBMP_BulkTx *tx, const SBMP_BulkOffer *offer)
+{
+	if (tx->busy) {
+		// discard the old session
+		sbmp_ep_remove_listener(tx->ep, tx->session);
+		tx->busy = false;
+	}
+
+	tx->offer = *offer;
+	tx->session = sbmp_ep_new_session(tx->ep);
+	tx->push = false;
+	tx->fill_ok = false;
+#if SBMP_HAS_CRC32
+	tx->delta_sig_count = 0;
+	tx->delta_sorted = false;
+	tx->delta_block = 0;
+	tx->delta_next = 0;
+#endif
+
+	// register the listener first, the reply could come before the offer function returns
+	if (!sbmp_ep_add_listener(tx->ep, tx->session, bulk_tx_listener, tx)) {
+		return false;
+	}
+
+	tx->busy = true;
+
+	if (!sbmp_bulk_offer_ex(tx->ep, &tx->offer, tx->session)) {
+		sbmp_ep_remove_listener(tx->ep, tx->session);
+		tx->busy = false;
+		return false;
+	}
+
+	// the user data is only needed for the offer
+	tx->offer.xtra = NULL;
+	tx->offer.xtra_len = 0;
+
+	return true;
+}
+
+#if SBMP_HAS_CRC32
+void sbmp_bulk_tx_set_delta(SBMP_BulkTx *tx, SBMP_BulkSig *sigs, uint32_t sig_cap, uint8_t *window, uint16_t window_len)
+{
+	tx->delta_sigs = sigs;
+	tx->delta_sig_cap = sig_cap;
+	tx->delta_sig_count = 0;
+	tx->delta_win = window;
+	tx->delta_win_len = window_len;
+}
+#endif
+
+void sbmp_bulk_tx_abort(SBMP_BulkTx *tx)
+{
+	if (!tx->busy) return;
+
+	sbmp_bulk_abort(tx->ep, tx->session);
+	finish(tx, false);
+}
+
+/**
+ * Send a chunk of the data.
+ *
+ * @param tx     : sender
+ * @param offset : chunk offset
+ * @param len    : chunk length
+ * @param push   : prefix the chunk with its offset (push mode)
+ * @return success
+ */
+static bool send_chunk(SBMP_BulkTx *tx, uint32_t offset, uint16_t len, bool push)
+{
+	// read the first piece before starting the response, so we can still abort cleanly
+	uint16_t piece = (len > tx->buffer_size ? tx->buffer_size : len);
+
+	if (!tx->read_func(tx, offset, tx->buffer, piece)) {
+		sbmp_error("Bulk data read failed at %"PRIu32, offset);
+		sbmp_bulk_tx_abort(tx);
+		return false;
+	}
+
+	bool suc;
+	if (push) {
+		suc = sbmp_ep_start_response(tx->ep, DG_BULK_DATA, sizeof(uint32_t) + len, tx->session)
+			  && sbmp_ep_send_u32(tx->ep, offset);
+	} else {
+		suc = sbmp_ep_start_response(tx->ep, DG_BULK_DATA, len, tx->session);
+	}
+
+	if (!suc) {
+		sbmp_error("Failed to send bulk data, sesn %"PRIu16, tx->session);
+		return false; // the receiver will have to retry
+	}
+
+	// send in pieces that fit in the scratch buffer
+	while (true) {
+		sbmp_ep_send_buffer(tx->ep, tx->buffer, piece, NULL);
+
+		offset += piece;
+		len -= piece;
+		if (len == 0) break;
+
+		piece = (len > tx->buffer_size ? tx->buffer_size : len);
+
+		if (!tx->read_func(tx, offset, tx->buffer, piece)) {
+			sbmp_error("Bulk data read failed at %"PRIu32, offset);
+
+			// finish the frame to keep the framing in sync, then abort
+			while (len-- > 0) sbmp_ep_send_u8(tx->ep, 0);
+			sbmp_bulk_tx_abort(tx);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Count bytes equal to the fill byte, starting at offset.
+ *
+ * @return run length
+ */
+static uint32_t fill_run(SBMP_BulkTx *tx, uint32_t offset, uint32_t max_len, uint8_t fill)
+{
+	uint32_t run = 0;
+
+	while (run < max_len) {
+		uint16_t piece = tx->buffer_size;
+		if (piece > max_len - run) piece = (uint16_t)(max_len - run);
+
+		if (!tx->read_func(tx, offset + run, tx->buffer, piece)) {
+			return run; // the error is handled when sending the data
+		}
+
+		for (uint16_t i = 0; i < piece; i++, run++) {
+			if (tx->buffer[i] != fill) return run;
+		}
+	}
+
+	return run;
+}
+
+/**
+ * Send the chunk as a fill run, if it's all the same byte
+ * (and the receiver accepts it).
+ *
+ * @param tx       : sender
+ * @param offset   : chunk offset
+ * @param len      : chunk length
+ * @param sent_len : var to store the run length
+ * @return true if the fill run was sent
+ */
+static bool send_fill(SBMP_BulkTx *tx, uint32_t offset, uint32_t len, uint32_t *sent_len)
+{
+	if (!(tx->offer.flags & BULK_FLAG_FILL) || !tx->fill_ok || len < FILL_MIN_LEN) {
+		return false;
+	}
+
+	if (!tx->read_func(tx, offset, tx->buffer, 1)) return false;
+	uint8_t fill = tx->buffer[0];
+
+	if (fill_run(tx, offset, len, fill) < len) return false;
+
+	// extend the run past the chunk
+	uint32_t run = len + fill_run(tx, offset + len, tx->offer.length - offset - len, fill);
+
+	if (!sbmp_bulk_fill(tx->ep, offset, run, fill, tx->session)) {
+		return false;
+	}
+
+	*sent_len = run;
+	return true;
+}
+
+/** Serve a chunk request */
+static void handle_request(SBMP_BulkTx *tx, SBMP_Datagram *dg)
+{
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	uint32_t offset = pp_u32(&pp);
+	uint16_t len = pp_u16(&pp);
+	uint8_t flags = (pp.ptr < pp.len ? pp_u8(&pp) : 0); // flags are optional
+
+	tx->fill_ok = (flags & BULK_REQ_FILL);
+
+	if (offset >= tx->offer.length) {
+		sbmp_error("Bulk request out of range (%"PRIu32")", offset);
+		sbmp_bulk_tx_abort(tx);
+		return;
+	}
+
+	if (len > tx->offer.length - offset) {
+		len = (uint16_t)(tx->offer.length - offset);
+	}
+
+	uint32_t run;
+	if (send_fill(tx, offset, len, &run)) return;
+
+	send_chunk(tx, offset, len, false);
+}
+
+/** Handle a push mode ack (credit update) */
+static void handle_ack(SBMP_BulkTx *tx, SBMP_Datagram *dg)
+{
+	if (!(tx->offer.flags & BULK_FLAG_PUSH)) {
+		sbmp_warn("Bulk push not offered, ignoring ack.");
+		return;
+	}
+
+	if (dg->length < ACK_LEN) {
+		sbmp_warn("Bulk ack too short (%"PRIu16" B), ignoring.", dg->length);
+		return;
+	}
+
+	PayloadParser pp = pp_start(dg->payload, dg->length);
+	uint32_t offset = pp_u32(&pp);
+	uint32_t window = pp_u32(&pp);
+	uint16_t chunk = pp_u16(&pp);
+	uint8_t flags = pp_u8(&pp);
+
+	if (window == 0 || chunk == 0) {
+		sbmp_warn("Bulk ack with no window or chunk size, ignoring.");
+		return;
+	}
+
+	// the chunk must fit in the receiver's buffer
+	uint16_t chunk_max = tx->ep->peer_buffer_size - DATAGRAM_HEADER_LEN - PUSH_HEADER_LEN;
+	if (chunk > chunk_max) chunk = chunk_max;
+
+	if (!tx->push || (flags & BULK_ACK_SEEK)) {
+		tx->push_pos = offset;
+	}
+
+	tx->push = true;
+	tx->push_limit = offset + window;
+	tx->push_chunk = chunk;
+	tx->fill_ok = (flags & BULK_ACK_FILL);
+
+#if SBMP_HAS_CRC32
+	if (tx->delta_sig_count > 0 && !tx->delta_sorted) {
+		// all signatures are received before the first ack
+		sbmp_bulk_delta_sort(tx->delta_sigs, tx->delta_sig_count);
+		tx->delta_sorted = true;
+	}
+#endif
+}
+
+#if SBMP_HAS_CRC32
+/** Receive block signatures (delta mode) */
+static void handle_signature(SBMP_BulkTx *tx, SBMP_Datagram *dg)
+{
+	if (!(tx->offer.flags & BULK_FLAG_DELTA) || tx->delta_sigs == NULL) {
+		sbmp_warn("Bulk delta not offered, ignoring signatures.");
+		return;
+	}
+
+	uint16_t block_size;
+	if (!sbmp_bulk_delta_parse_sigs(dg, tx->delta_sigs, &tx->delta_sig_count, tx->delta_sig_cap, &block_size)) {
+		return;
+	}
+
+	if (block_size == 0 || block_size > tx->delta_win_len / 2) {
+		sbmp_warn("Bulk delta block size %"PRIu16" too large for the window.", block_size);
+		tx->delta_sig_count = 0;
+		return;
+	}
+
+	tx->delta_block = block_size;
+	tx->delta_sorted = false;
+}
+
+/**
+ * Read a block at the given offset and check if it's the given block of the old data.
+ *
+ * @return true if the block matches
+ */
+static bool delta_block_matches(SBMP_BulkTx *tx, uint32_t offset, uint32_t index)
+{
+	uint16_t bs = tx->delta_block;
+
+	if (!tx->read_func(tx, offset, tx->delta_win, bs)) return false;
+
+	uint32_t weak = sbmp_bulk_delta_weak(tx->delta_win, bs);
+	const SBMP_BulkSig *sig = sbmp_bulk_delta_find(tx->delta_sigs, tx->delta_sig_count, weak, tx->delta_win, bs, index);
+
+	return (sig != NULL && sig->index == index);
+}
+
+/**
+ * Push the next part of the object in the delta mode - either
+ * a copy of the receiver's block(s), or literal data up to the next match.
+ *
+ * @param tx  : sender
+ * @param end : credit limit
+ * @return true if something was sent
+ */
+static bool delta_push(SBMP_BulkTx *tx, uint32_t end)
+{
+	uint16_t bs = tx->delta_block;
+	uint8_t *win = tx->delta_win;
+	uint32_t pos = tx->push_pos;
+
+	uint32_t max_lit = tx->delta_win_len - bs;
+	if (max_lit > tx->push_chunk) max_lit = tx->push_chunk;
+	if (max_lit > end - pos) max_lit = end - pos;
+
+	uint32_t scan = max_lit + bs;
+	if (scan > tx->offer.length - pos) scan = tx->offer.length - pos;
+
+	if (!tx->read_func(tx, pos, win, (uint16_t)scan)) {
+		sbmp_error("Bulk data read failed at %"PRIu32, pos);
+		sbmp_bulk_tx_abort(tx);
+		return false;
+	}
+
+	// look for the first block of the old data in the window
+	const SBMP_BulkSig *match = NULL;
+	uint32_t weak = 0;
+	uint32_t i;
+
+	for (i = 0; i < max_lit && i + bs <= scan; i++) {
+		if (i == 0) {
+			weak = sbmp_bulk_delta_weak(win, bs);
+		} else {
+			weak = sbmp_bulk_delta_roll(weak, win[i - 1], win[i + bs - 1], bs);
+		}
+
+		match = sbmp_bulk_delta_find(tx->delta_sigs, tx->delta_sig_count, weak, win + i, bs, tx->delta_next);
+		if (match != NULL) break;
+	}
+
+	if (match == NULL || i > 0) {
+		// literal data before the match (or the whole window)
+		uint32_t len = (match != NULL ? i : max_lit);
+		if (len > scan) len = scan;
+
+		bool suc = sbmp_bulk_push_data(tx->ep, pos, win, (uint16_t)len, tx->session);
+		if (suc) tx->push_pos += len;
+		return suc;
+	}
+
+	// extend the copy over the following blocks, while they're in the same order.
+	// Copies are not limited by the credit, they don't use the receiver's buffer.
+	uint32_t len = bs;
+	uint32_t index = match->index;
+
+	while (pos + len + bs <= tx->offer.length
+		   && delta_block_matches(tx, pos + len, index + len / bs)) {
+		len += bs;
+	}
+
+	bool suc = sbmp_bulk_copy(tx->ep, pos, index * bs, len, tx->session);
+	if (suc) {
+		tx->push_pos += len;
+		tx->delta_next = index + len / bs;
+	}
+	return suc;
+}
+#endif
+
+bool sbmp_bulk_tx_poll(SBMP_BulkTx *tx)
+{
+	if (!tx->busy || !tx->push) return false;
+
+	uint32_t end = tx->offer.length;
+	if (tx->push_limit < end) end = tx->push_limit;
+
+	if (tx->push_pos >= end) return false; // no credit, or all sent
+
+	if (tx->ep->frm.tx_status != FRM_STATE_IDLE) return false; // tx busy
+
+#if SBMP_HAS_CRC32
+	if (tx->delta_sig_count > 0) {
+		return delta_push(tx, end);
+	}
+#endif
+
+	uint32_t len = end - tx->push_pos;
+	if (len > tx->push_chunk) len = tx->push_chunk;
+
+	uint32_t run;
+	if (send_fill(tx, tx->push_pos, len, &run)) {
+		tx->push_pos += run; // the run can go past the credit, the receiver doesn't buffer it
+		return true;
+	}
+
+	if (!send_chunk(tx, tx->push_pos, (uint16_t)len, true)) {
+		return false;
+	}
+
+	tx->push_pos += len;
+	return true;
+}
+
+/** Session listener for the bulk transfer */
+static void bulk_tx_listener(SBMP_Endpoint *ep, SBMP_Datagram *dg, void **obj)
+{
+	(void)ep;
+	SBMP_BulkTx *tx = *obj;
+
+	switch (dg->type) {
+		case DG_BULK_REQUEST:
+			handle_request(tx, dg);
+			break;
+
+		case DG_BULK_ACK:
+			handle_ack(tx, dg);
+			break;
+
+#if SBMP_HAS_CRC32
+		case DG_BULK_SIGNATURE:
+			handle_signature(tx, dg);
+			break;
+#endif
+
+		case DG_SUCCESS:
+			sbmp_dbg("Bulk transfer confirmed, sesn %"PRIu16, dg->session);
+			finish(tx, true);
+			break;
+
+		case DG_FAILURE:
+		case DG_BULK_ABORT:
+			sbmp_info("Bulk transfer aborted by peer, sesn %"PRIu16, dg->session);
+			finish(tx, false);
+			break;
+
+		default:
+			sbmp_warn("Unexpected dg type %"PRIu8" in bulk session %"PRIu16, dg->type, dg->session);
+	}
+}
@@ -0,0 +1,160 @@
+#ifndef SBMP_BULK_TX_H
+#define SBMP_BULK_TX_H
+
+/**
+ * Bulk transfer sender.
+ *
+ * Offers a bulk object to the peer and serves its chunk requests.
+ * The data is obtained using a read callback, so it doesn't have to be
+ * in RAM (eg. it can be read from an external flash).
+ *
+ * If the link is interrupted, call sbmp_bulk_tx_offer() again after
+ * re-connecting. The offer keeps its identity, so a receiver using
+ * sbmp_bulk_rx can resume the transfer.
+ *
+ * To allow the push mode, set BULK_FLAG_PUSH in the offer flags, and call
+ * sbmp_bulk_tx_poll() periodically (eg. in the main loop). In push mode
+ * the data is streamed as long as the receiver grants credit, and no
+ * per-chunk requests are needed.
+ *
+ * With BULK_FLAG_FILL in the offer flags, chunks consisting of a single
+ * repeated byte (eg. erased flash) are sent as a short fill run descriptor,
+ * if the receiver accepts it. The run is extended past the chunk as far as
+ * it goes.
+ *
+ * The delta mode (BULK_FLAG_DELTA, together with BULK_FLAG_PUSH) is enabled
+ * with sbmp_bulk_tx_set_delta(). If the receiver sends signatures of its old
+ * data, only the changed parts are pushed, and the rest is sent as references
+ * to the old data (see sbmp_bulk_delta.h).
+ *
+ * The sender uses a session listener, so the endpoint must have
+ * listener slots initialized.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_config.h"
+#include "sbmp_session.h"
+#include "sbmp_bulk.h"
+#include "sbmp_bulk_delta.h"
+
+typedef struct SBMP_BulkTx_struct SBMP_BulkTx;
+
+/**
+ * Bulk data read function.
+ *
+ * @param tx     : the sender
+ * @param offset : offset to read from
+ * @param buf    : buffer to fill
+ * @param len    : number of bytes to read
+ * @return true on success, false if the data is no longer available (the transfer is aborted)
+ */
+typedef bool (*SBMP_BulkTxReadFunc)(SBMP_BulkTx *tx, uint32_t offset, uint8_t *buf, uint16_t len);
+
+/**
+ * Bulk sender end handler.
+ * Called when the receiver confirms the transfer, or when it's aborted.
+ */
+typedef void (*SBMP_BulkTxDoneHandler)(SBMP_BulkTx *tx, bool success);
+
+/** Bulk sender instance */
+struct SBMP_BulkTx_struct {
+	SBMP_Endpoint *ep;          /*!< Endpoint used for the transfer */
+	SBMP_BulkOffer offer;       /*!< The offer (length, identity, user data) */
+	uint16_t session;           /*!< Session of the current offer */
+	bool busy;                  /*!< Offer is active */
+
+	bool push;                  /*!< Push mode was started by the receiver */
+	uint32_t push_pos;          /*!< Next offset to push */
+	uint32_t push_limit;        /*!< Credit limit - offset up to which we can push */
+	uint16_t push_chunk;        /*!< Chunk size requested by the receiver */
+	bool fill_ok;               /*!< The receiver accepts fill runs (BULK_FLAG_FILL) */
+
+#if SBMP_HAS_CRC32
+	SBMP_BulkSig *delta_sigs;   /*!< Signatures of the receiver's blocks (delta mode) */
+	uint32_t delta_sig_cap;     /*!< Signature table capacity */
+	uint32_t delta_sig_count;   /*!< Number of received signatures */
+	bool delta_sorted;          /*!< The signature table is sorted */
+	uint16_t delta_block;       /*!< Receiver's block size */
+	uint32_t delta_next;        /*!< Block following the last match (preferred for the next match) */
+	uint8_t *delta_win;         /*!< Buffer for the matching window */
+	uint16_t delta_win_len;     /*!< Window buffer size */
+#endif
+
+	uint8_t *buffer;            /*!< Scratch buffer for reading the data */
+	uint16_t buffer_size;       /*!< Scratch buffer size (chunks are read in pieces this long) */
+
+	SBMP_BulkTxReadFunc read_func;       /*!< Data read function */
+	SBMP_BulkTxDoneHandler done_handler; /*!< End handler, can be NULL */
+	void *user;                 /*!< Arbitrary pointer for the user */
+};
+
+
+/**
+ * @brief Initialize the bulk sender.
+ *
+ * @param tx           : sender struct, NULL to allocate
+ * @param ep           : the endpoint
+ * @param buffer       : scratch buffer, NULL to allocate
+ * @param buffer_size  : scratch buffer size
+ * @param read_func    : data read function
+ * @param done_handler : end handler, can be NULL
+ * @return the sender (allocated if tx was NULL), NULL on failure
+ */
+SBMP_BulkTx *sbmp_bulk_tx_init(SBMP_BulkTx *tx,
+							   SBMP_Endpoint *ep,
+							   uint8_t *buffer,
+							   uint16_t buffer_size,
+							   SBMP_BulkTxReadFunc read_func,
+							   SBMP_BulkTxDoneHandler done_handler);
+
+/**
+ * @brief Offer a bulk object to the peer (in a new session).
+ *
+ * Calling this again re-offers the object (eg. after a reconnect).
+ * Use the same offer ID to let the receiver resume the transfer.
+ *
+ * @param tx    : sender
+ * @param offer : the offer. Copied; the xtra data must remain valid until the offer is sent.
+ * @return send success
+ */
+bool sbmp_bulk_tx_offer(SBMP_BulkTx *tx, const SBMP_BulkOffer *offer);
+
+/**
+ * @brief Push data to the receiver, if in push mode and credit is available.
+ *
+ * Sends at most one chunk. Call this periodically, outside of the
+ * receive path (the endpoint's Rx is blocked while the chunk is being sent).
+ *
+ * @param tx : sender
+ * @return true if a chunk was sent
+ */
+bool sbmp_bulk_tx_poll(SBMP_BulkTx *tx);
+
+#if SBMP_HAS_CRC32
+/**
+ * @brief Enable the delta mode.
+ *
+ * The offer must have the BULK_FLAG_DELTA and BULK_FLAG_PUSH flags set.
+ *
+ * The window buffer holds the data being matched - a block plus the
+ * longest literal chunk. It must be at least twice the receiver's block size,
+ * otherwise the signatures are ignored.
+ *
+ * @param tx         : sender
+ * @param sigs       : table for the receiver's signatures (one per block of its old data)
+ * @param sig_cap    : signature table capacity
+ * @param window     : window buffer
+ * @param window_len : window buffer size
+ */
+void sbmp_bulk_tx_set_delta(SBMP_BulkTx *tx, SBMP_BulkSig *sigs, uint32_t sig_cap, uint8_t *window, uint16_t window_len);
+#endif
+
+/**
+ * @brief Abort the transfer
+ * @param tx : sender
+ */
+void sbmp_bulk_tx_abort(SBMP_BulkTx *tx);
+
+#endif // SBMP_BULK_TX_H
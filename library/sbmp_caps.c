@@ -0,0 +1,130 @@
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_caps.h"
+
+#if SBMP_HAS_CAPS
+
+/** Write a capability entry, return its length */
+static uint8_t put_entry(uint8_t *buf, uint8_t type, uint16_t value, uint8_t len)
+{
+	buf[0] = type;
+	buf[1] = len;
+	buf[2] = value & 0xFF;
+	if (len > 1) buf[3] = (value >> 8) & 0xFF;
+
+	return (uint8_t)(2 + len);
+}
+
+uint8_t sbmp_caps_encode(const SBMP_Caps *caps, uint8_t *buf)
+{
+	uint8_t n = 0;
+
+	n += put_entry(buf + n, SBMP_CAP_VERSION, (uint16_t)(caps->version_major | (caps->version_minor << 8)), 2);
+	n += put_entry(buf + n, SBMP_CAP_CKSUMS, caps->cksums, 1);
+	n += put_entry(buf + n, SBMP_CAP_MAX_FRAME, caps->max_frame, 2);
+	n += put_entry(buf + n, SBMP_CAP_RX_BUFFERS, caps->rx_buffers, 1);
+	n += put_entry(buf + n, SBMP_CAP_FEATURES, caps->features, 2);
+
+	if (caps->hsk_seed != 0) {
+		n += put_entry(buf + n, SBMP_CAP_HSK_SEED, caps->hsk_seed, 2);
+	}
+
+	return n;
+}
+
+bool sbmp_caps_decode(SBMP_Caps *caps, const uint8_t *buf, uint16_t len)
+{
+	uint16_t i = 0;
+
+	while (i + 2 <= len) {
+		uint8_t type = buf[i];
+		uint8_t vlen = buf[i + 1];
+		const uint8_t *v = buf + i + 2;
+
+		if (i + 2 + vlen > len) {
+			sbmp_warn("Bad capability entry, type %"PRIu8, type);
+			return false;
+		}
+
+		// shorter values than expected are ignored, longer ones may carry more info
+		switch (type) {
+			case SBMP_CAP_VERSION:
+				if (vlen >= 2) {
+					caps->version_major = v[0];
+					caps->version_minor = v[1];
+				}
+				break;
+
+			case SBMP_CAP_CKSUMS:
+				if (vlen >= 1) caps->cksums = v[0];
+				break;
+
+			case SBMP_CAP_MAX_FRAME:
+				if (vlen >= 2) caps->max_frame = (uint16_t)(v[0] | (v[1] << 8));
+				break;
+
+			case SBMP_CAP_RX_BUFFERS:
+				if (vlen >= 1) caps->rx_buffers = v[0];
+				break;
+
+			case SBMP_CAP_FEATURES:
+				if (vlen >= 2) caps->features = (uint16_t)(v[0] | (v[1] << 8));
+				break;
+
+			case SBMP_CAP_HSK_SEED:
+				if (vlen >= 2) caps->hsk_seed = (uint16_t)(v[0] | (v[1] << 8));
+				break;
+
+			default:
+				sbmp_dbg("Unknown capability %"PRIu8", skipping.", type);
+				break;
+		}
+
+		i += 2 + vlen;
+	}
+
+	return true;
+}
+
+void sbmp_caps_intersect(SBMP_Caps *out, const SBMP_Caps *ours, const SBMP_Caps *peer)
+{
+	// the lower version
+	if (ours->version_major < peer->version_major
+		|| (ours->version_major == peer->version_major && ours->version_minor < peer->version_minor)) {
+		out->version_major = ours->version_major;
+		out->version_minor = ours->version_minor;
+	} else {
+		out->version_major = peer->version_major;
+		out->version_minor = peer->version_minor;
+	}
+
+	out->cksums = ours->cksums & peer->cksums;
+	out->max_frame = (ours->max_frame < peer->max_frame) ? ours->max_frame : peer->max_frame;
+	out->rx_buffers = (ours->rx_buffers < peer->rx_buffers) ? ours->rx_buffers : peer->rx_buffers;
+	out->features = ours->features & peer->features;
+	out->hsk_seed = 0; // not a capability
+}
+
+uint8_t sbmp_caps_cksum_bit(SBMP_CksumType type)
+{
+	switch (type) {
+		case SBMP_CKSUM_NONE: return SBMP_CAP_CKSUM_NONE;
+		case SBMP_CKSUM_XOR: return SBMP_CAP_CKSUM_XOR;
+		case SBMP_CKSUM_CRC32: return SBMP_CAP_CKSUM_CRC32;
+	}
+
+	return 0;
+}
+
+SBMP_CksumType sbmp_caps_pick_cksum(uint8_t cksums, SBMP_CksumType preferred)
+{
+	if (cksums & sbmp_caps_cksum_bit(preferred)) return preferred;
+
+	if (cksums & SBMP_CAP_CKSUM_CRC32) return SBMP_CKSUM_CRC32;
+	if (cksums & SBMP_CAP_CKSUM_XOR) return SBMP_CKSUM_XOR;
+
+	return SBMP_CKSUM_NONE;
+}
+
+#endif /* SBMP_HAS_CAPS */
@@ -0,0 +1,108 @@
+#ifndef SBMP_CAPS_H
+#define SBMP_CAPS_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_CAPS
+
+/**
+ * Capability negotiation.
+ *
+ * The handshake payload is followed by a block of capability entries:
+ *
+ *   [ type 1B | length 1B | value ] [ type | length | value ] ...
+ *
+ * Older peers read only the fixed fields before it, and entries of
+ * unknown types are skipped - so new capabilities can be added freely.
+ *
+ * After the handshake, the endpoint keeps what both parties support
+ * in ep->common_caps. Multi-byte values are little-endian.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_checksum.h"
+
+/** Protocol version sent in the handshake */
+#define SBMP_PROTO_VER_MAJOR 1
+#define SBMP_PROTO_VER_MINOR 5
+
+// Capability types
+#define SBMP_CAP_VERSION    1 /*!< Protocol version - major, minor (1 B each) */
+#define SBMP_CAP_CKSUMS     2 /*!< Supported checksums - bit map of SBMP_CAP_CKSUM_* (1 B) */
+#define SBMP_CAP_MAX_FRAME  3 /*!< Longest frame payload accepted (2 B) */
+#define SBMP_CAP_RX_BUFFERS 4 /*!< Number of received datagrams the party can queue (1 B) */
+#define SBMP_CAP_FEATURES   5 /*!< Optional features - bit map of SBMP_FEAT_* (2 B) */
+#define SBMP_CAP_HSK_SEED   6 /*!< Random value for resolving simultaneous handshakes (2 B) */
+
+// Checksum bits
+#define SBMP_CAP_CKSUM_NONE  0x01
+#define SBMP_CAP_CKSUM_XOR   0x02
+#define SBMP_CAP_CKSUM_CRC32 0x04
+
+// Feature bits
+#define SBMP_FEAT_RELIABLE  0x0001 /*!< Reliable mode (see sbmp_reliable.h) */
+#define SBMP_FEAT_CREDIT    0x0002 /*!< Flow control (see sbmp_credit.h) */
+#define SBMP_FEAT_FEC       0x0004 /*!< Forward error correction (see sbmp_fec.h) */
+#define SBMP_FEAT_APP_MASK  0xFF00 /*!< Free for the application */
+
+/** Max length of the encoded capabilities */
+#define SBMP_CAPS_MAX_LEN 22
+
+/** Capabilities of a party */
+typedef struct {
+	uint8_t version_major; /*!< Protocol version, 0.0 = unknown (older peer) */
+	uint8_t version_minor;
+	uint8_t cksums;        /*!< Supported checksums, SBMP_CAP_CKSUM_* */
+	uint16_t max_frame;    /*!< Longest frame payload accepted */
+	uint8_t rx_buffers;    /*!< Received datagrams the party can queue */
+	uint16_t features;     /*!< Optional features, SBMP_FEAT_* */
+	uint16_t hsk_seed;     /*!< Handshake tie-break value, 0 = not sent */
+} SBMP_Caps;
+
+
+/**
+ * @brief Encode capabilities for the handshake.
+ * @param caps : capabilities
+ * @param buf  : buffer for SBMP_CAPS_MAX_LEN bytes
+ * @return encoded length
+ */
+uint8_t sbmp_caps_encode(const SBMP_Caps *caps, uint8_t *buf);
+
+/**
+ * @brief Decode capabilities received in the handshake.
+ *
+ * Fields not present in the block are left unchanged.
+ *
+ * @param caps : capabilities to update
+ * @param buf  : the block
+ * @param len  : block length
+ * @return true if the block was valid
+ */
+bool sbmp_caps_decode(SBMP_Caps *caps, const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Get the capabilities supported by both parties.
+ * @param out  : result
+ * @param ours : our capabilities
+ * @param peer : peer's capabilities
+ */
+void sbmp_caps_intersect(SBMP_Caps *out, const SBMP_Caps *ours, const SBMP_Caps *peer);
+
+/**
+ * @brief Pick a checksum from a set
+ * @param cksums    : supported checksums, SBMP_CAP_CKSUM_*
+ * @param preferred : the preferred one, used if in the set
+ * @return the preferred checksum, or the strongest one in the set
+ */
+SBMP_CksumType sbmp_caps_pick_cksum(uint8_t cksums, SBMP_CksumType preferred);
+
+/**
+ * @brief Get the checksum bit for a checksum type
+ * @param type : checksum type
+ * @return SBMP_CAP_CKSUM_* bit, 0 if unknown
+ */
+uint8_t sbmp_caps_cksum_bit(SBMP_CksumType type);
+
+#endif /* SBMP_HAS_CAPS */
+#endif // SBMP_CAPS_H
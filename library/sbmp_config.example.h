@@ -16,7 +16,156 @@
  * If handshake is used, the peer will detect that CRC32 is not
  * supported here, and should start using XOR.
  */
+#ifndef SBMP_HAS_CRC32
 #define SBMP_HAS_CRC32 1
+#endif
+
+
+/* ---------- FEC ------------------ */
+
+/**
+ * @brief Add support for forward error correction
+ *
+ * FEC (Reed-Solomon blocks + Hamming-coded header) can be enabled
+ * per framing layer instance, see sbmp_frm_init_fec().
+ *
+ * Disable it to save about 1 kB of tables and code.
+ */
+#ifndef SBMP_HAS_FEC
+#define SBMP_HAS_FEC 1
+#endif
+
+
+/* ---------- CAPABILITIES --------- */
+
+/**
+ * @brief Exchange capabilities in the handshake
+ *
+ * Needed for negotiating FEC and the checksum, resolving simultaneous
+ * handshakes and resuming a session (see sbmp_caps.h). Without it,
+ * the handshake has only the fixed fields, like with an old peer.
+ *
+ * Disable it to save about 20 B in each endpoint and the code
+ * of the negotiation.
+ */
+#ifndef SBMP_HAS_CAPS
+#define SBMP_HAS_CAPS 1
+#endif
+
+/**
+ * @brief Source of randomness for the handshake tie-break (uint32_t)
+ *
+ * Mixed into the tie-break value of each handshake request, so parties
+ * starting a handshake at once draw different values even if their
+ * session numbers are seeded the same. Use eg. a hardware RNG or
+ * a free-running timer. Without one (0), seed the sessions differently
+ * on each party - see sbmp_ep_seed_session().
+ */
+#ifndef sbmp_entropy
+#define sbmp_entropy() 0
+#endif
+
+
+/* ---------- RELIABLE MODE -------- */
+
+/**
+ * @brief Add the reliable datagram mode
+ *
+ * Negotiated in the handshake, see sbmp_ep_init_reliable().
+ *
+ * Disable it to save the code of the mode (the retransmit
+ * buffer is given by the application only when it's used).
+ */
+#ifndef SBMP_HAS_RELIABLE
+#define SBMP_HAS_RELIABLE 1
+#endif
+
+
+/* ---------- FLOW CONTROL --------- */
+
+/**
+ * @brief Add the credit-based flow control
+ *
+ * Negotiated in the handshake, see sbmp_ep_init_credit().
+ *
+ * Disable it to save the state in each endpoint (about 12 B)
+ * and the code of the mode.
+ */
+#ifndef SBMP_HAS_CREDIT
+#define SBMP_HAS_CREDIT 1
+#endif
+
+
+/* ---------- KEEPALIVE ------------ */
+
+/**
+ * @brief Add the heartbeats, RTT measurement and link state
+ *
+ * See sbmp_ep_init_keepalive(). Heartbeats from the peer are
+ * echoed back even without it.
+ *
+ * Disable it to save the state in each endpoint (about 50 B)
+ * and the code of the module.
+ */
+#ifndef SBMP_HAS_KEEPALIVE
+#define SBMP_HAS_KEEPALIVE 1
+#endif
+
+
+/* ---------- DATAGRAM QUEUE ------- */
+
+/**
+ * @brief Add the received datagram queue
+ *
+ * Lets the main loop handle the datagrams in batches,
+ * see sbmp_ep_init_queue().
+ *
+ * Disable it to save the code of the queue.
+ */
+#ifndef SBMP_HAS_DGQUEUE
+#define SBMP_HAS_DGQUEUE 1
+#endif
+
+
+/* ---------- STATS ---------------- */
+
+/**
+ * @brief Add the session layer instrumentation
+ *
+ * Per datagram type throughput, handler run time and request to
+ * response latency histograms, see sbmp_ep_init_stats().
+ *
+ * Needs a microsecond clock, 64-bit integers and snprintf.
+ */
+#ifndef SBMP_HAS_STATS
+#define SBMP_HAS_STATS 0
+#endif
+
+
+/* ---------- CAPTURE -------------- */
+
+/**
+ * @brief Add the frame capture hook
+ *
+ * Lets the application see every received and sent frame,
+ * see sbmp_frm_set_capture() (and sbmp_pcap.h on POSIX hosts).
+ */
+#ifndef SBMP_HAS_CAPTURE
+#define SBMP_HAS_CAPTURE 0
+#endif
+
+
+/* ---------- THREADS -------------- */
+
+/**
+ * @brief Let other threads send on an endpoint
+ *
+ * Makes the session numbers atomic, needed by the multi-threaded
+ * transmit queue (sbmp_txq.h, POSIX hosts). Uses GCC / Clang atomics.
+ */
+#ifndef SBMP_HAS_THREADS
+#define SBMP_HAS_THREADS 0
+#endif
 
 
 /* ---------- MALLOC --------------- */
@@ -31,7 +180,9 @@
  * If disabled, init funcs will return NULL if NULL is passed
  * as argument.
  */
+#ifndef SBMP_USE_MALLOC
 #define SBMP_USE_MALLOC 1
+#endif
 
 // those will be used if malloc is enabled
 #define sbmp_malloc malloc
@@ -48,12 +199,16 @@
  *
  * Disable logging to free up memory taken by the messages.
  */
+#ifndef SBMP_LOGGING
 #define SBMP_LOGGING 1
+#endif
 
 /**
  * @brief Enable detailed logging (only for debugging, disable for better performance).
  */
+#ifndef SBMP_DEBUG
 #define SBMP_DEBUG 0
+#endif
 
 // here are the actual logging functions
 #include <stdio.h>
@@ -0,0 +1,165 @@
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_credit.h"
+
+#if SBMP_HAS_CREDIT
+
+// counters are 7-bit
+#define COUNT_MASK 0x7F
+
+/** Distance from a to b on the 7-bit counter (b is ahead of a if < 64) */
+static inline uint8_t count_diff(uint8_t b, uint8_t a)
+{
+	return (uint8_t)(b - a) & COUNT_MASK;
+}
+
+/** Check if b is ahead of a (or equal) */
+static inline bool count_ahead(uint8_t b, uint8_t a)
+{
+	return count_diff(b, a) <= SBMP_CREDIT_MAX_WINDOW;
+}
+
+/** The limit we grant to the peer */
+static uint8_t grant(const SBMP_Credit *cr)
+{
+	return (uint8_t)(cr->rx_count - cr->rx_pending + cr->window) & COUNT_MASK;
+}
+
+
+void sbmp_credit_init(SBMP_Credit *cr, uint8_t window, bool manual)
+{
+	if (window > SBMP_CREDIT_MAX_WINDOW) window = SBMP_CREDIT_MAX_WINDOW;
+
+	cr->window = window;
+	cr->manual = manual;
+	cr->stalls = 0;
+
+	sbmp_credit_reset(cr);
+}
+
+void sbmp_credit_reset(SBMP_Credit *cr)
+{
+	cr->active = false;
+	cr->lossless = false;
+
+	cr->tx_count = 0;
+	cr->tx_limit = 0;
+	cr->tx_consume = false;
+	cr->tx_req = false;
+
+	cr->rx_count = 0;
+	cr->rx_pending = 0;
+	cr->rx_sent_limit = 0;
+	cr->rx_req = false;
+}
+
+bool sbmp_credit_activate(SBMP_Credit *cr, uint8_t peer_window, bool lossless)
+{
+	sbmp_credit_reset(cr);
+	cr->lossless = lossless;
+
+	if (cr->window == 0 || peer_window == 0) {
+		return false; // not supported by one of us
+	}
+
+	if (peer_window > SBMP_CREDIT_MAX_WINDOW) peer_window = SBMP_CREDIT_MAX_WINDOW;
+
+	// both start at zero, with the full window granted
+	cr->tx_limit = peer_window;
+	cr->rx_sent_limit = cr->window;
+	cr->active = true;
+
+	sbmp_info("Flow control active, credit %"PRIu8", our window %"PRIu8, peer_window, cr->window);
+	return true;
+}
+
+uint8_t sbmp_credit_available(const SBMP_Credit *cr)
+{
+	if (!cr->active) return 0xFF;
+
+	uint8_t avail = count_diff(cr->tx_limit, cr->tx_count);
+	if (avail > SBMP_CREDIT_MAX_WINDOW) return 0; // limit behind the count - shouldn't happen
+
+	return avail;
+}
+
+uint8_t sbmp_credit_write_header(SBMP_Credit *cr, uint8_t *buf)
+{
+	if (!cr->active) return 0;
+
+	if (cr->tx_consume) {
+		cr->tx_count = (cr->tx_count + 1) & COUNT_MASK;
+		cr->tx_consume = false;
+	}
+
+	cr->rx_sent_limit = grant(cr);
+	cr->rx_req = false;
+
+	buf[0] = cr->tx_count | (cr->tx_req ? SBMP_CREDIT_REQ : 0);
+	buf[1] = cr->rx_sent_limit;
+
+	cr->tx_req = false;
+	return SBMP_CREDIT_HEADER_LEN;
+}
+
+void sbmp_credit_receive(SBMP_Credit *cr, const uint8_t *buf)
+{
+	if (!cr->active) return;
+
+	uint8_t count = buf[0] & COUNT_MASK;
+	uint8_t limit = buf[1] & COUNT_MASK;
+
+	// a delayed or repeated header can be older than what we have
+	if (!cr->lossless && count_ahead(count, cr->rx_count)) {
+		cr->rx_count = count;
+	}
+
+	if (count_ahead(limit, cr->tx_limit)) {
+		cr->tx_limit = limit;
+	}
+
+	if (buf[0] & SBMP_CREDIT_REQ) {
+		cr->rx_req = true;
+	}
+}
+
+void sbmp_credit_delivered(SBMP_Credit *cr, bool held)
+{
+	if (!cr->active) return;
+
+	if (cr->lossless) {
+		cr->rx_count = (cr->rx_count + 1) & COUNT_MASK;
+	}
+
+	if (held && cr->rx_pending < cr->window) {
+		cr->rx_pending++;
+	}
+}
+
+void sbmp_credit_release(SBMP_Credit *cr, uint8_t count)
+{
+	if (count > cr->rx_pending) count = cr->rx_pending;
+	cr->rx_pending -= count;
+}
+
+bool sbmp_credit_update_due(const SBMP_Credit *cr)
+{
+	if (!cr->active) return false;
+
+	uint8_t limit = grant(cr);
+	if (limit == cr->rx_sent_limit) {
+		return cr->rx_req; // nothing new, but the peer asked
+	}
+
+	uint8_t freed = count_diff(limit, cr->rx_sent_limit);
+	uint8_t threshold = (uint8_t)(cr->window / 2);
+	if (threshold == 0) threshold = 1;
+
+	// the peer is blocked, or enough credit to make the frame worth it
+	return cr->rx_req
+		   || cr->rx_count == cr->rx_sent_limit
+		   || freed >= threshold;
+}
+
+#endif /* SBMP_HAS_CREDIT */
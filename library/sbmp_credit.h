@@ -0,0 +1,151 @@
+#ifndef SBMP_CREDIT_H
+#define SBMP_CREDIT_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_CREDIT
+
+/**
+ * Credit-based flow control.
+ *
+ * Each party grants the peer credit for a number of datagrams (its "window"),
+ * and every datagram sent uses one. The credit is given back when the
+ * receiver has processed the datagram - so a fast sender can stream at
+ * full speed, but never overruns a slow receiver.
+ *
+ * Frames in this mode have the SBMP_FRM_FLAG_CREDIT flag, and the payload
+ * starts with a header (before the reliable mode header, if used):
+ *
+ *   [ count 1B | limit 1B ] [ ... ]
+ *
+ * - count : number of datagrams sent so far (7 bits, wraps around);
+ *           bit 7 asks the peer to send its credit right away
+ * - limit : the peer may send datagrams until its count reaches this (7 bits)
+ *
+ * Every frame carries the current limit for the peer, so the credit rides
+ * on the datagrams going the other way. If there's nothing to send, a frame
+ * with just the header is sent.
+ *
+ * The mode is negotiated in the handshake (see sbmp_ep_init_credit()).
+ * Use it through the endpoint; the functions here are called by the session layer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Length of the flow control header */
+#define SBMP_CREDIT_HEADER_LEN 2
+
+/** Max window (half of the 7-bit counter range) */
+#define SBMP_CREDIT_MAX_WINDOW 63
+
+/** Bit in the count byte - send the credit now */
+#define SBMP_CREDIT_REQ 0x80
+
+/** Flow control state */
+typedef struct {
+	bool active;          /*!< Negotiated with the peer, in use */
+	bool manual;          /*!< Credit is returned by sbmp_ep_credit_release(), not when the handler returns */
+	bool lossless;        /*!< Nothing is lost (reliable mode) - count the delivered datagrams, not the peer's count */
+	uint8_t window;       /*!< Datagrams we can take ahead (our credit for the peer), 0 = disabled */
+
+	uint8_t tx_count;     /*!< Datagrams sent */
+	uint8_t tx_limit;     /*!< Peer's limit - we can send until tx_count reaches it */
+	bool tx_consume;      /*!< The frame being started is a new datagram (uses credit) */
+	bool tx_req;          /*!< Ask the peer for its credit in the frame being started */
+
+	uint8_t rx_count;     /*!< Peer's datagram count (from the last received header, or delivered if lossless) */
+	uint8_t rx_pending;   /*!< Received datagrams not released by the application yet */
+	uint8_t rx_sent_limit;/*!< The limit last sent to the peer */
+	bool rx_req;          /*!< Send our credit to the peer without waiting */
+
+	uint32_t stalls;      /*!< Number of datagrams refused for lack of credit (stats) */
+} SBMP_Credit;
+
+
+/**
+ * @brief Initialize the flow control state.
+ *
+ * @param cr     : state
+ * @param window : datagrams the peer can send ahead (max SBMP_CREDIT_MAX_WINDOW), 0 = disabled
+ * @param manual : the credit is returned by sbmp_credit_release(), not on delivery
+ */
+void sbmp_credit_init(SBMP_Credit *cr, uint8_t window, bool manual);
+
+/**
+ * @brief Stop using the flow control and discard all state.
+ * @param cr : state
+ */
+void sbmp_credit_reset(SBMP_Credit *cr);
+
+/**
+ * @brief Start using the flow control (after the handshake).
+ *
+ * In the reliable mode, datagrams received out of order wait for the missing
+ * ones - the credit then follows the delivered datagrams (lossless = true).
+ * Otherwise, it follows the peer's count, so lost datagrams don't use it up.
+ *
+ * @param cr          : state
+ * @param peer_window : peer's window, 0 = not supported by the peer
+ * @param lossless    : datagrams are never lost (reliable mode)
+ * @return true if the mode is active
+ */
+bool sbmp_credit_activate(SBMP_Credit *cr, uint8_t peer_window, bool lossless);
+
+/**
+ * @brief Get the number of datagrams that can be sent now.
+ * @param cr : state
+ * @return remaining credit, 0xFF if the flow control isn't active
+ */
+uint8_t sbmp_credit_available(const SBMP_Credit *cr);
+
+/**
+ * @brief Write the header for a frame being started.
+ *
+ * Uses one credit if cr->tx_consume is set.
+ *
+ * @param cr  : state
+ * @param buf : buffer for SBMP_CREDIT_HEADER_LEN bytes
+ * @return header length, 0 if the mode isn't active
+ */
+uint8_t sbmp_credit_write_header(SBMP_Credit *cr, uint8_t *buf);
+
+/**
+ * @brief Process the header of a received frame.
+ *
+ * @param cr  : state
+ * @param buf : the header (SBMP_CREDIT_HEADER_LEN bytes)
+ */
+void sbmp_credit_receive(SBMP_Credit *cr, const uint8_t *buf);
+
+/**
+ * @brief Note a received datagram.
+ *
+ * A datagram the application releases later (in the manual mode, or when
+ * queued) holds its credit until then. The session layer's own datagrams
+ * (eg. heartbeats) are never seen by the application, so they don't.
+ *
+ * @param cr   : state
+ * @param held : the credit is held until sbmp_credit_release()
+ */
+void sbmp_credit_delivered(SBMP_Credit *cr, bool held);
+
+/**
+ * @brief Give back credit for processed datagrams (manual mode).
+ * @param cr    : state
+ * @param count : number of datagrams
+ */
+void sbmp_credit_release(SBMP_Credit *cr, uint8_t count);
+
+/**
+ * @brief Check if the peer should get a credit update now.
+ *
+ * True if half of the window was freed since the last update,
+ * if the peer used up all of its credit, or if it asked for it.
+ *
+ * @param cr : state
+ * @return update needed
+ */
+bool sbmp_credit_update_due(const SBMP_Credit *cr);
+
+#endif /* SBMP_HAS_CREDIT */
+#endif // SBMP_CREDIT_H
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include "sbmp_config.h"
 #include "sbmp_datagram.h"
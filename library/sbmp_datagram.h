@@ -22,12 +22,21 @@ typedef uint8_t SBMP_DgType;
 #define DG_HANDSHAKE_START    0
 #define DG_HANDSHAKE_ACCEPT   1
 #define DG_HANDSHAKE_CONFLICT 2
+#define DG_HANDSHAKE_RESUME   3
 
 // Bulk data transfer
-#define DG_BULK_OFFER   4
-#define DG_BULK_REQUEST 5
-#define DG_BULK_DATA    6
-#define DG_BULK_ABORT   7
+#define DG_BULK_OFFER     4
+#define DG_BULK_REQUEST   5
+#define DG_BULK_DATA      6
+#define DG_BULK_ABORT     7
+#define DG_BULK_ACK       8
+#define DG_BULK_SIGNATURE 9
+#define DG_BULK_COPY      13
+#define DG_BULK_FILL      14
+
+// Keepalive
+#define DG_HEARTBEAT      15
+#define DG_HEARTBEAT_ECHO 16
 
 // generic status codes
 #define DG_SUCCESS 10
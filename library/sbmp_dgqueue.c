@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sbmp_config.h"
+#include "sbmp_dgqueue.h"
+
+#if SBMP_HAS_DGQUEUE
+
+/** Length field of a marker telling the reader to go back to the start */
+#define WRAP_MARKER 0xFFFF
+
+// The indices are shared between an interrupt (or a thread) and the main loop:
+// the datagram is written before the head is moved, and read before the tail is.
+#define LOAD_INDEX(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_INDEX(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+
+SBMP_DgQueue *sbmp_dgq_init(SBMP_DgQueue *q, uint8_t *buffer, uint16_t size)
+{
+	bool q_mallocd = false;
+
+	if (size <= SBMP_DGQ_OVERHEAD + 1) {
+		sbmp_error("Datagram queue too small.");
+		return NULL;
+	}
+
+#if SBMP_USE_MALLOC
+	if (q == NULL) {
+		// caller wants us to allocate it
+		q = sbmp_malloc(sizeof(SBMP_DgQueue));
+		if (q == NULL) return NULL; // malloc failed
+		q_mallocd = true;
+	}
+
+	if (buffer == NULL) {
+		// caller wants us to allocate it
+		buffer = sbmp_malloc(size);
+		if (buffer == NULL) { // malloc failed
+			if (q_mallocd) sbmp_free(q);
+			return NULL;
+		}
+	}
+#else
+	(void)q_mallocd;
+
+	if (q == NULL || buffer == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	q->buffer = buffer;
+	q->size = size;
+	q->head = 0;
+	q->tail = 0;
+	q->dropped = 0;
+
+	return q;
+}
+
+/** Write the datagram at a position */
+static void write_entry(SBMP_DgQueue *q, uint16_t pos, const SBMP_Datagram *dg)
+{
+	uint8_t *p = q->buffer + pos;
+
+	p[0] = dg->length & 0xFF;
+	p[1] = (dg->length >> 8) & 0xFF;
+	p[2] = dg->session & 0xFF;
+	p[3] = (dg->session >> 8) & 0xFF;
+	p[4] = dg->type;
+
+	memcpy(p + SBMP_DGQ_OVERHEAD, dg->payload, dg->length);
+}
+
+bool sbmp_dgq_push(SBMP_DgQueue *q, const SBMP_Datagram *dg)
+{
+	uint32_t len = (uint32_t) dg->length + SBMP_DGQ_OVERHEAD;
+	uint16_t head = q->head;
+	uint16_t tail = LOAD_INDEX(q->tail);
+
+	// head == tail means empty, so one byte always stays free
+	uint16_t pos;
+	if (head >= tail) {
+		uint32_t at_end = (uint32_t) q->size - head - (tail == 0 ? 1 : 0);
+
+		if (len <= at_end) {
+			pos = head;
+		} else if (len < tail) {
+			// doesn't fit at the end, start over (the reader skips the rest)
+			if (q->size - head >= SBMP_DGQ_OVERHEAD) {
+				q->buffer[head] = WRAP_MARKER & 0xFF;
+				q->buffer[head + 1] = (WRAP_MARKER >> 8) & 0xFF;
+			}
+			pos = 0;
+		} else {
+			q->dropped++;
+			return false;
+		}
+	} else {
+		if (len >= (uint32_t)(tail - head)) {
+			q->dropped++;
+			return false;
+		}
+		pos = head;
+	}
+
+	write_entry(q, pos, dg);
+
+	uint32_t next = pos + len;
+	STORE_INDEX(q->head, (uint16_t)(next == q->size ? 0 : next));
+
+	return true;
+}
+
+/** Get the position of the oldest datagram, false if empty */
+static bool oldest(SBMP_DgQueue *q, uint16_t *pos)
+{
+	uint16_t tail = q->tail;
+	if (tail == LOAD_INDEX(q->head)) return false;
+
+	// the rest of the ring is skipped if there's no room for a header, or a marker
+	if (q->size - tail < SBMP_DGQ_OVERHEAD
+		|| (q->buffer[tail] | (q->buffer[tail + 1] << 8)) == WRAP_MARKER) {
+		tail = 0;
+	}
+
+	*pos = tail;
+	return true;
+}
+
+bool sbmp_dgq_peek(SBMP_DgQueue *q, SBMP_Datagram *dg)
+{
+	uint16_t pos;
+	if (!oldest(q, &pos)) return false;
+
+	const uint8_t *p = q->buffer + pos;
+
+	dg->length = (uint16_t)(p[0] | (p[1] << 8));
+	dg->session = (uint16_t)(p[2] | (p[3] << 8));
+	dg->type = p[4];
+	dg->payload = p + SBMP_DGQ_OVERHEAD;
+
+	return true;
+}
+
+void sbmp_dgq_pop(SBMP_DgQueue *q)
+{
+	uint16_t pos;
+	if (!oldest(q, &pos)) return;
+
+	const uint8_t *p = q->buffer + pos;
+	uint32_t next = pos + SBMP_DGQ_OVERHEAD + (uint32_t)(p[0] | (p[1] << 8));
+
+	STORE_INDEX(q->tail, (uint16_t)(next == q->size ? 0 : next));
+}
+
+bool sbmp_dgq_empty(SBMP_DgQueue *q)
+{
+	return q->tail == LOAD_INDEX(q->head);
+}
+
+#endif /* SBMP_HAS_DGQUEUE */
@@ -0,0 +1,83 @@
+#ifndef SBMP_DGQUEUE_H
+#define SBMP_DGQUEUE_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_DGQUEUE
+
+/**
+ * Received datagram queue.
+ *
+ * A ring buffer of complete datagrams (header + payload), each stored in
+ * one piece. The receiving side (eg. a UART interrupt) adds the datagrams,
+ * and the main loop takes them out - one producer and one consumer, no
+ * locks. The payload is read in place, no copy is needed for it.
+ *
+ * This module only contains the queue; use it through the endpoint
+ * (see sbmp_ep_init_queue() and sbmp_ep_poll()).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_datagram.h"
+
+/** Bytes taken by each queued datagram, in addition to its payload */
+#define SBMP_DGQ_OVERHEAD 5
+
+/** Datagram queue state */
+typedef struct {
+	uint8_t *buffer;        /*!< The ring */
+	uint16_t size;          /*!< Ring size */
+	uint16_t head;          /*!< Where the next datagram goes (written by the producer) */
+	uint16_t tail;          /*!< The oldest datagram (written by the consumer) */
+	uint32_t dropped;       /*!< Datagrams that didn't fit (stats) */
+} SBMP_DgQueue;
+
+
+/**
+ * @brief Initialize the queue.
+ *
+ * A datagram takes SBMP_DGQ_OVERHEAD + its payload length; a ring can hold
+ * a datagram up to size - SBMP_DGQ_OVERHEAD - 1 bytes long.
+ *
+ * @param q      : state, NULL to allocate
+ * @param buffer : the ring, NULL to allocate
+ * @param size   : ring size
+ * @return the state (allocated if q was NULL), NULL on failure
+ */
+SBMP_DgQueue *sbmp_dgq_init(SBMP_DgQueue *q, uint8_t *buffer, uint16_t size);
+
+/**
+ * @brief Add a copy of a datagram (the producer).
+ * @param q  : queue
+ * @param dg : datagram
+ * @return false if there wasn't room (the datagram is dropped)
+ */
+bool sbmp_dgq_push(SBMP_DgQueue *q, const SBMP_Datagram *dg);
+
+/**
+ * @brief Get the oldest datagram, without removing it (the consumer).
+ *
+ * The payload points into the ring - it's valid until sbmp_dgq_pop().
+ *
+ * @param q  : queue
+ * @param dg : filled with the datagram
+ * @return false if the queue is empty
+ */
+bool sbmp_dgq_peek(SBMP_DgQueue *q, SBMP_Datagram *dg);
+
+/**
+ * @brief Remove the oldest datagram (the consumer).
+ * @param q : queue
+ */
+void sbmp_dgq_pop(SBMP_DgQueue *q);
+
+/**
+ * @brief Check if the queue is empty
+ * @param q : queue
+ * @return is empty
+ */
+bool sbmp_dgq_empty(SBMP_DgQueue *q);
+
+#endif /* SBMP_HAS_DGQUEUE */
+#endif // SBMP_DGQUEUE_H
@@ -0,0 +1,416 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_fec.h"
+
+#if SBMP_HAS_FEC
+
+#if SBMP_FEC_SIMD
+#include <tmmintrin.h>
+#endif
+
+/** GF(2^8) exponentials (alpha = 2, polynomial 0x11D), doubled to skip the modulo */
+static const uint8_t gf_exp[512] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
+	0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0,
+	0x9d, 0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23,
+	0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1,
+	0x5f, 0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0,
+	0xfd, 0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2,
+	0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce,
+	0x81, 0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc,
+	0x85, 0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54,
+	0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73,
+	0xe6, 0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff,
+	0xe3, 0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41,
+	0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6,
+	0x51, 0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09,
+	0x12, 0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16,
+	0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e, 0x01,
+	0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26, 0x4c,
+	0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d,
+	0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23, 0x46,
+	0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1, 0x5f,
+	0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd,
+	0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2, 0xd9,
+	0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce, 0x81,
+	0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85,
+	0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54, 0xa8,
+	0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73, 0xe6,
+	0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3,
+	0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41, 0x82,
+	0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6, 0x51,
+	0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12,
+	0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16, 0x2c,
+	0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e, 0x01, 0x02,
+};
+
+/** GF(2^8) logarithms (log of 0 is undefined) */
+static const uint8_t gf_log[256] = {
+	0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6, 0x03, 0xdf, 0x33, 0xee, 0x1b, 0x68, 0xc7, 0x4b,
+	0x04, 0x64, 0xe0, 0x0e, 0x34, 0x8d, 0xef, 0x81, 0x1c, 0xc1, 0x69, 0xf8, 0xc8, 0x08, 0x4c, 0x71,
+	0x05, 0x8a, 0x65, 0x2f, 0xe1, 0x24, 0x0f, 0x21, 0x35, 0x93, 0x8e, 0xda, 0xf0, 0x12, 0x82, 0x45,
+	0x1d, 0xb5, 0xc2, 0x7d, 0x6a, 0x27, 0xf9, 0xb9, 0xc9, 0x9a, 0x09, 0x78, 0x4d, 0xe4, 0x72, 0xa6,
+	0x06, 0xbf, 0x8b, 0x62, 0x66, 0xdd, 0x30, 0xfd, 0xe2, 0x98, 0x25, 0xb3, 0x10, 0x91, 0x22, 0x88,
+	0x36, 0xd0, 0x94, 0xce, 0x8f, 0x96, 0xdb, 0xbd, 0xf1, 0xd2, 0x13, 0x5c, 0x83, 0x38, 0x46, 0x40,
+	0x1e, 0x42, 0xb6, 0xa3, 0xc3, 0x48, 0x7e, 0x6e, 0x6b, 0x3a, 0x28, 0x54, 0xfa, 0x85, 0xba, 0x3d,
+	0xca, 0x5e, 0x9b, 0x9f, 0x0a, 0x15, 0x79, 0x2b, 0x4e, 0xd4, 0xe5, 0xac, 0x73, 0xf3, 0xa7, 0x57,
+	0x07, 0x70, 0xc0, 0xf7, 0x8c, 0x80, 0x63, 0x0d, 0x67, 0x4a, 0xde, 0xed, 0x31, 0xc5, 0xfe, 0x18,
+	0xe3, 0xa5, 0x99, 0x77, 0x26, 0xb8, 0xb4, 0x7c, 0x11, 0x44, 0x92, 0xd9, 0x23, 0x20, 0x89, 0x2e,
+	0x37, 0x3f, 0xd1, 0x5b, 0x95, 0xbc, 0xcf, 0xcd, 0x90, 0x87, 0x97, 0xb2, 0xdc, 0xfc, 0xbe, 0x61,
+	0xf2, 0x56, 0xd3, 0xab, 0x14, 0x2a, 0x5d, 0x9e, 0x84, 0x3c, 0x39, 0x53, 0x47, 0x6d, 0x41, 0xa2,
+	0x1f, 0x2d, 0x43, 0xd8, 0xb7, 0x7b, 0xa4, 0x76, 0xc4, 0x17, 0x49, 0xec, 0x7f, 0x0c, 0x6f, 0xf6,
+	0x6c, 0xa1, 0x3b, 0x52, 0x29, 0x9d, 0x55, 0xaa, 0xfb, 0x60, 0x86, 0xb1, 0xbb, 0xcc, 0x3e, 0x5a,
+	0xcb, 0x59, 0x5f, 0xb0, 0x9c, 0xa9, 0xa0, 0x51, 0x0b, 0xf5, 0x16, 0xeb, 0x7a, 0x75, 0x2c, 0xd7,
+	0x4f, 0xae, 0xd5, 0xe9, 0xe6, 0xe7, 0xad, 0xe8, 0x74, 0xd6, 0xf4, 0xea, 0xa8, 0x50, 0x58, 0xaf,
+};
+
+/** Extended Hamming (8,4) code - nibble in bits 0-3, parity in bits 4-7 */
+static const uint8_t hamming_enc[16] = {
+	0x00, 0xb1, 0xd2, 0x63, 0xe4, 0x55, 0x36, 0x87, 0x78, 0xc9, 0xaa, 0x1b, 0x9c, 0x2d, 0x4e, 0xff,
+};
+
+/** Hamming (8,4) decoder - corrects one bit error, 0xFF = two bits damaged */
+static const uint8_t hamming_dec[256] = {
+	0x00, 0x00, 0x00, 0xff, 0x00, 0xff, 0xff, 0x07, 0x00, 0xff, 0xff, 0x0b, 0xff, 0x0d, 0x0e, 0xff,
+	0x00, 0xff, 0xff, 0x0b, 0xff, 0x05, 0x06, 0xff, 0xff, 0x0b, 0x0b, 0x0b, 0x0c, 0xff, 0xff, 0x0b,
+	0x00, 0xff, 0xff, 0x03, 0xff, 0x0d, 0x06, 0xff, 0xff, 0x0d, 0x0a, 0xff, 0x0d, 0x0d, 0xff, 0x0d,
+	0xff, 0x01, 0x06, 0xff, 0x06, 0xff, 0x06, 0x06, 0x08, 0xff, 0xff, 0x0b, 0xff, 0x0d, 0x06, 0xff,
+	0x00, 0xff, 0xff, 0x03, 0xff, 0x05, 0x0e, 0xff, 0xff, 0x09, 0x0e, 0xff, 0x0e, 0xff, 0x0e, 0x0e,
+	0xff, 0x05, 0x02, 0xff, 0x05, 0x05, 0xff, 0x05, 0x08, 0xff, 0xff, 0x0b, 0xff, 0x05, 0x0e, 0xff,
+	0xff, 0x03, 0x03, 0x03, 0x04, 0xff, 0xff, 0x03, 0x08, 0xff, 0xff, 0x03, 0xff, 0x0d, 0x0e, 0xff,
+	0x08, 0xff, 0xff, 0x03, 0xff, 0x05, 0x06, 0xff, 0x08, 0x08, 0x08, 0xff, 0x08, 0xff, 0xff, 0x0f,
+	0x00, 0xff, 0xff, 0x07, 0xff, 0x07, 0x07, 0x07, 0xff, 0x09, 0x0a, 0xff, 0x0c, 0xff, 0xff, 0x07,
+	0xff, 0x01, 0x02, 0xff, 0x0c, 0xff, 0xff, 0x07, 0x0c, 0xff, 0xff, 0x0b, 0x0c, 0x0c, 0x0c, 0xff,
+	0xff, 0x01, 0x0a, 0xff, 0x04, 0xff, 0xff, 0x07, 0x0a, 0xff, 0x0a, 0x0a, 0xff, 0x0d, 0x0a, 0xff,
+	0x01, 0x01, 0xff, 0x01, 0xff, 0x01, 0x06, 0xff, 0xff, 0x01, 0x0a, 0xff, 0x0c, 0xff, 0xff, 0x0f,
+	0xff, 0x09, 0x02, 0xff, 0x04, 0xff, 0xff, 0x07, 0x09, 0x09, 0xff, 0x09, 0xff, 0x09, 0x0e, 0xff,
+	0x02, 0xff, 0x02, 0x02, 0xff, 0x05, 0x02, 0xff, 0xff, 0x09, 0x02, 0xff, 0x0c, 0xff, 0xff, 0x0f,
+	0x04, 0xff, 0xff, 0x03, 0x04, 0x04, 0x04, 0xff, 0xff, 0x09, 0x0a, 0xff, 0x04, 0xff, 0xff, 0x0f,
+	0xff, 0x01, 0x02, 0xff, 0x04, 0xff, 0xff, 0x0f, 0x08, 0xff, 0xff, 0x0f, 0xff, 0x0f, 0x0f, 0x0f,
+};
+
+/** Multiply in GF(2^8) */
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+	if (a == 0 || b == 0) return 0;
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/** Divide in GF(2^8), b must not be 0 */
+static inline uint8_t gf_div(uint8_t a, uint8_t b)
+{
+	if (a == 0) return 0;
+	return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+/** alpha^n, for any n */
+static inline uint8_t gf_pow(uint32_t n)
+{
+	return gf_exp[n % 255];
+}
+
+#if SBMP_FEC_SIMD
+static bool simd_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+
+SBMP_Fec *sbmp_fec_init(SBMP_Fec *fec, uint8_t *block, uint8_t parity)
+{
+	bool fec_mallocd = false;
+
+	if (parity < 2 || parity > SBMP_FEC_MAX_PARITY || (parity & 1)) {
+		sbmp_error("Bad FEC parity count %"PRIu8, parity);
+		return NULL;
+	}
+
+#if SBMP_USE_MALLOC
+	if (fec == NULL) {
+		// caller wants us to allocate it
+		fec = sbmp_malloc(sizeof(SBMP_Fec));
+		if (fec == NULL) return NULL; // malloc failed
+		fec_mallocd = true;
+	}
+
+	if (block == NULL) {
+		// caller wants us to allocate it
+		block = sbmp_malloc(SBMP_FEC_BLOCK_MAX);
+		if (block == NULL) { // malloc failed
+			if (fec_mallocd) sbmp_free(fec);
+			return NULL;
+		}
+	}
+#else
+	(void)fec_mallocd;
+
+	if (fec == NULL || block == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	fec->parity = parity;
+	fec->block = block;
+
+	fec->corrected = 0;
+	fec->uncorrectable = 0;
+	fec->byte_errors = 0;
+
+	// generator polynomial - product of (x + alpha^j), j = 0 .. parity-1
+	uint8_t gen[SBMP_FEC_MAX_PARITY + 1] = {1}; // lowest degree first
+	for (int j = 0; j < parity; j++) {
+		uint8_t root = gf_pow(j);
+		gen[j + 1] = gen[j];
+		for (int i = j; i > 0; i--) {
+			gen[i] = gen[i - 1] ^ gf_mul(gen[i], root);
+		}
+		gen[0] = gf_mul(gen[0], root);
+	}
+
+	// highest degree first, without the leading 1 (all coefficients are non-zero)
+	for (int i = 0; i < parity; i++) {
+		fec->gen_log[i] = gf_log[gen[parity - 1 - i]];
+	}
+
+#if SBMP_FEC_SIMD
+	for (int j = 0; j < SBMP_FEC_MAX_PARITY; j++) {
+		uint8_t c = gf_pow(16 * j);
+		for (int n = 0; n < 16; n++) {
+			fec->syn_tab[j][0][n] = gf_mul(c, n);
+			fec->syn_tab[j][1][n] = gf_mul(c, n << 4);
+		}
+	}
+#endif
+
+	return fec;
+}
+
+void sbmp_fec_encode_begin(const SBMP_Fec *fec, uint8_t *reg)
+{
+	memset(reg, 0, fec->parity);
+}
+
+void sbmp_fec_encode_byte(const SBMP_Fec *fec, uint8_t *reg, uint8_t byte)
+{
+	// LFSR division by the generator, the register holds the remainder
+	uint8_t fb = byte ^ reg[0];
+
+	memmove(reg, reg + 1, fec->parity - 1);
+	reg[fec->parity - 1] = 0;
+
+	if (fb != 0) {
+		uint8_t lf = gf_log[fb];
+		for (int i = 0; i < fec->parity; i++) {
+			reg[i] ^= gf_exp[lf + fec->gen_log[i]];
+		}
+	}
+}
+
+/** Compute the syndromes (received polynomial evaluated at alpha^j) */
+static void syndromes(const uint8_t *block, uint16_t len, uint8_t parity, uint8_t *synd)
+{
+	for (int j = 0; j < parity; j++) {
+		uint8_t s = 0;
+		for (uint16_t i = 0; i < len; i++) {
+			// Horner's scheme - s = s * alpha^j + b
+			if (s != 0) s = gf_exp[gf_log[s] + j];
+			s ^= block[i];
+		}
+		synd[j] = s;
+	}
+}
+
+#if SBMP_FEC_SIMD
+/**
+ * Compute the syndromes, 16 bytes at a time.
+ *
+ * Each lane runs Horner's scheme over every 16th byte (multiplying by alpha^16j,
+ * using nibble lookup tables), and the lanes are combined at the end.
+ */
+__attribute__((target("ssse3")))
+static void syndromes_ssse3(const SBMP_Fec *fec, const uint8_t *block, uint16_t len, uint8_t parity, uint8_t *synd)
+{
+	__m128i acc[SBMP_FEC_MAX_PARITY];
+	const __m128i mask = _mm_set1_epi8(0x0F);
+
+	// leading zeros don't change the syndromes - align the end of the block to 16 bytes
+	uint8_t pad = (16 - len % 16) % 16;
+	uint8_t first[16] = {0};
+	memcpy(first + pad, block, 16 - pad);
+
+	__m128i x = _mm_loadu_si128((const __m128i *) first);
+	for (int j = 0; j < parity; j++) {
+		acc[j] = x;
+	}
+
+	for (uint16_t i = 16 - pad; i < len; i += 16) {
+		x = _mm_loadu_si128((const __m128i *)(block + i));
+
+		for (int j = 0; j < parity; j++) {
+			__m128i lo = _mm_and_si128(acc[j], mask);
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(acc[j], 4), mask);
+
+			__m128i prod = _mm_xor_si128(
+				_mm_shuffle_epi8(_mm_load_si128((const __m128i *) fec->syn_tab[j][0]), lo),
+				_mm_shuffle_epi8(_mm_load_si128((const __m128i *) fec->syn_tab[j][1]), hi));
+
+			acc[j] = _mm_xor_si128(prod, x);
+		}
+	}
+
+	// lane k is followed by (15 - k) bytes of its chunk
+	for (int j = 0; j < parity; j++) {
+		uint8_t lanes[16];
+		_mm_storeu_si128((__m128i *) lanes, acc[j]);
+
+		uint8_t s = 0;
+		for (int k = 0; k < 16; k++) {
+			s ^= gf_mul(lanes[k], gf_pow(j * (15 - k)));
+		}
+		synd[j] = s;
+	}
+}
+#endif
+
+int sbmp_fec_decode(SBMP_Fec *fec, uint8_t *block, uint16_t len, uint8_t parity)
+{
+	uint8_t synd[SBMP_FEC_MAX_PARITY];
+
+	if (parity > SBMP_FEC_MAX_PARITY || len > SBMP_FEC_BLOCK_MAX || len <= parity) {
+		return -1;
+	}
+
+#if SBMP_FEC_SIMD
+	static int simd = -1;
+	if (simd < 0) simd = simd_supported();
+
+	if (simd) {
+		syndromes_ssse3(fec, block, len, parity, synd);
+	} else {
+		syndromes(block, len, parity, synd);
+	}
+#else
+	(void)fec;
+	syndromes(block, len, parity, synd);
+#endif
+
+	bool clean = true;
+	for (int j = 0; j < parity; j++) {
+		if (synd[j] != 0) {
+			clean = false;
+			break;
+		}
+	}
+
+	if (clean) return 0; // the usual case
+
+	// Berlekamp-Massey - find the error locator polynomial
+	uint8_t lambda[SBMP_FEC_MAX_PARITY + 1] = {1};
+	uint8_t prev[SBMP_FEC_MAX_PARITY + 1] = {1};
+	uint8_t tmp[SBMP_FEC_MAX_PARITY + 1];
+	int errs = 0; // degree of lambda
+	int shift = 1;
+	uint8_t prev_disc = 1;
+
+	for (int n = 0; n < parity; n++) {
+		uint8_t disc = synd[n];
+		for (int i = 1; i <= errs; i++) {
+			disc ^= gf_mul(lambda[i], synd[n - i]);
+		}
+
+		if (disc == 0) {
+			shift++;
+			continue;
+		}
+
+		uint8_t coef = gf_div(disc, prev_disc);
+
+		if (2 * errs <= n) {
+			memcpy(tmp, lambda, sizeof(lambda));
+			for (int i = 0; i + shift <= parity; i++) {
+				lambda[i + shift] ^= gf_mul(coef, prev[i]);
+			}
+			errs = n + 1 - errs;
+			memcpy(prev, tmp, sizeof(prev));
+			prev_disc = disc;
+			shift = 1;
+		} else {
+			for (int i = 0; i + shift <= parity; i++) {
+				lambda[i + shift] ^= gf_mul(coef, prev[i]);
+			}
+			shift++;
+		}
+	}
+
+	if (errs > parity / 2) return -1;
+
+	// error evaluator - omega = synd * lambda mod x^parity
+	uint8_t omega[SBMP_FEC_MAX_PARITY];
+	for (int i = 0; i < parity; i++) {
+		uint8_t v = 0;
+		for (int k = 0; k <= i && k <= errs; k++) {
+			v ^= gf_mul(lambda[k], synd[i - k]);
+		}
+		omega[i] = v;
+	}
+
+	// Chien search for the error positions, Forney for the values
+	int found = 0;
+	uint8_t err_pos[SBMP_FEC_MAX_PARITY / 2];
+	uint8_t err_val[SBMP_FEC_MAX_PARITY / 2];
+
+	for (uint16_t i = 0; i < len && found < errs; i++) {
+		uint32_t power = len - 1 - i;        // position i holds the coefficient of x^power
+		uint32_t inv = (255 - power) % 255;  // log of X^-1
+
+		uint8_t val = 0;
+		for (int k = 0; k <= errs; k++) {
+			if (lambda[k] != 0) val ^= gf_exp[(gf_log[lambda[k]] + inv * k) % 255];
+		}
+		if (val != 0) continue;
+
+		// lambda' (odd terms only, in GF(2^m))
+		uint8_t deriv = 0;
+		for (int k = 1; k <= errs; k += 2) {
+			if (lambda[k] != 0) deriv ^= gf_exp[(gf_log[lambda[k]] + inv * (k - 1)) % 255];
+		}
+
+		uint8_t om = 0;
+		for (int k = 0; k < parity; k++) {
+			if (omega[k] != 0) om ^= gf_exp[(gf_log[omega[k]] + inv * k) % 255];
+		}
+
+		if (deriv == 0) return -1;
+
+		// e = X * omega(X^-1) / lambda'(X^-1)
+		err_pos[found] = (uint8_t) i;
+		err_val[found] = gf_mul(gf_pow(power), gf_div(om, deriv));
+		found++;
+	}
+
+	if (found != errs) return -1; // the locator has roots outside the block
+
+	for (int k = 0; k < found; k++) {
+		block[err_pos[k]] ^= err_val[k];
+	}
+
+	fec->byte_errors += found;
+	return found;
+}
+
+uint8_t sbmp_fec_hamming_encode(uint8_t nibble)
+{
+	return hamming_enc[nibble & 0x0F];
+}
+
+uint8_t sbmp_fec_hamming_decode(uint8_t code)
+{
+	return hamming_dec[code];
+}
+
+#endif /* SBMP_HAS_FEC */
@@ -0,0 +1,131 @@
+#ifndef SBMP_FEC_H
+#define SBMP_FEC_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_FEC
+
+/**
+ * Forward error correction for the framing layer.
+ *
+ * Used by sbmp_frame when FEC is enabled with sbmp_frm_init_fec().
+ *
+ * The frame header is protected by an extended Hamming (8,4) code - each
+ * nibble is sent as one byte, so a flipped bit in any header byte is corrected.
+ *
+ * The payload and its checksum are split in Reed-Solomon blocks
+ * (GF(2^8), polynomial 0x11D), each followed by its parity bytes.
+ * With P parity bytes, up to P/2 damaged bytes per block are corrected.
+ * Blocks are full RS(255, 255-P) codewords, the last one is shortened.
+ *
+ * Both codes are table-driven. On x86 hosts, the syndrome computation
+ * (the part run for every received block) uses SSSE3 if the CPU supports it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Max parity bytes per block */
+#define SBMP_FEC_MAX_PARITY 32
+
+/** Max Reed-Solomon block length (data + parity) */
+#define SBMP_FEC_BLOCK_MAX 255
+
+/** Use the vectorised syndrome computation (x86 hosts with GCC or Clang) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SBMP_FEC_SIMD 1
+#else
+#define SBMP_FEC_SIMD 0
+#endif
+
+/** FEC codec state & statistics */
+typedef struct {
+	uint8_t parity;        /*!< Parity bytes per block for Tx (even, max SBMP_FEC_MAX_PARITY) */
+	uint8_t gen_log[SBMP_FEC_MAX_PARITY]; /*!< Generator polynomial (log form, without the leading 1) */
+
+	uint8_t tx_reg[SBMP_FEC_MAX_PARITY]; /*!< Tx parity register */
+	uint8_t tx_count;      /*!< Data bytes in the current Tx block */
+
+	uint8_t *block;        /*!< Rx block buffer, SBMP_FEC_BLOCK_MAX long */
+	uint8_t rx_parity;     /*!< Parity bytes per block in the frame being received */
+	uint8_t rx_block_i;    /*!< Bytes in the block buffer */
+	uint8_t rx_block_len;  /*!< Length of the current Rx block (data + parity) */
+	uint32_t rx_remain;    /*!< Data (payload + checksum) still to be received */
+	bool rx_corrected;     /*!< Errors were corrected in the frame being received */
+	bool rx_failed;        /*!< A block of the frame being received couldn't be corrected */
+
+	uint32_t corrected;     /*!< Received frames with corrected errors */
+	uint32_t uncorrectable; /*!< Received frames with too many errors to correct */
+	uint32_t byte_errors;   /*!< Total number of corrected bytes (incl. header nibbles) */
+
+#if SBMP_FEC_SIMD
+	/** Multiplication tables for the vectorised syndromes - (alpha^16j * x), split to nibbles */
+	uint8_t syn_tab[SBMP_FEC_MAX_PARITY][2][16] __attribute__((aligned(16)));
+#endif
+} SBMP_Fec;
+
+
+/**
+ * @brief Initialize the FEC codec.
+ *
+ * @param fec    : codec struct, NULL to allocate
+ * @param block  : Rx block buffer (SBMP_FEC_BLOCK_MAX bytes), NULL to allocate
+ * @param parity : parity bytes per block (even, 2 - SBMP_FEC_MAX_PARITY)
+ * @return the codec (allocated if fec was NULL), NULL on failure
+ */
+SBMP_Fec *sbmp_fec_init(SBMP_Fec *fec, uint8_t *block, uint8_t parity);
+
+/**
+ * @brief Get the data length of a block
+ * @param parity : parity bytes per block
+ * @return data bytes per full block
+ */
+static inline uint8_t sbmp_fec_block_data_len(uint8_t parity)
+{
+	return (uint8_t)(SBMP_FEC_BLOCK_MAX - parity);
+}
+
+/**
+ * @brief Clear the encoder register before a block
+ * @param fec : codec
+ * @param reg : parity register, fec->parity long
+ */
+void sbmp_fec_encode_begin(const SBMP_Fec *fec, uint8_t *reg);
+
+/**
+ * @brief Add a data byte to the block being encoded.
+ *
+ * When the block is done, the register contains the parity bytes to send.
+ *
+ * @param fec  : codec
+ * @param reg  : parity register
+ * @param byte : data byte
+ */
+void sbmp_fec_encode_byte(const SBMP_Fec *fec, uint8_t *reg, uint8_t byte);
+
+/**
+ * @brief Correct a received block in place.
+ *
+ * @param fec    : codec
+ * @param block  : the block (data + parity)
+ * @param len    : block length
+ * @param parity : number of parity bytes at the end of the block
+ * @return number of corrected bytes, -1 if there are too many errors
+ */
+int sbmp_fec_decode(SBMP_Fec *fec, uint8_t *block, uint16_t len, uint8_t parity);
+
+/**
+ * @brief Encode a nibble with the Hamming (8,4) code
+ * @param nibble : value to encode (0-15)
+ * @return code byte
+ */
+uint8_t sbmp_fec_hamming_encode(uint8_t nibble);
+
+/**
+ * @brief Decode a Hamming (8,4) code byte, correcting a single bit error.
+ * @param code : received code byte
+ * @return the nibble (0-15), or 0xFF if two bits are damaged
+ */
+uint8_t sbmp_fec_hamming_decode(uint8_t code);
+
+#endif /* SBMP_HAS_FEC */
+#endif // SBMP_FEC_H
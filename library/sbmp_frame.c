@@ -9,6 +9,7 @@
 
 // protos
 static void call_frame_rx_callback(SBMP_FrmInst *frm);
+static void end_frame(SBMP_FrmInst *frm);
 
 
 /** Allocate the state struct & init all fields */
@@ -54,7 +55,25 @@ SBMP_FrmInst *sbmp_frm_init(
 
 	frm->user_token = NULL; // NULL if not set
 
+	frm->rx_errors = 0;
+	frm->tx_capture = NULL;
+	frm->tx_prefix = NULL;
+
+#if SBMP_HAS_FEC
+	frm->fec = NULL;
+	frm->tx_fec = false;
+#endif
+
+#if SBMP_HAS_CAPTURE
+	frm->capture = NULL;
+	frm->capture_buf = NULL;
+	frm->capture_size = 0;
+#endif
+
 	frm->tx_func = tx_func;
+	frm->tx_out = NULL;
+	frm->tx_end = NULL;
+	frm->tx_token = NULL;
 
 	frm->rx_enabled = false;
 	frm->tx_enabled = false;
@@ -64,6 +83,39 @@ SBMP_FrmInst *sbmp_frm_init(
 	return frm;
 }
 
+#if SBMP_HAS_FEC
+/** Enable forward error correction */
+bool sbmp_frm_init_fec(SBMP_FrmInst *frm, SBMP_Fec *fec, uint8_t *block, uint8_t parity)
+{
+	fec = sbmp_fec_init(fec, block, parity);
+	if (fec == NULL) {
+		sbmp_error("FEC init failed.");
+		return false;
+	}
+
+	frm->fec = fec;
+	frm->tx_fec = true;
+	return true;
+}
+
+/** Enable or disable sending FEC frames */
+void sbmp_frm_enable_fec_tx(SBMP_FrmInst *frm, bool enable)
+{
+	frm->tx_fec = enable && frm->fec != NULL;
+}
+#endif
+
+#if SBMP_HAS_CAPTURE
+/** Set the frame capture hook */
+void sbmp_frm_set_capture(SBMP_FrmInst *frm, SBMP_FrmCaptureFunc func, void *token, uint8_t *tx_buf, uint16_t tx_size)
+{
+	frm->capture = func;
+	frm->capture_token = token;
+	frm->capture_buf = tx_buf;
+	frm->capture_size = (tx_buf == NULL ? 0 : tx_size);
+}
+#endif
+
 /** Reset the internal state */
 void sbmp_frm_reset(SBMP_FrmInst *frm)
 {
@@ -96,16 +148,32 @@ void sbmp_frm_set_user_token(SBMP_FrmInst *frm, void *token)
 	frm->user_token = token;
 }
 
+/** Set the frame prefix function */
+void sbmp_frm_set_tx_prefix(SBMP_FrmInst *frm, SBMP_FrmPrefixFunc func)
+{
+	frm->tx_prefix = func;
+}
+
+/** Set the output functions with a context */
+void sbmp_frm_set_tx_output(SBMP_FrmInst *frm, SBMP_FrmTxOutFunc out, SBMP_FrmTxEndFunc end, void *token)
+{
+	frm->tx_out = out;
+	frm->tx_end = end;
+	frm->tx_token = token;
+}
+
 /** Reset the receiver state  */
 void sbmp_frm_reset_rx(SBMP_FrmInst *frm)
 {
 	frm->rx_buffer_i = 0;
 	frm->rx_length = 0;
+	frm->rx_discard = 0;
 	frm->mb_buf = 0;
 	frm->mb_cnt = 0;
 	frm->rx_hdr_xor = 0;
 	frm->rx_cksum_scratch = 0;
 	frm->rx_cksum_type = SBMP_CKSUM_NONE;
+	frm->rx_flags = 0;
 	frm->rx_status = FRM_STATE_IDLE;
 //	printf("---- RX RESET STATE ----\n");
 }
@@ -117,6 +185,7 @@ void sbmp_frm_reset_tx(SBMP_FrmInst *frm)
 	frm->tx_remain = 0;
 	frm->tx_cksum_scratch = 0;
 	frm->tx_cksum_type = SBMP_CKSUM_NONE;
+	frm->tx_capture = NULL;
 //	printf("---- TX RESET STATE ----\n");
 }
 
@@ -163,11 +232,222 @@ static void call_frame_rx_callback(SBMP_FrmInst *frm)
 	frm->rx_handler(frm->rx_buffer, frm->rx_length, frm->user_token);
 }
 
+#if SBMP_HAS_CAPTURE
+/** Pass a complete received frame to the capture hook */
+static void capture_rx(SBMP_FrmInst *frm, bool valid, bool fec, bool fec_corrected)
+{
+	if (frm->capture == NULL) return;
+
+	SBMP_FrmCapture cap = {
+		.tx = false,
+		.valid = valid,
+		.fec = fec,
+		.fec_corrected = fec_corrected,
+		.cksum_type = frm->rx_cksum_type,
+		.flags = frm->rx_flags,
+		.cksum = (frm->rx_cksum_type == SBMP_CKSUM_NONE ? 0 : frm->mb_buf),
+		.length = frm->rx_length,
+		.captured = frm->rx_length,
+		.payload = frm->rx_buffer,
+	};
+
+	frm->capture(&cap, frm->capture_token);
+}
+
+/** Copy a sent payload byte for the capture hook */
+static inline
+void capture_tx_byte(SBMP_FrmInst *frm, uint8_t byte)
+{
+	if (frm->capture_i < frm->capture_size) frm->capture_buf[frm->capture_i] = byte;
+	frm->capture_i++;
+}
+
+/** Pass a sent frame to the capture hook */
+static void capture_tx(SBMP_FrmInst *frm, uint32_t cksum)
+{
+	if (frm->capture == NULL) return;
+
+	SBMP_FrmCapture cap = {
+		.tx = true,
+		.valid = true,
+		.fec_corrected = false,
+#if SBMP_HAS_FEC
+		.fec = frm->tx_fec,
+#else
+		.fec = false,
+#endif
+		.cksum_type = frm->tx_cksum_type,
+		.flags = frm->capture_flags,
+		.cksum = cksum,
+		.length = frm->capture_len,
+		.captured = (frm->capture_len < frm->capture_size ? frm->capture_len : frm->capture_size),
+		.payload = frm->capture_buf,
+	};
+
+	frm->capture(&cap, frm->capture_token);
+}
+#endif
+
+#if SBMP_HAS_FEC
+
+/** Start of a FEC frame */
+#define FEC_SOF 0x02
+
+/** Header bytes of a FEC frame (cksum type & flags, length, parity, xor), each sent as 2 code bytes */
+#define FEC_HEADER_LEN 5
+
+/** Start receiving the next FEC block */
+static void fec_next_block(SBMP_Fec *fec)
+{
+	uint8_t data_len = sbmp_fec_block_data_len(fec->rx_parity);
+	if (fec->rx_remain < data_len) data_len = (uint8_t) fec->rx_remain;
+
+	fec->rx_block_i = 0;
+	fec->rx_block_len = (uint8_t)(data_len + fec->rx_parity);
+}
+
+/** Receive a byte of the Hamming-coded FEC frame header */
+static void fec_receive_header(SBMP_FrmInst *frm, uint8_t rxbyte)
+{
+	SBMP_Fec *fec = frm->fec;
+
+	uint8_t nibble = sbmp_fec_hamming_decode(rxbyte);
+	if (nibble == 0xFF) {
+		sbmp_error("FEC header damaged!");
+		frm->rx_errors++;
+		fec->uncorrectable++;
+		sbmp_frm_reset_rx(frm); // abort
+		return;
+	}
+
+	if (sbmp_fec_hamming_encode(nibble) != rxbyte) {
+		fec->byte_errors++;
+		fec->rx_corrected = true;
+	}
+
+	// header bytes are collected in the block buffer, low nibble first
+	uint8_t *hdr = fec->block;
+	if ((frm->mb_cnt & 1) == 0) {
+		hdr[frm->mb_cnt / 2] = nibble;
+	} else {
+		hdr[frm->mb_cnt / 2] |= (uint8_t)(nibble << 4);
+	}
+
+	if (++frm->mb_cnt < FEC_HEADER_LEN * 2) return;
+
+	if ((FEC_SOF ^ hdr[0] ^ hdr[1] ^ hdr[2] ^ hdr[3]) != hdr[4]) {
+		sbmp_error("Header XOR mismatch!");
+		frm->rx_errors++;
+		sbmp_frm_reset_rx(frm); // abort
+		return;
+	}
+
+	frm->rx_cksum_type = hdr[0] & ~SBMP_FRM_FLAGS_MASK;
+	frm->rx_flags = hdr[0] & SBMP_FRM_FLAGS_MASK;
+	frm->rx_length = (uint16_t)(hdr[1] | (hdr[2] << 8));
+	fec->rx_parity = hdr[3];
+
+	if (frm->rx_length == 0 || fec->rx_parity < 2 || fec->rx_parity > SBMP_FEC_MAX_PARITY) {
+		sbmp_error("Bad FEC frame header!");
+		frm->rx_errors++;
+		sbmp_frm_reset_rx(frm); // abort
+		return;
+	}
+
+	fec->rx_remain = frm->rx_length + chksum_length(frm->rx_cksum_type);
+
+	// Check if not too long
+	if (frm->rx_length > frm->rx_buffer_cap) {
+		sbmp_error("Rx packet too long - %"PRIu16"!", (uint16_t)frm->rx_length);
+
+		// discard all blocks
+		uint8_t data_len = sbmp_fec_block_data_len(fec->rx_parity);
+		uint32_t blocks = (fec->rx_remain + data_len - 1) / data_len;
+
+		frm->rx_status = FRM_STATE_DISCARD;
+		frm->rx_discard = fec->rx_remain + blocks * fec->rx_parity;
+		return;
+	}
+
+	frm->mb_buf = 0;
+	frm->mb_cnt = 0;
+	cksum_begin(frm->rx_cksum_type, &frm->rx_cksum_scratch);
+
+	fec_next_block(fec);
+	frm->rx_status = FRM_STATE_FEC_DATA;
+}
+
+/** Receive a byte of a FEC block; correct the block when complete and pass on its data */
+static void fec_receive_data(SBMP_FrmInst *frm, uint8_t rxbyte)
+{
+	SBMP_Fec *fec = frm->fec;
+
+	fec->block[fec->rx_block_i++] = rxbyte;
+	if (fec->rx_block_i < fec->rx_block_len) return;
+
+	uint8_t data_len = (uint8_t)(fec->rx_block_len - fec->rx_parity);
+
+	int fixed = sbmp_fec_decode(fec, fec->block, fec->rx_block_len, fec->rx_parity);
+	if (fixed < 0) {
+		fec->rx_failed = true; // keep going, the checksum decides
+	} else if (fixed > 0) {
+		fec->rx_corrected = true;
+	}
+
+	for (uint8_t i = 0; i < data_len; i++) {
+		uint8_t b = fec->block[i];
+
+		if (frm->rx_buffer_i < frm->rx_length) {
+			append_rx_byte(frm, b);
+			cksum_update(frm->rx_cksum_type, &frm->rx_cksum_scratch, b);
+		} else {
+			set_byte(&frm->mb_buf, frm->mb_cnt++, b);
+		}
+	}
+
+	fec->rx_remain -= data_len;
+	if (fec->rx_remain > 0) {
+		fec_next_block(fec);
+		return;
+	}
+
+	// frame complete
+	bool ok;
+	if (frm->rx_cksum_type == SBMP_CKSUM_NONE) {
+		ok = !fec->rx_failed;
+	} else {
+		ok = cksum_verify(frm->rx_cksum_type, &frm->rx_cksum_scratch, frm->mb_buf);
+		if (!ok) {
+			sbmp_error("Rx checksum mismatch!");
+			frm->rx_errors++;
+		}
+	}
+
+	if (fec->rx_failed) {
+		fec->uncorrectable++;
+	} else if (ok && fec->rx_corrected) {
+		fec->corrected++;
+	}
+
+#if SBMP_HAS_CAPTURE
+	capture_rx(frm, ok, true, fec->rx_corrected);
+#endif
+
+	if (ok) call_frame_rx_callback(frm);
+
+	// clear, enter IDLE
+	sbmp_frm_reset_rx(frm);
+}
+
+#endif /* SBMP_HAS_FEC */
+
 /**
  * @brief Receive a byte
  *
  * SOF 8 | CKSUM_TYPE 8 | LEN 16 | PAYLOAD | CKSUM 0/4
  *
+ * With FEC: SOF 8 | HEADER 80 (Hamming) | BLOCKS (data + parity)
+ *
  * @param state
  * @param rxbyte
  * @return status
@@ -193,6 +473,13 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 				hdrxor_update(frm, rxbyte);
 
 				frm->rx_status = FRM_STATE_CKSUM_TYPE;
+#if SBMP_HAS_FEC
+			} else if (rxbyte == FEC_SOF && frm->fec != NULL) {
+				frm->mb_cnt = 0;
+				frm->fec->rx_corrected = false;
+				frm->fec->rx_failed = false;
+				frm->rx_status = FRM_STATE_FEC_HEADER;
+#endif
 			} else {
 				// bad char
 				retval = SBMP_RX_INVALID;
@@ -200,7 +487,8 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 			break;
 
 		case FRM_STATE_CKSUM_TYPE:
-			frm->rx_cksum_type = rxbyte; // checksum type received
+			frm->rx_cksum_type = rxbyte & ~SBMP_FRM_FLAGS_MASK; // checksum type received
+			frm->rx_flags = rxbyte & SBMP_FRM_FLAGS_MASK;
 
 			hdrxor_update(frm, rxbyte);
 
@@ -237,6 +525,7 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 		case FRM_STATE_HDRXOR:
 			if (! hdrxor_verify(frm, rxbyte)) {
 				sbmp_error("Header XOR mismatch!");
+				frm->rx_errors++;
 				sbmp_frm_reset_rx(frm); // abort
 				break;
 			}
@@ -246,7 +535,7 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 				sbmp_error("Rx packet too long - %"PRIu16"!", (uint16_t)frm->rx_length);
 				// discard the rest + checksum
 				frm->rx_status = FRM_STATE_DISCARD;
-				frm->rx_length += chksum_length(frm->rx_cksum_type);
+				frm->rx_discard = (uint32_t) frm->rx_length + chksum_length(frm->rx_cksum_type);
 				break;
 			}
 
@@ -255,8 +544,7 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 			break;
 
 		case FRM_STATE_DISCARD:
-			frm->rx_buffer_i++;
-			if (frm->rx_buffer_i == frm->rx_length) {
+			if (--frm->rx_discard == 0) {
 				// done
 				sbmp_frm_reset_rx(frm); // go IDLE
 			}
@@ -278,6 +566,9 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 					frm->mb_cnt = 0;
 				} else {
 					// no checksum
+#if SBMP_HAS_CAPTURE
+					capture_rx(frm, true, false, false);
+#endif
 					// fire the callback
 					call_frame_rx_callback(frm);
 
@@ -294,23 +585,113 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte)
 			// if last of the MB field
 			if (frm->mb_cnt == chksum_length(frm->rx_cksum_type)) {
 
-				if (cksum_verify(frm->rx_cksum_type, &frm->rx_cksum_scratch, frm->mb_buf)) {
+				bool ok = cksum_verify(frm->rx_cksum_type, &frm->rx_cksum_scratch, frm->mb_buf);
+
+#if SBMP_HAS_CAPTURE
+				capture_rx(frm, ok, false, false);
+#endif
+
+				if (ok) {
 					call_frame_rx_callback(frm);
 				} else {
 					sbmp_error("Rx checksum mismatch!");
+					frm->rx_errors++;
 				}
 
 				// clear, enter IDLE
 				sbmp_frm_reset_rx(frm);
 			}
 			break;
+
+#if SBMP_HAS_FEC
+		case FRM_STATE_FEC_HEADER:
+			fec_receive_header(frm, rxbyte);
+			break;
+
+		case FRM_STATE_FEC_DATA:
+			fec_receive_data(frm, rxbyte);
+			break;
+#else
+		default:
+			sbmp_frm_reset_rx(frm);
+			break;
+#endif
 	}
 
 	return retval;
 }
 
+/** Send a byte using the output function */
+static inline
+void tx_byte(SBMP_FrmInst *frm, uint8_t byte)
+{
+	if (frm->tx_out != NULL) {
+		frm->tx_out(byte, frm->tx_token);
+	} else {
+		frm->tx_func(byte);
+	}
+}
+
+/**
+ * Send a byte of the payload or checksum.
+ * With FEC, the parity is sent after each full block.
+ */
+static void tx_data_byte(SBMP_FrmInst *frm, uint8_t byte)
+{
+	tx_byte(frm, byte);
+
+#if SBMP_HAS_FEC
+	if (!frm->tx_fec) return;
+	SBMP_Fec *fec = frm->fec;
+
+	sbmp_fec_encode_byte(fec, fec->tx_reg, byte);
+
+	if (++fec->tx_count == sbmp_fec_block_data_len(fec->parity)) {
+		for (uint8_t i = 0; i < fec->parity; i++) {
+			tx_byte(frm, fec->tx_reg[i]);
+		}
+
+		fec->tx_count = 0;
+		sbmp_fec_encode_begin(fec, fec->tx_reg);
+	}
+#endif
+}
+
+#if SBMP_HAS_FEC
+/** Send a FEC frame header */
+static void tx_fec_header(SBMP_FrmInst *frm, uint8_t cksum_flags, uint16_t length)
+{
+	SBMP_Fec *fec = frm->fec;
+
+	uint8_t hdr[FEC_HEADER_LEN] = {
+		cksum_flags,
+		length & 0xFF,
+		(length >> 8) & 0xFF,
+		fec->parity,
+		0
+	};
+
+	hdr[4] = FEC_SOF ^ hdr[0] ^ hdr[1] ^ hdr[2] ^ hdr[3];
+
+	tx_byte(frm, FEC_SOF);
+	for (int i = 0; i < FEC_HEADER_LEN; i++) {
+		tx_byte(frm, sbmp_fec_hamming_encode(hdr[i] & 0x0F));
+		tx_byte(frm, sbmp_fec_hamming_encode(hdr[i] >> 4));
+	}
+
+	fec->tx_count = 0;
+	sbmp_fec_encode_begin(fec, fec->tx_reg);
+}
+#endif
+
 /** Send a frame header */
 bool sbmp_frm_start(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint16_t length)
+{
+	return sbmp_frm_start_flags(frm, cksum_type, 0, length);
+}
+
+/** Send a frame header, with flags */
+bool sbmp_frm_start_flags(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint8_t flags, uint16_t length)
 {
 	if (! frm->tx_enabled) {
 		sbmp_error("Can't tx, not enabled.");
@@ -322,7 +703,7 @@ bool sbmp_frm_start(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint16_t lengt
 		return false;
 	}
 
-	if (frm->tx_func == NULL) {
+	if (frm->tx_func == NULL && frm->tx_out == NULL) {
 		sbmp_error("Can't tx, no tx func!");
 		return false;
 	}
@@ -332,6 +713,14 @@ bool sbmp_frm_start(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint16_t lengt
 		cksum_type = SBMP_CKSUM_XOR;
 	}
 
+	uint8_t prefix[SBMP_FRM_PREFIX_MAX];
+	uint8_t prefix_len = 0;
+
+	if (frm->tx_prefix != NULL) {
+		prefix_len = frm->tx_prefix(prefix, frm->user_token);
+		if (prefix_len > 0) flags |= SBMP_FRM_FLAG_CREDIT;
+	}
+
 	sbmp_frm_reset_tx(frm);
 
 	frm->tx_cksum_type = cksum_type;
@@ -340,25 +729,51 @@ bool sbmp_frm_start(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint16_t lengt
 
 	// Send the header
 
-	uint16_t len = (uint16_t) length;
+	uint16_t len = (uint16_t)(length + prefix_len);
 
-	uint8_t hdr[4] = {
-		0x01,
-		cksum_type,
-		len & 0xFF,
-		(len >> 8) & 0xFF
-	};
+#if SBMP_HAS_CAPTURE
+	frm->capture_i = 0;
+	frm->capture_len = len;
+	frm->capture_flags = flags & SBMP_FRM_FLAGS_MASK;
+#endif
 
-	uint8_t hdr_xor = 0;
-	for (int i = 0; i < 4; i++) {
-		hdr_xor ^= hdr[i];
-		frm->tx_func(hdr[i]);
-	}
+#if SBMP_HAS_FEC
+	if (frm->tx_fec) {
+		tx_fec_header(frm, cksum_type | (flags & SBMP_FRM_FLAGS_MASK), len);
+	} else
+#endif
+	{
+		uint8_t hdr[4] = {
+			0x01,
+			cksum_type | (flags & SBMP_FRM_FLAGS_MASK),
+			len & 0xFF,
+			(len >> 8) & 0xFF
+		};
+
+		uint8_t hdr_xor = 0;
+		for (int i = 0; i < 4; i++) {
+			hdr_xor ^= hdr[i];
+			tx_byte(frm, hdr[i]);
+		}
 
-	frm->tx_func(hdr_xor);
+		tx_byte(frm, hdr_xor);
+	}
 
 	cksum_begin(frm->tx_cksum_type, &frm->tx_cksum_scratch);
 
+	// the prefix is a part of the payload, but not of what the caller sends
+	for (uint8_t i = 0; i < prefix_len; i++) {
+		tx_data_byte(frm, prefix[i]);
+		cksum_update(frm->tx_cksum_type, &frm->tx_cksum_scratch, prefix[i]);
+#if SBMP_HAS_CAPTURE
+		capture_tx_byte(frm, prefix[i]);
+#endif
+	}
+
+	if (length == 0 && prefix_len > 0) {
+		end_frame(frm); // prefix only
+	}
+
 	return true;
 }
 
@@ -380,17 +795,37 @@ static void end_frame(SBMP_FrmInst *frm)
 
 		case SBMP_CKSUM_XOR:
 			// 1-byte checksum
-			frm->tx_func(cksum & 0xFF);
+			tx_data_byte(frm, cksum & 0xFF);
 			break;
 
 		case SBMP_CKSUM_CRC32:
-			frm->tx_func(cksum & 0xFF);
-			frm->tx_func((cksum >> 8) & 0xFF);
-			frm->tx_func((cksum >> 16) & 0xFF);
-			frm->tx_func((cksum >> 24) & 0xFF);
+			tx_data_byte(frm, cksum & 0xFF);
+			tx_data_byte(frm, (cksum >> 8) & 0xFF);
+			tx_data_byte(frm, (cksum >> 16) & 0xFF);
+			tx_data_byte(frm, (cksum >> 24) & 0xFF);
 	}
 
+#if SBMP_HAS_FEC
+	// parity of the last (short) block
+	SBMP_Fec *fec = frm->fec;
+	if (frm->tx_fec && fec->tx_count > 0) {
+		for (uint8_t i = 0; i < fec->parity; i++) {
+			tx_byte(frm, fec->tx_reg[i]);
+		}
+		fec->tx_count = 0;
+	}
+#endif
+
+#if SBMP_HAS_CAPTURE
+	capture_tx(frm, cksum);
+#endif
+
+	frm->tx_capture = NULL;
 	frm->tx_status = FRM_STATE_IDLE; // tx done
+
+	if (frm->tx_end != NULL) {
+		frm->tx_end(frm->tx_token);
+	}
 }
 
 /** Send a byte in the currently open frame */
@@ -405,8 +840,12 @@ bool sbmp_frm_send_byte(SBMP_FrmInst *frm, uint8_t byte)
 		return false;
 	}
 
-	frm->tx_func(byte);
+	tx_data_byte(frm, byte);
 	cksum_update(frm->tx_cksum_type, &frm->tx_cksum_scratch, byte);
+	if (frm->tx_capture != NULL) *frm->tx_capture++ = byte;
+#if SBMP_HAS_CAPTURE
+	capture_tx_byte(frm, byte);
+#endif
 	frm->tx_remain--;
 
 	//  this was the last bute of the frame payload
@@ -16,6 +16,7 @@
 
 #include "sbmp_config.h"
 #include "sbmp_checksum.h"
+#include "sbmp_fec.h"
 
 /**
  * Status returned from the byte rx function.
@@ -27,6 +28,71 @@ typedef enum {
 	SBMP_RX_DISABLED, /*!< The byte was rejected, because the frame parser is not enabled yet. */
 } SBMP_RxStatus;
 
+/**
+ * Frame flags, sent in the top bits of the checksum type byte.
+ * Only used if both parties support them (negotiated in the handshake).
+ */
+#define SBMP_FRM_FLAGS_MASK    0xC0
+#define SBMP_FRM_FLAG_RELIABLE 0x80 /*!< Payload starts with a reliable mode header (see sbmp_reliable.h) */
+#define SBMP_FRM_FLAG_CREDIT   0x40 /*!< Payload starts with a flow control header (see sbmp_credit.h) */
+
+/** Max length of a frame prefix */
+#define SBMP_FRM_PREFIX_MAX 4
+
+/**
+ * Frame prefix function, called when a frame is started.
+ *
+ * The returned bytes are sent before the payload (counted in the frame length),
+ * and the frame gets the SBMP_FRM_FLAG_CREDIT flag. Used by the flow control.
+ *
+ * @param buf   : buffer for the prefix, SBMP_FRM_PREFIX_MAX bytes
+ * @param token : the user token
+ * @return prefix length, 0 = none
+ */
+typedef uint8_t (*SBMP_FrmPrefixFunc)(uint8_t *buf, void *token);
+
+/**
+ * Byte output with a context, an alternative to tx_func (see sbmp_frm_set_tx_output()).
+ *
+ * @param byte  : byte to send
+ * @param token : the output token
+ */
+typedef void (*SBMP_FrmTxOutFunc)(uint8_t byte, void *token);
+
+/**
+ * Called after the last byte of each sent frame (eg. to flush a buffer).
+ *
+ * @param token : the output token
+ */
+typedef void (*SBMP_FrmTxEndFunc)(void *token);
+
+#if SBMP_HAS_CAPTURE
+/** A frame passed to the capture hook */
+typedef struct {
+	bool tx;                   /*!< Sent by us (else received) */
+	bool valid;                /*!< Checksum verdict (always true for sent frames) */
+	bool fec;                  /*!< Sent / received as a FEC frame */
+	bool fec_corrected;        /*!< Received FEC frame that needed correcting */
+	SBMP_CksumType cksum_type; /*!< Checksum type */
+	uint8_t flags;             /*!< Frame flags (SBMP_FRM_FLAG_*) */
+	uint32_t cksum;            /*!< The checksum (as received, for received frames) */
+	uint16_t length;           /*!< Payload length */
+	uint16_t captured;         /*!< Bytes in `payload` - less than length if a sent frame didn't fit in the capture buffer */
+	const uint8_t *payload;    /*!< Payload, including the frame prefix */
+} SBMP_FrmCapture;
+
+/**
+ * Frame capture hook.
+ *
+ * Called for each received frame (after the checksum is verified, before the Rx handler),
+ * and for each sent frame after its last byte. Must not send anything.
+ *
+ * @param frame : the frame, valid only during the call
+ * @param token : the capture token
+ */
+typedef void (*SBMP_FrmCaptureFunc)(const SBMP_FrmCapture *frame, void *token);
+#endif
+
 /** SBMP internal state (context). Allows having multiple SBMP interfaces. */
 typedef struct SBMP_FrmInstance_struct SBMP_FrmInst;
 
@@ -62,6 +128,78 @@ SBMP_FrmInst *sbmp_frm_init(
  */
 void sbmp_frm_set_user_token(SBMP_FrmInst *frm, void *token);
 
+/**
+ * @brief Set the frame prefix function.
+ *
+ * With a prefix, a frame can be started with zero length - it then
+ * contains only the prefix, and is closed right away.
+ *
+ * @param frm  : Framing layer instance
+ * @param func : prefix function, NULL = none
+ */
+void sbmp_frm_set_tx_prefix(SBMP_FrmInst *frm, SBMP_FrmPrefixFunc func);
+
+/**
+ * @brief Set the output functions with a context.
+ *
+ * If `out` is set, it's used instead of tx_func. This allows several
+ * instances to share the output code (eg. a buffered file descriptor,
+ * see sbmp_transport_posix.h). `end` is called when a frame is complete,
+ * so the output can be sent in one piece.
+ *
+ * @param frm   : Framing layer instance
+ * @param out   : byte output, NULL = use tx_func
+ * @param end   : frame end function, NULL = none
+ * @param token : passed to the functions
+ */
+void sbmp_frm_set_tx_output(SBMP_FrmInst *frm, SBMP_FrmTxOutFunc out, SBMP_FrmTxEndFunc end, void *token);
+
+#if SBMP_HAS_FEC
+/**
+ * @brief Enable forward error correction.
+ *
+ * Sent frames are then protected by FEC (see sbmp_fec.h), at the cost of
+ * the parity bytes and a longer header. Received FEC frames are corrected
+ * before the checksum is verified; plain frames are still accepted.
+ *
+ * Both parties must support FEC. Statistics are kept in frm->fec.
+ *
+ * @param frm    : Framing layer instance
+ * @param fec    : FEC state, NULL to allocate
+ * @param block  : block buffer (SBMP_FEC_BLOCK_MAX bytes), NULL to allocate
+ * @param parity : parity bytes per 255-byte block (even, max SBMP_FEC_MAX_PARITY);
+ *                 corrects up to parity/2 damaged bytes per block
+ * @return success
+ */
+bool sbmp_frm_init_fec(SBMP_FrmInst *frm, SBMP_Fec *fec, uint8_t *block, uint8_t parity);
+
+/**
+ * @brief Enable or disable sending FEC frames (enabled by sbmp_frm_init_fec()).
+ *
+ * With Tx disabled, FEC frames are still received.
+ *
+ * @param frm    : Framing layer instance
+ * @param enable : send FEC frames
+ */
+void sbmp_frm_enable_fec_tx(SBMP_FrmInst *frm, bool enable);
+#endif
+
+#if SBMP_HAS_CAPTURE
+/**
+ * @brief Set the frame capture hook (eg. to record the traffic, see sbmp_pcap.h).
+ *
+ * Sent payloads are collected in the given buffer (the payload isn't kept
+ * anywhere else); longer frames are passed truncated.
+ *
+ * @param frm      : Framing layer instance
+ * @param func     : capture hook, NULL = disable
+ * @param token    : passed to the hook
+ * @param tx_buf   : buffer for the sent payloads, NULL = don't capture the payload
+ * @param tx_size  : buffer size
+ */
+void sbmp_frm_set_capture(SBMP_FrmInst *frm, SBMP_FrmCaptureFunc func, void *token, uint8_t *tx_buf, uint16_t tx_size);
+#endif
+
 /**
  * @brief Reset the SBMP frm state, discard partial messages (both rx and tx).
  * @param frm : Framing layer instance
@@ -114,6 +252,17 @@ SBMP_RxStatus sbmp_frm_receive(SBMP_FrmInst *frm, uint8_t rxbyte);
  */
 bool sbmp_frm_start(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint16_t length);
 
+/**
+ * @brief Start a frame transmission, with frame flags
+ *
+ * @param frm        : Framing layer instance
+ * @param cksum_type : checksum to use (0, 32)
+ * @param flags      : frame flags (SBMP_FRM_FLAG_*)
+ * @param length     : payload length
+ * @return true if frame was started.
+ */
+bool sbmp_frm_start_flags(SBMP_FrmInst *frm, SBMP_CksumType cksum_type, uint8_t flags, uint16_t length);
+
 /**
  * @brief Send one byte in the open frame.
  *
@@ -150,9 +299,11 @@ enum SBMP_FrmStatus {
 	FRM_STATE_LENGTH,       /*!< Rx, waiting for payload length (2 bytes) */
 	FRM_STATE_HDRXOR,       /*!< Rx, waiting for header XOR (1 byte) */
 	FRM_STATE_PAYLOAD,      /*!< Rx or Tx, payload rx/tx in progress. */
-	FRM_STATE_DISCARD,      /*!< Discard rx_length worth of bytes, then end */
+	FRM_STATE_DISCARD,      /*!< Discard rx_discard worth of bytes, then end */
 	FRM_STATE_CKSUM,        /*!< Rx, waiting for checksum (4 bytes) */
 	FRM_STATE_WAIT_HANDLER, /*!< Rx, waiting for rx callback to process the payload */
+	FRM_STATE_FEC_HEADER,   /*!< Rx, receiving a Hamming-coded FEC frame header */
+	FRM_STATE_FEC_DATA,     /*!< Rx, receiving FEC blocks (payload + checksum + parity) */
 };
 
 /**
@@ -178,10 +329,19 @@ struct SBMP_FrmInstance_struct {
 	uint16_t rx_buffer_cap; /*!< Buffer capacity */
 
 	uint16_t rx_length;     /*!< Total payload length */
+	uint32_t rx_discard;    /*!< Bytes left to discard (frame too long) */
 
 	SBMP_CksumType rx_cksum_type; /*!< Current packet's checksum type */
+	uint8_t rx_flags;       /*!< Current packet's frame flags */
 	uint32_t rx_cksum_scratch; /*!< crc aggregation field for received data */
 
+	uint32_t rx_errors;     /*!< Number of damaged frames (header or checksum mismatch) */
+
+#if SBMP_HAS_FEC
+	SBMP_Fec *fec;          /*!< Forward error correction, NULL = disabled */
+	bool tx_fec;            /*!< Send FEC frames (else only receive them) */
+#endif
+
 	void (*rx_handler)(uint8_t *payload, uint16_t length, void *user_token); /*!< Message received handler */
 
 	void *user_token;    /*!< Arbitrary pointer set by the user. Passed to callbacks.
@@ -195,8 +355,24 @@ struct SBMP_FrmInstance_struct {
 
 	enum SBMP_FrmStatus tx_status;
 
+	uint8_t *tx_capture;    /*!< If set, the sent payload bytes are also copied here (for retransmission) */
+	SBMP_FrmPrefixFunc tx_prefix; /*!< Adds a header before the payload of sent frames, NULL = none */
+
+#if SBMP_HAS_CAPTURE
+	SBMP_FrmCaptureFunc capture;  /*!< Frame capture hook, NULL = disabled */
+	void *capture_token;          /*!< Passed to the capture hook */
+	uint8_t *capture_buf;         /*!< Copy of the sent payload, for the capture hook */
+	uint16_t capture_size;        /*!< Capture buffer size */
+	uint16_t capture_i;           /*!< Sent payload bytes seen so far */
+	uint16_t capture_len;         /*!< Payload length of the frame being sent */
+	uint8_t capture_flags;        /*!< Flags of the frame being sent */
+#endif
+
 	// output functions. Only tx_func is needed.
 	void (*tx_func)(uint8_t byte);  /*!< Function to send one byte */
+	SBMP_FrmTxOutFunc tx_out;       /*!< Byte output with a context, used instead of tx_func if set */
+	SBMP_FrmTxEndFunc tx_end;       /*!< Called after each sent frame, NULL = none */
+	void *tx_token;                 /*!< Passed to tx_out and tx_end */
 };
 
 // ------------------------------------
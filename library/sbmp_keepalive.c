@@ -0,0 +1,105 @@
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_keepalive.h"
+
+#if SBMP_HAS_KEEPALIVE
+
+#define HISTORY_MASK (SBMP_KA_HISTORY - 1)
+
+void sbmp_ka_init(SBMP_Keepalive *ka, SBMP_KaClockFunc clock, uint32_t interval, uint8_t max_missed)
+{
+	ka->clock = clock;
+	ka->interval = interval;
+	ka->max_missed = (max_missed == 0 ? 1 : max_missed);
+
+	ka->seq = 0;
+	ka->srtt = 0;
+	ka->rttvar = 0;
+	ka->sent = 0;
+	ka->lost = 0;
+
+	sbmp_ka_reset(ka);
+}
+
+void sbmp_ka_reset(SBMP_Keepalive *ka)
+{
+	ka->up = false;
+	ka->pending = false;
+	ka->awaiting = 0;
+	ka->missed = 0;
+
+	// send the first heartbeat right away
+	ka->sent_at[ka->seq & HISTORY_MASK] = (ka->clock != NULL ? ka->clock() - ka->interval : 0);
+}
+
+bool sbmp_ka_poll(SBMP_Keepalive *ka)
+{
+	if (ka->clock == NULL) return false;
+
+	uint32_t elapsed = ka->clock() - ka->sent_at[ka->seq & HISTORY_MASK];
+	if (elapsed < ka->interval) return false;
+
+	if (ka->pending) {
+		// the next one is due, and no echo yet
+		ka->pending = false;
+		ka->lost++;
+
+		if (ka->missed < 0xFF) ka->missed++;
+
+		if (ka->up && ka->missed >= ka->max_missed) {
+			sbmp_warn("Link down, %"PRIu8" heartbeats missed.", ka->missed);
+			ka->up = false;
+		}
+	}
+
+	return true;
+}
+
+void sbmp_ka_sent(SBMP_Keepalive *ka, uint8_t seq)
+{
+	ka->seq = seq;
+	ka->pending = true;
+	ka->awaiting |= (uint8_t)(1 << (seq & HISTORY_MASK));
+	ka->sent_at[seq & HISTORY_MASK] = ka->clock();
+	ka->sent++;
+}
+
+void sbmp_ka_echo(SBMP_Keepalive *ka, uint8_t seq)
+{
+	sbmp_ka_activity(ka);
+
+	uint8_t bit = (uint8_t)(1 << (seq & HISTORY_MASK));
+	uint8_t age = (uint8_t)(ka->seq - seq);
+	if (age >= SBMP_KA_HISTORY || !(ka->awaiting & bit)) return; // too old, or a duplicate
+
+	ka->awaiting &= (uint8_t)~bit;
+	if (age == 0) ka->pending = false;
+
+	// Jacobson / Karels, as in TCP (RFC 6298)
+	uint32_t rtt = ka->clock() - ka->sent_at[seq & HISTORY_MASK];
+	if (ka->srtt == 0) {
+		ka->srtt = rtt << 3;
+		ka->rttvar = rtt << 1;
+	} else {
+		int32_t err = (int32_t)rtt - (int32_t)(ka->srtt >> 3);
+		ka->srtt += err;
+
+		if (err < 0) err = -err;
+		ka->rttvar += err - (ka->rttvar >> 2);
+	}
+
+	if (ka->srtt == 0) ka->srtt = 1; // a sub-millisecond link
+}
+
+void sbmp_ka_activity(SBMP_Keepalive *ka)
+{
+	ka->missed = 0;
+
+	if (!ka->up && ka->clock != NULL) {
+		sbmp_info("Link up.");
+		ka->up = true;
+	}
+}
+
+#endif /* SBMP_HAS_KEEPALIVE */
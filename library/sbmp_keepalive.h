@@ -0,0 +1,129 @@
+#ifndef SBMP_KEEPALIVE_H
+#define SBMP_KEEPALIVE_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_KEEPALIVE
+
+/**
+ * Keepalive & link quality.
+ *
+ * The endpoint sends a heartbeat datagram (DG_HEARTBEAT, 1-byte sequence number)
+ * every `interval` ms, and the peer echoes it back (DG_HEARTBEAT_ECHO).
+ * The echoes give the round-trip time; a heartbeat not echoed before the next
+ * one is due counts as missed (but its echo is still used for the RTT if it
+ * comes later - each heartbeat has its own sequence number). After `max_missed` missed heartbeats in a row,
+ * the link is considered down. It's up again when anything is received.
+ *
+ * Peers echo heartbeats even without the keepalive enabled.
+ *
+ * Heartbeats and echoes are sent as plain frames, outside the reliable window and
+ * the flow control, so a blocked window doesn't hide a dead link. A heartbeat that
+ * can't be sent at all (Tx busy) is counted as sent, and missed if not echoed.
+ *
+ * This module only contains the logic (no I/O); use it through the endpoint
+ * (see sbmp_ep_init_keepalive()).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Clock function for the heartbeats.
+ * @return current time in milliseconds (can wrap around)
+ */
+typedef uint32_t (*SBMP_KaClockFunc)(void);
+
+/** Number of recent heartbeats whose echo is accepted (power of two, max 8) */
+#define SBMP_KA_HISTORY 4
+
+/** Keepalive state */
+typedef struct {
+	SBMP_KaClockFunc clock; /*!< Millisecond clock, NULL = disabled */
+	uint32_t interval;      /*!< Heartbeat interval (ms) */
+	uint8_t max_missed;     /*!< Missed heartbeats in a row before the link is down */
+
+	bool up;                /*!< Link state */
+	uint8_t seq;            /*!< Sequence number of the last heartbeat sent */
+	bool pending;           /*!< Waiting for the echo of the last heartbeat (not counted as missed yet) */
+	uint8_t awaiting;       /*!< Bit map of recent heartbeats not echoed yet, by seq % SBMP_KA_HISTORY */
+	uint32_t sent_at[SBMP_KA_HISTORY]; /*!< Times the recent heartbeats were sent, by seq % SBMP_KA_HISTORY */
+	uint8_t missed;         /*!< Missed heartbeats in a row */
+
+	uint32_t srtt;          /*!< Smoothed RTT (ms, scaled by 8), 0 = no sample yet */
+	uint32_t rttvar;        /*!< RTT variation (ms, scaled by 4) */
+
+	uint32_t sent;          /*!< Heartbeats sent (stats) */
+	uint32_t lost;          /*!< Heartbeats not echoed in time (stats) */
+} SBMP_Keepalive;
+
+
+/**
+ * @brief Initialize the keepalive state.
+ *
+ * @param ka         : state
+ * @param clock      : millisecond clock, NULL = disabled
+ * @param interval   : heartbeat interval (ms)
+ * @param max_missed : missed heartbeats in a row before the link is down (min 1)
+ */
+void sbmp_ka_init(SBMP_Keepalive *ka, SBMP_KaClockFunc clock, uint32_t interval, uint8_t max_missed);
+
+/**
+ * @brief Discard the link state (eg. on a handshake). RTT estimates are kept.
+ * @param ka : state
+ */
+void sbmp_ka_reset(SBMP_Keepalive *ka);
+
+/**
+ * @brief Check for a missed heartbeat & if a new one should be sent.
+ *
+ * @param ka : state
+ * @return true if a heartbeat should be sent now (call sbmp_ka_sent() when it is)
+ */
+bool sbmp_ka_poll(SBMP_Keepalive *ka);
+
+/**
+ * @brief Note a heartbeat was sent (or failed to send - it's then missed)
+ * @param ka  : state
+ * @param seq : its sequence number (ka->seq + 1)
+ */
+void sbmp_ka_sent(SBMP_Keepalive *ka, uint8_t seq);
+
+/**
+ * @brief Process a heartbeat echo from the peer.
+ *
+ * Echoes of heartbeats older than SBMP_KA_HISTORY are ignored.
+ *
+ * @param ka  : state
+ * @param seq : the echoed sequence number
+ */
+void sbmp_ka_echo(SBMP_Keepalive *ka, uint8_t seq);
+
+/**
+ * @brief Note something was received from the peer (the link is up).
+ * @param ka : state
+ */
+void sbmp_ka_activity(SBMP_Keepalive *ka);
+
+/**
+ * @brief Get the smoothed round-trip time
+ * @param ka : state
+ * @return RTT in ms, 0 if not measured yet
+ */
+static inline uint32_t sbmp_ka_rtt(const SBMP_Keepalive *ka)
+{
+	return ka->srtt >> 3;
+}
+
+/**
+ * @brief Get a timeout for requests, derived from the RTT (SRTT + 4 * RTTVAR, as in TCP)
+ * @param ka : state
+ * @return timeout in ms, 0 if the RTT wasn't measured yet
+ */
+static inline uint32_t sbmp_ka_timeout(const SBMP_Keepalive *ka)
+{
+	if (ka->srtt == 0) return 0;
+	return (ka->srtt >> 3) + ka->rttvar;
+}
+
+#endif /* SBMP_HAS_KEEPALIVE */
+#endif // SBMP_KEEPALIVE_H
@@ -0,0 +1,1053 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "sbmp_config.h"
+#include "sbmp_loop.h"
+
+#if SBMP_LOOP_HAS_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/** Events handled per epoll_wait() */
+#define MAX_EVENTS 64
+
+/** A registered transport */
+typedef struct {
+	SBMP_Transport *tp;         /*!< NULL = removed */
+	SBMP_LoopCloseFunc on_close;
+	void *arg;
+	bool want_out;              /*!< Waiting for the fd to become writable */
+
+#if SBMP_LOOP_HAS_URING
+	uint32_t ops;               /*!< io_uring requests in progress */
+	bool reading;               /*!< A read request is posted */
+	bool multishot;             /*!< ... and it's a multishot read */
+	bool writing;               /*!< The write buffer is being written */
+	uint8_t *wbuf;              /*!< Write buffer (in flight, or a spare one) */
+	size_t wsize;
+	size_t wlen;
+	size_t wpos;
+#endif
+} Port;
+
+typedef struct Uring_struct Uring;
+
+/** A timer (in the heap) */
+typedef struct {
+	uint64_t due;               /*!< Time of the next call (ms) */
+	uint32_t period;            /*!< 0 = one-shot */
+	uint32_t id;
+	SBMP_LoopTimerFunc func;
+	void *arg;
+} Timer;
+
+struct SBMP_Loop_struct {
+	int epfd;                   /*!< -1 with the io_uring backend */
+	Uring *ur;                  /*!< NULL with the epoll backend */
+
+	Port **ports;
+	size_t port_count;
+	size_t port_cap;
+	bool ports_removed;         /*!< Some ports need to be freed */
+
+	Timer *timers;              /*!< Binary heap, earliest first */
+	size_t timer_count;
+	size_t timer_cap;
+	uint32_t next_timer_id;
+
+	bool stop;
+	struct epoll_event events[MAX_EVENTS];
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint32_t sbmp_loop_clock_ms(void)
+{
+	return (uint32_t) now_ms();
+}
+
+uint32_t sbmp_loop_clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+#if SBMP_LOOP_HAS_URING
+static Uring *uring_create(void);
+static void uring_destroy(Uring *ur);
+static bool uring_add(SBMP_Loop *loop, Port *port);
+static void uring_remove(SBMP_Loop *loop, Port *port);
+static void uring_free_port(Port *port);
+static bool uring_wait(SBMP_Loop *loop, int timeout_ms);
+static void uring_drain(SBMP_Loop *loop);
+#endif
+
+SBMP_Loop *sbmp_loop_create(void)
+{
+	SBMP_Loop *loop = calloc(1, sizeof(SBMP_Loop));
+	if (loop == NULL) {
+		sbmp_error("No memory for the loop.");
+		return NULL;
+	}
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		sbmp_error("Can't create the epoll instance: %s", strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	loop->next_timer_id = 1;
+	return loop;
+}
+
+SBMP_Loop *sbmp_loop_create_uring(void)
+{
+#if SBMP_LOOP_HAS_URING
+	SBMP_Loop *loop = calloc(1, sizeof(SBMP_Loop));
+	if (loop == NULL) {
+		sbmp_error("No memory for the loop.");
+		return NULL;
+	}
+
+	loop->ur = uring_create();
+	if (loop->ur == NULL) {
+		free(loop);
+		return NULL;
+	}
+
+	loop->epfd = -1;
+	loop->next_timer_id = 1;
+	return loop;
+#else
+	sbmp_error("Built without io_uring.");
+	return NULL;
+#endif
+}
+
+// --- Transports ---
+
+bool sbmp_loop_add(SBMP_Loop *loop, SBMP_Transport *tp, SBMP_LoopCloseFunc on_close, void *arg)
+{
+	if (loop->port_count == loop->port_cap) {
+		size_t cap = loop->port_cap ? loop->port_cap * 2 : 16;
+		Port **ports = realloc(loop->ports, cap * sizeof(Port *));
+		if (ports == NULL) {
+			sbmp_error("No memory for the loop ports.");
+			return false;
+		}
+
+		loop->ports = ports;
+		loop->port_cap = cap;
+	}
+
+	Port *port = calloc(1, sizeof(Port));
+	if (port == NULL) {
+		sbmp_error("No memory for the loop ports.");
+		return false;
+	}
+
+	port->tp = tp;
+	port->on_close = on_close;
+	port->arg = arg;
+
+#if SBMP_LOOP_HAS_URING
+	if (loop->ur != NULL) {
+		if (!uring_add(loop, port)) {
+			free(port);
+			return false;
+		}
+
+		loop->ports[loop->port_count++] = port;
+		return true;
+	}
+#endif
+
+	if (!sbmp_tp_set_nonblock(tp, true)) {
+		free(port);
+		return false;
+	}
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = port};
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sbmp_tp_fd(tp), &ev) != 0) {
+		sbmp_error("Can't add fd %d to the loop: %s", sbmp_tp_fd(tp), strerror(errno));
+		free(port);
+		return false;
+	}
+
+	loop->ports[loop->port_count++] = port;
+	return true;
+}
+
+/** Remove a port from epoll; it's freed at the end of the loop turn */
+static void remove_port(SBMP_Loop *loop, Port *port)
+{
+#if SBMP_LOOP_HAS_URING
+	if (loop->ur != NULL) {
+		uring_remove(loop, port);
+	} else
+#endif
+	{
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, sbmp_tp_fd(port->tp), NULL);
+	}
+
+	port->tp = NULL;
+	loop->ports_removed = true;
+}
+
+void sbmp_loop_remove(SBMP_Loop *loop, SBMP_Transport *tp)
+{
+	for (size_t i = 0; i < loop->port_count; i++) {
+		if (loop->ports[i]->tp == tp) {
+			remove_port(loop, loop->ports[i]);
+			return;
+		}
+	}
+}
+
+/** EOF or an error - remove the port and tell the user */
+static void close_port(SBMP_Loop *loop, Port *port)
+{
+	SBMP_Transport *tp = port->tp;
+	remove_port(loop, port);
+
+	if (port->on_close != NULL) {
+		port->on_close(loop, tp, port->arg);
+	}
+}
+
+/** Free a port's memory */
+static void free_port(Port *port)
+{
+#if SBMP_LOOP_HAS_URING
+	uring_free_port(port);
+#endif
+	free(port);
+}
+
+/** Free the removed ports */
+static void compact_ports(SBMP_Loop *loop)
+{
+	size_t j = 0;
+	loop->ports_removed = false;
+
+	for (size_t i = 0; i < loop->port_count; i++) {
+		Port *port = loop->ports[i];
+
+#if SBMP_LOOP_HAS_URING
+		if (port->tp == NULL && port->ops > 0) {
+			// the kernel still uses it
+			loop->ports[j++] = port;
+			loop->ports_removed = true;
+			continue;
+		}
+#endif
+
+		if (port->tp == NULL) {
+			free_port(port);
+		} else {
+			loop->ports[j++] = port;
+		}
+	}
+
+	loop->port_count = j;
+}
+
+/** Read from a ready port */
+static void port_read(SBMP_Loop *loop, Port *port)
+{
+	for (int i = 0; i < SBMP_LOOP_READS_PER_TURN && port->tp != NULL; i++) {
+		ssize_t n = sbmp_tp_receive(port->tp);
+
+		if (n < 0) {
+			close_port(loop, port);
+			return;
+		}
+
+		if (n == 0) return; // nothing more now
+	}
+}
+
+/** Wait for the writable state of the ports with unsent data */
+static void update_out_interest(SBMP_Loop *loop)
+{
+	for (size_t i = 0; i < loop->port_count; i++) {
+		Port *port = loop->ports[i];
+		if (port->tp == NULL) continue;
+
+		bool pending = sbmp_tp_tx_pending(port->tp) > 0;
+		if (pending == port->want_out) continue;
+
+		struct epoll_event ev = {.events = EPOLLIN | (pending ? EPOLLOUT : 0), .data.ptr = port};
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, sbmp_tp_fd(port->tp), &ev) == 0) {
+			port->want_out = pending;
+		}
+	}
+}
+
+// --- Timers ---
+
+static void heap_swap(SBMP_Loop *loop, size_t a, size_t b)
+{
+	Timer t = loop->timers[a];
+	loop->timers[a] = loop->timers[b];
+	loop->timers[b] = t;
+}
+
+static void heap_up(SBMP_Loop *loop, size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (loop->timers[parent].due <= loop->timers[i].due) break;
+
+		heap_swap(loop, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(SBMP_Loop *loop, size_t i)
+{
+	while (true) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < loop->timer_count && loop->timers[l].due < loop->timers[min].due) min = l;
+		if (r < loop->timer_count && loop->timers[r].due < loop->timers[min].due) min = r;
+		if (min == i) break;
+
+		heap_swap(loop, i, min);
+		i = min;
+	}
+}
+
+static bool heap_push(SBMP_Loop *loop, const Timer *t)
+{
+	if (loop->timer_count == loop->timer_cap) {
+		size_t cap = loop->timer_cap ? loop->timer_cap * 2 : 16;
+		Timer *timers = realloc(loop->timers, cap * sizeof(Timer));
+		if (timers == NULL) {
+			sbmp_error("No memory for the loop timers.");
+			return false;
+		}
+
+		loop->timers = timers;
+		loop->timer_cap = cap;
+	}
+
+	loop->timers[loop->timer_count] = *t;
+	heap_up(loop, loop->timer_count++);
+	return true;
+}
+
+static void heap_remove(SBMP_Loop *loop, size_t i)
+{
+	loop->timers[i] = loop->timers[--loop->timer_count];
+
+	if (i < loop->timer_count) {
+		heap_down(loop, i);
+		heap_up(loop, i);
+	}
+}
+
+uint32_t sbmp_loop_timer(SBMP_Loop *loop, uint32_t delay_ms, uint32_t period, SBMP_LoopTimerFunc func, void *arg)
+{
+	Timer t = {
+		.due = now_ms() + delay_ms,
+		.period = period,
+		.id = loop->next_timer_id,
+		.func = func,
+		.arg = arg,
+	};
+
+	if (!heap_push(loop, &t)) return 0;
+
+	if (++loop->next_timer_id == 0) loop->next_timer_id = 1;
+	return t.id;
+}
+
+void sbmp_loop_cancel(SBMP_Loop *loop, uint32_t id)
+{
+	for (size_t i = 0; i < loop->timer_count; i++) {
+		if (loop->timers[i].id == id) {
+			heap_remove(loop, i);
+			return;
+		}
+	}
+}
+
+/** Run the due timers */
+static void run_timers(SBMP_Loop *loop)
+{
+	uint64_t now = now_ms();
+
+	while (loop->timer_count > 0 && loop->timers[0].due <= now) {
+		Timer t = loop->timers[0];
+
+		if (t.period > 0) {
+			// re-arm first, so the function can cancel it
+			loop->timers[0].due = (t.due + t.period > now) ? t.due + t.period : now + t.period;
+			heap_down(loop, 0);
+		} else {
+			heap_remove(loop, 0);
+		}
+
+		t.func(loop, t.arg);
+	}
+}
+
+/** Poll the enabled modes of an endpoint */
+static void poll_endpoint(SBMP_Loop *loop, void *arg)
+{
+	(void)loop;
+	SBMP_Endpoint *ep = arg;
+	(void)ep; // all the modes can be disabled in the config
+
+#if SBMP_HAS_RELIABLE
+	sbmp_ep_reliable_poll(ep);
+#endif
+#if SBMP_HAS_CREDIT
+	sbmp_ep_credit_poll(ep);
+#endif
+#if SBMP_HAS_KEEPALIVE
+	sbmp_ep_keepalive_poll(ep);
+#endif
+}
+
+uint32_t sbmp_loop_poll_endpoint(SBMP_Loop *loop, SBMP_Endpoint *ep, uint32_t period)
+{
+	return sbmp_loop_timer(loop, period, period, poll_endpoint, ep);
+}
+
+// --- Running ---
+
+/** Wait for the fd events and handle them */
+static bool epoll_dispatch(SBMP_Loop *loop, int timeout_ms)
+{
+	int n = epoll_wait(loop->epfd, loop->events, MAX_EVENTS, timeout_ms);
+	if (n < 0) {
+		if (errno != EINTR) {
+			sbmp_error("epoll_wait failed: %s", strerror(errno));
+			return false;
+		}
+		n = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		Port *port = loop->events[i].data.ptr;
+		uint32_t events = loop->events[i].events;
+
+		if (port->tp != NULL && (events & EPOLLOUT)) {
+			if (!sbmp_tp_flush(port->tp)) close_port(loop, port);
+		}
+
+		if (port->tp != NULL && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+			port_read(loop, port);
+		}
+	}
+
+	return true;
+}
+
+bool sbmp_loop_run_once(SBMP_Loop *loop, int timeout_ms)
+{
+	int wait = timeout_ms;
+
+	// data the parser couldn't take yet
+	for (size_t i = 0; i < loop->port_count; i++) {
+		if (loop->ports[i]->tp != NULL && sbmp_tp_rx_pending(loop->ports[i]->tp) > 0) {
+			wait = 0;
+			break;
+		}
+	}
+
+	if (wait != 0 && loop->timer_count > 0) {
+		uint64_t now = now_ms();
+		uint64_t due = loop->timers[0].due;
+		int until_timer = (due <= now) ? 0 : (int)((due - now) < 0x7FFFFFFF ? due - now : 0x7FFFFFFF);
+
+		if (wait < 0 || until_timer < wait) wait = until_timer;
+	}
+
+#if SBMP_LOOP_HAS_URING
+	if (loop->ur != NULL) {
+		if (!uring_wait(loop, wait)) return false;
+	} else
+#endif
+	{
+		if (!epoll_dispatch(loop, wait)) return false;
+	}
+
+	for (size_t i = 0; i < loop->port_count; i++) {
+		Port *port = loop->ports[i];
+		if (port->tp != NULL && sbmp_tp_rx_pending(port->tp) > 0) {
+			sbmp_tp_receive(port->tp);
+		}
+	}
+
+	run_timers(loop);
+
+	if (loop->ur == NULL) update_out_interest(loop);
+
+	if (loop->ports_removed) compact_ports(loop);
+
+	return true;
+}
+
+bool sbmp_loop_run(SBMP_Loop *loop)
+{
+	loop->stop = false;
+
+	while (!loop->stop) {
+		if (!sbmp_loop_run_once(loop, -1)) return false;
+	}
+
+	return true;
+}
+
+void sbmp_loop_stop(SBMP_Loop *loop)
+{
+	loop->stop = true;
+}
+
+void sbmp_loop_close(SBMP_Loop *loop)
+{
+#if SBMP_LOOP_HAS_URING
+	if (loop->ur != NULL) {
+		for (size_t i = 0; i < loop->port_count; i++) {
+			if (loop->ports[i]->tp != NULL) sbmp_tp_set_external_io(loop->ports[i]->tp, false);
+			loop->ports[i]->tp = NULL;
+		}
+
+		uring_drain(loop);
+		uring_destroy(loop->ur);
+	}
+#endif
+
+	for (size_t i = 0; i < loop->port_count; i++) {
+		free_port(loop->ports[i]);
+	}
+
+	if (loop->epfd >= 0) close(loop->epfd);
+	free(loop->ports);
+	free(loop->timers);
+	free(loop);
+}
+
+// --- io_uring backend ---
+
+#if SBMP_LOOP_HAS_URING
+
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49 // Linux 6.7, newer than some headers
+#endif
+
+/** Group ID of the receive buffers */
+#define URING_BGID 1
+
+/** Request types, in the low bits of user_data (next to the Port pointer) */
+#define OP_POLL 0
+#define OP_READ 1
+#define OP_WRITE 2
+#define OP_CANCEL 3
+#define OP_MASK 3
+
+struct Uring_struct {
+	int fd;
+	bool multishot;             /*!< Use multishot reads (cleared if the kernel doesn't know them) */
+
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	struct io_uring_sqe *sqes;
+	uint32_t to_submit;         /*!< Queued, not yet submitted entries */
+
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	size_t sqes_len;
+
+	struct io_uring_buf_ring *br; /*!< Ring of the receive buffers, shared with the kernel */
+	size_t br_len;
+	uint16_t br_tail;
+	uint8_t *bufs;              /*!< The receive buffers */
+};
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/** Give a receive buffer (back) to the kernel */
+static void uring_put_buffer(Uring *ur, uint16_t bid)
+{
+	struct io_uring_buf *buf = &ur->br->bufs[ur->br_tail & (SBMP_LOOP_URING_BUFFERS - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(ur->bufs + (size_t) bid * SBMP_LOOP_URING_BUF_SIZE);
+	buf->len = SBMP_LOOP_URING_BUF_SIZE;
+	buf->bid = bid;
+
+	ur->br_tail++;
+	__atomic_store_n(&ur->br->tail, ur->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_destroy(Uring *ur)
+{
+	if (ur->sqes != NULL && ur->sqes != MAP_FAILED) munmap(ur->sqes, ur->sqes_len);
+	if (ur->cq_map != NULL && ur->cq_map != MAP_FAILED && ur->cq_map != ur->sq_map) munmap(ur->cq_map, ur->cq_map_len);
+	if (ur->sq_map != NULL && ur->sq_map != MAP_FAILED) munmap(ur->sq_map, ur->sq_map_len);
+	if (ur->fd >= 0) close(ur->fd);
+
+	// after the ring is gone - the kernel doesn't write to the buffers anymore
+	if (ur->br != NULL && ur->br != MAP_FAILED) munmap(ur->br, ur->br_len);
+	free(ur->bufs);
+	free(ur);
+}
+
+static Uring *uring_create(void)
+{
+	Uring *ur = calloc(1, sizeof(Uring));
+	if (ur == NULL) {
+		sbmp_error("No memory for the loop.");
+		return NULL;
+	}
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = SBMP_LOOP_URING_ENTRIES * 4;
+
+	ur->fd = sys_uring_setup(SBMP_LOOP_URING_ENTRIES, &p);
+
+	if (ur->fd < 0 && errno == EINVAL) {
+		// no COOP_TASKRUN before Linux 5.19
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = SBMP_LOOP_URING_ENTRIES * 4;
+		ur->fd = sys_uring_setup(SBMP_LOOP_URING_ENTRIES, &p);
+	}
+
+	if (ur->fd < 0) {
+		sbmp_error("io_uring is not available: %s", strerror(errno));
+		free(ur);
+		return NULL;
+	}
+
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		sbmp_error("io_uring is too old (needs Linux 5.19).");
+		goto fail;
+	}
+
+	ur->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ur->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_map_len > ur->sq_map_len) ur->sq_map_len = ur->cq_map_len;
+		ur->cq_map_len = ur->sq_map_len;
+	}
+
+	ur->sq_map = mmap(NULL, ur->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ur->sq_map == MAP_FAILED) goto fail_map;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_map = ur->sq_map;
+	} else {
+		ur->cq_map = mmap(NULL, ur->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+		if (ur->cq_map == MAP_FAILED) goto fail_map;
+	}
+
+	ur->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) goto fail_map;
+
+	uint8_t *sq = ur->sq_map;
+	ur->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	ur->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	ur->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ur->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	ur->sq_entries = p.sq_entries;
+
+	uint8_t *cq = ur->cq_map;
+	ur->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	ur->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	ur->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// receive buffers, picked by the kernel as the data arrives
+	ur->br_len = SBMP_LOOP_URING_BUFFERS * sizeof(struct io_uring_buf);
+	ur->br = mmap(NULL, ur->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ur->bufs = malloc((size_t) SBMP_LOOP_URING_BUFFERS * SBMP_LOOP_URING_BUF_SIZE);
+	if (ur->br == MAP_FAILED || ur->bufs == NULL) {
+		sbmp_error("No memory for the io_uring buffers.");
+		goto fail;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t) ur->br;
+	reg.ring_entries = SBMP_LOOP_URING_BUFFERS;
+	reg.bgid = URING_BGID;
+
+	if (sys_uring_register(ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		sbmp_error("Can't register the io_uring buffers (needs Linux 5.19): %s", strerror(errno));
+		goto fail;
+	}
+
+	for (uint16_t i = 0; i < SBMP_LOOP_URING_BUFFERS; i++) {
+		uring_put_buffer(ur, i);
+	}
+
+	ur->multishot = true;
+	return ur;
+
+fail_map:
+	sbmp_error("Can't map the io_uring: %s", strerror(errno));
+fail:
+	uring_destroy(ur);
+	return NULL;
+}
+
+/**
+ * Submit the queued requests, and wait for a completion
+ * @param wait       : wait for a completion
+ * @param timeout_ms : max wait, -1 = forever
+ */
+static bool uring_enter(Uring *ur, bool wait, int timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+
+	unsigned flags = 0;
+	if (wait) {
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+		if (timeout_ms >= 0) {
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+			arg.ts = (uint64_t)(uintptr_t) &ts;
+		}
+	}
+
+	int n = sys_uring_enter(ur->fd, ur->to_submit, wait ? 1 : 0, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+	if (n < 0) {
+		if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) return true;
+
+		sbmp_error("io_uring_enter failed: %s", strerror(errno));
+		return false;
+	}
+
+	ur->to_submit -= (uint32_t) n;
+	return true;
+}
+
+/** Make room for n submission entries (submitting the queued ones if needed) */
+static bool uring_reserve(Uring *ur, uint32_t n)
+{
+	if (*ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) + n <= ur->sq_entries) return true;
+
+	uring_enter(ur, false, 0);
+
+	if (*ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) + n <= ur->sq_entries) return true;
+
+	sbmp_error("The io_uring is full.");
+	return false;
+}
+
+/** Get a submission entry (reserved with uring_reserve()) */
+static struct io_uring_sqe *uring_sqe(Uring *ur)
+{
+	uint32_t idx = *ur->sq_tail & ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[idx] = idx;
+
+	return sqe;
+}
+
+/** Queue the entry from uring_sqe() */
+static void uring_push(Uring *ur)
+{
+	__atomic_store_n(ur->sq_tail, *ur->sq_tail + 1, __ATOMIC_RELEASE);
+	ur->to_submit++;
+}
+
+/** Queue a poll, linked to the next request (it runs when the fd is ready) */
+static void uring_link_poll(Uring *ur, Port *port, uint32_t events)
+{
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sbmp_tp_fd(port->tp);
+	sqe->poll32_events = events;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = (uint64_t)(uintptr_t) port | OP_POLL;
+	uring_push(ur);
+
+	port->ops++;
+}
+
+/** Post a read - the kernel picks a buffer when the data arrives */
+static bool uring_post_read(Uring *ur, Port *port)
+{
+	if (!uring_reserve(ur, 2)) return false;
+
+	// a multishot read waits by itself, a single one would fail with EAGAIN
+	if (!ur->multishot) uring_link_poll(ur, port, POLLIN);
+
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	sqe->opcode = ur->multishot ? IORING_OP_READ_MULTISHOT : IORING_OP_READ;
+	sqe->fd = sbmp_tp_fd(port->tp);
+	sqe->off = (uint64_t) -1;
+	sqe->len = ur->multishot ? 0 : SBMP_LOOP_URING_BUF_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = (uint64_t)(uintptr_t) port | OP_READ;
+	uring_push(ur);
+
+	port->reading = true;
+	port->multishot = ur->multishot;
+	port->ops++;
+	return true;
+}
+
+/**
+ * Post a write of the rest of the write buffer
+ * @param poll : wait for the fd to become writable first
+ */
+static bool uring_post_write(Uring *ur, Port *port, bool poll)
+{
+	if (!uring_reserve(ur, 2)) return false;
+
+	if (poll) uring_link_poll(ur, port, POLLOUT);
+
+	struct io_uring_sqe *sqe = uring_sqe(ur);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = sbmp_tp_fd(port->tp);
+	sqe->off = (uint64_t) -1;
+	sqe->addr = (uint64_t)(uintptr_t)(port->wbuf + port->wpos);
+	sqe->len = (uint32_t)(port->wlen - port->wpos);
+	sqe->user_data = (uint64_t)(uintptr_t) port | OP_WRITE;
+	uring_push(ur);
+
+	port->ops++;
+	return true;
+}
+
+/** Take the finished frames from the transport and write them */
+static void uring_start_write(Uring *ur, Port *port)
+{
+	if (port->tp == NULL || port->writing) return;
+	if (!sbmp_tp_tx_swap(port->tp, &port->wbuf, &port->wsize, &port->wlen)) return;
+
+	port->wpos = 0;
+	port->writing = true;
+
+	if (!uring_post_write(ur, port, false)) {
+		sbmp_error("Frames lost on fd %d.", sbmp_tp_fd(port->tp));
+		port->writing = false;
+	}
+}
+
+static bool uring_add(SBMP_Loop *loop, Port *port)
+{
+	// otherwise a write to a full tty blocks the thread in io_uring_enter()
+	if (!sbmp_tp_set_nonblock(port->tp, true)) return false;
+
+	sbmp_tp_set_external_io(port->tp, true);
+
+	if (!uring_post_read(loop->ur, port)) {
+		sbmp_tp_set_external_io(port->tp, false);
+		return false;
+	}
+
+	return true;
+}
+
+static void uring_remove(SBMP_Loop *loop, Port *port)
+{
+	sbmp_tp_set_external_io(port->tp, false);
+
+	if (port->ops == 0) return;
+
+	// the read, and the write if any
+	if (!uring_reserve(loop->ur, 1)) return; // the port is kept until the loop is closed
+
+	struct io_uring_sqe *sqe = uring_sqe(loop->ur);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = sbmp_tp_fd(port->tp);
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = (uint64_t)(uintptr_t) port | OP_CANCEL;
+	uring_push(loop->ur);
+
+	port->ops++;
+}
+
+static void uring_free_port(Port *port)
+{
+	free(port->wbuf);
+}
+
+static void uring_read_done(SBMP_Loop *loop, Port *port, const struct io_uring_cqe *cqe)
+{
+	Uring *ur = loop->ur;
+	bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	bool has_buf = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+	uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+	if (!more) port->reading = false;
+
+	if (port->tp != NULL) {
+		if (cqe->res == -EINVAL && port->multishot) {
+			if (ur->multishot) sbmp_info("No multishot reads, using single reads.");
+			ur->multishot = false;
+		} else if (cqe->res == -ENOBUFS || cqe->res == -EAGAIN || cqe->res == -EINTR || cqe->res == -ECANCELED) {
+			// out of buffers (or interrupted) - post it again
+		} else if (!sbmp_tp_feed(port->tp, has_buf ? ur->bufs + (size_t) bid * SBMP_LOOP_URING_BUF_SIZE : NULL, cqe->res)) {
+			if (has_buf) uring_put_buffer(ur, bid);
+			close_port(loop, port);
+			return;
+		}
+	}
+
+	if (has_buf) uring_put_buffer(ur, bid);
+
+	if (port->tp != NULL && !port->reading && !uring_post_read(ur, port)) {
+		close_port(loop, port);
+	}
+}
+
+static void uring_write_done(SBMP_Loop *loop, Port *port, const struct io_uring_cqe *cqe)
+{
+	if (port->tp == NULL) {
+		port->writing = false;
+		return;
+	}
+
+	if (cqe->res == -EAGAIN || cqe->res == -EINTR || cqe->res == -ECANCELED) {
+		// the OS buffer is full
+		if (!uring_post_write(loop->ur, port, true)) port->writing = false;
+		return;
+	}
+
+	if (!sbmp_tp_written(port->tp, cqe->res)) {
+		port->writing = false;
+		close_port(loop, port);
+		return;
+	}
+
+	port->wpos += (size_t) cqe->res;
+	if (port->wpos < port->wlen) {
+		if (!uring_post_write(loop->ur, port, true)) port->writing = false;
+		return;
+	}
+
+	port->writing = false;
+	uring_start_write(loop->ur, port); // frames sent in the meantime
+}
+
+/** Handle the completed requests */
+static void uring_reap(SBMP_Loop *loop)
+{
+	Uring *ur = loop->ur;
+	uint32_t head = *ur->cq_head;
+
+	while (head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe cqe = ur->cqes[head & ur->cq_mask];
+		__atomic_store_n(ur->cq_head, ++head, __ATOMIC_RELEASE);
+
+		if (cqe.user_data == 0) continue; // cancel all, see sbmp_loop_close()
+
+		Port *port = (Port *)(uintptr_t)(cqe.user_data & ~(uint64_t) OP_MASK);
+		if (!(cqe.flags & IORING_CQE_F_MORE)) port->ops--;
+
+		switch (cqe.user_data & OP_MASK) {
+			case OP_READ:
+				uring_read_done(loop, port, &cqe);
+				break;
+
+			case OP_WRITE:
+				uring_write_done(loop, port, &cqe);
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+static bool uring_wait(SBMP_Loop *loop, int timeout_ms)
+{
+	Uring *ur = loop->ur;
+
+	// frames sent since the last turn
+	for (size_t i = 0; i < loop->port_count; i++) {
+		uring_start_write(ur, loop->ports[i]);
+	}
+
+	bool ready = *ur->cq_head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	bool wait = timeout_ms != 0 && !ready;
+
+	if ((wait || ur->to_submit > 0) && !uring_enter(ur, wait, timeout_ms)) return false;
+
+	uring_reap(loop);
+	return true;
+}
+
+/** Cancel everything before the buffers are freed */
+static void uring_drain(SBMP_Loop *loop)
+{
+	Uring *ur = loop->ur;
+
+	if (uring_reserve(ur, 1)) {
+		struct io_uring_sqe *sqe = uring_sqe(ur);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = 0;
+		uring_push(ur);
+	}
+
+	for (int tries = 0; tries < 10; tries++) {
+		bool busy = false;
+		for (size_t i = 0; i < loop->port_count; i++) {
+			if (loop->ports[i]->ops > 0) busy = true;
+		}
+
+		if (!busy || !uring_enter(ur, true, 100)) break;
+		uring_reap(loop);
+	}
+}
+
+#endif // SBMP_LOOP_HAS_URING
@@ -0,0 +1,180 @@
+#ifndef SBMP_LOOP_H
+#define SBMP_LOOP_H
+
+/**
+ * Event loop for many transports (Linux only - not included from sbmp.h).
+ *
+ * Drives any number of transports (see sbmp_transport_posix.h) from one
+ * thread, using epoll:
+ *
+ * - Readable transports are read in chunks (up to a few reads per turn, so
+ *   a busy port doesn't starve the others), and the data is passed to the
+ *   attached framing layer - the Rx handlers run in the loop thread.
+ * - Frames that didn't fit in the OS buffer are written when the fd
+ *   becomes writable (the transports are switched to the non-blocking mode).
+ * - Timers (one-shot or periodic, millisecond resolution) run in the same
+ *   thread, eg. for request timeouts and sbmp_ep_keepalive_poll().
+ *
+ * With sbmp_loop_create_uring(), io_uring is used instead of epoll: every
+ * transport has a read posted all the time (multishot on Linux 6.7+), the
+ * kernel fills buffers from a shared pool, and the frames sent during a loop
+ * turn are written with one request per transport, all submitted together
+ * with the wait for the next events - one syscall per turn in total.
+ *
+ * All the functions must be called from the loop thread (or before it's
+ * started), including sending messages on the attached endpoints.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_config.h"
+#include "sbmp_session.h"
+#include "sbmp_transport_posix.h"
+
+/** Reads of one transport per loop turn */
+#define SBMP_LOOP_READS_PER_TURN 4
+
+/** io_uring backend available (Linux 5.19+ at runtime) */
+#ifndef SBMP_LOOP_HAS_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SBMP_LOOP_HAS_URING 1
+#endif
+#endif
+#endif
+
+#ifndef SBMP_LOOP_HAS_URING
+#define SBMP_LOOP_HAS_URING 0
+#endif
+
+/** io_uring: submission queue size */
+#define SBMP_LOOP_URING_ENTRIES 256
+
+/** io_uring: receive buffers shared by all transports (power of 2) */
+#define SBMP_LOOP_URING_BUFFERS 256
+
+/** io_uring: size of a receive buffer */
+#define SBMP_LOOP_URING_BUF_SIZE 4096
+
+/** Event loop */
+typedef struct SBMP_Loop_struct SBMP_Loop;
+
+/**
+ * Called when a transport reaches the end of file or fails.
+ * The transport is already removed from the loop; the function may close it.
+ *
+ * @param loop : the loop
+ * @param tp   : the transport
+ * @param arg  : user argument
+ */
+typedef void (*SBMP_LoopCloseFunc)(SBMP_Loop *loop, SBMP_Transport *tp, void *arg);
+
+/**
+ * Timer function
+ * @param loop : the loop
+ * @param arg  : user argument
+ */
+typedef void (*SBMP_LoopTimerFunc)(SBMP_Loop *loop, void *arg);
+
+
+/**
+ * @brief Create a loop
+ * @return the loop, NULL on failure
+ */
+SBMP_Loop *sbmp_loop_create(void);
+
+/**
+ * @brief Create a loop using io_uring
+ *
+ * The transports are switched to the non-blocking mode, and to the external
+ * I/O (see sbmp_tp_set_external_io()) while they're in the loop. Frames sent
+ * outside of the loop callbacks are written in the next loop turn.
+ *
+ * @return the loop, NULL if io_uring isn't available (use sbmp_loop_create() then)
+ */
+SBMP_Loop *sbmp_loop_create_uring(void);
+
+/**
+ * @brief Add a transport (switched to the non-blocking mode).
+ *
+ * The transport should be attached to a framing layer instance first.
+ *
+ * @param loop     : the loop
+ * @param tp       : transport
+ * @param on_close : called on EOF or an error, NULL = just remove it
+ * @param arg      : passed to on_close
+ * @return success
+ */
+bool sbmp_loop_add(SBMP_Loop *loop, SBMP_Transport *tp, SBMP_LoopCloseFunc on_close, void *arg);
+
+/**
+ * @brief Remove a transport (it's not closed)
+ * @param loop : the loop
+ * @param tp   : transport
+ */
+void sbmp_loop_remove(SBMP_Loop *loop, SBMP_Transport *tp);
+
+/**
+ * @brief Start a timer
+ * @param loop     : the loop
+ * @param delay_ms : time to the first call
+ * @param period   : period of the following calls (ms), 0 = one-shot
+ * @param func     : timer function
+ * @param arg      : passed to the function
+ * @return timer ID (> 0), 0 on failure
+ */
+uint32_t sbmp_loop_timer(SBMP_Loop *loop, uint32_t delay_ms, uint32_t period, SBMP_LoopTimerFunc func, void *arg);
+
+/**
+ * @brief Stop a timer (can be called from the timer function)
+ * @param loop : the loop
+ * @param id   : timer ID
+ */
+void sbmp_loop_cancel(SBMP_Loop *loop, uint32_t id);
+
+/**
+ * @brief Poll an endpoint periodically - the reliable mode, flow control and
+ * keepalive (whichever is enabled).
+ *
+ * @param loop   : the loop
+ * @param ep     : the endpoint
+ * @param period : poll period (ms)
+ * @return timer ID, 0 on failure
+ */
+uint32_t sbmp_loop_poll_endpoint(SBMP_Loop *loop, SBMP_Endpoint *ep, uint32_t period);
+
+/**
+ * @brief Wait for events (at most the given time) and handle them
+ * @param loop       : the loop
+ * @param timeout_ms : max wait, -1 = until an event or a timer
+ * @return false on an error
+ */
+bool sbmp_loop_run_once(SBMP_Loop *loop, int timeout_ms);
+
+/**
+ * @brief Run until sbmp_loop_stop() is called
+ * @param loop : the loop
+ * @return false on an error
+ */
+bool sbmp_loop_run(SBMP_Loop *loop);
+
+/**
+ * @brief Make sbmp_loop_run() return (from a callback in the loop)
+ * @param loop : the loop
+ */
+void sbmp_loop_stop(SBMP_Loop *loop);
+
+/**
+ * @brief Close the loop. The transports aren't closed.
+ * @param loop : the loop
+ */
+void sbmp_loop_close(SBMP_Loop *loop);
+
+/** Monotonic clock in ms (can be given to the keepalive and bulk modules) */
+uint32_t sbmp_loop_clock_ms(void);
+
+/** Monotonic clock in us (can be given to the stats) */
+uint32_t sbmp_loop_clock_us(void);
+
+#endif // SBMP_LOOP_H
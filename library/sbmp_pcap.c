@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sbmp_config.h"
+#include "sbmp_checksum.h"
+#include "sbmp_pcap.h"
+
+/** pcap magic with nanosecond timestamps */
+#define PCAP_MAGIC_NS 0xA1B23C4D
+/** pcap magic with microsecond timestamps */
+#define PCAP_MAGIC_US 0xA1B2C3D4
+
+/** Length of the pcap file header */
+#define PCAP_FILE_HEADER 24
+/** Length of the pcap record header */
+#define PCAP_REC_HEADER 16
+
+/** Longest record (header, max frame) */
+#define PCAP_SNAPLEN (SBMP_PCAP_REC_HEADER + SBMP_PCAP_FRM_HEADER + 0xFFFF + 4)
+
+/** Size of the Tx capture buffers */
+#define TX_BUF_SIZE 0xFFFF
+
+static uint32_t get_u32(const uint8_t *buf, bool swap)
+{
+	if (swap) {
+		return (uint32_t)buf[3] | ((uint32_t)buf[2] << 8) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[0] << 24);
+	}
+
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+#if SBMP_HAS_CAPTURE
+
+static void put_u16(uint8_t *buf, uint16_t v)
+{
+	buf[0] = v & 0xFF;
+	buf[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t *buf, uint32_t v)
+{
+	put_u16(buf, v & 0xFFFF);
+	put_u16(buf + 2, (v >> 16) & 0xFFFF);
+}
+
+/** Tx capture buffer of an attached instance */
+typedef struct TxBuf_struct {
+	struct TxBuf_struct *next;
+	uint8_t bytes[TX_BUF_SIZE];
+} TxBuf;
+
+struct SBMP_Pcap_struct {
+	int fd;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	uint8_t *ring;          /*!< Records waiting to be written */
+	size_t size;            /*!< Ring size */
+	size_t head;            /*!< Write position (total bytes added) */
+	size_t tail;            /*!< Read position (total bytes written out) */
+
+	bool closing;           /*!< Writer thread should finish */
+	bool failed;            /*!< A write failed */
+	uint32_t dropped;       /*!< Records dropped, the ring was full */
+
+	TxBuf *tx_bufs;         /*!< Buffers given to the attached instances */
+};
+
+/** Write the whole buffer to the file */
+static bool write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return true;
+}
+
+/** Writer thread - moves records from the ring to the file */
+static void *writer_thread(void *arg)
+{
+	SBMP_Pcap *pcap = arg;
+
+	pthread_mutex_lock(&pcap->lock);
+
+	while (true) {
+		while (pcap->head == pcap->tail && !pcap->closing) {
+			pthread_cond_wait(&pcap->cond, &pcap->lock);
+		}
+
+		if (pcap->head == pcap->tail) break; // closing & all written
+
+		// the contiguous part of the ring
+		size_t start = pcap->tail % pcap->size;
+		size_t len = pcap->head - pcap->tail;
+		if (start + len > pcap->size) len = pcap->size - start;
+
+		pthread_mutex_unlock(&pcap->lock);
+		bool ok = write_all(pcap->fd, pcap->ring + start, len);
+		pthread_mutex_lock(&pcap->lock);
+
+		if (!ok) pcap->failed = true;
+		pcap->tail += len;
+	}
+
+	pthread_mutex_unlock(&pcap->lock);
+	return NULL;
+}
+
+SBMP_Pcap *sbmp_pcap_open(const char *path, size_t buffer_size)
+{
+	if (buffer_size == 0) buffer_size = SBMP_PCAP_DEFAULT_BUFFER;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		sbmp_error("Can't create capture %s.", path);
+		return NULL;
+	}
+
+	uint8_t hdr[PCAP_FILE_HEADER];
+	put_u32(hdr, PCAP_MAGIC_NS);
+	put_u16(hdr + 4, 2); // version 2.4
+	put_u16(hdr + 6, 4);
+	put_u32(hdr + 8, 0); // GMT
+	put_u32(hdr + 12, 0); // accuracy
+	put_u32(hdr + 16, PCAP_SNAPLEN);
+	put_u32(hdr + 20, SBMP_PCAP_LINKTYPE);
+
+	if (!write_all(fd, hdr, sizeof(hdr))) {
+		sbmp_error("Can't write capture %s.", path);
+		close(fd);
+		return NULL;
+	}
+
+	SBMP_Pcap *pcap = calloc(1, sizeof(SBMP_Pcap));
+	uint8_t *ring = malloc(buffer_size);
+	if (pcap == NULL || ring == NULL) {
+		free(pcap);
+		free(ring);
+		close(fd);
+		return NULL;
+	}
+
+	pcap->fd = fd;
+	pcap->ring = ring;
+	pcap->size = buffer_size;
+
+	pthread_mutex_init(&pcap->lock, NULL);
+	pthread_cond_init(&pcap->cond, NULL);
+
+	if (pthread_create(&pcap->thread, NULL, writer_thread, pcap) != 0) {
+		sbmp_error("Can't start the capture writer.");
+		pthread_mutex_destroy(&pcap->lock);
+		pthread_cond_destroy(&pcap->cond);
+		free(ring);
+		free(pcap);
+		close(fd);
+		return NULL;
+	}
+
+	return pcap;
+}
+
+bool sbmp_pcap_attach(SBMP_Pcap *pcap, SBMP_FrmInst *frm)
+{
+	TxBuf *txb = malloc(sizeof(TxBuf));
+	if (txb == NULL) {
+		sbmp_error("No memory for the capture buffer.");
+		return false;
+	}
+
+	pthread_mutex_lock(&pcap->lock);
+	txb->next = pcap->tx_bufs;
+	pcap->tx_bufs = txb;
+	pthread_mutex_unlock(&pcap->lock);
+
+	sbmp_frm_set_capture(frm, sbmp_pcap_frame, pcap, txb->bytes, TX_BUF_SIZE);
+	return true;
+}
+
+/** Copy bytes into the ring (space was checked) */
+static void ring_put(SBMP_Pcap *pcap, const uint8_t *buf, size_t len)
+{
+	if (len == 0) return;
+
+	size_t start = pcap->head % pcap->size;
+	size_t first = (start + len > pcap->size) ? pcap->size - start : len;
+
+	memcpy(pcap->ring + start, buf, first);
+	memcpy(pcap->ring, buf + first, len - first);
+	pcap->head += len;
+}
+
+void sbmp_pcap_frame(const SBMP_FrmCapture *frame, void *token)
+{
+	SBMP_Pcap *pcap = token;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts); // wall clock, so the viewers show the real date
+
+	uint8_t cksum_len = chksum_length(frame->cksum_type);
+	bool truncated = frame->captured < frame->length;
+
+	uint32_t orig_len = (uint32_t)(SBMP_PCAP_REC_HEADER + SBMP_PCAP_FRM_HEADER + frame->length + cksum_len);
+	uint32_t incl_len = truncated ? (uint32_t)(SBMP_PCAP_REC_HEADER + SBMP_PCAP_FRM_HEADER + frame->captured) : orig_len;
+
+	// pcap record header, our header, frame header
+	uint8_t hdr[PCAP_REC_HEADER + SBMP_PCAP_REC_HEADER + SBMP_PCAP_FRM_HEADER];
+	put_u32(hdr, (uint32_t) ts.tv_sec);
+	put_u32(hdr + 4, (uint32_t) ts.tv_nsec);
+	put_u32(hdr + 8, incl_len);
+	put_u32(hdr + 12, orig_len);
+
+	uint8_t *p = hdr + PCAP_REC_HEADER;
+	p[0] = (uint8_t)((frame->tx ? SBMP_PCAP_TX : 0)
+					 | (frame->valid ? 0 : SBMP_PCAP_CKSUM_BAD)
+					 | (frame->fec ? SBMP_PCAP_FEC : 0)
+					 | (frame->fec_corrected ? SBMP_PCAP_FEC_CORRECTED : 0));
+	p[1] = 0;
+
+	p += SBMP_PCAP_REC_HEADER;
+	p[0] = 0x01;
+	p[1] = (uint8_t)(frame->cksum_type | frame->flags);
+	put_u16(p + 2, frame->length);
+	p[4] = p[0] ^ p[1] ^ p[2] ^ p[3];
+
+	uint8_t cksum[4];
+	put_u32(cksum, frame->cksum);
+
+	size_t total = sizeof(hdr) + frame->captured + (truncated ? 0 : cksum_len);
+
+	pthread_mutex_lock(&pcap->lock);
+
+	if (pcap->size - (pcap->head - pcap->tail) < total) {
+		pcap->dropped++;
+	} else {
+		bool was_empty = (pcap->head == pcap->tail);
+
+		ring_put(pcap, hdr, sizeof(hdr));
+		ring_put(pcap, frame->payload, frame->captured);
+		if (!truncated) ring_put(pcap, cksum, cksum_len);
+
+		// wake the writer only if it could be waiting
+		if (was_empty) pthread_cond_signal(&pcap->cond);
+	}
+
+	pthread_mutex_unlock(&pcap->lock);
+}
+
+uint32_t sbmp_pcap_dropped(SBMP_Pcap *pcap)
+{
+	pthread_mutex_lock(&pcap->lock);
+	uint32_t dropped = pcap->dropped;
+	pthread_mutex_unlock(&pcap->lock);
+
+	return dropped;
+}
+
+bool sbmp_pcap_close(SBMP_Pcap *pcap)
+{
+	pthread_mutex_lock(&pcap->lock);
+	pcap->closing = true;
+	pthread_cond_signal(&pcap->cond);
+	pthread_mutex_unlock(&pcap->lock);
+
+	pthread_join(pcap->thread, NULL);
+
+	bool ok = !pcap->failed;
+	if (close(pcap->fd) != 0) ok = false;
+
+	if (pcap->dropped > 0) {
+		sbmp_warn("Capture: %"PRIu32" records dropped (buffer full).", pcap->dropped);
+	}
+
+	while (pcap->tx_bufs != NULL) {
+		TxBuf *next = pcap->tx_bufs->next;
+		free(pcap->tx_bufs);
+		pcap->tx_bufs = next;
+	}
+
+	pthread_mutex_destroy(&pcap->lock);
+	pthread_cond_destroy(&pcap->cond);
+	free(pcap->ring);
+	free(pcap);
+
+	return ok;
+}
+
+#endif /* SBMP_HAS_CAPTURE */
+
+
+// ---- Reading --------------------------------------------------------
+
+struct SBMP_PcapReader_struct {
+	FILE *file;
+	bool swap;              /*!< Written with the other byte order */
+	bool ns;                /*!< Nanosecond timestamps */
+	uint8_t buf[PCAP_SNAPLEN];
+};
+
+SBMP_PcapReader *sbmp_pcap_reader_open(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		sbmp_error("Can't open capture %s.", path);
+		return NULL;
+	}
+
+	uint8_t hdr[PCAP_FILE_HEADER];
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+		sbmp_error("Capture %s too short.", path);
+		fclose(f);
+		return NULL;
+	}
+
+	bool swap = false, ns;
+	uint32_t magic = get_u32(hdr, false);
+
+	if (magic != PCAP_MAGIC_NS && magic != PCAP_MAGIC_US) {
+		swap = true;
+		magic = get_u32(hdr, true);
+	}
+
+	if (magic == PCAP_MAGIC_NS) {
+		ns = true;
+	} else if (magic == PCAP_MAGIC_US) {
+		ns = false;
+	} else {
+		sbmp_error("%s is not a pcap file.", path);
+		fclose(f);
+		return NULL;
+	}
+
+	if (get_u32(hdr + 20, swap) != SBMP_PCAP_LINKTYPE) {
+		sbmp_error("%s is not a SBMP capture.", path);
+		fclose(f);
+		return NULL;
+	}
+
+	SBMP_PcapReader *reader = malloc(sizeof(SBMP_PcapReader));
+	if (reader == NULL) {
+		fclose(f);
+		return NULL;
+	}
+
+	reader->file = f;
+	reader->swap = swap;
+	reader->ns = ns;
+	return reader;
+}
+
+bool sbmp_pcap_read(SBMP_PcapReader *reader, SBMP_PcapRecord *rec)
+{
+	while (true) {
+		uint8_t hdr[PCAP_REC_HEADER];
+		if (fread(hdr, 1, sizeof(hdr), reader->file) != sizeof(hdr)) return false;
+
+		uint32_t sec = get_u32(hdr, reader->swap);
+		uint32_t frac = get_u32(hdr + 4, reader->swap);
+		uint32_t incl_len = get_u32(hdr + 8, reader->swap);
+		uint32_t orig_len = get_u32(hdr + 12, reader->swap);
+
+		if (incl_len > sizeof(reader->buf)) {
+			sbmp_error("Capture record too long (%"PRIu32" B).", incl_len);
+			return false;
+		}
+
+		if (fread(reader->buf, 1, incl_len, reader->file) != incl_len) return false;
+
+		if (incl_len < SBMP_PCAP_REC_HEADER + SBMP_PCAP_FRM_HEADER) {
+			sbmp_warn("Capture record too short, skipping.");
+			continue;
+		}
+
+		rec->time_ns = (uint64_t)sec * 1000000000 + (reader->ns ? frac : (uint64_t)frac * 1000);
+		rec->info = reader->buf[0];
+		rec->frame = reader->buf + SBMP_PCAP_REC_HEADER;
+		rec->length = incl_len - SBMP_PCAP_REC_HEADER;
+		rec->orig_length = orig_len - SBMP_PCAP_REC_HEADER;
+		return true;
+	}
+}
+
+void sbmp_pcap_reader_close(SBMP_PcapReader *reader)
+{
+	fclose(reader->file);
+	free(reader);
+}
@@ -0,0 +1,141 @@
+#ifndef SBMP_PCAP_H
+#define SBMP_PCAP_H
+
+/**
+ * Traffic capture to pcap files (POSIX hosts only - not included from sbmp.h).
+ *
+ * The capture writer is attached to a framing layer instance with the capture
+ * hook (SBMP_HAS_CAPTURE), and records every received and sent frame with
+ * a wall clock timestamp (CLOCK_REALTIME, ns resolution).
+ *
+ * The hook only copies the record into a memory buffer; a writer thread
+ * writes it to the file, so the link isn't slowed down by disk I/O.
+ * If the buffer fills up, records are dropped (and counted).
+ *
+ * The file uses the link type LINKTYPE_USER0 (147). Each record is:
+ *
+ * +--------+----------+-----------------------------------------------+
+ * | Info   | Reserved | Frame                                         |
+ * | 1 byte | 1 byte   | 0x01, cksum type, length, xor, payload, cksum |
+ * +--------+----------+-----------------------------------------------+
+ *
+ * The frame is always stored in the plain (non-FEC) encoding, with the original
+ * checksum - FEC frames are marked in the info byte. In Wireshark, the records
+ * can be decoded with a Lua dissector, or just viewed as bytes (DLT 147).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbmp_config.h"
+#include "sbmp_frame.h"
+
+/** Link type of the captures */
+#define SBMP_PCAP_LINKTYPE 147
+
+/** Length of the record header before the frame */
+#define SBMP_PCAP_REC_HEADER 2
+
+/** Length of the frame header (SOF, cksum type, length, xor) */
+#define SBMP_PCAP_FRM_HEADER 5
+
+/** Record info flags */
+#define SBMP_PCAP_TX            0x01 /*!< Sent frame (else received) */
+#define SBMP_PCAP_CKSUM_BAD     0x02 /*!< Checksum mismatch (the frame was dropped) */
+#define SBMP_PCAP_FEC           0x04 /*!< Sent / received as a FEC frame */
+#define SBMP_PCAP_FEC_CORRECTED 0x08 /*!< Received FEC frame that needed correcting */
+
+/** Default size of the write buffer */
+#define SBMP_PCAP_DEFAULT_BUFFER (256 * 1024)
+
+/** Capture writer */
+typedef struct SBMP_Pcap_struct SBMP_Pcap;
+
+/** Capture reader */
+typedef struct SBMP_PcapReader_struct SBMP_PcapReader;
+
+/** A record read from a capture */
+typedef struct {
+	uint64_t time_ns;       /*!< Timestamp */
+	uint8_t info;           /*!< SBMP_PCAP_* flags */
+	const uint8_t *frame;   /*!< The frame (valid until the next read) */
+	uint32_t length;        /*!< Captured frame bytes */
+	uint32_t orig_length;   /*!< Frame length on the link (can be more, if truncated) */
+} SBMP_PcapRecord;
+
+
+#if SBMP_HAS_CAPTURE
+
+/**
+ * @brief Create a capture file and start the writer thread.
+ *
+ * @param path        : file to create (overwritten)
+ * @param buffer_size : write buffer size, 0 = default
+ * @return the writer, NULL on failure
+ */
+SBMP_Pcap *sbmp_pcap_open(const char *path, size_t buffer_size);
+
+/**
+ * @brief Record the traffic of a framing layer instance.
+ *
+ * Several instances can write to one capture (eg. both ends of a link),
+ * from different threads.
+ *
+ * @param pcap : capture writer
+ * @param frm  : framing layer instance (eg. &ep->frm)
+ * @return success (fails if out of memory for the Tx capture buffer)
+ */
+bool sbmp_pcap_attach(SBMP_Pcap *pcap, SBMP_FrmInst *frm);
+
+/**
+ * @brief The capture hook - for applications that want to filter the frames
+ *        or chain it with another hook.
+ *
+ * @param frame : the frame
+ * @param pcap  : capture writer (the token)
+ */
+void sbmp_pcap_frame(const SBMP_FrmCapture *frame, void *pcap);
+
+/**
+ * @brief Get the number of records dropped because the buffer was full
+ * @param pcap : capture writer
+ * @return dropped records
+ */
+uint32_t sbmp_pcap_dropped(SBMP_Pcap *pcap);
+
+/**
+ * @brief Write out the buffered records, stop the writer thread and close the file.
+ *
+ * Detach the capture from all instances first (sbmp_frm_set_capture(frm, NULL, ...)).
+ *
+ * @param pcap : capture writer, freed
+ * @return true if all records were written
+ */
+bool sbmp_pcap_close(SBMP_Pcap *pcap);
+
+#endif /* SBMP_HAS_CAPTURE */
+
+
+/**
+ * @brief Open a capture for reading.
+ * @param path : the file
+ * @return the reader, NULL on failure (not a SBMP capture)
+ */
+SBMP_PcapReader *sbmp_pcap_reader_open(const char *path);
+
+/**
+ * @brief Read the next record
+ * @param reader : capture reader
+ * @param rec    : filled with the record
+ * @return false at the end of the file (or on an error)
+ */
+bool sbmp_pcap_read(SBMP_PcapReader *reader, SBMP_PcapRecord *rec);
+
+/**
+ * @brief Close the capture, free the reader
+ * @param reader : capture reader
+ */
+void sbmp_pcap_reader_close(SBMP_PcapReader *reader);
+
+#endif // SBMP_PCAP_H
@@ -0,0 +1,402 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sbmp_config.h"
+#include "sbmp_pool.h"
+
+/** A dispatched datagram */
+typedef struct Job_struct {
+	struct Job_struct *next;
+	SBMP_Endpoint *ep;
+	SBMP_Datagram dg;
+	uint64_t queued_at;         /*!< Dispatch time (us) */
+	uint8_t payload[];
+} Job;
+
+enum LaneState {
+	LANE_IDLE,                  /*!< No jobs, in no queue */
+	LANE_READY,                 /*!< Has jobs, in a worker's queue */
+	LANE_RUNNING,               /*!< A worker is running its jobs */
+};
+
+/** Datagrams of the sessions with the same hash, in order */
+typedef struct {
+	pthread_mutex_t lock;
+	Job *first;
+	Job *last;
+	enum LaneState state;
+} Lane;
+
+typedef struct {
+	SBMP_Pool *pool;
+	uint8_t index;
+	pthread_t thread;
+
+	// queue of ready lanes - the owner takes from the front, thieves from the back
+	pthread_mutex_t lock;
+	uint16_t ready[SBMP_POOL_LANES]; /*!< Ring; a lane is in one queue at most */
+	uint16_t ready_first;
+	uint16_t ready_count;
+
+	pthread_mutex_t stats_lock;
+	SBMP_PoolStats stats;       /*!< Only handled, steals and the histograms are used */
+} Worker;
+
+struct SBMP_Pool_struct {
+	SBMP_PoolHandler handler;
+	void *token;
+
+	Lane lanes[SBMP_POOL_LANES];
+
+	Worker workers[SBMP_POOL_MAX_WORKERS];
+	uint8_t worker_count;
+
+	pthread_mutex_t lock;       /*!< For sleeping / waking */
+	pthread_cond_t wake;        /*!< Work came in, or stopping */
+	pthread_cond_t idle;        /*!< Depth dropped to 0 */
+	uint32_t sleepers;          /*!< Workers waiting for work */
+	bool running;
+
+	uint32_t depth;
+	uint32_t max_depth;
+	uint64_t dispatched;
+};
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint16_t lane_of(SBMP_Endpoint *ep, uint16_t session)
+{
+	// the endpoint is mixed in, sessions of different links are unrelated
+	uint32_t h = (uint32_t)((uintptr_t) ep >> 4) * 0x9E3779B1u ^ session;
+	h *= 0x85EBCA6Bu;
+	return (uint16_t)((h >> 16) % SBMP_POOL_LANES);
+}
+
+static void ready_push(Worker *w, uint16_t lane)
+{
+	pthread_mutex_lock(&w->lock);
+	w->ready[(w->ready_first + w->ready_count) % SBMP_POOL_LANES] = lane;
+	__atomic_store_n(&w->ready_count, w->ready_count + 1, __ATOMIC_SEQ_CST); // see any_ready()
+	pthread_mutex_unlock(&w->lock);
+}
+
+/** Take a lane from a worker's queue, -1 if empty */
+static int ready_take(Worker *w, bool from_back)
+{
+	int lane = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->ready_count > 0) {
+		if (from_back) {
+			lane = w->ready[(w->ready_first + w->ready_count - 1) % SBMP_POOL_LANES];
+		} else {
+			lane = w->ready[w->ready_first];
+			w->ready_first = (uint16_t)((w->ready_first + 1) % SBMP_POOL_LANES);
+		}
+		__atomic_store_n(&w->ready_count, w->ready_count - 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return lane;
+}
+
+/** Find a lane to run - our own, else steal one */
+static int find_lane(Worker *w)
+{
+	SBMP_Pool *pool = w->pool;
+
+	int lane = ready_take(w, false);
+	if (lane >= 0) return lane;
+
+	for (uint8_t i = 1; i < pool->worker_count; i++) {
+		Worker *victim = &pool->workers[(w->index + i) % pool->worker_count];
+
+		lane = ready_take(victim, true);
+		if (lane >= 0) {
+			pthread_mutex_lock(&w->stats_lock);
+			w->stats.steals++;
+			pthread_mutex_unlock(&w->stats_lock);
+			return lane;
+		}
+	}
+
+	return -1;
+}
+
+static void run_job(Worker *w, Job *job)
+{
+	SBMP_Pool *pool = w->pool;
+	uint64_t start = now_us();
+
+	pool->handler(job->ep, &job->dg, pool->token);
+
+	uint64_t end = now_us();
+
+	pthread_mutex_lock(&w->stats_lock);
+	w->stats.handled++;
+#if SBMP_HAS_STATS
+	sbmp_hist_add(&w->stats.wait, (uint32_t)(start - job->queued_at));
+	sbmp_hist_add(&w->stats.run, (uint32_t)(end - start));
+#else
+	(void)start;
+	(void)end;
+#endif
+	pthread_mutex_unlock(&w->stats_lock);
+
+	free(job);
+
+	if (__atomic_sub_fetch(&pool->depth, 1, __ATOMIC_SEQ_CST) == 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/** Run a batch of a lane's jobs */
+static void run_lane(Worker *w, uint16_t index)
+{
+	Lane *lane = &w->pool->lanes[index];
+
+	pthread_mutex_lock(&lane->lock);
+	lane->state = LANE_RUNNING;
+
+	for (int n = 0; n < SBMP_POOL_BATCH; n++) {
+		Job *job = lane->first;
+		if (job == NULL) break;
+
+		lane->first = job->next;
+		if (lane->first == NULL) lane->last = NULL;
+
+		pthread_mutex_unlock(&lane->lock);
+		run_job(w, job);
+		pthread_mutex_lock(&lane->lock);
+	}
+
+	if (lane->first == NULL) {
+		lane->state = LANE_IDLE;
+		pthread_mutex_unlock(&lane->lock);
+	} else {
+		// more left, let the other lanes have a turn
+		lane->state = LANE_READY;
+		pthread_mutex_unlock(&lane->lock);
+		ready_push(w, index);
+	}
+}
+
+static bool any_ready(SBMP_Pool *pool)
+{
+	for (uint8_t i = 0; i < pool->worker_count; i++) {
+		if (__atomic_load_n(&pool->workers[i].ready_count, __ATOMIC_SEQ_CST) > 0) return true;
+	}
+	return false;
+}
+
+static void *worker_thread(void *arg)
+{
+	Worker *w = arg;
+	SBMP_Pool *pool = w->pool;
+
+	for (;;) {
+		int lane = find_lane(w);
+		if (lane >= 0) {
+			run_lane(w, (uint16_t) lane);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		if (!pool->running) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+
+		// announce we sleep, then look again - a dispatch either sees us, or we see its lane
+		__atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (!any_ready(pool)) pthread_cond_wait(&pool->wake, &pool->lock);
+		__atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/** Dispatch function, set on the endpoints */
+static void pool_dispatch(SBMP_Endpoint *ep, SBMP_Datagram *dg, void *token)
+{
+	SBMP_Pool *pool = token;
+
+	Job *job = malloc(sizeof(Job) + dg->length);
+	if (job == NULL) {
+		sbmp_error("No memory for a dispatched datagram, dropped.");
+		return;
+	}
+
+	job->next = NULL;
+	job->ep = ep;
+	job->dg = *dg;
+	job->dg.payload = job->payload;
+	memcpy(job->payload, dg->payload, dg->length);
+	job->queued_at = now_us();
+
+	uint32_t depth = __atomic_add_fetch(&pool->depth, 1, __ATOMIC_SEQ_CST);
+	uint32_t max = __atomic_load_n(&pool->max_depth, __ATOMIC_RELAXED);
+	while (depth > max && !__atomic_compare_exchange_n(&pool->max_depth, &max, depth, true,
+													   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+	__atomic_fetch_add(&pool->dispatched, 1, __ATOMIC_RELAXED);
+
+	uint16_t index = lane_of(ep, dg->session);
+	Lane *lane = &pool->lanes[index];
+
+	pthread_mutex_lock(&lane->lock);
+	if (lane->last != NULL) {
+		lane->last->next = job;
+	} else {
+		lane->first = job;
+	}
+	lane->last = job;
+
+	bool schedule = (lane->state == LANE_IDLE);
+	if (schedule) lane->state = LANE_READY;
+	pthread_mutex_unlock(&lane->lock);
+
+	if (!schedule) return; // queued or running, the worker will get to it
+
+	ready_push(&pool->workers[index % pool->worker_count], index);
+
+	if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->wake);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+// ---
+
+SBMP_Pool *sbmp_pool_create(uint8_t workers, SBMP_PoolHandler handler, void *token)
+{
+	if (workers == 0 || workers > SBMP_POOL_MAX_WORKERS || handler == NULL) {
+		sbmp_error("Bad worker pool parameters.");
+		return NULL;
+	}
+
+	SBMP_Pool *pool = calloc(1, sizeof(SBMP_Pool));
+	if (pool == NULL) {
+		sbmp_error("No memory for the worker pool.");
+		return NULL;
+	}
+
+	pool->handler = handler;
+	pool->token = token;
+	pool->running = true;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (int i = 0; i < SBMP_POOL_LANES; i++) {
+		pthread_mutex_init(&pool->lanes[i].lock, NULL);
+	}
+
+	for (uint8_t i = 0; i < SBMP_POOL_MAX_WORKERS; i++) {
+		Worker *w = &pool->workers[i];
+		w->pool = pool;
+		w->index = i;
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_mutex_init(&w->stats_lock, NULL);
+	}
+
+	// the workers look at each other's queues, set them all up first
+	pool->worker_count = workers;
+
+	for (uint8_t i = 0; i < workers; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i]) != 0) {
+			sbmp_error("Can't start a worker thread.");
+			pool->worker_count = i;
+			sbmp_pool_close(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+void sbmp_pool_attach(SBMP_Pool *pool, SBMP_Endpoint *ep)
+{
+	sbmp_ep_set_dispatch(ep, pool_dispatch, pool);
+}
+
+void sbmp_pool_drain(SBMP_Pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (__atomic_load_n(&pool->depth, __ATOMIC_SEQ_CST) > 0) {
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+size_t sbmp_pool_pending(SBMP_Pool *pool)
+{
+	return __atomic_load_n(&pool->depth, __ATOMIC_ACQUIRE);
+}
+
+void sbmp_pool_stats(SBMP_Pool *pool, SBMP_PoolStats *stats)
+{
+	memset(stats, 0, sizeof(SBMP_PoolStats));
+
+	stats->dispatched = __atomic_load_n(&pool->dispatched, __ATOMIC_RELAXED);
+	stats->depth = __atomic_load_n(&pool->depth, __ATOMIC_RELAXED);
+	stats->max_depth = __atomic_load_n(&pool->max_depth, __ATOMIC_RELAXED);
+
+	for (uint8_t i = 0; i < pool->worker_count; i++) {
+		Worker *w = &pool->workers[i];
+
+		pthread_mutex_lock(&w->stats_lock);
+		stats->handled += w->stats.handled;
+		stats->steals += w->stats.steals;
+#if SBMP_HAS_STATS
+		sbmp_hist_merge(&stats->wait, &w->stats.wait);
+		sbmp_hist_merge(&stats->run, &w->stats.run);
+#endif
+		pthread_mutex_unlock(&w->stats_lock);
+	}
+}
+
+void sbmp_pool_close(SBMP_Pool *pool)
+{
+	if (pool == NULL) return;
+
+	if (pool->worker_count > 0) sbmp_pool_drain(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = false;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint8_t i = 0; i < pool->worker_count; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	for (int i = 0; i < SBMP_POOL_MAX_WORKERS; i++) {
+		pthread_mutex_destroy(&pool->workers[i].lock);
+		pthread_mutex_destroy(&pool->workers[i].stats_lock);
+	}
+
+	for (int i = 0; i < SBMP_POOL_LANES; i++) {
+		pthread_mutex_destroy(&pool->lanes[i].lock);
+	}
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
@@ -0,0 +1,118 @@
+#ifndef SBMP_POOL_H
+#define SBMP_POOL_H
+
+/**
+ * Worker pool for the received datagrams (POSIX threads - not included from sbmp.h).
+ *
+ * Normally the Rx handler runs in the thread that receives, so a slow
+ * handler holds up the whole link. A pool takes the datagrams from the
+ * endpoint (sbmp_ep_set_dispatch()), copies them, and runs the handler in
+ * a fixed set of worker threads:
+ *
+ * - Datagrams of one session run in order, one at a time - each session
+ *   maps to a lane (by a hash), and a lane is run by one worker at a time.
+ * - Different sessions run in parallel.
+ * - A lane with work goes to the queue of its home worker; an idle worker
+ *   takes lanes from the others' queues (work stealing).
+ *
+ * The handshake, resume and heartbeat datagrams are still handled by the
+ * endpoint. The session listeners are not used with a pool.
+ *
+ * The handlers run in the workers, so they must not call the endpoint
+ * directly - send the responses through a transmit queue (sbmp_txq.h).
+ *
+ *   pool = sbmp_pool_create(4, handler, token);
+ *   sbmp_pool_attach(pool, ep);   // one pool can serve many endpoints
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbmp_config.h"
+#include "sbmp_session.h"
+#include "sbmp_stats.h"
+
+/** Number of session lanes (sessions sharing a lane run one after the other) */
+#ifndef SBMP_POOL_LANES
+#define SBMP_POOL_LANES 256
+#endif
+
+/** Datagrams a worker runs from one lane before letting others have a turn */
+#ifndef SBMP_POOL_BATCH
+#define SBMP_POOL_BATCH 16
+#endif
+
+/** Most workers in a pool */
+#define SBMP_POOL_MAX_WORKERS 64
+
+/** Worker pool */
+typedef struct SBMP_Pool_struct SBMP_Pool;
+
+/**
+ * Datagram handler, run in a worker.
+ *
+ * The datagram (a copy) is valid only during the call.
+ */
+typedef void (*SBMP_PoolHandler)(SBMP_Endpoint *ep, SBMP_Datagram *dg, void *token);
+
+/** Worker pool statistics */
+typedef struct {
+	uint64_t dispatched;    /*!< Datagrams taken from the endpoints */
+	uint64_t handled;       /*!< Handler calls finished */
+	uint64_t steals;        /*!< Lanes taken from another worker's queue */
+	uint32_t depth;         /*!< Datagrams waiting or running now */
+	uint32_t max_depth;     /*!< Most datagrams waiting or running at once */
+#if SBMP_HAS_STATS
+	SBMP_Histogram wait;    /*!< Time from the dispatch to the handler start (us) */
+	SBMP_Histogram run;     /*!< Handler run time (us) */
+#endif
+} SBMP_PoolStats;
+
+
+/**
+ * @brief Start a worker pool.
+ * @param workers : number of worker threads (1 - SBMP_POOL_MAX_WORKERS)
+ * @param handler : datagram handler
+ * @param token   : passed to the handler
+ * @return the pool, NULL on failure
+ */
+SBMP_Pool *sbmp_pool_create(uint8_t workers, SBMP_PoolHandler handler, void *token);
+
+/**
+ * @brief Pass the datagrams received by an endpoint to the pool.
+ * @param pool : pool
+ * @param ep   : endpoint
+ */
+void sbmp_pool_attach(SBMP_Pool *pool, SBMP_Endpoint *ep);
+
+/**
+ * @brief Wait until all the dispatched datagrams are handled.
+ * @param pool : pool
+ */
+void sbmp_pool_drain(SBMP_Pool *pool);
+
+/**
+ * @brief Get the number of datagrams waiting or running
+ * @param pool : pool
+ * @return datagram count
+ */
+size_t sbmp_pool_pending(SBMP_Pool *pool);
+
+/**
+ * @brief Get the statistics (summed over the workers)
+ * @param pool  : pool
+ * @param stats : filled with the stats
+ */
+void sbmp_pool_stats(SBMP_Pool *pool, SBMP_PoolStats *stats);
+
+/**
+ * @brief Run the rest of the datagrams, stop the workers and free the pool.
+ *
+ * Detach the endpoints first (sbmp_ep_set_dispatch(ep, NULL, NULL)).
+ *
+ * @param pool : pool
+ */
+void sbmp_pool_close(SBMP_Pool *pool);
+
+#endif // SBMP_POOL_H
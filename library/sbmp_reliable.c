@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sbmp_config.h"
+#include "sbmp_reliable.h"
+
+#if SBMP_HAS_RELIABLE
+
+// Datagram header length - 2 B sesn, 1 B type
+#define DATAGRAM_HEADER_LEN 3
+
+
+SBMP_Reliable *sbmp_rel_init(SBMP_Reliable *rel, uint8_t *buffer, uint8_t depth, uint16_t slot_size, SBMP_RelClockFunc clock)
+{
+	bool rel_mallocd = false;
+
+	if (depth == 0 || slot_size < DATAGRAM_HEADER_LEN) {
+		sbmp_error("Bad reliable mode depth or slot size.");
+		return NULL;
+	}
+
+	// power of two, so the slot index follows the 8-bit sequence number
+	if (depth > SBMP_REL_MAX_DEPTH) depth = SBMP_REL_MAX_DEPTH;
+	uint8_t d = 1;
+	while (d * 2 <= depth) d *= 2;
+	depth = d;
+
+#if SBMP_USE_MALLOC
+	if (rel == NULL) {
+		// caller wants us to allocate it
+		rel = sbmp_malloc(sizeof(SBMP_Reliable));
+		if (rel == NULL) return NULL; // malloc failed
+		rel_mallocd = true;
+	}
+
+	if (buffer == NULL) {
+		// caller wants us to allocate it
+		buffer = sbmp_malloc(2 * (size_t)depth * slot_size);
+		if (buffer == NULL) { // malloc failed
+			if (rel_mallocd) sbmp_free(rel);
+			return NULL;
+		}
+	}
+#else
+	(void)rel_mallocd;
+
+	if (rel == NULL || buffer == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	rel->depth = depth;
+	rel->slot_size = slot_size;
+	rel->tx_buf = buffer;
+	rel->rx_buf = buffer + (size_t)depth * slot_size;
+
+	rel->clock = clock;
+	rel->rto = SBMP_REL_DEFAULT_RTO;
+
+	rel->retransmits = 0;
+	rel->duplicates = 0;
+
+	sbmp_rel_reset(rel);
+
+	return rel;
+}
+
+void sbmp_rel_reset(SBMP_Reliable *rel)
+{
+	rel->active = false;
+	rel->window = 0;
+
+	rel->tx_base = 0;
+	rel->tx_next = 0;
+
+	rel->rx_next = 0;
+	rel->rx_mask = 0;
+	rel->ack_pending = 0;
+	rel->ack_now = false;
+}
+
+bool sbmp_rel_activate(SBMP_Reliable *rel, uint8_t peer_depth, SBMP_CksumType cksum_type)
+{
+	sbmp_rel_reset(rel);
+
+	if (peer_depth == 0) {
+		sbmp_info("Peer doesn't support the reliable mode.");
+		return false;
+	}
+
+	rel->window = (peer_depth < rel->depth ? peer_depth : rel->depth);
+	rel->cksum_type = cksum_type;
+	rel->active = true;
+
+	sbmp_info("Reliable mode active, window %"PRIu8, rel->window);
+	return true;
+}
+
+/** Number of datagrams waiting for an ack */
+static inline uint8_t in_flight(SBMP_Reliable *rel)
+{
+	return (uint8_t)(rel->tx_next - rel->tx_base);
+}
+
+uint8_t sbmp_rel_free(SBMP_Reliable *rel)
+{
+	if (!rel->active) return 0;
+	return rel->window - in_flight(rel);
+}
+
+/** Get the retransmit buffer slot of a sequence number */
+static inline SBMP_RelTxSlot *tx_slot(SBMP_Reliable *rel, uint8_t seq)
+{
+	return &rel->tx[seq & (rel->depth - 1)];
+}
+
+/** Get the data of a retransmit buffer slot */
+static inline uint8_t *tx_slot_data(SBMP_Reliable *rel, uint8_t seq)
+{
+	return rel->tx_buf + (size_t)(seq & (rel->depth - 1)) * rel->slot_size;
+}
+
+/** Get current time, 0 if there's no clock */
+static inline uint32_t now(SBMP_Reliable *rel)
+{
+	return (rel->clock != NULL ? rel->clock() : 0);
+}
+
+/** Send the reliable mode header in a started frame. This confirms all received datagrams. */
+static void send_header(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint8_t seq)
+{
+	sbmp_frm_send_byte(frm, seq);
+	sbmp_frm_send_byte(frm, rel->rx_next);
+	sbmp_frm_send_byte(frm, rel->rx_mask & 0xFF);
+	sbmp_frm_send_byte(frm, (rel->rx_mask >> 8) & 0xFF);
+
+	rel->ack_pending = 0;
+	rel->ack_now = false;
+}
+
+bool sbmp_rel_start(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint16_t session, SBMP_DgType type, uint16_t length)
+{
+	uint32_t dg_len = (uint32_t)length + DATAGRAM_HEADER_LEN;
+
+	if (dg_len > rel->slot_size) {
+		sbmp_error("Datagram too long for the reliable mode (%"PRIu32" B, max %"PRIu16" B).", dg_len, rel->slot_size);
+		return false;
+	}
+
+	if (sbmp_rel_free(rel) == 0) {
+		sbmp_warn("Reliable mode window full, can't send.");
+		return false;
+	}
+
+	if (frm->tx_status != FRM_STATE_IDLE) {
+		sbmp_error("Can't start datagram, SBMP tx not IDLE.");
+		return false;
+	}
+
+	if (! sbmp_frm_start_flags(frm, rel->cksum_type, SBMP_FRM_FLAG_RELIABLE, (uint16_t)(SBMP_REL_HEADER_LEN + dg_len))) {
+		return false;
+	}
+
+	uint8_t seq = rel->tx_next++;
+
+	SBMP_RelTxSlot *slot = tx_slot(rel, seq);
+	slot->len = (uint16_t)dg_len;
+	slot->sent_next = rel->tx_next;
+	slot->sacked = false;
+	slot->retx = false;
+	slot->sent_time = now(rel);
+
+	sbmp_dbg("Started a reliable DG type %"PRIu8", sesn %"PRIu16", len %"PRIu16", seq %"PRIu8, type, session, length, seq);
+
+	send_header(rel, frm, seq);
+
+	// keep a copy of the datagram for retransmission
+	frm->tx_capture = tx_slot_data(rel, seq);
+
+	sbmp_frm_send_byte(frm, session & 0xFF);
+	sbmp_frm_send_byte(frm, (session >> 8) & 0xFF);
+	sbmp_frm_send_byte(frm, type);
+
+	return true;
+}
+
+/** Send a datagram from the retransmit buffer again */
+static bool retransmit(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint8_t seq)
+{
+	SBMP_RelTxSlot *slot = tx_slot(rel, seq);
+
+	if (! sbmp_frm_start_flags(frm, rel->cksum_type, SBMP_FRM_FLAG_RELIABLE, SBMP_REL_HEADER_LEN + slot->len)) {
+		return false;
+	}
+
+	sbmp_dbg("Retransmitting seq %"PRIu8, seq);
+
+	send_header(rel, frm, seq);
+	sbmp_frm_send_buffer(frm, tx_slot_data(rel, seq), slot->len);
+
+	slot->sent_next = rel->tx_next;
+	slot->retx = false;
+	slot->sent_time = now(rel);
+
+	rel->retransmits++;
+	return true;
+}
+
+/** Send an ack-only frame */
+static bool send_ack(SBMP_Reliable *rel, SBMP_FrmInst *frm)
+{
+	if (frm->tx_status != FRM_STATE_IDLE
+		|| ! sbmp_frm_start_flags(frm, rel->cksum_type, SBMP_FRM_FLAG_RELIABLE, SBMP_REL_HEADER_LEN)) {
+		return false;
+	}
+
+	send_header(rel, frm, rel->tx_next);
+	return true;
+}
+
+/**
+ * Send what's pending - retransmissions, and an ack if at least
+ * min_pending datagrams are unconfirmed (or a gap was seen).
+ */
+static void send_pending(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint8_t min_pending)
+{
+	uint8_t count = in_flight(rel);
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t seq = (uint8_t)(rel->tx_base + i);
+		if (!tx_slot(rel, seq)->retx) continue;
+
+		if (frm->tx_status != FRM_STATE_IDLE || !retransmit(rel, frm, seq)) {
+			return; // busy, try again later
+		}
+	}
+
+	if (rel->ack_now || (rel->ack_pending > 0 && rel->ack_pending >= min_pending)) {
+		send_ack(rel, frm);
+	}
+}
+
+/** Process the ack fields of a received frame */
+static void handle_ack(SBMP_Reliable *rel, uint8_t ack, uint16_t sack)
+{
+	uint8_t count = in_flight(rel);
+	uint8_t acked = (uint8_t)(ack - rel->tx_base);
+
+	if (acked > count) {
+		sbmp_dbg("Stale reliable ack %"PRIu8", ignoring.", ack);
+		return;
+	}
+
+	// cumulative ack - release the slots
+	rel->tx_base = ack;
+	count -= acked;
+
+	// selective ack
+	bool any = false;
+	uint8_t highest = 0;
+	for (uint8_t i = 0; i < 16; i++) {
+		if (!(sack & (1 << i))) continue;
+
+		uint8_t seq = (uint8_t)(ack + 1 + i);
+		if ((uint8_t)(seq - rel->tx_base) >= count) break;
+
+		tx_slot(rel, seq)->sacked = true;
+		highest = seq;
+		any = true;
+	}
+
+	if (!any) return;
+
+	// a datagram sent after a missing one was received - the missing one was lost
+	for (uint8_t seq = rel->tx_base; seq != highest; seq++) {
+		SBMP_RelTxSlot *slot = tx_slot(rel, seq);
+		if (slot->sacked || slot->retx) continue;
+
+		if ((int8_t)(highest - slot->sent_next) >= 0) {
+			slot->retx = true;
+		}
+	}
+}
+
+/** Process a received datagram */
+static void receive_dg(SBMP_Reliable *rel, uint8_t seq, uint8_t *dg, uint16_t len,
+					   SBMP_RelDeliverFunc deliver, void *token)
+{
+	uint8_t dist = (uint8_t)(seq - rel->rx_next);
+
+	if (dist >= 128) {
+		// already delivered - our ack was lost
+		sbmp_dbg("Duplicate reliable DG seq %"PRIu8, seq);
+		rel->duplicates++;
+		rel->ack_now = true;
+		return;
+	}
+
+	if (dist >= rel->depth) {
+		sbmp_warn("Reliable DG seq %"PRIu8" out of window, dropping.", seq);
+		return;
+	}
+
+	if (dist > 0) {
+		// an earlier one is missing, keep this one for later
+		uint16_t bit = (uint16_t)(1 << (dist - 1));
+		rel->ack_now = true; // let the sender know about the gap
+
+		if (rel->rx_mask & bit) {
+			rel->duplicates++;
+			return;
+		}
+
+		if (len > rel->slot_size) {
+			sbmp_dbg("Reliable DG seq %"PRIu8" too long to buffer, dropping.", seq);
+			return;
+		}
+
+		uint8_t slot = seq & (rel->depth - 1);
+		memcpy(rel->rx_buf + (size_t)slot * rel->slot_size, dg, len);
+		rel->rx_len[slot] = len;
+		rel->rx_mask |= bit;
+		return;
+	}
+
+	// the expected one - deliver it, and all buffered ones following it
+	bool buffered = (rel->rx_mask & 1);
+	rel->rx_next++;
+	rel->rx_mask >>= 1;
+	rel->ack_pending++;
+
+	deliver(dg, len, token);
+
+	if (buffered) rel->ack_now = true; // a gap was filled
+
+	while (buffered) {
+		uint8_t slot = rel->rx_next & (rel->depth - 1);
+
+		buffered = (rel->rx_mask & 1);
+		rel->rx_next++;
+		rel->rx_mask >>= 1;
+		rel->ack_pending++;
+
+		deliver(rel->rx_buf + (size_t)slot * rel->slot_size, rel->rx_len[slot], token);
+	}
+}
+
+void sbmp_rel_receive(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint8_t *payload, uint16_t length,
+					  SBMP_RelDeliverFunc deliver, void *token)
+{
+	if (length < SBMP_REL_HEADER_LEN) {
+		sbmp_error("Reliable frame too short.");
+		return;
+	}
+
+	// [ seq 1B | ack 1B | sack 2B ] [ datagram ]
+	uint8_t seq = payload[0];
+	handle_ack(rel, payload[1], (uint16_t)(payload[2] | (payload[3] << 8)));
+
+	if (length > SBMP_REL_HEADER_LEN) {
+		receive_dg(rel, seq, payload + SBMP_REL_HEADER_LEN, length - SBMP_REL_HEADER_LEN, deliver, token);
+	}
+
+	// retransmit what was lost; ack every other datagram, the rest is left for poll
+	// (unless a reply was sent meanwhile, carrying the ack)
+	send_pending(rel, frm, 2);
+}
+
+void sbmp_rel_poll(SBMP_Reliable *rel, SBMP_FrmInst *frm)
+{
+	if (!rel->active) return;
+
+	uint8_t count = in_flight(rel);
+
+	if (rel->clock != NULL && count > 0) {
+		uint32_t time = rel->clock();
+
+		// retransmission timeout of the oldest unconfirmed datagram
+		for (uint8_t i = 0; i < count; i++) {
+			SBMP_RelTxSlot *slot = tx_slot(rel, (uint8_t)(rel->tx_base + i));
+			if (slot->sacked) continue;
+
+			if (!slot->retx && time - slot->sent_time >= rel->rto) {
+				sbmp_dbg("Reliable timeout, seq %"PRIu8, (uint8_t)(rel->tx_base + i));
+				slot->retx = true;
+			}
+			break;
+		}
+	}
+
+	send_pending(rel, frm, 1);
+}
+
+#endif /* SBMP_HAS_RELIABLE */
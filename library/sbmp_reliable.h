@@ -0,0 +1,171 @@
+#ifndef SBMP_RELIABLE_H
+#define SBMP_RELIABLE_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_RELIABLE
+
+/**
+ * Reliable datagram mode.
+ *
+ * Sits between the framing and the datagram layer. Each datagram gets
+ * a sequence number and is kept in a retransmit buffer until the peer
+ * confirms it. Acknowledgements are piggy-backed on outgoing datagrams
+ * (or sent as a short ack-only frame if there's nothing to send).
+ *
+ * Frames in this mode have the SBMP_FRM_FLAG_RELIABLE flag, and the payload
+ * starts with a header:
+ *
+ *   [ seq 1B | ack 1B | sack 2B ] [ datagram ]
+ *
+ * - seq  : sequence number of the datagram (ignored in ack-only frames)
+ * - ack  : next expected sequence number (all before it were received)
+ * - sack : selective ack - bit N means ack+1+N was received too
+ *
+ * Ack-only frames have just the header.
+ *
+ * Datagrams received out of order are buffered, so they're delivered
+ * in order and exactly once. When the sender sees a datagram sent after
+ * a missing one confirmed, the missing one is retransmitted right away;
+ * so a lost frame is usually recovered within one round-trip.
+ * A retransmission timeout (needs a clock) handles the rest.
+ *
+ * The mode is negotiated in the handshake (see sbmp_ep_init_reliable()).
+ * Use it through the endpoint; the functions here are called by the session layer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_datagram.h"
+
+/** Max number of datagrams in the retransmit buffer (limited by the sack field) */
+#define SBMP_REL_MAX_DEPTH 16
+
+/** Length of the reliable mode header */
+#define SBMP_REL_HEADER_LEN 4
+
+/** Default retransmission timeout (ms) */
+#define SBMP_REL_DEFAULT_RTO 500
+
+/**
+ * Clock function for the retransmission timeout.
+ * @return current time in milliseconds (can wrap around)
+ */
+typedef uint32_t (*SBMP_RelClockFunc)(void);
+
+/** Handler for delivered datagrams (same as the frame rx handler) */
+typedef void (*SBMP_RelDeliverFunc)(uint8_t *payload, uint16_t length, void *token);
+
+/** Retransmit buffer slot */
+typedef struct {
+	uint16_t len;         /*!< Datagram length */
+	uint8_t sent_next;    /*!< Sequence number following the last transmission (for loss detection) */
+	bool sacked;          /*!< Confirmed by a selective ack */
+	bool retx;            /*!< Marked for retransmission */
+	uint32_t sent_time;   /*!< Time of the last transmission */
+} SBMP_RelTxSlot;
+
+/** Reliable mode state */
+typedef struct {
+	bool active;          /*!< Negotiated with the peer, in use */
+	uint8_t depth;        /*!< Number of slots (power of two) */
+	uint8_t window;       /*!< Max datagrams in flight (lower of the two parties' depths) */
+	uint16_t slot_size;   /*!< Slot size - max length of a datagram (incl. its 3-byte header) */
+	SBMP_CksumType cksum_type; /*!< Checksum for the frames */
+
+	uint8_t *tx_buf;      /*!< Retransmit buffer, depth * slot_size */
+	uint8_t *rx_buf;      /*!< Buffer for datagrams received out of order, depth * slot_size */
+
+	uint8_t tx_base;      /*!< Oldest unconfirmed sequence number */
+	uint8_t tx_next;      /*!< Next sequence number to send */
+	SBMP_RelTxSlot tx[SBMP_REL_MAX_DEPTH]; /*!< Retransmit buffer slots */
+
+	uint8_t rx_next;      /*!< Next expected sequence number */
+	uint16_t rx_mask;     /*!< Datagrams received after rx_next (bit N = rx_next+1+N) */
+	uint16_t rx_len[SBMP_REL_MAX_DEPTH]; /*!< Lengths of the buffered datagrams */
+	uint8_t ack_pending;  /*!< Number of received datagrams not confirmed yet */
+	bool ack_now;         /*!< Send an ack without waiting (gap or duplicate seen) */
+
+	SBMP_RelClockFunc clock; /*!< Clock for timeouts, NULL = retransmit only on a selective ack */
+	uint32_t rto;         /*!< Retransmission timeout (ms) */
+
+	uint32_t retransmits; /*!< Number of retransmitted datagrams (stats) */
+	uint32_t duplicates;  /*!< Number of received duplicates (stats) */
+} SBMP_Reliable;
+
+
+/**
+ * @brief Initialize the reliable mode state.
+ *
+ * @param rel       : state struct, NULL to allocate
+ * @param buffer    : buffer for 2 * depth * slot_size bytes, NULL to allocate
+ * @param depth     : number of slots (rounded down to a power of two, max SBMP_REL_MAX_DEPTH)
+ * @param slot_size : max datagram length, incl. the 3-byte datagram header
+ * @param clock     : millisecond clock, NULL = no retransmission timeout
+ * @return the state (allocated if rel was NULL), NULL on failure
+ */
+SBMP_Reliable *sbmp_rel_init(SBMP_Reliable *rel, uint8_t *buffer, uint8_t depth, uint16_t slot_size, SBMP_RelClockFunc clock);
+
+/**
+ * @brief Stop using the reliable mode and discard all state.
+ * @param rel : state
+ */
+void sbmp_rel_reset(SBMP_Reliable *rel);
+
+/**
+ * @brief Start using the reliable mode (after the handshake).
+ *
+ * @param rel        : state
+ * @param peer_depth : peer's number of slots, 0 = not supported by the peer
+ * @param cksum_type : checksum to use for the frames
+ * @return true if the mode is active
+ */
+bool sbmp_rel_activate(SBMP_Reliable *rel, uint8_t peer_depth, SBMP_CksumType cksum_type);
+
+/**
+ * @brief Start a sequenced datagram (and the frame).
+ *
+ * Fails if the retransmit buffer is full (wait for the peer's ack)
+ * or if the datagram doesn't fit in a slot.
+ *
+ * @param rel     : state
+ * @param frm     : framing layer
+ * @param session : session number
+ * @param type    : datagram type
+ * @param length  : datagram payload length
+ * @return success
+ */
+bool sbmp_rel_start(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint16_t session, SBMP_DgType type, uint16_t length);
+
+/**
+ * @brief Handle a received frame with the SBMP_FRM_FLAG_RELIABLE flag.
+ *
+ * Processes the acks, and passes the datagram(s) to the deliver function
+ * in order (a datagram can release ones buffered before).
+ *
+ * @param rel     : state
+ * @param frm     : framing layer
+ * @param payload : frame payload
+ * @param length  : frame payload length
+ * @param deliver : datagram handler
+ * @param token   : token for the handler
+ */
+void sbmp_rel_receive(SBMP_Reliable *rel, SBMP_FrmInst *frm, uint8_t *payload, uint16_t length,
+					  SBMP_RelDeliverFunc deliver, void *token);
+
+/**
+ * @brief Retransmit lost datagrams, send a pending ack.
+ * @param rel : state
+ * @param frm : framing layer
+ */
+void sbmp_rel_poll(SBMP_Reliable *rel, SBMP_FrmInst *frm);
+
+/**
+ * @brief Get the number of datagrams that can be sent now.
+ * @param rel : state
+ * @return free slots in the window
+ */
+uint8_t sbmp_rel_free(SBMP_Reliable *rel);
+
+#endif /* SBMP_HAS_RELIABLE */
+#endif // SBMP_RELIABLE_H
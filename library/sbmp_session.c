@@ -1,27 +1,119 @@
 #include <inttypes.h>
+#include <string.h>
 
 #include "sbmp_config.h"
 #include "sbmp_session.h"
 
 // protos
 static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg);
+static bool send_plain(SBMP_Endpoint *ep, SBMP_DgType type, const uint8_t *buffer, uint16_t length, uint16_t sesn);
 
 // lsb, msb for uint16_t
 #define U16_LSB(x) ((x) & 0xFF)
 #define U16_MSB(x) ((x >> 8) & 0xFF)
 
-// length of the payload sent with a handshake packet.
-#define HSK_PAYLOAD_LEN 3
+// length of the payload sent with a handshake packet (without the capabilities).
+#define HSK_PAYLOAD_LEN 5
+// the reliable mode depth was added later, older peers send only this much
+#define HSK_PAYLOAD_MIN_LEN 3
 // Datagram header length - 2 B sesn, 1 B type
 #define DATAGRA_HEADER_LEN 3
+// format of the exported parameters
+#define PARAMS_FORMAT 1
+
+// handshake payload buffer
+#if SBMP_HAS_CAPS
+#define HSK_BUF_LEN (HSK_PAYLOAD_LEN + SBMP_CAPS_MAX_LEN)
+#else
+#define HSK_BUF_LEN HSK_PAYLOAD_LEN
+#endif
 
 #define SESSION2ORIGIN(session) (((session) & 0x8000) >> 15)
 
 
-/** Rx handler that is assigned to the framing layer */
-static void ep_rx_handler(uint8_t *buf, uint16_t len, void *token)
+#if SBMP_HAS_CREDIT
+/** Send a frame with just the flow control header */
+static bool send_credit(SBMP_Endpoint *ep, bool request)
+{
+	if (ep->frm.tx_status != FRM_STATE_IDLE) {
+		ep->credit.rx_req = true; // goes with the next frame, or on poll
+		return false;
+	}
+
+	ep->credit.tx_req = request;
+	bool suc = sbmp_frm_start(&ep->frm, ep->peer_pref_cksum, 0);
+	ep->credit.tx_req = false;
+
+	return suc;
+}
+
+/** Send a credit update if the peer should get it now */
+static void credit_update(SBMP_Endpoint *ep)
+{
+	if (sbmp_credit_update_due(&ep->credit)) {
+		send_credit(ep, false);
+	}
+}
+
+/** Frame prefix function - adds the flow control header */
+static uint8_t ep_tx_prefix(uint8_t *buf, void *token)
+{
+	SBMP_Endpoint *ep = (SBMP_Endpoint *)token;
+	return sbmp_credit_write_header(&ep->credit, buf);
+}
+#endif
+
+
+/** Pass a datagram to the dispatch function, a listener or the Rx handler */
+static void run_handlers(SBMP_Endpoint *ep, SBMP_Datagram *dg)
+{
+#if SBMP_HAS_STATS
+	// the handler may disable the endpoint & reuse the dg, keep the type
+	SBMP_DgType type = dg->type;
+	uint32_t start = (ep->stats != NULL ? ep->stats->clock() : 0);
+#endif
+
+	// the dispatch function takes all, else try listeners first...
+	bool handled = false;
+	if (ep->dispatch != NULL) {
+		ep->dispatch(ep, dg, ep->dispatch_token);
+		handled = true;
+	}
+
+	for (int i = 0; !handled && i < ep->listener_count; i++) {
+		SBMP_SessionListenerSlot *slot = &ep->listeners[i];
+		if (slot->callback == NULL) continue; // skip unused
+		if (slot->session == dg->session) {
+			slot->callback(ep, dg, &slot->obj); // call the listener
+			handled = true;
+			break;
+		}
+	}
+
+	if (!handled) {
+		sbmp_dbg("No listener for sesn %"PRIu16", using default handler.", dg->session);
+
+		// if no listener consumed it, call the default handler
+		ep->rx_handler(dg);
+	}
+
+#if SBMP_HAS_STATS
+	if (ep->stats != NULL) sbmp_stats_handler(ep->stats, type, start);
+#endif
+}
+
+#if SBMP_HAS_CREDIT
+/** Check if a datagram is handled by the session layer (not passed to the application) */
+static bool is_session_dg(SBMP_DgType type)
+{
+	return type <= DG_HANDSHAKE_RESUME // handshake, resume
+		   || type == DG_HEARTBEAT || type == DG_HEARTBEAT_ECHO;
+}
+#endif
+
+/** Parse a received datagram and pass it on */
+static void ep_deliver(uint8_t *buf, uint16_t len, void *token)
 {
-	// endpoint pointer is stored in the user token
 	SBMP_Endpoint *ep = (SBMP_Endpoint *)token;
 
 	if (NULL != sbmp_dg_parse(&ep->static_dg, buf, len)) {
@@ -29,11 +121,72 @@ static void ep_rx_handler(uint8_t *buf, uint16_t len, void *token)
 
 		sbmp_dbg("Received datagram type %"PRIu8", sesn %"PRIu16", len %"PRIu16, ep->static_dg.type, ep->static_dg.session, len);
 
+#if SBMP_HAS_CREDIT
+		// session datagrams are sent without credit
+		if (!is_session_dg(ep->static_dg.type)) {
+			// the credit is held until the application releases it, or polls the queue
+			bool held = ep->credit.manual;
+#if SBMP_HAS_DGQUEUE
+			held = held || ep->queue != NULL;
+#endif
+			sbmp_credit_delivered(&ep->credit, held);
+		}
+#endif
+
+#if SBMP_HAS_STATS
+		if (ep->stats != NULL) sbmp_stats_rx(ep->stats, &ep->static_dg);
+#endif
+
 		// check if handshake datagram, else call user callback.
 		handle_hsk_datagram(ep, &ep->static_dg);
 	}
 }
 
+/** Rx handler that is assigned to the framing layer */
+static void ep_rx_handler(uint8_t *buf, uint16_t len, void *token)
+{
+	// endpoint pointer is stored in the user token
+	SBMP_Endpoint *ep = (SBMP_Endpoint *)token;
+
+#if SBMP_HAS_STATS
+	if (ep->stats != NULL) sbmp_stats_arrival(ep->stats);
+#endif
+
+	if (ep->frm.rx_flags & SBMP_FRM_FLAG_CREDIT) {
+#if SBMP_HAS_CREDIT
+		if (len < SBMP_CREDIT_HEADER_LEN) {
+			sbmp_error("Flow control frame too short.");
+			return;
+		}
+
+		sbmp_credit_receive(&ep->credit, buf);
+		buf += SBMP_CREDIT_HEADER_LEN;
+		len -= SBMP_CREDIT_HEADER_LEN;
+#else
+		// never negotiated, the peer shouldn't send it
+		sbmp_warn("Flow control frame received, but not supported. Dropping.");
+		return;
+#endif
+	}
+
+	if (ep->frm.rx_flags & SBMP_FRM_FLAG_RELIABLE) {
+		if (!sbmp_ep_is_reliable(ep)) {
+			sbmp_warn("Reliable frame received, but the mode is not active. Dropping.");
+		} else {
+#if SBMP_HAS_RELIABLE
+			sbmp_rel_receive(ep->rel, &ep->frm, buf, len, ep_deliver, ep);
+#endif
+		}
+	} else if (len > 0) {
+		ep_deliver(buf, len, token);
+	}
+
+#if SBMP_HAS_CREDIT
+	// the datagram was processed - give the credit back
+	credit_update(ep);
+#endif
+}
+
 /**
  * @brief Initialize the endpoint.
  *
@@ -72,6 +225,10 @@ SBMP_Endpoint *sbmp_ep_init(
 	ep->listeners = NULL;
 	ep->listener_count = 0;
 
+#if SBMP_HAS_RELIABLE
+	ep->rel = NULL;
+#endif
+
 	// set up the framing layer
 	SBMP_FrmInst *alloc_frm = sbmp_frm_init(&ep->frm, buffer, buffer_size, ep_rx_handler, tx_func);
 	if (!alloc_frm) {
@@ -83,8 +240,35 @@ SBMP_Endpoint *sbmp_ep_init(
 	// set token, so callback knows what EP it's for.
 	sbmp_frm_set_user_token(&ep->frm, (void *) ep);
 
+#if SBMP_HAS_CREDIT
+	// flow control header for all frames (when negotiated)
+	sbmp_credit_init(&ep->credit, 0, false);
+	sbmp_frm_set_tx_prefix(&ep->frm, ep_tx_prefix);
+#endif
+
+#if SBMP_HAS_KEEPALIVE
+	sbmp_ka_init(&ep->ka, NULL, 0, 1);
+	ep->link_handler = NULL;
+#endif
+
+#if SBMP_HAS_STATS
+	ep->stats = NULL;
+#endif
+
 	ep->rx_handler = dg_rx_handler;
+	ep->dispatch = NULL;
+	ep->dispatch_token = NULL;
+#if SBMP_HAS_DGQUEUE
+	ep->queue = NULL;
+#endif
 	ep->buffer_size = buffer_size; // sent to the peer
+#if SBMP_HAS_CAPS
+	ep->rx_buffers = 1;
+	ep->app_features = 0;
+	ep->hsk_seed = 0;
+	ep->hsk_token = 0;
+	ep->hsk_plain = false;
+#endif
 
 #if SBMP_HAS_CRC32
 	ep->peer_pref_cksum = SBMP_CKSUM_CRC32;
@@ -126,6 +310,227 @@ bool sbmp_ep_init_listeners(SBMP_Endpoint *ep, SBMP_SessionListenerSlot *listene
 	return true;
 }
 
+#if SBMP_HAS_RELIABLE
+bool sbmp_ep_init_reliable(SBMP_Endpoint *ep, SBMP_Reliable *rel, uint8_t *buffer,
+						   uint8_t depth, uint16_t slot_size, SBMP_RelClockFunc clock)
+{
+	rel = sbmp_rel_init(rel, buffer, depth, slot_size, clock);
+	if (!rel) {
+		sbmp_error("Failed to init the reliable mode.");
+		return false;
+	}
+
+	ep->rel = rel;
+	return true;
+}
+
+void sbmp_ep_reliable_poll(SBMP_Endpoint *ep)
+{
+	if (ep->rel != NULL) {
+		sbmp_rel_poll(ep->rel, &ep->frm);
+	}
+}
+#endif
+
+bool sbmp_ep_is_reliable(SBMP_Endpoint *ep)
+{
+#if SBMP_HAS_RELIABLE
+	return ep->rel != NULL && ep->rel->active;
+#else
+	(void)ep;
+	return false;
+#endif
+}
+
+#if SBMP_HAS_CREDIT
+#if SBMP_HAS_DGQUEUE
+/** Reduce the flow control window to what the datagram queue can hold */
+static void fit_credit_window(SBMP_Endpoint *ep)
+{
+	if (ep->queue == NULL || ep->credit.window == 0) return;
+
+	// the largest datagrams the peer can send, and the end of the ring skipped on a wrap
+	uint32_t entry = (uint32_t) ep->buffer_size - DATAGRA_HEADER_LEN + SBMP_DGQ_OVERHEAD;
+	uint32_t fits = (ep->queue->size - 1) / entry;
+	fits = (fits > 0 ? fits - 1 : 0);
+
+	if (fits == 0) {
+		sbmp_warn("Datagram queue can't hold a datagram of %"PRIu16" B.", ep->buffer_size - DATAGRA_HEADER_LEN);
+		fits = 1;
+	}
+
+	if (ep->credit.window > fits) {
+		sbmp_info("Flow control window reduced to %"PRIu32" for the datagram queue.", fits);
+		ep->credit.window = (uint8_t) fits;
+	}
+}
+#endif
+
+bool sbmp_ep_init_credit(SBMP_Endpoint *ep, uint8_t window, bool manual)
+{
+	if (window == 0) {
+		sbmp_error("Flow control window can't be 0.");
+		return false;
+	}
+
+	sbmp_credit_init(&ep->credit, window, manual);
+#if SBMP_HAS_DGQUEUE
+	fit_credit_window(ep);
+#endif
+	return true;
+}
+
+void sbmp_ep_credit_release(SBMP_Endpoint *ep, uint8_t count)
+{
+	sbmp_credit_release(&ep->credit, count);
+	credit_update(ep);
+}
+
+void sbmp_ep_credit_poll(SBMP_Endpoint *ep)
+{
+	if (!ep->credit.active) return;
+
+	if (sbmp_credit_update_due(&ep->credit)) {
+		send_credit(ep, false);
+	} else if (sbmp_credit_available(&ep->credit) == 0) {
+		// our credit update may have been lost
+		send_credit(ep, true);
+	}
+}
+
+uint8_t sbmp_ep_credit_available(SBMP_Endpoint *ep)
+{
+	return sbmp_credit_available(&ep->credit);
+}
+#endif
+
+#if SBMP_HAS_KEEPALIVE
+bool sbmp_ep_init_keepalive(SBMP_Endpoint *ep, SBMP_KaClockFunc clock, uint32_t interval,
+							uint8_t max_missed, SBMP_LinkHandler handler)
+{
+	if (clock == NULL || interval == 0) {
+		sbmp_error("Keepalive needs a clock and an interval.");
+		return false;
+	}
+
+	sbmp_ka_init(&ep->ka, clock, interval, max_missed);
+	ep->link_handler = handler;
+	return true;
+}
+
+/** Call the link handler if the link state changed */
+static void link_check(SBMP_Endpoint *ep, bool was_up)
+{
+	if (ep->ka.up != was_up && ep->link_handler != NULL) {
+		ep->link_handler(ep, ep->ka.up);
+	}
+}
+
+void sbmp_ep_keepalive_poll(SBMP_Endpoint *ep)
+{
+	if (ep->ka.clock == NULL || ep->hsk_status != SBMP_HSK_SUCCESS) return;
+
+	bool was_up = ep->ka.up;
+
+	if (sbmp_ka_poll(&ep->ka)) {
+		uint8_t seq = (uint8_t)(ep->ka.seq + 1);
+		if (!send_plain(ep, DG_HEARTBEAT, &seq, 1, sbmp_ep_new_session(ep))) {
+			// Tx busy - count it as lost, or a blocked link would never go down
+			sbmp_dbg("Heartbeat not sent.");
+		}
+		sbmp_ka_sent(&ep->ka, seq);
+	}
+
+	link_check(ep, was_up);
+}
+#endif
+
+#if SBMP_HAS_STATS
+bool sbmp_ep_init_stats(SBMP_Endpoint *ep, SBMP_Stats *stats, SBMP_StatsClockFunc clock)
+{
+	stats = sbmp_stats_init(stats, clock);
+	if (!stats) {
+		sbmp_error("Failed to init the stats.");
+		return false;
+	}
+
+	ep->stats = stats;
+	return true;
+}
+#endif
+
+#if SBMP_HAS_FEC
+bool sbmp_ep_init_fec(SBMP_Endpoint *ep, SBMP_Fec *fec, uint8_t *block, uint8_t parity)
+{
+	if (!sbmp_frm_init_fec(&ep->frm, fec, block, parity)) {
+		return false;
+	}
+
+	// sent only when the peer supports it too (after a handshake)
+	sbmp_frm_enable_fec_tx(&ep->frm, false);
+	return true;
+}
+#endif
+
+#if SBMP_HAS_CAPS
+void sbmp_ep_set_caps(SBMP_Endpoint *ep, uint8_t rx_buffers, uint16_t app_features)
+{
+	ep->rx_buffers = (rx_buffers == 0 ? 1 : rx_buffers);
+	ep->app_features = app_features & SBMP_FEAT_APP_MASK;
+}
+#endif
+
+void sbmp_ep_set_dispatch(SBMP_Endpoint *ep, SBMP_DispatchFunc func, void *token)
+{
+	ep->dispatch = func;
+	ep->dispatch_token = token;
+}
+
+#if SBMP_HAS_DGQUEUE
+bool sbmp_ep_init_queue(SBMP_Endpoint *ep, SBMP_DgQueue *queue, uint8_t *buffer, uint16_t size)
+{
+	queue = sbmp_dgq_init(queue, buffer, size);
+	if (queue == NULL) {
+		sbmp_error("Datagram queue init failed.");
+		return false;
+	}
+
+	ep->queue = queue;
+#if SBMP_HAS_CREDIT
+	fit_credit_window(ep);
+#endif
+	return true;
+}
+
+uint16_t sbmp_ep_poll(SBMP_Endpoint *ep, void (*handler)(SBMP_Datagram *dg), uint16_t max)
+{
+	if (ep->queue == NULL) return 0;
+
+	SBMP_Datagram dg;
+	uint16_t count = 0;
+
+	while ((max == 0 || count < max) && sbmp_dgq_peek(ep->queue, &dg)) {
+		if (handler != NULL) {
+			handler(&dg);
+		} else {
+			run_handlers(ep, &dg);
+		}
+
+		sbmp_dgq_pop(ep->queue);
+		count++;
+	}
+
+#if SBMP_HAS_CREDIT
+	// processed now - give the credit back
+	if (count > 0) {
+		sbmp_ep_credit_release(ep, count > 255 ? 255 : (uint8_t) count);
+	}
+#endif
+
+	return count;
+}
+#endif
+
 /**
  * @brief Reset an endpoint and it's Framing Layer
  *
@@ -143,6 +548,27 @@ void sbmp_ep_reset(SBMP_Endpoint *ep)
 	ep->hsk_status = SBMP_HSK_IDLE;
 
 	ep->peer_buffer_size = 0xFFFF; // max possible buffer
+#if SBMP_HAS_RELIABLE
+	ep->peer_rel_depth = 0;
+#endif
+#if SBMP_HAS_CREDIT
+	ep->peer_credit_window = 0;
+#endif
+#if SBMP_HAS_CAPS
+	memset(&ep->common_caps, 0, sizeof(SBMP_Caps));
+	ep->hsk_token = 0;
+	ep->hsk_resumed = false;
+#endif
+
+#if SBMP_HAS_RELIABLE
+	if (ep->rel != NULL) sbmp_rel_reset(ep->rel);
+#endif
+#if SBMP_HAS_CREDIT
+	sbmp_credit_reset(&ep->credit);
+#endif
+#if SBMP_HAS_KEEPALIVE
+	sbmp_ka_reset(&ep->ka);
+#endif
 
 	sbmp_frm_reset(&ep->frm);
 }
@@ -178,12 +604,17 @@ void sbmp_ep_set_preferred_cksum(SBMP_Endpoint *endp, SBMP_CksumType cksum_type)
 /** Get a new session number */
 uint16_t sbmp_ep_new_session(SBMP_Endpoint *ep)
 {
+#if SBMP_HAS_THREADS
+	// the counter runs through all 16 bits, the origin bit is masked off
+	uint16_t sesn = __atomic_fetch_add(&ep->next_session, 1, __ATOMIC_RELAXED) & 0x7FFF;
+#else
 	uint16_t sesn = ep->next_session;
 
 	if (++ep->next_session == 0x8000) {
 		// overflow into the origin bit
 		ep->next_session = 0; // start from zero
 	}
+#endif
 
 	return sesn | (uint16_t)(ep->origin << 15); // add the origin bit
 }
@@ -191,17 +622,77 @@ uint16_t sbmp_ep_new_session(SBMP_Endpoint *ep)
 
 // ---- Header/body send funcs -------------------------------------------------
 
-/** Start a message as a reply */
-bool sbmp_ep_start_response(SBMP_Endpoint *ep, SBMP_DgType type, uint16_t length, uint16_t sesn)
+/**
+ * Start a datagram
+ *
+ * @param plain : send it outside the reliable window, using no credit (session datagrams)
+ */
+static bool start_dg(SBMP_Endpoint *ep, SBMP_DgType type, uint16_t length, uint16_t sesn, bool plain)
 {
 	uint16_t peer_accepts = ep->peer_buffer_size - DATAGRA_HEADER_LEN;
 
+#if SBMP_HAS_RELIABLE
+	bool reliable = !plain && sbmp_ep_is_reliable(ep);
+	if (reliable) peer_accepts -= SBMP_REL_HEADER_LEN;
+#endif
+
+#if SBMP_HAS_CREDIT
+	SBMP_Credit *cr = &ep->credit;
+	if (cr->active) peer_accepts -= SBMP_CREDIT_HEADER_LEN;
+#endif
+
 	if (length > peer_accepts) {
 		sbmp_error("Msg too long (%"PRIu16" B), peer accepts max %"PRIu16" B.", length, peer_accepts);
 		return false;
 	}
 
-	return sbmp_dg_start(&ep->frm, ep->peer_pref_cksum, sesn, type, length);
+#if SBMP_HAS_CREDIT
+	if (!plain) {
+		if (sbmp_credit_available(cr) == 0) {
+			sbmp_dbg("Out of flow control credit, can't send.");
+			cr->stalls++;
+			return false;
+		}
+
+		// the frame prefix takes one credit
+		cr->tx_consume = true;
+	}
+#else
+	(void)plain;
+#endif
+
+	bool suc;
+#if SBMP_HAS_RELIABLE
+	if (reliable) {
+		suc = sbmp_rel_start(ep->rel, &ep->frm, sesn, type, length);
+	} else
+#endif
+	{
+		suc = sbmp_dg_start(&ep->frm, ep->peer_pref_cksum, sesn, type, length);
+	}
+
+#if SBMP_HAS_CREDIT
+	cr->tx_consume = false;
+#endif
+
+#if SBMP_HAS_STATS
+	if (suc && ep->stats != NULL) sbmp_stats_tx(ep->stats, type, length);
+#endif
+
+	return suc;
+}
+
+/** Send a session datagram (heartbeat) that must get through a full reliable window or credit */
+static bool send_plain(SBMP_Endpoint *ep, SBMP_DgType type, const uint8_t *buffer, uint16_t length, uint16_t sesn)
+{
+	return start_dg(ep, type, length, sesn, true)
+		   && sbmp_ep_send_buffer(ep, buffer, length, NULL);
+}
+
+/** Start a message as a reply */
+bool sbmp_ep_start_response(SBMP_Endpoint *ep, SBMP_DgType type, uint16_t length, uint16_t sesn)
+{
+	return start_dg(ep, type, length, sesn, false);
 }
 
 /** Start a message in a new session */
@@ -212,6 +703,10 @@ bool sbmp_ep_start_message(SBMP_Endpoint *ep, SBMP_DgType type, uint16_t length,
 	bool suc = sbmp_ep_start_response(ep, type, length, sn);
 	if (suc) {
 		if (sesn_ptr != NULL) *sesn_ptr = sn;
+
+#if SBMP_HAS_STATS
+		if (ep->stats != NULL) sbmp_stats_request(ep->stats, type, sn);
+#endif
 	}
 
 	return suc;
@@ -286,31 +781,153 @@ bool sbmp_ep_send_message(
 		if (sesn_ptr != NULL) *sesn_ptr = old_sesn; // restore
 	}
 
+#if SBMP_HAS_STATS
+	if (suc && ep->stats != NULL) sbmp_stats_request(ep->stats, type, sn);
+#endif
+
 	return suc;
 }
 
 
 // ---- Handshake ------------------------------------------------------
 
+#if SBMP_HAS_CAPS
+/** Pick a new handshake tie-break value (never 0) */
+static void next_hsk_seed(SBMP_Endpoint *ep)
+{
+	// xorshift, mixed with the session counter (randomised by the application) and the entropy source
+	uint32_t e = (uint32_t) sbmp_entropy();
+	uint16_t x = (uint16_t)(ep->hsk_seed ^ ep->next_session ^ 0x5EED ^ e ^ (e >> 16));
+	x ^= (uint16_t)(x << 7);
+	x ^= (uint16_t)(x >> 9);
+	x ^= (uint16_t)(x << 8);
+
+	ep->hsk_seed = (x == 0 ? 1 : x);
+}
+
+/** Get our capabilities */
+static void get_our_caps(SBMP_Endpoint *ep, SBMP_Caps *caps)
+{
+	caps->version_major = SBMP_PROTO_VER_MAJOR;
+	caps->version_minor = SBMP_PROTO_VER_MINOR;
+
+	caps->cksums = SBMP_CAP_CKSUM_NONE | SBMP_CAP_CKSUM_XOR;
+#if SBMP_HAS_CRC32
+	caps->cksums |= SBMP_CAP_CKSUM_CRC32;
+#endif
+
+	caps->max_frame = ep->buffer_size;
+	caps->rx_buffers = ep->rx_buffers;
+
+	caps->features = ep->app_features;
+#if SBMP_HAS_RELIABLE
+	if (ep->rel != NULL) caps->features |= SBMP_FEAT_RELIABLE;
+#endif
+#if SBMP_HAS_CREDIT
+	if (ep->credit.window > 0) caps->features |= SBMP_FEAT_CREDIT;
+#endif
+#if SBMP_HAS_FEC
+	if (ep->frm.fec != NULL) caps->features |= SBMP_FEAT_FEC;
+#endif
+}
+#endif
+
 /**
  * Prepare a buffer to send to peer during handshake
  *
- * The buffer is long HSK_PAYLOAD_LEN bytes
+ * The buffer is long HSK_BUF_LEN bytes
+ *
+ * @param with_caps : include the capabilities
+ * @param with_seed : include the tie-break value (for a handshake request)
+ * @return payload length
  */
-static void populate_hsk_buf(SBMP_Endpoint *ep, uint8_t* buf)
+static uint16_t populate_hsk_buf(SBMP_Endpoint *ep, uint8_t* buf, bool with_caps, bool with_seed)
 {
-	// [ pref_crc 1B | buf_size 2B ]
+	// [ pref_crc 1B | buf_size 2B | rel_depth 1B | credit_window 1B | capabilities ]
 
 	buf[0] = ep->pref_cksum;
 	buf[1] = U16_LSB(ep->buffer_size);
 	buf[2] = U16_MSB(ep->buffer_size);
+#if SBMP_HAS_RELIABLE
+	buf[3] = (ep->rel != NULL ? ep->rel->depth : 0);
+#else
+	buf[3] = 0; // no reliable mode
+#endif
+#if SBMP_HAS_CREDIT
+	buf[4] = ep->credit.window;
+#else
+	buf[4] = 0; // no flow control
+#endif
+
+#if SBMP_HAS_CAPS
+	if (!with_caps) return HSK_PAYLOAD_LEN;
+
+	SBMP_Caps caps;
+	get_our_caps(ep, &caps);
+	caps.hsk_seed = (with_seed ? ep->hsk_seed : 0);
+	return (uint16_t)(HSK_PAYLOAD_LEN + sbmp_caps_encode(&caps, buf + HSK_PAYLOAD_LEN));
+#else
+	(void)with_caps;
+	(void)with_seed;
+	return HSK_PAYLOAD_LEN; // just the fixed fields, like an old peer
+#endif
 }
 
 /** Parse peer info from received handhsake dg payload */
-static void parse_peer_hsk_buf(SBMP_Endpoint *ep, const uint8_t* buf)
+static void parse_peer_hsk_buf(SBMP_Endpoint *ep, const uint8_t* buf, uint16_t len)
 {
 	ep->peer_pref_cksum = buf[0];
 	ep->peer_buffer_size = (uint16_t)(buf[1] | (buf[2] << 8));
+	uint8_t peer_depth = (len >= 4 ? buf[3] : 0);
+#if SBMP_HAS_RELIABLE
+	ep->peer_rel_depth = peer_depth;
+#endif
+	uint8_t peer_window = (len >= 5 ? buf[4] : 0);
+#if SBMP_HAS_CREDIT
+	ep->peer_credit_window = peer_window;
+#endif
+
+#if SBMP_HAS_CAPS
+	// an older peer sends no capabilities - derive what we can from the fixed fields
+	SBMP_Caps peer;
+	peer.version_major = 0;
+	peer.version_minor = 0;
+	peer.cksums = SBMP_CAP_CKSUM_NONE | SBMP_CAP_CKSUM_XOR | sbmp_caps_cksum_bit(ep->peer_pref_cksum);
+	peer.max_frame = ep->peer_buffer_size;
+	peer.rx_buffers = 1;
+	peer.features = (uint16_t)((peer_depth ? SBMP_FEAT_RELIABLE : 0)
+							   | (peer_window ? SBMP_FEAT_CREDIT : 0));
+	peer.hsk_seed = 0;
+
+	if (len > HSK_PAYLOAD_LEN) {
+		if (!sbmp_caps_decode(&peer, buf + HSK_PAYLOAD_LEN, (uint16_t)(len - HSK_PAYLOAD_LEN))) {
+			sbmp_warn("Peer's capabilities damaged, using what was read.");
+		}
+	}
+
+	SBMP_Caps ours;
+	get_our_caps(ep, &ours);
+	sbmp_caps_intersect(&ep->common_caps, &ours, &peer);
+
+	// the request's tie-break value identifies the handshake (for sbmp_ep_resume())
+	ep->hsk_token = peer.hsk_seed;
+
+	if (peer.max_frame < ep->peer_buffer_size) {
+		ep->peer_buffer_size = peer.max_frame;
+	}
+
+	// use the peer's preferred checksum if we have it, else the best we both have
+	ep->peer_pref_cksum = sbmp_caps_pick_cksum(ep->common_caps.cksums, ep->peer_pref_cksum);
+
+	sbmp_info("Handshake success, peer buf %"PRIu16", pref cksum %d, version %"PRIu8".%"PRIu8", features 0x%04"PRIx16,
+			  ep->peer_buffer_size,
+			  ep->peer_pref_cksum,
+			  peer.version_major,
+			  peer.version_minor,
+			  ep->common_caps.features);
+#else
+	(void)peer_depth;
+	(void)peer_window;
 
 	sbmp_info("Handshake success, peer buf %"PRIu16", pref cksum %d",
 			  ep->peer_buffer_size,
@@ -321,6 +938,67 @@ static void parse_peer_hsk_buf(SBMP_Endpoint *ep, const uint8_t* buf)
 		sbmp_warn("CRC32 not avail, using XOR as peer's pref cksum.");
 		ep->peer_pref_cksum = SBMP_CKSUM_XOR;
 	}
+#endif
+}
+
+/**
+ * Resolve simultaneous handshake requests.
+ *
+ * The request with the higher tie-break value wins, the other party accepts it.
+ *
+ * @return 1 = ours wins, -1 = peer's wins, 0 = can't decide (old peer, same values)
+ */
+static int hsk_tie_break(SBMP_Endpoint *ep, SBMP_Datagram *dg)
+{
+#if SBMP_HAS_CAPS
+	if (dg->length <= HSK_PAYLOAD_LEN) return 0; // no capabilities
+
+	SBMP_Caps peer;
+	peer.hsk_seed = 0;
+	sbmp_caps_decode(&peer, dg->payload + HSK_PAYLOAD_LEN, (uint16_t)(dg->length - HSK_PAYLOAD_LEN));
+
+	if (peer.hsk_seed == 0 || peer.hsk_seed == ep->hsk_seed) return 0;
+
+	return (ep->hsk_seed > peer.hsk_seed) ? 1 : -1;
+#else
+	(void)ep;
+	(void)dg;
+	return 0; // we send no tie-break value
+#endif
+}
+
+/** Start the modes negotiated in the handshake */
+static void activate_modes(SBMP_Endpoint *ep)
+{
+	(void)ep; // all the modes can be disabled in the config
+
+#if SBMP_HAS_RELIABLE
+	if (ep->rel != NULL) sbmp_rel_activate(ep->rel, ep->peer_rel_depth, ep->peer_pref_cksum);
+#endif
+#if SBMP_HAS_CREDIT
+	sbmp_credit_activate(&ep->credit, ep->peer_credit_window, sbmp_ep_is_reliable(ep));
+#endif
+
+#if SBMP_HAS_FEC && SBMP_HAS_CAPS
+	sbmp_frm_enable_fec_tx(&ep->frm, (ep->common_caps.features & SBMP_FEAT_FEC) != 0);
+#endif
+}
+
+/** Stop the negotiated modes until the next handshake or resume */
+static void stop_modes(SBMP_Endpoint *ep)
+{
+	(void)ep; // all the modes can be disabled in the config
+
+#if SBMP_HAS_RELIABLE
+	if (ep->rel != NULL) sbmp_rel_reset(ep->rel);
+#endif
+#if SBMP_HAS_CREDIT
+	sbmp_credit_reset(&ep->credit);
+#endif
+
+#if SBMP_HAS_FEC
+	sbmp_frm_enable_fec_tx(&ep->frm, false);
+#endif
 }
 
 /**
@@ -329,14 +1007,31 @@ static void parse_peer_hsk_buf(SBMP_Endpoint *ep, const uint8_t* buf)
  */
 bool sbmp_ep_start_handshake(SBMP_Endpoint *ep)
 {
+#if SBMP_HAS_CAPS
+	// an old peer with a small buffer drops a request with the capabilities -
+	// if the last one got no reply, try without them (and then with them again)
+	bool retry = (ep->hsk_status == SBMP_HSK_AWAIT_REPLY);
+	ep->hsk_plain = retry && !ep->hsk_plain;
+	if (ep->hsk_plain) sbmp_info("No reply to the handshake, trying without capabilities.");
+
+	next_hsk_seed(ep);
+#endif
+
 	sbmp_ep_abort_handshake(ep);
 
-	uint8_t buf[HSK_PAYLOAD_LEN];
-	populate_hsk_buf(ep, buf);
+	uint8_t buf[HSK_BUF_LEN];
+#if SBMP_HAS_CAPS
+	uint16_t len = populate_hsk_buf(ep, buf, !ep->hsk_plain, true);
+#else
+	uint16_t len = populate_hsk_buf(ep, buf, false, false);
+#endif
+
+	// the peer starts from scratch too
+	stop_modes(ep);
 
 	ep->hsk_status = SBMP_HSK_AWAIT_REPLY;
 
-	bool suc = sbmp_ep_send_message(ep, DG_HANDSHAKE_START, buf, 3, &ep->hsk_session, NULL);
+	bool suc = sbmp_ep_send_message(ep, DG_HANDSHAKE_START, buf, len, &ep->hsk_session, NULL);
 
 	if (!suc) {
 		sbmp_error("Failed to start handshake.");
@@ -364,6 +1059,143 @@ void sbmp_ep_abort_handshake(SBMP_Endpoint *ep)
 	}
 }
 
+#if SBMP_HAS_CAPS
+uint16_t sbmp_ep_export_params(SBMP_Endpoint *ep, uint8_t *buf)
+{
+	if (ep->hsk_status != SBMP_HSK_SUCCESS || ep->hsk_token == 0) {
+		return 0; // nothing to resume
+	}
+
+	const SBMP_Caps *caps = &ep->common_caps;
+
+	buf[0] = PARAMS_FORMAT;
+	buf[1] = ep->origin;
+	buf[2] = U16_LSB(ep->peer_buffer_size);
+	buf[3] = U16_MSB(ep->peer_buffer_size);
+	buf[4] = ep->peer_pref_cksum;
+#if SBMP_HAS_RELIABLE
+	buf[5] = ep->peer_rel_depth;
+#else
+	buf[5] = 0;
+#endif
+#if SBMP_HAS_CREDIT
+	buf[6] = ep->peer_credit_window;
+#else
+	buf[6] = 0;
+#endif
+	buf[7] = caps->version_major;
+	buf[8] = caps->version_minor;
+	buf[9] = caps->cksums;
+	buf[10] = U16_LSB(caps->max_frame);
+	buf[11] = U16_MSB(caps->max_frame);
+	buf[12] = caps->rx_buffers;
+	buf[13] = U16_LSB(caps->features);
+	buf[14] = U16_MSB(caps->features);
+	buf[15] = U16_LSB(ep->hsk_token);
+	buf[16] = U16_MSB(ep->hsk_token);
+
+	uint8_t check = 0;
+	for (int i = 0; i < SBMP_EP_PARAMS_LEN - 1; i++) check ^= buf[i];
+	buf[SBMP_EP_PARAMS_LEN - 1] = check;
+
+	return SBMP_EP_PARAMS_LEN;
+}
+
+bool sbmp_ep_import_params(SBMP_Endpoint *ep, const uint8_t *buf, uint16_t len)
+{
+	if (len < SBMP_EP_PARAMS_LEN || buf[0] != PARAMS_FORMAT) {
+		sbmp_warn("Unknown endpoint params format.");
+		return false;
+	}
+
+	uint8_t check = 0;
+	for (int i = 0; i < SBMP_EP_PARAMS_LEN; i++) check ^= buf[i];
+	if (check != 0) {
+		sbmp_warn("Endpoint params damaged.");
+		return false;
+	}
+
+	sbmp_ep_reset(ep);
+
+	SBMP_Caps *caps = &ep->common_caps;
+
+	ep->origin = buf[1] & 1;
+	ep->peer_buffer_size = (uint16_t)(buf[2] | (buf[3] << 8));
+	ep->peer_pref_cksum = buf[4];
+#if SBMP_HAS_RELIABLE
+	ep->peer_rel_depth = buf[5];
+#endif
+#if SBMP_HAS_CREDIT
+	ep->peer_credit_window = buf[6];
+#endif
+	caps->version_major = buf[7];
+	caps->version_minor = buf[8];
+	caps->cksums = buf[9];
+	caps->max_frame = (uint16_t)(buf[10] | (buf[11] << 8));
+	caps->rx_buffers = buf[12];
+	caps->features = (uint16_t)(buf[13] | (buf[14] << 8));
+	ep->hsk_token = (uint16_t)(buf[15] | (buf[16] << 8));
+
+	ep->hsk_status = SBMP_HSK_SUCCESS;
+	return true;
+}
+
+bool sbmp_ep_resume(SBMP_Endpoint *ep)
+{
+	if (ep->hsk_status != SBMP_HSK_SUCCESS || ep->hsk_token == 0) {
+		sbmp_error("No params to resume, do a handshake.");
+		return false;
+	}
+
+	// the peer resets its modes when it gets this
+	stop_modes(ep);
+
+	uint8_t buf[2] = { U16_LSB(ep->hsk_token), U16_MSB(ep->hsk_token) };
+	if (!sbmp_ep_send_message(ep, DG_HANDSHAKE_RESUME, buf, 2, NULL, NULL)) {
+		sbmp_error("Failed to send resume.");
+		return false;
+	}
+
+	ep->hsk_resumed = true;
+	activate_modes(ep);
+
+	sbmp_dbg("Session resumed.");
+	return true;
+}
+#endif
+
+/** Process a resume datagram from the peer */
+static void handle_resume(SBMP_Endpoint *ep, SBMP_Datagram *dg)
+{
+#if SBMP_HAS_CAPS
+	uint16_t token = (dg->length >= 2 ? (uint16_t)(dg->payload[0] | (dg->payload[1] << 8)) : 0);
+
+	if (ep->hsk_status != SBMP_HSK_SUCCESS || ep->hsk_token == 0 || token != ep->hsk_token) {
+		sbmp_info("Peer's resume token doesn't match, starting a handshake.");
+		sbmp_ep_start_handshake(ep);
+		return;
+	}
+
+	if (ep->hsk_resumed) {
+		// we both resumed at once, already starting from scratch
+		ep->hsk_resumed = false;
+		return;
+	}
+
+	sbmp_info("Peer resumed the session.");
+
+	// the peer starts the modes from scratch
+	stop_modes(ep);
+	activate_modes(ep);
+#else
+	(void)dg;
+
+	// we never give the peer a token
+	sbmp_info("Can't resume without capabilities, starting a handshake.");
+	sbmp_ep_start_handshake(ep);
+#endif
+}
+
 /**
  * @brief Process handshake datagrams & update handshake state accordingly.
  *
@@ -378,10 +1210,34 @@ static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg)
 	bool hsk_accept = (dg->type == DG_HANDSHAKE_ACCEPT);
 	bool hsk_conflict = (dg->type == DG_HANDSHAKE_CONFLICT);
 
-	if (hsk_start || hsk_accept || hsk_conflict) {
+#if SBMP_HAS_KEEPALIVE
+	// anything from the peer means the link works
+	bool was_up = ep->ka.up;
+	sbmp_ka_activity(&ep->ka);
+	link_check(ep, was_up);
+#endif
+
+	if (dg->type == DG_HEARTBEAT) {
+		// echo it back (even with the keepalive disabled)
+		send_plain(ep, DG_HEARTBEAT_ECHO, dg->payload, dg->length, dg->session);
+
+	} else if (dg->type == DG_HEARTBEAT_ECHO) {
+#if SBMP_HAS_KEEPALIVE
+		if (ep->ka.clock != NULL && dg->length >= 1) {
+			sbmp_ka_echo(&ep->ka, dg->payload[0]);
+		}
+#endif
+
+	} else if (dg->type == DG_HANDSHAKE_RESUME) {
+		handle_resume(ep, dg);
+
+	} else if (hsk_start || hsk_accept || hsk_conflict) {
 		// prepare payload to send in response
-		uint8_t our_info_pld[HSK_PAYLOAD_LEN];
-		populate_hsk_buf(ep, our_info_pld);
+		uint8_t our_info_pld[HSK_BUF_LEN];
+		uint16_t our_info_len;
+
+		// a request without the capabilities comes from a peer that can't take them
+		bool peer_caps = (dg->length > HSK_PAYLOAD_LEN);
 
 		//printf("hsk_state = %d, hsk_ses %d, dg_ses %d\n",ep->hsk_state,  ep->hsk_session, dg->session);
 
@@ -389,9 +1245,25 @@ static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg)
 			// peer requests origin
 			sbmp_info("Incoming handshake request");
 
+			if (ep->hsk_status == SBMP_HSK_AWAIT_REPLY) {
+				// both started at once - one of the requests can win
+				int tb = hsk_tie_break(ep, dg);
+				if (tb > 0) {
+					// the peer accepts ours when it gets it
+					sbmp_info("Simultaneous handshake, our request wins.");
+					return;
+				}
+
+				if (tb < 0) {
+					sbmp_info("Simultaneous handshake, peer's request wins.");
+					sbmp_ep_abort_handshake(ep);
+				}
+			}
+
 			if (ep->hsk_status == SBMP_HSK_AWAIT_REPLY) {
 				// conflict occured - we're already waiting for a reply.
-				sbmp_ep_send_response(ep, DG_HANDSHAKE_CONFLICT, our_info_pld, HSK_PAYLOAD_LEN, dg->session, NULL);
+				our_info_len = populate_hsk_buf(ep, our_info_pld, peer_caps, false);
+				sbmp_ep_send_response(ep, DG_HANDSHAKE_CONFLICT, our_info_pld, our_info_len, dg->session, NULL);
 				ep->hsk_status = SBMP_HSK_CONFLICT;
 
 				sbmp_error("Handshake conflict!");
@@ -401,14 +1273,20 @@ static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg)
 				sbmp_ep_set_origin(ep, !peer_origin);
 
 				// read peer's info
-				if (dg->length >= HSK_PAYLOAD_LEN) {
-					parse_peer_hsk_buf(ep, dg->payload);
+				if (dg->length >= HSK_PAYLOAD_MIN_LEN) {
+					parse_peer_hsk_buf(ep, dg->payload, dg->length);
 				}
 
 				ep->hsk_status = SBMP_HSK_SUCCESS;
 
+				// the peer doesn't use the negotiated modes until it gets our reply
+				stop_modes(ep);
+
 				// Send Accept response
-				sbmp_ep_send_response(ep, DG_HANDSHAKE_ACCEPT, our_info_pld, HSK_PAYLOAD_LEN, dg->session, NULL);
+				our_info_len = populate_hsk_buf(ep, our_info_pld, peer_caps, false);
+				sbmp_ep_send_response(ep, DG_HANDSHAKE_ACCEPT, our_info_pld, our_info_len, dg->session, NULL);
+
+				activate_modes(ep);
 			}
 		} else if (hsk_accept) {
 			// peer accepted our request
@@ -420,13 +1298,24 @@ static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg)
 
 			} else {
 				// OK, we were waiting for this reply
+				uint16_t len = dg->length;
+#if SBMP_HAS_CAPS
+				// we sent no capabilities, so the peer doesn't use them either
+				if (ep->hsk_plain && len > HSK_PAYLOAD_LEN) len = HSK_PAYLOAD_LEN;
+#endif
 
 				// read peer's info
-				if (dg->length >= HSK_PAYLOAD_LEN) {
-					parse_peer_hsk_buf(ep, dg->payload);
+				if (len >= HSK_PAYLOAD_MIN_LEN) {
+					parse_peer_hsk_buf(ep, dg->payload, len);
 				}
 
+#if SBMP_HAS_CAPS
+				// a peer without capabilities can't resume
+				ep->hsk_token = (ep->common_caps.version_major != 0) ? ep->hsk_seed : 0;
+#endif
 				ep->hsk_status = SBMP_HSK_SUCCESS;
+
+				activate_modes(ep);
 			}
 		} else if (hsk_conflict) {
 			// peer rejected our request due to conflict
@@ -446,20 +1335,27 @@ static void handle_hsk_datagram(SBMP_Endpoint *ep, SBMP_Datagram *dg)
 		}
 
 	} else {
-		// try listeners first...
-		for (int i = 0; i < ep->listener_count; i++) {
-			SBMP_SessionListenerSlot *slot = &ep->listeners[i];
-			if (slot->callback == NULL) continue; // skip unused
-			if (slot->session == dg->session) {
-				slot->callback(ep, dg, &slot->obj); // call the listener
-				return;
-			}
-		}
+#if SBMP_HAS_CAPS
+		// the peer is talking, a resume from it is a new one
+		ep->hsk_resumed = false;
+#endif
 
-		sbmp_dbg("No listener for sesn %"PRIu16", using default handler.", dg->session);
+#if SBMP_HAS_DGQUEUE
+		if (ep->queue != NULL) {
+			// handled later, by sbmp_ep_poll()
+			if (!sbmp_dgq_push(ep->queue, dg)) {
+				sbmp_warn("Datagram queue full, dropped type %"PRIu8", sesn %"PRIu16, dg->type, dg->session);
 
-		// if no listener consumed it, call the default handler
-		ep->rx_handler(dg);
+#if SBMP_HAS_CREDIT
+				// never polled, give its credit back now
+				sbmp_credit_release(&ep->credit, 1);
+#endif
+			}
+		} else
+#endif
+		{
+			run_handlers(ep, dg);
+		}
 	}
 }
 
@@ -11,6 +11,23 @@
  * Next you should trigger a handshake, which assigns your endpoint the origin bit,
  * and obtains information about your peer (it's buffer size and preferred checksum).
  *
+ * If both parties enable it with sbmp_ep_init_reliable(), the handshake also
+ * starts the reliable mode - lost datagrams are then retransmitted automatically
+ * (see sbmp_reliable.h).
+ *
+ * With sbmp_ep_init_credit(), the handshake also starts the flow control -
+ * the peer then sends only as many datagrams as we can take (see sbmp_credit.h).
+ *
+ * With sbmp_ep_init_queue(), the received datagrams are copied to a queue,
+ * and the handlers run later, from sbmp_ep_poll() (see sbmp_dgqueue.h).
+ *
+ * With sbmp_ep_init_keepalive(), the endpoint sends heartbeats, measures the
+ * round-trip time and reports when the link goes down or up (see sbmp_keepalive.h).
+ *
+ * The handshake also exchanges capabilities (see sbmp_caps.h) - what both
+ * parties support is then in ep->common_caps, and the optional modes
+ * (reliable, flow control, FEC) are started if both have them enabled.
+ *
  * You can still interact with the framing layer directly, but it shouldn't be needed.
  */
 
@@ -21,6 +38,12 @@
 #include "sbmp_config.h"
 #include "sbmp_datagram.h"
 #include "sbmp_frame.h"
+#include "sbmp_reliable.h"
+#include "sbmp_credit.h"
+#include "sbmp_caps.h"
+#include "sbmp_keepalive.h"
+#include "sbmp_stats.h"
+#include "sbmp_dgqueue.h"
 #include "payload_parser.h"
 
 /**
@@ -37,6 +60,16 @@ typedef enum {
 /** Forward declaration of the endpoint struct */
 typedef struct SBMP_Endpoint_struct SBMP_Endpoint;
 
+#if SBMP_HAS_KEEPALIVE
+/**
+ * Link state change handler (keepalive)
+ *
+ * @param ep : the endpoint
+ * @param up : true if the link came up, false if it went down
+ */
+typedef void (*SBMP_LinkHandler)(SBMP_Endpoint *ep, bool up);
+#endif
+
 /**
  * Session listener function.
  *
@@ -44,6 +77,14 @@ typedef struct SBMP_Endpoint_struct SBMP_Endpoint;
  */
 typedef void (*SBMP_SessionListener)(SBMP_Endpoint *ep, SBMP_Datagram *dg, void **obj);
 
+/**
+ * Dispatch function - takes the received datagrams instead of the listeners
+ * and the Rx handler (eg. to run them in other threads, see sbmp_pool.h).
+ *
+ * The datagram is valid only during the call.
+ */
+typedef void (*SBMP_DispatchFunc)(SBMP_Endpoint *ep, SBMP_Datagram *dg, void *token);
+
 /**
  * Session listener slot.
  *
@@ -60,24 +101,62 @@ typedef struct {
 /** SBMP Endpoint (session) structure */
 struct SBMP_Endpoint_struct {
 	bool origin;                     /*!< Local origin bit */
-	uint16_t next_session;           /*!< Next session number */
+	uint16_t next_session;           /*!< Next session number (low 15 bits with SBMP_HAS_THREADS) */
 
 	SBMP_SessionListenerSlot *listeners; /*!< Array of session listener slots */
 	uint16_t listener_count;             /*!< length of the session listener slot array */
 
 	void (*rx_handler)(SBMP_Datagram *dg);  /*!< Datagram receive handler */
+	SBMP_DispatchFunc dispatch;      /*!< Used instead of the listeners and rx_handler if set */
+	void *dispatch_token;            /*!< Passed to the dispatch function */
+#if SBMP_HAS_DGQUEUE
+	SBMP_DgQueue *queue;             /*!< Received datagrams waiting for sbmp_ep_poll(), NULL = handled on arrival */
+#endif
 
 	SBMP_FrmInst frm;                /*!< Framing layer internal state */
 
+#if SBMP_HAS_RELIABLE
+	SBMP_Reliable *rel;              /*!< Reliable mode state, NULL = not supported */
+#endif
+#if SBMP_HAS_CREDIT
+	SBMP_Credit credit;              /*!< Flow control state */
+#endif
+#if SBMP_HAS_KEEPALIVE
+	SBMP_Keepalive ka;               /*!< Keepalive & RTT state */
+	SBMP_LinkHandler link_handler;   /*!< Called when the link goes up or down, can be NULL */
+#endif
+#if SBMP_HAS_STATS
+	SBMP_Stats *stats;               /*!< Instrumentation, NULL = disabled */
+#endif
+
 	// Handshake
 	SBMP_HandshakeStatus hsk_status;  /*!< Handshake progress */
 	uint16_t hsk_session;            /*!< Session number of the handshake request message */
+#if SBMP_HAS_CAPS
+	uint16_t hsk_seed;               /*!< Tie-break value sent with our handshake request */
+	uint16_t hsk_token;              /*!< Identifies the last handshake, for resuming; 0 = can't resume */
+	bool hsk_resumed;                /*!< We sent a resume, and got nothing from the peer since */
+	bool hsk_plain;                  /*!< Our last handshake request had no capabilities (for old peers) */
+#endif
 	uint16_t peer_buffer_size;       /*!< Peer's buffer size (obtained during handshake) */
 	SBMP_CksumType peer_pref_cksum;  /*!< Peer's preferred checksum type */
+#if SBMP_HAS_RELIABLE
+	uint8_t peer_rel_depth;          /*!< Peer's reliable mode depth, 0 = not supported */
+#endif
+#if SBMP_HAS_CREDIT
+	uint8_t peer_credit_window;      /*!< Peer's flow control window, 0 = not supported */
+#endif
+#if SBMP_HAS_CAPS
+	SBMP_Caps common_caps;           /*!< Capabilities supported by both parties (all 0 before the handshake) */
+#endif
 
 	// Our info for the peer
 	uint16_t buffer_size;            /*!< Our buffer size */
 	SBMP_CksumType pref_cksum;       /*!< Our preferred checksum */
+#if SBMP_HAS_CAPS
+	uint8_t rx_buffers;              /*!< Received datagrams we can queue */
+	uint16_t app_features;           /*!< Application feature bits (SBMP_FEAT_APP_MASK) */
+#endif
 
 	SBMP_Datagram static_dg;         /*!< Static datagram, used when DG is pased to a callback.
 										  This way the datagram remains valid until next Frm Rx,
@@ -95,6 +174,8 @@ struct SBMP_Endpoint_struct {
  * The datagram is valid until a new payload byte is received by the Frm.
  * Disable the endpoint (-> thus also Frm) in the callback if you need
  * to keep the Dg longer. Then re-enable it after the Dg is processed.
+ * Or queue the datagrams with sbmp_ep_init_queue(), and handle them
+ * from the main loop with sbmp_ep_poll().
  *
  * @param ep          : Endpoint struct pointer, or NULL to allocate one.
  * @param buffer      : Rx buffer. NULL to allocate one.
@@ -118,6 +199,230 @@ SBMP_Endpoint *sbmp_ep_init(SBMP_Endpoint *ep,
  */
 bool sbmp_ep_init_listeners(SBMP_Endpoint *ep, SBMP_SessionListenerSlot *listener_slots, uint16_t slot_count);
 
+#if SBMP_HAS_RELIABLE
+/**
+ * @brief Enable the reliable datagram mode
+ *
+ * The mode is started by the next handshake, if the peer supports it too.
+ * Datagrams are then kept in a retransmit buffer until the peer confirms them,
+ * and the lost ones are sent again.
+ *
+ * Call sbmp_ep_reliable_poll() periodically (eg. in the main loop).
+ *
+ * @param ep        : Endpoint pointer
+ * @param rel       : state struct, NULL to malloc.
+ * @param buffer    : buffer for 2 * depth * slot_size bytes, NULL to malloc.
+ * @param depth     : max number of datagrams in flight (power of two, max SBMP_REL_MAX_DEPTH)
+ * @param slot_size : longest datagram that can be sent (incl. the 3-byte header); should be >= peer's buffer size
+ * @param clock     : millisecond clock for the retransmission timeout, can be NULL
+ * @return success
+ */
+bool sbmp_ep_init_reliable(SBMP_Endpoint *ep, SBMP_Reliable *rel, uint8_t *buffer,
+						   uint8_t depth, uint16_t slot_size, SBMP_RelClockFunc clock);
+
+/**
+ * @brief Retransmit lost datagrams and send pending acks (reliable mode).
+ *
+ * Call this periodically, outside of the receive path.
+ *
+ * @param ep : Endpoint
+ */
+void sbmp_ep_reliable_poll(SBMP_Endpoint *ep);
+#endif
+
+/** Check if the reliable mode is active (negotiated in the handshake); false if not built in */
+bool sbmp_ep_is_reliable(SBMP_Endpoint *ep);
+
+#if SBMP_HAS_CREDIT
+/**
+ * @brief Enable the credit-based flow control
+ *
+ * The mode is started by the next handshake, if the peer supports it too.
+ * The peer can then send at most `window` datagrams ahead, and gets more
+ * credit as we process them. Sending fails when we run out of the peer's
+ * credit - check sbmp_ep_credit_available() and try again later.
+ *
+ * In the manual mode, the credit is returned by sbmp_ep_credit_release()
+ * (eg. when the main loop takes a datagram from a queue). Otherwise,
+ * it's returned when the Rx handler returns.
+ *
+ * Call sbmp_ep_credit_poll() periodically (eg. every 100 ms).
+ *
+ * @param ep     : Endpoint pointer
+ * @param window : datagrams the peer can send ahead (1 - SBMP_CREDIT_MAX_WINDOW)
+ * @param manual : the credit is returned by sbmp_ep_credit_release()
+ * @return success
+ */
+bool sbmp_ep_init_credit(SBMP_Endpoint *ep, uint8_t window, bool manual);
+
+/**
+ * @brief Give the peer credit for processed datagrams (manual mode)
+ *
+ * Call for every received datagram once it's processed.
+ *
+ * @param ep    : Endpoint
+ * @param count : number of processed datagrams
+ */
+void sbmp_ep_credit_release(SBMP_Endpoint *ep, uint8_t count);
+
+/**
+ * @brief Send a pending credit update; if we're out of credit, ask the peer for it.
+ *
+ * Only needed if frames can get lost, or if the Rx side can't send when
+ * releasing the credit (Tx busy). Don't call it in a tight loop - each call
+ * can send a short frame.
+ *
+ * @param ep : Endpoint
+ */
+void sbmp_ep_credit_poll(SBMP_Endpoint *ep);
+
+/**
+ * @brief Get the number of datagrams that can be sent now
+ * @param ep : Endpoint
+ * @return remaining credit, 0xFF if the flow control isn't active
+ */
+uint8_t sbmp_ep_credit_available(SBMP_Endpoint *ep);
+#endif
+
+#if SBMP_HAS_KEEPALIVE
+/**
+ * @brief Enable the keepalive
+ *
+ * A heartbeat is sent every `interval` ms (after a handshake), and the peer
+ * echoes it back. This measures the RTT (see sbmp_ep_rtt()), and detects
+ * a dead link - after `max_missed` heartbeats in a row without an echo,
+ * the link handler is called with up = false. When anything arrives
+ * from the peer again, it's called with up = true.
+ *
+ * Call sbmp_ep_keepalive_poll() periodically (more often than the interval).
+ *
+ * @param ep         : Endpoint pointer
+ * @param clock      : millisecond clock
+ * @param interval   : heartbeat interval (ms)
+ * @param max_missed : missed heartbeats before the link is down
+ * @param handler    : link up / down handler, can be NULL
+ * @return success
+ */
+bool sbmp_ep_init_keepalive(SBMP_Endpoint *ep, SBMP_KaClockFunc clock, uint32_t interval,
+							uint8_t max_missed, SBMP_LinkHandler handler);
+
+/**
+ * @brief Send a heartbeat when it's due, and check for missed ones.
+ * @param ep : Endpoint
+ */
+void sbmp_ep_keepalive_poll(SBMP_Endpoint *ep);
+
+/** Check if the link is up (keepalive) */
+static inline bool sbmp_ep_link_up(SBMP_Endpoint *ep)
+{
+	return ep->ka.up;
+}
+
+/** Get the smoothed RTT in ms, 0 = not measured yet (keepalive) */
+static inline uint32_t sbmp_ep_rtt(SBMP_Endpoint *ep)
+{
+	return sbmp_ka_rtt(&ep->ka);
+}
+
+/** Get a timeout for requests derived from the RTT in ms, 0 = not measured yet (keepalive) */
+static inline uint32_t sbmp_ep_rtt_timeout(SBMP_Endpoint *ep)
+{
+	return sbmp_ka_timeout(&ep->ka);
+}
+#endif
+
+#if SBMP_HAS_STATS
+/**
+ * @brief Enable the instrumentation (see sbmp_stats.h)
+ *
+ * Print the results with sbmp_stats_dump_text() or sbmp_stats_dump_json()
+ * on ep->stats.
+ *
+ * @param ep    : Endpoint pointer
+ * @param stats : state, NULL to allocate
+ * @param clock : microsecond clock
+ * @return success
+ */
+bool sbmp_ep_init_stats(SBMP_Endpoint *ep, SBMP_Stats *stats, SBMP_StatsClockFunc clock);
+#endif
+
+#if SBMP_HAS_FEC
+/**
+ * @brief Enable the forward error correction
+ *
+ * FEC frames are received right away, but sent only after a handshake
+ * with a peer that supports FEC too (see sbmp_frm_init_fec()).
+ *
+ * @param ep     : Endpoint pointer
+ * @param fec    : FEC state, NULL to allocate
+ * @param block  : Rx block buffer (SBMP_FEC_BLOCK_MAX bytes), NULL to allocate
+ * @param parity : parity bytes per block (even, 2 - SBMP_FEC_MAX_PARITY)
+ * @return success
+ */
+bool sbmp_ep_init_fec(SBMP_Endpoint *ep, SBMP_Fec *fec, uint8_t *block, uint8_t parity);
+#endif
+
+#if SBMP_HAS_CAPS
+/**
+ * @brief Set capabilities sent to the peer in the handshake
+ *
+ * Both are informative - the result is in ep->common_caps after the handshake.
+ *
+ * @param ep           : Endpoint
+ * @param rx_buffers   : received datagrams we can queue (default 1)
+ * @param app_features : application feature bits (only SBMP_FEAT_APP_MASK is used)
+ */
+void sbmp_ep_set_caps(SBMP_Endpoint *ep, uint8_t rx_buffers, uint16_t app_features);
+#endif
+
+/**
+ * @brief Pass the received datagrams to a dispatch function.
+ *
+ * The handshake, resume and heartbeat datagrams are still handled by the
+ * endpoint; all others go to the function, not to the listeners or the
+ * Rx handler.
+ *
+ * @param ep    : Endpoint
+ * @param func  : dispatch function, NULL = back to the listeners and the Rx handler
+ * @param token : passed to the function
+ */
+void sbmp_ep_set_dispatch(SBMP_Endpoint *ep, SBMP_DispatchFunc func, void *token);
+
+#if SBMP_HAS_DGQUEUE
+/**
+ * @brief Queue the received datagrams, to be handled by sbmp_ep_poll().
+ *
+ * The receiving side (eg. an interrupt) then only copies each datagram to
+ * the queue, and runs no handlers; the main loop takes them in batches.
+ * The handshake, resume and heartbeat datagrams are still handled on arrival.
+ * A datagram that doesn't fit is dropped (counted in queue->dropped).
+ *
+ * With the flow control (sbmp_ep_init_credit()), the credit of a queued
+ * datagram is given back by sbmp_ep_poll(), and the window is reduced to
+ * what the queue can hold - the peer then never sends more. Size the queue
+ * for the window: (window + 1) * (SBMP_DGQ_OVERHEAD + Rx buffer size) + 1.
+ *
+ * @param ep     : Endpoint
+ * @param queue  : queue state, NULL to allocate
+ * @param buffer : the ring, NULL to allocate
+ * @param size   : ring size (a datagram takes SBMP_DGQ_OVERHEAD + its length)
+ * @return success
+ */
+bool sbmp_ep_init_queue(SBMP_Endpoint *ep, SBMP_DgQueue *queue, uint8_t *buffer, uint16_t size);
+
+/**
+ * @brief Handle the queued datagrams (see sbmp_ep_init_queue()).
+ *
+ * The datagram passed to the handler is valid until it returns.
+ *
+ * @param ep      : Endpoint
+ * @param handler : datagram handler, NULL = the dispatch function, listeners and Rx handler, as usual
+ * @param max     : most datagrams to handle, 0 = all
+ * @return number of datagrams handled
+ */
+uint16_t sbmp_ep_poll(SBMP_Endpoint *ep, void (*handler)(SBMP_Datagram *dg), uint16_t max);
+#endif
+
 /**
  * @brief Reset an endpoint and it's Framing Layer
  *
@@ -127,7 +432,13 @@ bool sbmp_ep_init_listeners(SBMP_Endpoint *ep, SBMP_SessionListenerSlot *listene
  */
 void sbmp_ep_reset(SBMP_Endpoint *ep);
 
-/** Set session number (good to randomize before starting a handshake) */
+/**
+ * Set session number (good to randomize before starting a handshake)
+ *
+ * The handshake tie-break value is derived from it, and from sbmp_entropy()
+ * in the config. Without an entropy source, the parties must be seeded
+ * differently, or simultaneous handshakes always end in a conflict.
+ */
 void sbmp_ep_seed_session(SBMP_Endpoint *ep, uint16_t sesn);
 
 /**
@@ -281,6 +592,49 @@ void sbmp_ep_abort_handshake(SBMP_Endpoint *ep);
 /** Get current handshake state */
 SBMP_HandshakeStatus sbmp_ep_handshake_status(SBMP_Endpoint *ep);
 
+#if SBMP_HAS_CAPS
+/** Length of the exported endpoint parameters */
+#define SBMP_EP_PARAMS_LEN 18
+
+/**
+ * @brief Export the parameters negotiated in the handshake
+ *
+ * Store them (eg. in EEPROM or a retained RAM section) to skip the handshake
+ * after a reset - see sbmp_ep_resume().
+ *
+ * @param ep  : Endpoint struct
+ * @param buf : buffer for SBMP_EP_PARAMS_LEN bytes
+ * @return length of the exported data, 0 if there's nothing to export (no handshake with a capable peer)
+ */
+uint16_t sbmp_ep_export_params(SBMP_Endpoint *ep, uint8_t *buf);
+
+/**
+ * @brief Import parameters saved by sbmp_ep_export_params()
+ *
+ * The endpoint is reset, and then behaves as after the handshake.
+ * Call sbmp_ep_resume() before sending anything else.
+ *
+ * @param ep  : Endpoint struct
+ * @param buf : the exported data
+ * @param len : data length
+ * @return success (false if the data is damaged)
+ */
+bool sbmp_ep_import_params(SBMP_Endpoint *ep, const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Resume the session with imported parameters, without a handshake
+ *
+ * Sends a token identifying the last handshake, and starts the negotiated
+ * modes right away - traffic can follow immediately. If the peer doesn't
+ * recognise the token (it was reset too, or did another handshake since),
+ * it starts a new handshake.
+ *
+ * @param ep : Endpoint struct
+ * @return success
+ */
+bool sbmp_ep_resume(SBMP_Endpoint *ep);
+#endif
+
 /**
  * @brief Receive a byte from USART (is passed to the framing layer)
  * @param ep   : Endpoint struct
@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "sbmp_config.h"
+#include "sbmp_shm.h"
+
+/** "SBMP" */
+#define SHM_MAGIC 0x504D4253
+
+#define CACHE_LINE 64
+
+/** Largest ring size */
+#define SHM_MAX_RING (1UL << 30)
+
+/** Indices of a ring (free-running), each on its own cache line */
+typedef struct {
+	uint32_t tail;              /*!< Written by the producer */
+	uint8_t pad1[CACHE_LINE - 4];
+	uint32_t head;              /*!< Written by the consumer */
+	uint8_t pad2[CACHE_LINE - 4];
+} RingIdx;
+
+/** Start of the shared region, followed by the data of ring 0 and ring 1 */
+typedef struct {
+	uint32_t magic;
+	uint32_t ring_size;
+	uint32_t closed[2];         /*!< The side closed its end */
+	uint8_t pad[CACHE_LINE - 16];
+	RingIdx ring[2];            /*!< Ring i is written by side i */
+} ShmHeader;
+
+struct SBMP_Shm_struct {
+	int side;                   /*!< 0 = created the region, 1 = the peer */
+	int fds[3];                 /*!< memfd, eventfd of side 0, eventfd of side 1 */
+	ShmHeader *hdr;
+	size_t map_len;
+	uint32_t size;
+	uint32_t mask;
+
+	RingIdx *tx;
+	uint8_t *tx_data;
+	uint32_t tx_tail;           /*!< Our tail, including the unpublished bytes */
+	uint32_t tx_published;      /*!< Tail visible to the peer */
+	uint32_t tx_head;           /*!< Last seen head of the peer */
+
+	uint8_t *ovf;               /*!< Bytes that didn't fit in the ring */
+	size_t ovf_len;
+	size_t ovf_size;
+
+	RingIdx *rx;
+	uint8_t *rx_data;
+	uint32_t rx_head;
+
+	SBMP_FrmInst *frm;
+	uint32_t spin_us;           /*!< Busy-wait before sleeping */
+	SBMP_ShmStats stats;
+};
+
+/** Map the region; init_size > 0 = write the header first */
+static SBMP_Shm *shm_open_fds(const int fds[3], int side, uint32_t init_size)
+{
+	SBMP_Shm *shm = calloc(1, sizeof(SBMP_Shm));
+	if (shm == NULL) {
+		sbmp_error("No memory for the shm transport.");
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fds[0], &st) != 0 || (size_t) st.st_size < sizeof(ShmHeader)) {
+		sbmp_error("Bad shm region.");
+		free(shm);
+		return NULL;
+	}
+
+	shm->map_len = (size_t) st.st_size;
+	shm->hdr = mmap(NULL, shm->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (shm->hdr == MAP_FAILED) {
+		sbmp_error("Can't map the shm region: %s", strerror(errno));
+		free(shm);
+		return NULL;
+	}
+
+	if (init_size > 0) {
+		shm->hdr->ring_size = init_size;
+		__atomic_store_n(&shm->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	uint32_t size = shm->hdr->ring_size;
+	if (__atomic_load_n(&shm->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+		|| size == 0 || (size & (size - 1)) != 0
+		|| sizeof(ShmHeader) + 2 * (size_t) size > shm->map_len) {
+		sbmp_error("Bad shm region.");
+		munmap(shm->hdr, shm->map_len);
+		free(shm);
+		return NULL;
+	}
+
+	memcpy(shm->fds, fds, sizeof(shm->fds));
+	shm->side = side;
+	shm->size = size;
+	shm->mask = size - 1;
+
+	uint8_t *data = (uint8_t *) shm->hdr + sizeof(ShmHeader);
+	shm->tx = &shm->hdr->ring[side];
+	shm->tx_data = data + (size_t) side * size;
+	shm->rx = &shm->hdr->ring[1 - side];
+	shm->rx_data = data + (size_t)(1 - side) * size;
+
+	// continue where the indices are (a re-opened side)
+	shm->tx_tail = shm->tx_published = __atomic_load_n(&shm->tx->tail, __ATOMIC_ACQUIRE);
+	shm->tx_head = __atomic_load_n(&shm->tx->head, __ATOMIC_ACQUIRE);
+	shm->rx_head = __atomic_load_n(&shm->rx->head, __ATOMIC_ACQUIRE);
+
+	return shm;
+}
+
+SBMP_Shm *sbmp_shm_create(size_t ring_size)
+{
+	if (ring_size == 0) ring_size = SBMP_SHM_DEFAULT_RING;
+
+	if ((ring_size & (ring_size - 1)) != 0 || ring_size > SHM_MAX_RING) {
+		sbmp_error("Bad shm ring size %zu (must be a power of 2).", ring_size);
+		return NULL;
+	}
+
+	int fds[3];
+	fds[0] = memfd_create("sbmp", MFD_CLOEXEC);
+	fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	fds[2] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0
+		|| ftruncate(fds[0], (off_t)(sizeof(ShmHeader) + 2 * ring_size)) != 0) {
+		sbmp_error("Can't create the shm region: %s", strerror(errno));
+		goto fail;
+	}
+
+	SBMP_Shm *shm = shm_open_fds(fds, 0, (uint32_t) ring_size);
+	if (shm != NULL) return shm;
+
+fail:
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] >= 0) close(fds[i]);
+	}
+	return NULL;
+}
+
+bool sbmp_shm_pair(SBMP_Shm **a, SBMP_Shm **b, size_t ring_size)
+{
+	*a = sbmp_shm_create(ring_size);
+	if (*a == NULL) return false;
+
+	int fds[3];
+	for (int i = 0; i < 3; i++) {
+		fds[i] = fcntl(((*a)->fds[i]), F_DUPFD_CLOEXEC, 0);
+	}
+
+	*b = (fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0) ? shm_open_fds(fds, 1, 0) : NULL;
+	if (*b == NULL) {
+		for (int i = 0; i < 3; i++) {
+			if (fds[i] >= 0) close(fds[i]);
+		}
+		sbmp_shm_close(*a);
+		return false;
+	}
+
+	return true;
+}
+
+bool sbmp_shm_send_peer(SBMP_Shm *shm, int sock)
+{
+	char byte = 'S';
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(shm->fds))];
+	} ctrl;
+	memset(&ctrl, 0, sizeof(ctrl));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(shm->fds));
+	memcpy(CMSG_DATA(cmsg), shm->fds, sizeof(shm->fds));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+		sbmp_error("Can't send the shm fds: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+SBMP_Shm *sbmp_shm_open_peer(int sock)
+{
+	char byte;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} ctrl;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+		sbmp_error("Can't receive the shm fds: %s", strerror(errno));
+		return NULL;
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+		sbmp_error("No shm fds received.");
+		return NULL;
+	}
+
+	int fds[3];
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	SBMP_Shm *shm = shm_open_fds(fds, 1, 0);
+	if (shm == NULL) {
+		for (int i = 0; i < 3; i++) close(fds[i]);
+	}
+
+	return shm;
+}
+
+// --- Data path ---
+
+/** Signal the peer's eventfd */
+static void wake_peer(SBMP_Shm *shm)
+{
+	uint64_t one = 1;
+	if (write(shm->fds[2 - shm->side], &one, sizeof(one)) == sizeof(one)) {
+		shm->stats.wakeups++;
+	}
+}
+
+/** Make the written bytes visible; wake the peer if it saw the ring empty */
+static void tx_publish(SBMP_Shm *shm)
+{
+	if (shm->tx_tail == shm->tx_published) return;
+
+	uint32_t before = shm->tx_published;
+
+	// seq_cst store + load, paired with rx_consume() - either we see the
+	// peer's new head, or the peer sees our new tail
+	__atomic_store_n(&shm->tx->tail, shm->tx_tail, __ATOMIC_SEQ_CST);
+	shm->tx_head = __atomic_load_n(&shm->tx->head, __ATOMIC_SEQ_CST);
+
+	shm->stats.tx_bytes += shm->tx_tail - before;
+	shm->tx_published = shm->tx_tail;
+
+	if (shm->tx_head == before) wake_peer(shm);
+}
+
+/** Free space in the Tx ring */
+static uint32_t tx_room(SBMP_Shm *shm)
+{
+	if (shm->tx_tail - shm->tx_head == shm->size) {
+		shm->tx_head = __atomic_load_n(&shm->tx->head, __ATOMIC_ACQUIRE);
+	}
+
+	return shm->size - (shm->tx_tail - shm->tx_head);
+}
+
+/** Move the bytes from the overflow buffer to the ring */
+static void tx_drain(SBMP_Shm *shm)
+{
+	size_t done = 0;
+
+	while (done < shm->ovf_len) {
+		uint32_t room = tx_room(shm);
+		if (room == 0) break; // the peer wakes us when it makes room
+
+		size_t n = shm->ovf_len - done;
+		if (n > room) n = room;
+
+		uint32_t pos = shm->tx_tail & shm->mask;
+		size_t first = shm->size - pos;
+		if (first > n) first = n;
+
+		memcpy(shm->tx_data + pos, shm->ovf + done, first);
+		memcpy(shm->tx_data, shm->ovf + done + first, n - first);
+
+		shm->tx_tail += (uint32_t) n;
+		done += n;
+		tx_publish(shm);
+	}
+
+	if (done > 0) {
+		memmove(shm->ovf, shm->ovf + done, shm->ovf_len - done);
+		shm->ovf_len -= done;
+	}
+}
+
+/** Byte output of the framing layer */
+static void shm_out(uint8_t byte, void *token)
+{
+	SBMP_Shm *shm = token;
+
+	if (shm->ovf_len == 0 && tx_room(shm) > 0) {
+		shm->tx_data[shm->tx_tail & shm->mask] = byte;
+		shm->tx_tail++;
+		return;
+	}
+
+	if (shm->ovf_len == shm->ovf_size) {
+		size_t size = shm->ovf_size ? shm->ovf_size * 2 : 4096;
+		uint8_t *buf = realloc(shm->ovf, size);
+		if (buf == NULL) {
+			sbmp_error("No memory for the shm overflow buffer.");
+			return; // the byte is lost, the peer drops the frame
+		}
+
+		shm->ovf = buf;
+		shm->ovf_size = size;
+	}
+
+	if (shm->ovf_len == 0) shm->stats.overflows++;
+	shm->ovf[shm->ovf_len++] = byte;
+}
+
+/** Frame end - publish it */
+static void shm_end(void *token)
+{
+	SBMP_Shm *shm = token;
+
+	tx_publish(shm);
+	if (shm->ovf_len > 0) tx_drain(shm);
+}
+
+void sbmp_shm_attach(SBMP_Shm *shm, SBMP_FrmInst *frm)
+{
+	shm->frm = frm;
+	sbmp_frm_set_tx_output(frm, shm_out, shm_end, shm);
+}
+
+/** Pass the bytes in the Rx ring to the parser, until it's busy */
+static uint32_t rx_consume(SBMP_Shm *shm)
+{
+	uint32_t start = shm->rx_head;
+	uint32_t tail = __atomic_load_n(&shm->rx->tail, __ATOMIC_ACQUIRE);
+
+	while (shm->rx_head != tail) {
+		uint8_t b = shm->rx_data[shm->rx_head & shm->mask];
+		if (shm->frm != NULL && sbmp_frm_receive(shm->frm, b) == SBMP_RX_BUSY) break;
+		shm->rx_head++;
+	}
+
+	if (shm->rx_head == start) return 0;
+
+	// paired with tx_publish() of the peer
+	__atomic_store_n(&shm->rx->head, shm->rx_head, __ATOMIC_SEQ_CST);
+	tail = __atomic_load_n(&shm->rx->tail, __ATOMIC_SEQ_CST);
+
+	if (tail - start >= shm->size) wake_peer(shm); // it was full
+
+	uint32_t n = shm->rx_head - start;
+	shm->stats.rx_bytes += n;
+	return n;
+}
+
+/** Peer closed and everything is read */
+static bool peer_gone(SBMP_Shm *shm)
+{
+	return __atomic_load_n(&shm->hdr->closed[1 - shm->side], __ATOMIC_ACQUIRE)
+		   && sbmp_shm_rx_pending(shm) == 0;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void sbmp_shm_set_spin(SBMP_Shm *shm, uint32_t spin_us)
+{
+	shm->spin_us = spin_us;
+}
+
+ssize_t sbmp_shm_receive(SBMP_Shm *shm, int timeout_ms)
+{
+	if (shm->ovf_len > 0) tx_drain(shm);
+
+	uint32_t n = rx_consume(shm);
+	if (n > 0 || sbmp_shm_rx_pending(shm) > 0) return n; // data, or the parser is busy
+
+	if (peer_gone(shm)) return -1;
+	if (timeout_ms == 0) return 0;
+
+	if (shm->spin_us > 0) {
+		uint64_t end = now_us() + shm->spin_us;
+
+		do {
+			if (shm->ovf_len > 0) tx_drain(shm);
+
+			n = rx_consume(shm);
+			if (n > 0) return n;
+		} while (now_us() < end && !peer_gone(shm));
+	}
+
+	// clear the eventfd, check again, and sleep
+	uint64_t cnt;
+	int efd = shm->fds[1 + shm->side];
+	if (read(efd, &cnt, sizeof(cnt)) < 0) {
+		// EAGAIN - nothing to clear
+	}
+
+	n = rx_consume(shm);
+	if (n > 0) return n;
+	if (peer_gone(shm)) return -1;
+
+	struct pollfd pfd = {.fd = efd, .events = POLLIN};
+	poll(&pfd, 1, timeout_ms);
+
+	if (shm->ovf_len > 0) tx_drain(shm);
+	return rx_consume(shm);
+}
+
+size_t sbmp_shm_tx_pending(SBMP_Shm *shm)
+{
+	return shm->ovf_len + (shm->tx_tail - shm->tx_published);
+}
+
+size_t sbmp_shm_rx_pending(SBMP_Shm *shm)
+{
+	return __atomic_load_n(&shm->rx->tail, __ATOMIC_ACQUIRE) - shm->rx_head;
+}
+
+int sbmp_shm_fd(SBMP_Shm *shm)
+{
+	return shm->fds[1 + shm->side];
+}
+
+const SBMP_ShmStats *sbmp_shm_stats(SBMP_Shm *shm)
+{
+	return &shm->stats;
+}
+
+void sbmp_shm_close(SBMP_Shm *shm)
+{
+	if (shm->frm != NULL && shm->frm->tx_token == shm) {
+		sbmp_frm_set_tx_output(shm->frm, NULL, NULL, NULL);
+	}
+
+	__atomic_store_n(&shm->hdr->closed[shm->side], 1, __ATOMIC_RELEASE);
+	wake_peer(shm);
+
+	munmap(shm->hdr, shm->map_len);
+	for (int i = 0; i < 3; i++) close(shm->fds[i]);
+	free(shm->ovf);
+	free(shm);
+}
@@ -0,0 +1,151 @@
+#ifndef SBMP_SHM_H
+#define SBMP_SHM_H
+
+/**
+ * Shared memory transport (Linux only - not included from sbmp.h).
+ *
+ * Connects two endpoints in different processes (or threads) on one machine,
+ * without syscalls or copies on the data path:
+ *
+ * - A memfd region holds two single-producer / single-consumer byte rings,
+ *   one for each direction, with the indices on separate cache lines.
+ * - The framing layer writes the frame bytes straight into the ring
+ *   (sbmp_frm_set_tx_output()); the frame is published at its end.
+ * - The receiver parses the bytes straight from the ring.
+ * - Each side has an eventfd, written only when a ring goes from empty to
+ *   non-empty (or from full to non-full), so there are no syscalls while
+ *   the peer keeps up. The fd can be used with poll() / epoll.
+ *
+ * Bytes that don't fit in a full ring are kept in a local buffer and moved
+ * to the ring later, by sbmp_shm_receive() - the sender never blocks.
+ *
+ * The creating side passes the peer's fds over a Unix socket:
+ *
+ *   daemon:     shm = sbmp_shm_create(0); sbmp_shm_send_peer(shm, sock);
+ *   simulator:  shm = sbmp_shm_open_peer(sock);
+ *   both:       sbmp_shm_attach(shm, &ep->frm);
+ *               while (sbmp_shm_receive(shm, -1) >= 0) { ... }
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "sbmp_config.h"
+#include "sbmp_frame.h"
+
+/** Default size of each ring */
+#define SBMP_SHM_DEFAULT_RING 65536
+
+/** Shared memory transport (one side) */
+typedef struct SBMP_Shm_struct SBMP_Shm;
+
+/** Shared memory transport statistics */
+typedef struct {
+	uint64_t rx_bytes;      /*!< Bytes taken from the ring */
+	uint64_t tx_bytes;      /*!< Bytes put in the ring */
+	uint32_t wakeups;       /*!< Wakeups sent to the peer */
+	uint32_t overflows;     /*!< Times the ring was full */
+} SBMP_ShmStats;
+
+
+/**
+ * @brief Create the shared region (the first side).
+ * @param ring_size : size of each ring (power of 2), 0 = default
+ * @return the transport, NULL on failure
+ */
+SBMP_Shm *sbmp_shm_create(size_t ring_size);
+
+/**
+ * @brief Create both sides in one process (eg. for tests and benchmarks).
+ * @param a         : the first side
+ * @param b         : the second side
+ * @param ring_size : size of each ring (power of 2), 0 = default
+ * @return success
+ */
+bool sbmp_shm_pair(SBMP_Shm **a, SBMP_Shm **b, size_t ring_size);
+
+/**
+ * @brief Send the fds of the other side over a Unix socket (SCM_RIGHTS).
+ * @param shm  : the side from sbmp_shm_create()
+ * @param sock : connected Unix socket
+ * @return success
+ */
+bool sbmp_shm_send_peer(SBMP_Shm *shm, int sock);
+
+/**
+ * @brief Open the other side with the fds received from sbmp_shm_send_peer().
+ * @param sock : connected Unix socket
+ * @return the transport, NULL on failure
+ */
+SBMP_Shm *sbmp_shm_open_peer(int sock);
+
+/**
+ * @brief Connect the transport to a framing layer instance (eg. &ep->frm).
+ *
+ * Sets the instance's output functions; tx_func is not used.
+ *
+ * @param shm : transport
+ * @param frm : framing layer instance
+ */
+void sbmp_shm_attach(SBMP_Shm *shm, SBMP_FrmInst *frm);
+
+/**
+ * @brief Busy-wait before sleeping in sbmp_shm_receive().
+ *
+ * Lowers the latency (no wakeup syscalls while the peer answers within the
+ * time), at the cost of CPU time. Only useful if both sides have a core.
+ *
+ * @param shm     : transport
+ * @param spin_us : time to poll the ring, 0 = sleep right away (default)
+ */
+void sbmp_shm_set_spin(SBMP_Shm *shm, uint32_t spin_us);
+
+/**
+ * @brief Move the waiting bytes to the ring, and pass the received ones to the parser.
+ *
+ * If the parser is busy (waiting for the Rx handler), the rest stays in the
+ * ring until the next call.
+ *
+ * @param shm        : transport
+ * @param timeout_ms : max time to wait for data if there's none, -1 = forever
+ * @return bytes received (0 if none), -1 if the peer closed its side
+ */
+ssize_t sbmp_shm_receive(SBMP_Shm *shm, int timeout_ms);
+
+/**
+ * @brief Get the number of bytes waiting for room in the ring
+ * @param shm : transport
+ * @return byte count
+ */
+size_t sbmp_shm_tx_pending(SBMP_Shm *shm);
+
+/**
+ * @brief Get the number of bytes in the receive ring
+ * @param shm : transport
+ * @return byte count
+ */
+size_t sbmp_shm_rx_pending(SBMP_Shm *shm);
+
+/**
+ * @brief Get the eventfd - readable when data or room in the ring arrives
+ * @param shm : transport
+ * @return the fd
+ */
+int sbmp_shm_fd(SBMP_Shm *shm);
+
+/**
+ * @brief Get the statistics
+ * @param shm : transport
+ * @return the stats
+ */
+const SBMP_ShmStats *sbmp_shm_stats(SBMP_Shm *shm);
+
+/**
+ * @brief Detach the transport, tell the peer, and free it.
+ * @param shm : transport
+ */
+void sbmp_shm_close(SBMP_Shm *shm);
+
+#endif // SBMP_SHM_H
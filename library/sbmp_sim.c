@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sbmp_config.h"
+#include "sbmp_sim.h"
+
+/** Initial capacity of a line queue */
+#define QUEUE_INITIAL 1024
+
+/** The simulator that ran last (for the clock functions) */
+static SBMP_Sim *current;
+
+static void node_tx(uint8_t byte, void *token);
+
+SBMP_Sim *sbmp_sim_init(SBMP_Sim *sim, uint64_t seed)
+{
+#if SBMP_USE_MALLOC
+	if (sim == NULL) {
+		// caller wants us to allocate it
+		sim = sbmp_malloc(sizeof(SBMP_Sim));
+		if (sim == NULL) return NULL; // malloc failed
+	}
+#else
+	if (sim == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	memset(sim, 0, sizeof(SBMP_Sim));
+	sim->rng = seed ? seed : 1;
+
+	current = sim;
+	return sim;
+}
+
+void sbmp_sim_release(SBMP_Sim *sim)
+{
+	for (int i = 0; i < sim->line_count; i++) {
+		sbmp_free(sim->lines[i].bytes);
+		sbmp_free(sim->lines[i].times);
+	}
+
+	for (int i = 0; i < sim->node_count; i++) {
+		sbmp_frm_set_tx_output(&sim->nodes[i].ep->frm, NULL, NULL, NULL);
+	}
+
+	sim->line_count = 0;
+	sim->node_count = 0;
+
+	if (current == sim) current = NULL;
+}
+
+uint32_t sbmp_sim_random(SBMP_Sim *sim)
+{
+	// xorshift64*
+	uint64_t x = sim->rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sim->rng = x;
+
+	return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/** Random event with the given probability */
+static bool chance(SBMP_Sim *sim, double p)
+{
+	if (p <= 0) return false;
+	return sbmp_sim_random(sim) < p * 4294967296.0;
+}
+
+int sbmp_sim_add_node(SBMP_Sim *sim, SBMP_Endpoint *ep)
+{
+	if (sim->node_count == SBMP_SIM_MAX_NODES) {
+		sbmp_error("Too many simulated nodes.");
+		return -1;
+	}
+
+	uint8_t index = sim->node_count++;
+
+	SBMP_SimNode *node = &sim->nodes[index];
+	node->sim = sim;
+	node->ep = ep;
+	node->index = index;
+
+	sbmp_frm_set_tx_output(&ep->frm, node_tx, NULL, node);
+
+	return index;
+}
+
+/** Set up a line */
+static bool line_init(SBMP_SimLine *line, uint8_t from, uint8_t to, const SBMP_SimLineConfig *cfg)
+{
+	memset(line, 0, sizeof(SBMP_SimLine));
+
+	line->from = from;
+	line->to = to;
+	line->cfg = *cfg;
+	line->cap = QUEUE_INITIAL;
+	line->bytes = sbmp_malloc(line->cap);
+	line->times = sbmp_malloc(line->cap * sizeof(uint64_t));
+
+	if (line->bytes == NULL || line->times == NULL) {
+		sbmp_free(line->bytes);
+		sbmp_free(line->times);
+		return false;
+	}
+
+	return true;
+}
+
+int sbmp_sim_connect(SBMP_Sim *sim, int a, int b, const SBMP_SimLineConfig *cfg)
+{
+	if (a < 0 || b < 0 || a >= sim->node_count || b >= sim->node_count || a == b) {
+		sbmp_error("Bad nodes to connect.");
+		return -1;
+	}
+
+	if (sim->line_count + 2 > SBMP_SIM_MAX_LINES) {
+		sbmp_error("Too many simulated lines.");
+		return -1;
+	}
+
+	int index = sim->line_count;
+
+	if (!line_init(&sim->lines[index], (uint8_t)a, (uint8_t)b, cfg)) return -1;
+	if (!line_init(&sim->lines[index + 1], (uint8_t)b, (uint8_t)a, cfg)) {
+		sbmp_free(sim->lines[index].bytes);
+		sbmp_free(sim->lines[index].times);
+		return -1;
+	}
+
+	sim->line_count += 2;
+	return index;
+}
+
+void sbmp_sim_configure(SBMP_Sim *sim, int line, const SBMP_SimLineConfig *cfg)
+{
+	if (line < 0 || line >= sim->line_count) return;
+	sim->lines[line].cfg = *cfg;
+}
+
+/** Make room for another byte in the queue */
+static bool line_grow(SBMP_SimLine *line)
+{
+	uint32_t count = line->tail - line->head;
+	if (count < line->cap) return true;
+
+	uint32_t cap = line->cap * 2;
+	uint8_t *bytes = sbmp_malloc(cap);
+	uint64_t *times = sbmp_malloc(cap * sizeof(uint64_t));
+
+	if (bytes == NULL || times == NULL) {
+		sbmp_free(bytes);
+		sbmp_free(times);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t j = (line->head + i) & (line->cap - 1);
+		bytes[i] = line->bytes[j];
+		times[i] = line->times[j];
+	}
+
+	sbmp_free(line->bytes);
+	sbmp_free(line->times);
+
+	line->bytes = bytes;
+	line->times = times;
+	line->cap = cap;
+	line->head = 0;
+	line->tail = count;
+	return true;
+}
+
+/** Put a byte on a line */
+static void line_put(SBMP_Sim *sim, SBMP_SimLine *line, uint8_t byte)
+{
+	const SBMP_SimLineConfig *cfg = &line->cfg;
+
+	// a new transmission after a pause gets a new jitter
+	if (line->busy_until <= sim->now) {
+		line->busy_until = sim->now;
+		line->jitter = cfg->jitter_us ? sbmp_sim_random(sim) % (cfg->jitter_us + 1) : 0;
+	}
+
+	if (cfg->baud > 0) {
+		line->busy_until += 10000000ULL / cfg->baud; // 8N1
+	}
+
+	line->stats.sent++;
+
+	if (chance(sim, cfg->drop_rate)) {
+		line->stats.dropped++;
+		return;
+	}
+
+	uint8_t orig = byte;
+
+	if (line->burst_left == 0 && chance(sim, cfg->burst_rate)) {
+		line->burst_left = cfg->burst_len;
+	}
+
+	if (line->burst_left > 0) {
+		line->burst_left--;
+		byte = (uint8_t) sbmp_sim_random(sim);
+	}
+
+	if (cfg->bit_error_rate > 0) {
+		for (int bit = 0; bit < 8; bit++) {
+			if (chance(sim, cfg->bit_error_rate)) byte ^= (uint8_t)(1 << bit);
+		}
+	}
+
+	if (byte != orig) line->stats.corrupted++;
+
+	if (!line_grow(line)) {
+		sbmp_error("Sim queue full, byte lost.");
+		line->stats.dropped++;
+		return;
+	}
+
+	uint64_t t = line->busy_until + cfg->latency_us + line->jitter;
+	if (t < line->last_delivery) t = line->last_delivery; // no reordering
+	line->last_delivery = t;
+
+	uint32_t i = line->tail++ & (line->cap - 1);
+	line->bytes[i] = byte;
+	line->times[i] = t;
+}
+
+/** Byte sent by a node */
+static void node_tx(uint8_t byte, void *token)
+{
+	SBMP_SimNode *node = token;
+	SBMP_Sim *sim = node->sim;
+
+	for (int i = 0; i < sim->line_count; i++) {
+		if (sim->lines[i].from == node->index) {
+			line_put(sim, &sim->lines[i], byte);
+		}
+	}
+}
+
+/** Find the line with the earliest delivery */
+static SBMP_SimLine *next_line(SBMP_Sim *sim)
+{
+	SBMP_SimLine *best = NULL;
+
+	for (int i = 0; i < sim->line_count; i++) {
+		SBMP_SimLine *line = &sim->lines[i];
+		if (line->head == line->tail) continue;
+
+		if (best == NULL
+			|| line->times[line->head & (line->cap - 1)] < best->times[best->head & (best->cap - 1)]) {
+			best = line;
+		}
+	}
+
+	return best;
+}
+
+uint64_t sbmp_sim_next_event(SBMP_Sim *sim)
+{
+	SBMP_SimLine *line = next_line(sim);
+	if (line == NULL) return UINT64_MAX;
+
+	return line->times[line->head & (line->cap - 1)];
+}
+
+void sbmp_sim_run(SBMP_Sim *sim, uint64_t until)
+{
+	current = sim;
+
+	while (true) {
+		SBMP_SimLine *line = next_line(sim);
+		if (line == NULL) break;
+
+		uint32_t i = line->head & (line->cap - 1);
+		if (line->times[i] > until) break;
+
+		if (line->times[i] > sim->now) sim->now = line->times[i];
+		line->head++;
+		line->stats.delivered++;
+
+		sbmp_ep_receive(sim->nodes[line->to].ep, line->bytes[i]);
+	}
+
+	if (until > sim->now) sim->now = until;
+}
+
+bool sbmp_sim_run_idle(SBMP_Sim *sim, uint64_t limit)
+{
+	uint64_t next = sbmp_sim_next_event(sim);
+
+	while (next != UINT64_MAX && next <= limit) {
+		sbmp_sim_run(sim, next);
+		next = sbmp_sim_next_event(sim);
+	}
+
+	return next == UINT64_MAX;
+}
+
+uint32_t sbmp_sim_clock_ms(void)
+{
+	return current ? (uint32_t)(current->now / 1000) : 0;
+}
+
+uint32_t sbmp_sim_clock_us(void)
+{
+	return current ? (uint32_t) current->now : 0;
+}
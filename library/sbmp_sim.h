@@ -0,0 +1,176 @@
+#ifndef SBMP_SIM_H
+#define SBMP_SIM_H
+
+/**
+ * Link simulator, for testing and benchmarks (not included from sbmp.h).
+ *
+ * Connects endpoints with simulated serial lines, on a virtual clock.
+ * Each line has a baud rate (8N1 - 10 bits per byte), latency, jitter,
+ * and random errors - flipped bits, dropped bytes and bursts of garbage.
+ * The random numbers come from the simulator's own generator, so a run is
+ * fully determined by the seed.
+ *
+ * Nothing happens on its own - the application runs the simulation up to
+ * a time with sbmp_sim_run(), and does its own work (polling timers,
+ * sending messages) in between. Bytes sent by an endpoint are put on all
+ * its lines at the current virtual time.
+ *
+ * The endpoints' output is taken over by the simulator. The clock functions
+ * (sbmp_sim_clock_ms() etc.) can be given to the keepalive, stats and
+ * the bulk transfer modules; they read the simulator that ran last.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sbmp_session.h"
+
+/** Max number of endpoints in a simulator */
+#define SBMP_SIM_MAX_NODES 16
+
+/** Max number of lines in a simulator (each link has two) */
+#define SBMP_SIM_MAX_LINES 16
+
+/** Parameters of a line */
+typedef struct {
+	uint32_t baud;          /*!< Baud rate, 0 = unlimited */
+	uint32_t latency_us;    /*!< Fixed delay */
+	uint32_t jitter_us;     /*!< Random extra delay (0 - jitter), drawn when the line starts sending after a pause */
+	double bit_error_rate;  /*!< Probability of each bit being flipped */
+	double drop_rate;       /*!< Probability of each byte being lost */
+	double burst_rate;      /*!< Probability of a burst of garbage starting at each byte */
+	uint16_t burst_len;     /*!< Length of the bursts (bytes replaced with random values) */
+} SBMP_SimLineConfig;
+
+/** Statistics of a line */
+typedef struct {
+	uint64_t sent;          /*!< Bytes put on the line */
+	uint64_t delivered;     /*!< Bytes delivered */
+	uint64_t corrupted;     /*!< Bytes delivered damaged */
+	uint64_t dropped;       /*!< Bytes lost */
+} SBMP_SimLineStats;
+
+/** One direction of a link */
+typedef struct {
+	uint8_t from;           /*!< Sending node */
+	uint8_t to;             /*!< Receiving node */
+	SBMP_SimLineConfig cfg; /*!< Parameters */
+	SBMP_SimLineStats stats; /*!< Statistics */
+
+	uint8_t *bytes;         /*!< Queue of bytes in flight */
+	uint64_t *times;        /*!< Delivery times of the queued bytes */
+	uint32_t cap;           /*!< Queue capacity (power of two) */
+	uint32_t head;          /*!< Next byte to deliver */
+	uint32_t tail;          /*!< Next free slot */
+
+	uint64_t busy_until;    /*!< When the transmitter finishes the last byte */
+	uint64_t last_delivery; /*!< Delivery time of the last byte (keeps the order) */
+	uint32_t jitter;        /*!< Jitter of the current transmission */
+	uint16_t burst_left;    /*!< Bytes left in the current error burst */
+} SBMP_SimLine;
+
+typedef struct SBMP_Sim_struct SBMP_Sim;
+
+/** A simulated endpoint */
+typedef struct {
+	SBMP_Sim *sim;          /*!< The simulator */
+	SBMP_Endpoint *ep;      /*!< The endpoint */
+	uint8_t index;          /*!< Node number */
+} SBMP_SimNode;
+
+/** Simulator state (must not be moved after adding nodes) */
+struct SBMP_Sim_struct {
+	uint64_t now;           /*!< Virtual time (us) */
+	uint64_t rng;           /*!< Random generator state */
+
+	SBMP_SimNode nodes[SBMP_SIM_MAX_NODES]; /*!< Endpoints, by node number */
+	uint8_t node_count;
+
+	SBMP_SimLine lines[SBMP_SIM_MAX_LINES];
+	uint8_t line_count;
+};
+
+
+/**
+ * @brief Initialize the simulator
+ * @param sim  : simulator, NULL to allocate
+ * @param seed : random seed
+ * @return the simulator, NULL on failure
+ */
+SBMP_Sim *sbmp_sim_init(SBMP_Sim *sim, uint64_t seed);
+
+/**
+ * @brief Release the line queues and the nodes' outputs.
+ * The simulator struct itself is not freed.
+ * @param sim : simulator
+ */
+void sbmp_sim_release(SBMP_Sim *sim);
+
+/**
+ * @brief Add an endpoint to the simulation. Its output is set to the simulator
+ * (with sbmp_frm_set_tx_output()).
+ * @param sim : simulator
+ * @param ep  : the endpoint
+ * @return node number, -1 if there are too many nodes
+ */
+int sbmp_sim_add_node(SBMP_Sim *sim, SBMP_Endpoint *ep);
+
+/**
+ * @brief Connect two nodes with a link (a line in each direction)
+ * @param sim : simulator
+ * @param a   : node number
+ * @param b   : node number
+ * @param cfg : parameters of both lines
+ * @return index of the a -> b line (b -> a is the next one), -1 on failure
+ */
+int sbmp_sim_connect(SBMP_Sim *sim, int a, int b, const SBMP_SimLineConfig *cfg);
+
+/**
+ * @brief Change the parameters of a line (eg. to simulate an outage).
+ * Bytes already in flight are not affected.
+ * @param sim  : simulator
+ * @param line : line index
+ * @param cfg  : new parameters
+ */
+void sbmp_sim_configure(SBMP_Sim *sim, int line, const SBMP_SimLineConfig *cfg);
+
+/**
+ * @brief Get the time of the next byte delivery
+ * @param sim : simulator
+ * @return time in us, UINT64_MAX if nothing is in flight
+ */
+uint64_t sbmp_sim_next_event(SBMP_Sim *sim);
+
+/**
+ * @brief Deliver all bytes due before the given time, and move the clock there.
+ *
+ * Bytes sent by the endpoints meanwhile (eg. responses) are delivered too,
+ * if they arrive in time.
+ *
+ * @param sim   : simulator
+ * @param until : virtual time (us)
+ */
+void sbmp_sim_run(SBMP_Sim *sim, uint64_t until);
+
+/**
+ * @brief Run until nothing is in flight, or until a time limit.
+ * @param sim   : simulator
+ * @param limit : virtual time limit (us)
+ * @return true if the lines are idle
+ */
+bool sbmp_sim_run_idle(SBMP_Sim *sim, uint64_t limit);
+
+/**
+ * @brief Get a random number from the simulator's generator
+ * @param sim : simulator
+ * @return random number
+ */
+uint32_t sbmp_sim_random(SBMP_Sim *sim);
+
+/** Virtual time of the simulator that ran last, in ms (clock for the keepalive & bulk modules) */
+uint32_t sbmp_sim_clock_ms(void);
+
+/** Virtual time of the simulator that ran last, in us (clock for the stats) */
+uint32_t sbmp_sim_clock_us(void);
+
+#endif // SBMP_SIM_H
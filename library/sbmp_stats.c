@@ -0,0 +1,357 @@
+#include <inttypes.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sbmp_config.h"
+#include "sbmp_stats.h"
+
+#if SBMP_HAS_STATS
+
+// ---- Histogram ------------------------------------------------------
+
+/** Get the bucket of a value */
+static uint16_t hist_index(uint32_t value)
+{
+	if (value < SBMP_HIST_SUB) return (uint16_t)value;
+
+	uint8_t msb = 31;
+	while (!(value & (1UL << msb))) msb--;
+
+	uint8_t shift = (uint8_t)(msb - SBMP_HIST_SUB_BITS);
+	return (uint16_t)((shift + 1) * SBMP_HIST_SUB + ((value >> shift) & (SBMP_HIST_SUB - 1)));
+}
+
+uint32_t sbmp_hist_bucket_low(uint16_t index)
+{
+	if (index < SBMP_HIST_SUB) return index;
+
+	uint16_t octave = index / SBMP_HIST_SUB;
+	uint16_t sub = index % SBMP_HIST_SUB;
+	return (uint32_t)(SBMP_HIST_SUB + sub) << (octave - 1);
+}
+
+/** Get the highest value of a histogram bucket */
+static uint32_t hist_bucket_high(uint16_t index)
+{
+	if (index + 1 >= SBMP_HIST_BUCKETS) return UINT32_MAX;
+	return sbmp_hist_bucket_low((uint16_t)(index + 1)) - 1;
+}
+
+void sbmp_hist_add(SBMP_Histogram *hist, uint32_t value)
+{
+	if (hist->count == 0 || value < hist->min) hist->min = value;
+	if (value > hist->max) hist->max = value;
+
+	hist->count++;
+	hist->sum += value;
+	hist->buckets[hist_index(value)]++;
+}
+
+void sbmp_hist_merge(SBMP_Histogram *dst, const SBMP_Histogram *src)
+{
+	if (src->count == 0) return;
+
+	if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (uint16_t i = 0; i < SBMP_HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+uint32_t sbmp_hist_percentile(const SBMP_Histogram *hist, uint8_t percentile)
+{
+	if (hist->count == 0) return 0;
+	if (percentile > 100) percentile = 100;
+
+	// rank of the sample, rounded up
+	uint32_t rank = (uint32_t)(((uint64_t)hist->count * percentile + 99) / 100);
+	if (rank == 0) rank = 1;
+
+	uint32_t seen = 0;
+	for (uint16_t i = 0; i < SBMP_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint32_t high = hist_bucket_high(i);
+			return (high > hist->max) ? hist->max : high;
+		}
+	}
+
+	return hist->max;
+}
+
+static uint32_t hist_mean(const SBMP_Histogram *hist)
+{
+	return hist->count ? (uint32_t)(hist->sum / hist->count) : 0;
+}
+
+
+// ---- Recording ------------------------------------------------------
+
+SBMP_Stats *sbmp_stats_init(SBMP_Stats *stats, SBMP_StatsClockFunc clock)
+{
+	if (clock == NULL) {
+		sbmp_error("Stats need a clock.");
+		return NULL;
+	}
+
+#if SBMP_USE_MALLOC
+	if (stats == NULL) {
+		// caller wants us to allocate it
+		stats = sbmp_malloc(sizeof(SBMP_Stats));
+		if (stats == NULL) return NULL; // malloc failed
+	}
+#else
+	if (stats == NULL) {
+		return NULL; // malloc not enabled, fail
+	}
+#endif
+
+	stats->clock = clock;
+	sbmp_stats_reset(stats);
+
+	return stats;
+}
+
+void sbmp_stats_reset(SBMP_Stats *stats)
+{
+	SBMP_StatsClockFunc clock = stats->clock;
+
+	memset(stats, 0, sizeof(SBMP_Stats));
+
+	stats->clock = clock;
+	stats->started_at = clock();
+}
+
+/** Find or allocate the slot for a type */
+static SBMP_TypeStats *type_slot(SBMP_Stats *stats, SBMP_DgType type)
+{
+	for (int i = 0; i < SBMP_STATS_TYPES; i++) {
+		SBMP_TypeStats *ts = &stats->types[i];
+
+		if (!ts->used) {
+			ts->used = true;
+			ts->type = type;
+			return ts;
+		}
+
+		if (ts->type == type) return ts;
+	}
+
+	return &stats->other;
+}
+
+const SBMP_TypeStats *sbmp_stats_get(const SBMP_Stats *stats, SBMP_DgType type)
+{
+	for (int i = 0; i < SBMP_STATS_TYPES; i++) {
+		const SBMP_TypeStats *ts = &stats->types[i];
+		if (!ts->used) break;
+		if (ts->type == type) return ts;
+	}
+
+	return NULL;
+}
+
+void sbmp_stats_rx(SBMP_Stats *stats, const SBMP_Datagram *dg)
+{
+	SBMP_TypeStats *ts = type_slot(stats, dg->type);
+	ts->rx_count++;
+	ts->rx_bytes += dg->length;
+
+	// a response to a request we're timing?
+	for (int i = 0; i < SBMP_STATS_PENDING; i++) {
+		SBMP_StatsPending *p = &stats->pending[i];
+
+		if (p->used && p->session == dg->session) {
+			p->used = false;
+			sbmp_hist_add(&type_slot(stats, p->type)->latency, stats->arrival - p->sent_at);
+			break;
+		}
+	}
+}
+
+void sbmp_stats_handler(SBMP_Stats *stats, SBMP_DgType type, uint32_t start)
+{
+	sbmp_hist_add(&type_slot(stats, type)->handler, stats->clock() - start);
+}
+
+void sbmp_stats_tx(SBMP_Stats *stats, SBMP_DgType type, uint16_t length)
+{
+	SBMP_TypeStats *ts = type_slot(stats, type);
+	ts->tx_count++;
+	ts->tx_bytes += length;
+}
+
+void sbmp_stats_request(SBMP_Stats *stats, SBMP_DgType type, uint16_t session)
+{
+	uint32_t now = stats->clock();
+
+	// free slot, or the oldest one (its response is probably not coming)
+	SBMP_StatsPending *slot = &stats->pending[0];
+	for (int i = 0; i < SBMP_STATS_PENDING; i++) {
+		SBMP_StatsPending *p = &stats->pending[i];
+
+		if (!p->used) {
+			slot = p;
+			break;
+		}
+
+		if (now - p->sent_at > now - slot->sent_at) slot = p;
+	}
+
+	if (slot->used) stats->pending_evicted++;
+
+	slot->used = true;
+	slot->type = type;
+	slot->session = session;
+	slot->sent_at = now;
+}
+
+
+// ---- Output ---------------------------------------------------------
+
+/** Output buffer */
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len; /*!< Length of the whole output, can be > size */
+} Writer;
+
+static void out(Writer *w, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	size_t avail = (w->len < w->size) ? w->size - w->len : 0;
+	int n = vsnprintf(avail ? w->buf + w->len : NULL, avail, fmt, args);
+	if (n > 0) w->len += (size_t)n;
+
+	va_end(args);
+}
+
+/** Bytes per second over the measurement */
+static uint64_t rate(uint64_t bytes, uint32_t elapsed_us)
+{
+	return elapsed_us ? bytes * 1000000 / elapsed_us : 0;
+}
+
+static void text_hist(Writer *w, const SBMP_Histogram *h)
+{
+	out(w, " %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32,
+		h->count, hist_mean(h), sbmp_hist_percentile(h, 50), sbmp_hist_percentile(h, 99), h->max);
+}
+
+static void text_type(Writer *w, const SBMP_TypeStats *ts, const char *name, uint32_t elapsed)
+{
+	out(w, "%5s %8"PRIu32" %10"PRIu64" %8"PRIu32" %10"PRIu64" %9"PRIu64" %9"PRIu64" |",
+		name, ts->rx_count, ts->rx_bytes, ts->tx_count, ts->tx_bytes,
+		rate(ts->rx_bytes, elapsed), rate(ts->tx_bytes, elapsed));
+	text_hist(w, &ts->handler);
+	out(w, " |");
+	text_hist(w, &ts->latency);
+	out(w, "\n");
+}
+
+size_t sbmp_stats_dump_text(const SBMP_Stats *stats, char *buf, size_t size)
+{
+	Writer w = {buf, size, 0};
+	if (size > 0) buf[0] = 0;
+
+	uint32_t elapsed = stats->clock() - stats->started_at;
+
+	out(&w, "SBMP stats over %"PRIu32" ms (times in us)\n", elapsed / 1000);
+	out(&w, "%5s %8s %10s %8s %10s %9s %9s | %8s %8s %8s %8s %8s | %8s %8s %8s %8s %8s\n",
+		"type", "rx", "rx B", "tx", "tx B", "rx B/s", "tx B/s",
+		"handled", "mean", "p50", "p99", "max",
+		"replies", "mean", "p50", "p99", "max");
+
+	char name[6];
+	for (int i = 0; i < SBMP_STATS_TYPES; i++) {
+		const SBMP_TypeStats *ts = &stats->types[i];
+		if (!ts->used) break;
+
+		snprintf(name, sizeof(name), "%"PRIu8, ts->type);
+		text_type(&w, ts, name, elapsed);
+	}
+
+	if (stats->other.rx_count || stats->other.tx_count) {
+		text_type(&w, &stats->other, "other", elapsed);
+	}
+
+	if (stats->pending_evicted) {
+		out(&w, "%"PRIu32" requests without a response dropped from the table\n", stats->pending_evicted);
+	}
+
+	return w.len;
+}
+
+static void json_hist(Writer *w, const char *key, const SBMP_Histogram *h)
+{
+	out(w, "\"%s\":{\"count\":%"PRIu32",\"min\":%"PRIu32",\"mean\":%"PRIu32",\"p50\":%"PRIu32
+		",\"p90\":%"PRIu32",\"p99\":%"PRIu32",\"max\":%"PRIu32",\"buckets\":[",
+		key, h->count, (h->count ? h->min : 0), hist_mean(h), sbmp_hist_percentile(h, 50),
+		sbmp_hist_percentile(h, 90), sbmp_hist_percentile(h, 99), h->max);
+
+	bool first = true;
+	for (uint16_t i = 0; i < SBMP_HIST_BUCKETS; i++) {
+		if (h->buckets[i] == 0) continue;
+		out(w, "%s[%"PRIu32",%"PRIu32"]", first ? "" : ",", sbmp_hist_bucket_low(i), h->buckets[i]);
+		first = false;
+	}
+
+	out(w, "]}");
+}
+
+static void json_type(Writer *w, const SBMP_TypeStats *ts, bool other, uint32_t elapsed)
+{
+	if (other) {
+		out(w, "{\"type\":\"other\"");
+	} else {
+		out(w, "{\"type\":%"PRIu8, ts->type);
+	}
+
+	out(w, ",\"rx\":%"PRIu32",\"rx_bytes\":%"PRIu64",\"rx_rate\":%"PRIu64
+		",\"tx\":%"PRIu32",\"tx_bytes\":%"PRIu64",\"tx_rate\":%"PRIu64",",
+		ts->rx_count, ts->rx_bytes, rate(ts->rx_bytes, elapsed),
+		ts->tx_count, ts->tx_bytes, rate(ts->tx_bytes, elapsed));
+
+	json_hist(w, "handler_us", &ts->handler);
+	out(w, ",");
+	json_hist(w, "latency_us", &ts->latency);
+	out(w, "}");
+}
+
+size_t sbmp_stats_dump_json(const SBMP_Stats *stats, char *buf, size_t size)
+{
+	Writer w = {buf, size, 0};
+	if (size > 0) buf[0] = 0;
+
+	uint32_t elapsed = stats->clock() - stats->started_at;
+
+	out(&w, "{\"elapsed_us\":%"PRIu32",\"pending_evicted\":%"PRIu32",\"types\":[",
+		elapsed, stats->pending_evicted);
+
+	int i;
+	for (i = 0; i < SBMP_STATS_TYPES; i++) {
+		const SBMP_TypeStats *ts = &stats->types[i];
+		if (!ts->used) break;
+
+		if (i > 0) out(&w, ",");
+		json_type(&w, ts, false, elapsed);
+	}
+
+	if (stats->other.rx_count || stats->other.tx_count) {
+		if (i > 0) out(&w, ",");
+		json_type(&w, &stats->other, true, elapsed);
+	}
+
+	out(&w, "]}\n");
+
+	return w.len;
+}
+
+#endif /* SBMP_HAS_STATS */
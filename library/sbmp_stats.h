@@ -0,0 +1,216 @@
+#ifndef SBMP_STATS_H
+#define SBMP_STATS_H
+
+#include "sbmp_config.h"
+#if SBMP_HAS_STATS
+
+/**
+ * Instrumentation for the session layer.
+ *
+ * Enabled with sbmp_ep_init_stats(). For each datagram type, the endpoint
+ * then records:
+ *
+ * - received / sent datagrams and bytes (-> throughput),
+ * - how long the Rx handler (or a session listener) took,
+ * - request to response latency - from starting a message in a new session,
+ *   to the arrival of the first datagram with the same session number.
+ *   The latency is recorded under the type of the request.
+ *
+ * Times are kept in log-linear histograms (SBMP_HIST_SUB buckets per power
+ * of two, so the relative error is under 1/SBMP_HIST_SUB), in fixed memory.
+ *
+ * The struct is large (~2 kB per tracked type) - meant for bigger targets
+ * and for debugging.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbmp_datagram.h"
+
+/** Number of datagram types tracked separately (others are summed up) */
+#ifndef SBMP_STATS_TYPES
+#define SBMP_STATS_TYPES 8
+#endif
+
+/** Number of requests awaiting a response that can be tracked */
+#ifndef SBMP_STATS_PENDING
+#define SBMP_STATS_PENDING 8
+#endif
+
+/** Histogram sub-buckets per power of two (log2) */
+#ifndef SBMP_HIST_SUB_BITS
+#define SBMP_HIST_SUB_BITS 3
+#endif
+#define SBMP_HIST_SUB (1 << SBMP_HIST_SUB_BITS)
+
+/** Number of histogram buckets (covers the whole uint32_t range) */
+#define SBMP_HIST_BUCKETS ((32 - SBMP_HIST_SUB_BITS + 1) * SBMP_HIST_SUB)
+
+/**
+ * Clock function for the measurements.
+ * @return current time in microseconds (can wrap around)
+ */
+typedef uint32_t (*SBMP_StatsClockFunc)(void);
+
+/** Log-linear histogram */
+typedef struct {
+	uint32_t count;  /*!< Number of samples */
+	uint32_t min;    /*!< Smallest sample */
+	uint32_t max;    /*!< Largest sample */
+	uint64_t sum;    /*!< Sum of the samples (for the mean) */
+	uint32_t buckets[SBMP_HIST_BUCKETS]; /*!< Sample counts */
+} SBMP_Histogram;
+
+/** Stats of a datagram type */
+typedef struct {
+	SBMP_DgType type;       /*!< Datagram type */
+	bool used;              /*!< The slot is in use */
+
+	uint32_t rx_count;      /*!< Received datagrams */
+	uint32_t tx_count;      /*!< Sent datagrams */
+	uint64_t rx_bytes;      /*!< Received payload bytes */
+	uint64_t tx_bytes;      /*!< Sent payload bytes */
+
+	SBMP_Histogram handler; /*!< Rx handler run time (us) */
+	SBMP_Histogram latency; /*!< Request to response latency (us) */
+} SBMP_TypeStats;
+
+/** A request awaiting a response */
+typedef struct {
+	bool used;              /*!< The slot is in use */
+	SBMP_DgType type;       /*!< Request type */
+	uint16_t session;       /*!< Request session number */
+	uint32_t sent_at;       /*!< Time the request was started */
+} SBMP_StatsPending;
+
+/** Instrumentation state */
+typedef struct {
+	SBMP_StatsClockFunc clock; /*!< Microsecond clock */
+	uint32_t started_at;    /*!< Start of the measurement (init / reset) */
+	uint32_t arrival;       /*!< Arrival time of the datagram being processed */
+
+	SBMP_TypeStats types[SBMP_STATS_TYPES]; /*!< Per-type stats */
+	SBMP_TypeStats other;   /*!< Types that didn't fit in the table */
+
+	SBMP_StatsPending pending[SBMP_STATS_PENDING]; /*!< Requests awaiting a response */
+	uint32_t pending_evicted; /*!< Requests dropped from the table before a response came */
+} SBMP_Stats;
+
+
+/**
+ * @brief Add a sample to a histogram
+ * @param hist  : histogram
+ * @param value : the sample
+ */
+void sbmp_hist_add(SBMP_Histogram *hist, uint32_t value);
+
+/**
+ * @brief Add the samples of one histogram to another
+ * @param dst : histogram to add to
+ * @param src : histogram to add
+ */
+void sbmp_hist_merge(SBMP_Histogram *dst, const SBMP_Histogram *src);
+
+/**
+ * @brief Get a percentile from a histogram.
+ * @param hist       : histogram
+ * @param percentile : 0 - 100
+ * @return upper bound of the bucket holding the percentile, 0 if empty
+ */
+uint32_t sbmp_hist_percentile(const SBMP_Histogram *hist, uint8_t percentile);
+
+/**
+ * @brief Get the lowest value of a histogram bucket
+ * @param index : bucket index
+ * @return value
+ */
+uint32_t sbmp_hist_bucket_low(uint16_t index);
+
+/**
+ * @brief Initialize the instrumentation.
+ * @param stats : state, NULL to allocate
+ * @param clock : microsecond clock
+ * @return the state (allocated if stats was NULL), NULL on failure
+ */
+SBMP_Stats *sbmp_stats_init(SBMP_Stats *stats, SBMP_StatsClockFunc clock);
+
+/**
+ * @brief Clear all collected data
+ * @param stats : state
+ */
+void sbmp_stats_reset(SBMP_Stats *stats);
+
+/**
+ * @brief Note the arrival of a frame (before it's parsed)
+ * @param stats : state
+ */
+static inline void sbmp_stats_arrival(SBMP_Stats *stats)
+{
+	stats->arrival = stats->clock();
+}
+
+/**
+ * @brief Record a received datagram (arrival time from sbmp_stats_arrival())
+ * @param stats : state
+ * @param dg    : the datagram
+ */
+void sbmp_stats_rx(SBMP_Stats *stats, const SBMP_Datagram *dg);
+
+/**
+ * @brief Record the run time of the Rx handler
+ * @param stats : state
+ * @param type  : type of the handled datagram
+ * @param start : clock value before calling the handler
+ */
+void sbmp_stats_handler(SBMP_Stats *stats, SBMP_DgType type, uint32_t start);
+
+/**
+ * @brief Record a sent datagram
+ * @param stats  : state
+ * @param type   : datagram type
+ * @param length : payload length
+ */
+void sbmp_stats_tx(SBMP_Stats *stats, SBMP_DgType type, uint16_t length);
+
+/**
+ * @brief Start timing a request (a datagram starting a new session)
+ * @param stats   : state
+ * @param type    : datagram type
+ * @param session : session number
+ */
+void sbmp_stats_request(SBMP_Stats *stats, SBMP_DgType type, uint16_t session);
+
+/**
+ * @brief Get the stats for a datagram type
+ * @param stats : state
+ * @param type  : datagram type
+ * @return the stats, NULL if nothing recorded for the type
+ */
+const SBMP_TypeStats *sbmp_stats_get(const SBMP_Stats *stats, SBMP_DgType type);
+
+/**
+ * @brief Print the stats as a text table
+ *
+ * @param stats : state
+ * @param buf   : output buffer
+ * @param size  : buffer size
+ * @return length of the whole output (as snprintf - can be more than size)
+ */
+size_t sbmp_stats_dump_text(const SBMP_Stats *stats, char *buf, size_t size);
+
+/**
+ * @brief Export the stats as JSON, including the histogram buckets
+ *
+ * Non-empty buckets are listed as [lowest value, count] pairs.
+ *
+ * @param stats : state
+ * @param buf   : output buffer
+ * @param size  : buffer size
+ * @return length of the whole output (as snprintf - can be more than size)
+ */
+size_t sbmp_stats_dump_json(const SBMP_Stats *stats, char *buf, size_t size);
+
+#endif /* SBMP_HAS_STATS */
+#endif // SBMP_STATS_H
@@ -0,0 +1,703 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#include "sbmp_config.h"
+#include "sbmp_transport_posix.h"
+
+/** Internal flag: the fd is read and written by someone else */
+#define TP_EXTERNAL_IO 0x8000
+
+struct SBMP_Transport_struct {
+	int fd;
+	uint16_t flags;
+	SBMP_FrmInst *frm;      /*!< Attached framing layer instance */
+
+	uint8_t *tx_buf;
+	size_t tx_size;
+	size_t tx_pos;          /*!< First byte not yet written */
+	size_t tx_len;          /*!< Bytes in the buffer */
+
+	uint8_t *rx_buf;
+	size_t rx_size;
+	size_t rx_pos;          /*!< First byte not yet passed to the parser */
+	size_t rx_len;          /*!< Bytes in the buffer */
+
+	int error;
+	SBMP_TransportStats stats;
+};
+
+/** Set or clear O_NONBLOCK */
+static bool set_nonblock(int fd, bool nonblock)
+{
+	int fl = fcntl(fd, F_GETFL);
+	if (fl < 0) return false;
+
+	fl = nonblock ? (fl | O_NONBLOCK) : (fl & ~O_NONBLOCK);
+	return fcntl(fd, F_SETFL, fl) == 0;
+}
+
+SBMP_Transport *sbmp_tp_from_fd(int fd, uint16_t flags)
+{
+	SBMP_Transport *tp = calloc(1, sizeof(SBMP_Transport));
+	if (tp == NULL) {
+		sbmp_error("No memory for the transport.");
+		return NULL;
+	}
+
+	tp->fd = fd;
+	tp->flags = flags;
+
+	if (!sbmp_tp_set_buffers(tp, SBMP_TP_DEFAULT_TX_BUFFER, SBMP_TP_DEFAULT_RX_BUFFER)
+		|| !set_nonblock(fd, (flags & SBMP_TP_NONBLOCK) != 0)) {
+		free(tp->tx_buf);
+		free(tp->rx_buf);
+		free(tp);
+		return NULL;
+	}
+
+	return tp;
+}
+
+bool sbmp_tp_set_buffers(SBMP_Transport *tp, size_t tx_size, size_t rx_size)
+{
+	if (tx_size == 0 || rx_size == 0 || tp->tx_len > 0 || tp->rx_pos < tp->rx_len) {
+		sbmp_error("Can't change the transport buffers.");
+		return false;
+	}
+
+	uint8_t *tx = malloc(tx_size);
+	uint8_t *rx = malloc(rx_size);
+
+	if (tx == NULL || rx == NULL) {
+		sbmp_error("No memory for the transport buffers.");
+		free(tx);
+		free(rx);
+		return false;
+	}
+
+	free(tp->tx_buf);
+	free(tp->rx_buf);
+
+	tp->tx_buf = tx;
+	tp->tx_size = tx_size;
+	tp->rx_buf = rx;
+	tp->rx_size = rx_size;
+	tp->rx_pos = tp->rx_len = 0;
+
+	return true;
+}
+
+bool sbmp_tp_set_nonblock(SBMP_Transport *tp, bool nonblock)
+{
+	if (!set_nonblock(tp->fd, nonblock)) {
+		tp->error = errno;
+		return false;
+	}
+
+	if (nonblock) {
+		tp->flags |= SBMP_TP_NONBLOCK;
+	} else {
+		tp->flags &= (uint16_t) ~SBMP_TP_NONBLOCK;
+	}
+
+	return true;
+}
+
+// --- Serial ports & ptys ---
+
+/** Standard baud rates */
+static const struct {
+	uint32_t baud;
+	speed_t speed;
+} bauds[] = {
+	{1200, B1200}, {2400, B2400}, {4800, B4800}, {9600, B9600},
+	{19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+	{230400, B230400},
+#ifdef B460800
+	{460800, B460800},
+#endif
+#ifdef B500000
+	{500000, B500000},
+#endif
+#ifdef B921600
+	{921600, B921600},
+#endif
+#ifdef B1000000
+	{1000000, B1000000},
+#endif
+#ifdef B2000000
+	{2000000, B2000000},
+#endif
+#ifdef B3000000
+	{3000000, B3000000},
+#endif
+};
+
+#if defined(__linux__) && !defined(__powerpc__) && !defined(__sparc__) && !defined(__alpha__)
+#define HAS_TERMIOS2 1
+
+/** struct termios2 of the kernel (asm-generic layout), for custom baud rates */
+struct sbmp_termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#define SBMP_TCGETS2 _IOR('T', 0x2A, struct sbmp_termios2)
+#define SBMP_TCSETS2 _IOW('T', 0x2B, struct sbmp_termios2)
+#define SBMP_BOTHER  0010000
+
+/** Set a non-standard baud rate */
+static bool set_custom_baud(int fd, uint32_t baud)
+{
+	struct sbmp_termios2 tio;
+	if (ioctl(fd, SBMP_TCGETS2, &tio) != 0) return false;
+
+	tio.c_cflag &= ~(tcflag_t) CBAUD;
+	tio.c_cflag |= SBMP_BOTHER;
+	tio.c_ispeed = baud;
+	tio.c_ospeed = baud;
+
+	return ioctl(fd, SBMP_TCSETS2, &tio) == 0;
+}
+#else
+#define HAS_TERMIOS2 0
+#endif
+
+/** Ask the driver for a low latency (best effort) */
+static void set_low_latency(int fd)
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+	struct serial_struct ss;
+	if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(fd, TIOCSSERIAL, &ss) == 0) return;
+	}
+#endif
+
+	sbmp_dbg("Low latency mode not supported.");
+}
+
+/**
+ * Put a tty in the raw mode
+ * @param baud : baud rate, 0 = don't change
+ */
+static bool setup_tty(int fd, uint32_t baud, uint16_t flags)
+{
+	struct termios tio;
+	if (tcgetattr(fd, &tio) != 0) return false;
+
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(tcflag_t)(CSTOPB | PARENB);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+
+#ifdef CRTSCTS
+	if (flags & SBMP_TP_RTSCTS) {
+		tio.c_cflag |= CRTSCTS;
+	} else {
+		tio.c_cflag &= ~(tcflag_t) CRTSCTS;
+	}
+#endif
+
+	bool custom = false;
+
+	if (baud != 0) {
+		custom = true;
+
+		for (size_t i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+			if (bauds[i].baud == baud) {
+				cfsetispeed(&tio, bauds[i].speed);
+				cfsetospeed(&tio, bauds[i].speed);
+				custom = false;
+				break;
+			}
+		}
+	}
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) return false;
+
+	if (custom) {
+#if HAS_TERMIOS2
+		if (!set_custom_baud(fd, baud)) return false;
+#else
+		errno = EINVAL;
+		return false;
+#endif
+	}
+
+	if (flags & SBMP_TP_LOW_LATENCY) {
+		set_low_latency(fd);
+	}
+
+	return true;
+}
+
+SBMP_Transport *sbmp_tp_open_tty(const char *path, uint32_t baud, uint16_t flags)
+{
+	// non-blocking open doesn't wait for the carrier
+	int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		sbmp_error("Can't open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if (!setup_tty(fd, baud, flags)) {
+		sbmp_error("Can't set up %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+
+	SBMP_Transport *tp = sbmp_tp_from_fd(fd, flags);
+	if (tp == NULL) close(fd);
+	return tp;
+}
+
+SBMP_Transport *sbmp_tp_open_pty(const char **slave_name, uint16_t flags)
+{
+	static char name[128];
+
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+		sbmp_error("Can't open a pty: %s", strerror(errno));
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+
+	(void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	// the pty settings (used by the slave side) are shared with the master
+	if (!setup_tty(fd, 0, 0)) {
+		sbmp_error("Can't set up the pty: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	const char *pts = ptsname(fd);
+	if (pts == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	snprintf(name, sizeof(name), "%s", pts);
+	if (slave_name != NULL) *slave_name = name;
+
+	SBMP_Transport *tp = sbmp_tp_from_fd(fd, flags);
+	if (tp == NULL) close(fd);
+	return tp;
+}
+
+bool sbmp_tp_pty_pair(SBMP_Transport **a, SBMP_Transport **b, uint16_t flags)
+{
+	const char *name;
+
+	*a = sbmp_tp_open_pty(&name, flags);
+	if (*a == NULL) return false;
+
+	*b = sbmp_tp_open_tty(name, 0, flags & SBMP_TP_NONBLOCK);
+	if (*b == NULL) {
+		sbmp_tp_close(*a);
+		*a = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+// --- Sockets ---
+
+bool sbmp_tp_socketpair(SBMP_Transport **a, SBMP_Transport **b, uint16_t flags)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+		sbmp_error("Can't create a socketpair: %s", strerror(errno));
+		return false;
+	}
+
+	*a = sbmp_tp_from_fd(sv[0], flags);
+	*b = sbmp_tp_from_fd(sv[1], flags);
+
+	if (*a == NULL || *b == NULL) {
+		if (*a != NULL) sbmp_tp_close(*a); else close(sv[0]);
+		if (*b != NULL) sbmp_tp_close(*b); else close(sv[1]);
+		*a = *b = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+SBMP_Transport *sbmp_tp_open_unix(const char *path, uint16_t flags)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		sbmp_error("Socket path too long: %s", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		sbmp_error("Can't connect to %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+
+	SBMP_Transport *tp = sbmp_tp_from_fd(fd, flags);
+	if (tp == NULL) close(fd);
+	return tp;
+}
+
+SBMP_Transport *sbmp_tp_open_tcp(const char *host, uint16_t port, uint16_t flags)
+{
+	char port_str[8];
+	snprintf(port_str, sizeof(port_str), "%u", port);
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int rv = getaddrinfo(host, port_str, &hints, &res);
+	if (rv != 0) {
+		sbmp_error("Can't resolve %s: %s", host, gai_strerror(rv));
+		return NULL;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) continue;
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd < 0) {
+		sbmp_error("Can't connect to %s:%u: %s", host, port, strerror(errno));
+		return NULL;
+	}
+
+	// frames are written whole, don't wait for more
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	SBMP_Transport *tp = sbmp_tp_from_fd(fd, flags);
+	if (tp == NULL) close(fd);
+	return tp;
+}
+
+// --- Data path ---
+
+/** Make room for at least one more byte in the Tx buffer */
+static bool tx_make_room(SBMP_Transport *tp)
+{
+	if (tp->tx_len < tp->tx_size) return true;
+
+	if (!sbmp_tp_flush(tp)) return false;
+	if (tp->tx_len < tp->tx_size) return true;
+
+	// non-blocking and the OS buffer is full - keep the data
+	if (tp->tx_pos > 0) {
+		memmove(tp->tx_buf, tp->tx_buf + tp->tx_pos, tp->tx_len - tp->tx_pos);
+		tp->tx_len -= tp->tx_pos;
+		tp->tx_pos = 0;
+		return true;
+	}
+
+	uint8_t *buf = realloc(tp->tx_buf, tp->tx_size * 2);
+	if (buf == NULL) {
+		sbmp_error("No memory for the transport Tx buffer.");
+		return false;
+	}
+
+	tp->tx_buf = buf;
+	tp->tx_size *= 2;
+	return true;
+}
+
+/** Byte output of the framing layer */
+static void tp_out(uint8_t byte, void *token)
+{
+	SBMP_Transport *tp = token;
+
+	if (!tx_make_room(tp)) return; // the byte is lost, the peer drops the frame
+
+	tp->tx_buf[tp->tx_len++] = byte;
+}
+
+/** Frame end - write it */
+static void tp_end(void *token)
+{
+	sbmp_tp_flush(token);
+}
+
+void sbmp_tp_attach(SBMP_Transport *tp, SBMP_FrmInst *frm)
+{
+	tp->frm = frm;
+	sbmp_frm_set_tx_output(frm, tp_out, tp_end, tp);
+}
+
+bool sbmp_tp_flush(SBMP_Transport *tp)
+{
+	if (tp->flags & TP_EXTERNAL_IO) return true; // see sbmp_tp_tx_swap()
+
+	while (tp->tx_pos < tp->tx_len) {
+		ssize_t n = write(tp->fd, tp->tx_buf + tp->tx_pos, tp->tx_len - tp->tx_pos);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (tp->flags & SBMP_TP_NONBLOCK) return true; // the rest goes later
+
+				// a blocking transport on a non-blocking fd - wait
+				struct pollfd pfd = {.fd = tp->fd, .events = POLLOUT};
+				poll(&pfd, 1, -1);
+				continue;
+			}
+
+			tp->error = errno;
+			sbmp_error("Transport write failed: %s", strerror(errno));
+			tp->tx_pos = tp->tx_len = 0; // discard
+			return false;
+		}
+
+		tp->tx_pos += (size_t) n;
+		tp->stats.tx_bytes += (uint64_t) n;
+		tp->stats.writes++;
+	}
+
+	tp->tx_pos = tp->tx_len = 0;
+	return true;
+}
+
+/** Pass the buffered bytes to the parser, until it's busy */
+static void rx_feed(SBMP_Transport *tp)
+{
+	while (tp->rx_pos < tp->rx_len) {
+		if (tp->frm != NULL && sbmp_frm_receive(tp->frm, tp->rx_buf[tp->rx_pos]) == SBMP_RX_BUSY) {
+			return; // try again later
+		}
+
+		tp->rx_pos++;
+	}
+}
+
+ssize_t sbmp_tp_receive(SBMP_Transport *tp)
+{
+	if (tp->rx_pos < tp->rx_len) {
+		rx_feed(tp);
+		return 0;
+	}
+
+	if (tp->flags & TP_EXTERNAL_IO) return 0; // see sbmp_tp_feed()
+
+	ssize_t n = read(tp->fd, tp->rx_buf, tp->rx_size);
+
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+		tp->error = errno;
+		return -1;
+	}
+
+	if (n == 0) {
+		tp->error = 0; // end of file
+		return -1;
+	}
+
+	tp->stats.rx_bytes += (uint64_t) n;
+	tp->stats.reads++;
+
+	tp->rx_pos = 0;
+	tp->rx_len = (size_t) n;
+	rx_feed(tp);
+
+	return n;
+}
+
+// --- External I/O ---
+
+void sbmp_tp_set_external_io(SBMP_Transport *tp, bool external)
+{
+	if (external) {
+		tp->flags |= TP_EXTERNAL_IO;
+	} else {
+		tp->flags &= (uint16_t) ~TP_EXTERNAL_IO;
+	}
+}
+
+/** Make room for more received bytes (the unparsed ones are moved to the start) */
+static bool rx_make_room(SBMP_Transport *tp, size_t len)
+{
+	size_t pending = tp->rx_len - tp->rx_pos;
+
+	if (tp->rx_pos > 0) {
+		memmove(tp->rx_buf, tp->rx_buf + tp->rx_pos, pending);
+		tp->rx_pos = 0;
+		tp->rx_len = pending;
+	}
+
+	if (pending + len <= tp->rx_size) return true;
+
+	uint8_t *buf = realloc(tp->rx_buf, pending + len);
+	if (buf == NULL) {
+		sbmp_error("No memory for the transport Rx buffer.");
+		return false;
+	}
+
+	tp->rx_buf = buf;
+	tp->rx_size = pending + len;
+	return true;
+}
+
+bool sbmp_tp_feed(SBMP_Transport *tp, const uint8_t *data, ssize_t result)
+{
+	if (result <= 0) {
+		tp->error = (int) -result;
+		return false;
+	}
+
+	size_t len = (size_t) result;
+	tp->stats.rx_bytes += len;
+	tp->stats.reads++;
+
+	size_t i = 0;
+
+	if (tp->rx_pos == tp->rx_len) {
+		// nothing waiting - parse straight from the caller's buffer
+		while (i < len) {
+			if (tp->frm != NULL && sbmp_frm_receive(tp->frm, data[i]) == SBMP_RX_BUSY) break;
+			i++;
+		}
+
+		if (i == len) return true;
+	}
+
+	// keep the rest for sbmp_tp_receive()
+	if (!rx_make_room(tp, len - i)) return true; // the bytes are lost, the frame is dropped
+
+	memcpy(tp->rx_buf + tp->rx_len, data + i, len - i);
+	tp->rx_len += len - i;
+	rx_feed(tp);
+
+	return true;
+}
+
+bool sbmp_tp_tx_swap(SBMP_Transport *tp, uint8_t **buf, size_t *size, size_t *len)
+{
+	if (tp->tx_pos == tp->tx_len) return false;
+
+	uint8_t *fresh = *buf;
+	size_t fresh_size = *size;
+
+	if (fresh == NULL || fresh_size == 0) {
+		fresh_size = tp->tx_size;
+		fresh = malloc(fresh_size);
+		if (fresh == NULL) {
+			sbmp_error("No memory for the transport Tx buffer.");
+			return false;
+		}
+	}
+
+	if (tp->tx_pos > 0) {
+		memmove(tp->tx_buf, tp->tx_buf + tp->tx_pos, tp->tx_len - tp->tx_pos);
+		tp->tx_len -= tp->tx_pos;
+		tp->tx_pos = 0;
+	}
+
+	*buf = tp->tx_buf;
+	*size = tp->tx_size;
+	*len = tp->tx_len;
+
+	tp->tx_buf = fresh;
+	tp->tx_size = fresh_size;
+	tp->tx_len = 0;
+
+	return true;
+}
+
+bool sbmp_tp_written(SBMP_Transport *tp, ssize_t result)
+{
+	if (result < 0) {
+		tp->error = (int) -result;
+		sbmp_error("Transport write failed: %s", strerror(tp->error));
+		return false;
+	}
+
+	tp->stats.tx_bytes += (uint64_t) result;
+	tp->stats.writes++;
+	return true;
+}
+
+size_t sbmp_tp_tx_pending(SBMP_Transport *tp)
+{
+	return tp->tx_len - tp->tx_pos;
+}
+
+size_t sbmp_tp_rx_pending(SBMP_Transport *tp)
+{
+	return tp->rx_len - tp->rx_pos;
+}
+
+int sbmp_tp_fd(SBMP_Transport *tp)
+{
+	return tp->fd;
+}
+
+int sbmp_tp_error(SBMP_Transport *tp)
+{
+	return tp->error;
+}
+
+const SBMP_TransportStats *sbmp_tp_stats(SBMP_Transport *tp)
+{
+	return &tp->stats;
+}
+
+void sbmp_tp_close(SBMP_Transport *tp)
+{
+	if (tp->frm != NULL && tp->frm->tx_token == tp) {
+		sbmp_frm_set_tx_output(tp->frm, NULL, NULL, NULL);
+	}
+
+	close(tp->fd);
+	free(tp->tx_buf);
+	free(tp->rx_buf);
+	free(tp);
+}
@@ -0,0 +1,266 @@
+#ifndef SBMP_TRANSPORT_POSIX_H
+#define SBMP_TRANSPORT_POSIX_H
+
+/**
+ * Transport over a file descriptor (POSIX hosts only - not included from sbmp.h).
+ *
+ * Opens and configures serial ports, pseudo-terminals and Unix / TCP sockets,
+ * and connects them to a framing layer instance (or an endpoint):
+ *
+ * - Sent bytes are collected in a buffer and written with one write() at the
+ *   end of each frame (using sbmp_frm_set_tx_output()).
+ * - Received bytes are read in large chunks and passed to the frame parser.
+ * - The file descriptor is available for poll() / epoll.
+ *
+ * In the blocking mode, sbmp_tp_receive() waits for data, and a frame is
+ * always written completely. With SBMP_TP_NONBLOCK, the part of a frame that
+ * doesn't fit in the OS buffer is kept for later - wait for the fd to become
+ * writable and call sbmp_tp_flush() (see sbmp_tp_tx_pending()).
+ *
+ * Example:
+ *
+ *   SBMP_Transport *tp = sbmp_tp_open_tty("/dev/ttyUSB0", 115200, SBMP_TP_LOW_LATENCY);
+ *   sbmp_tp_attach(tp, &ep->frm);
+ *   while (sbmp_tp_receive(tp) >= 0) { ... }
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "sbmp_config.h"
+#include "sbmp_frame.h"
+
+/** Open flags */
+#define SBMP_TP_NONBLOCK    0x01 /*!< Non-blocking reads and writes */
+#define SBMP_TP_LOW_LATENCY 0x02 /*!< Serial port: ask the driver for a low latency (eg. FTDI timer) */
+#define SBMP_TP_RTSCTS      0x04 /*!< Serial port: hardware flow control */
+
+/** Default buffer sizes */
+#define SBMP_TP_DEFAULT_TX_BUFFER 4096
+#define SBMP_TP_DEFAULT_RX_BUFFER 4096
+
+/** Transport over a file descriptor */
+typedef struct SBMP_Transport_struct SBMP_Transport;
+
+/** Transport statistics */
+typedef struct {
+	uint64_t rx_bytes;      /*!< Bytes read */
+	uint64_t tx_bytes;      /*!< Bytes written */
+	uint32_t reads;         /*!< read() calls that returned data */
+	uint32_t writes;        /*!< write() calls */
+} SBMP_TransportStats;
+
+
+/**
+ * @brief Wrap an open file descriptor (eg. an accepted socket).
+ *
+ * The descriptor is closed by sbmp_tp_close().
+ *
+ * @param fd    : file descriptor
+ * @param flags : SBMP_TP_NONBLOCK or 0
+ * @return the transport, NULL on failure
+ */
+SBMP_Transport *sbmp_tp_from_fd(int fd, uint16_t flags);
+
+/**
+ * @brief Open a serial port in the raw mode (8N1).
+ *
+ * Non-standard baud rates are supported on Linux.
+ *
+ * @param path  : device path
+ * @param baud  : baud rate, 0 = keep the current one
+ * @param flags : SBMP_TP_* flags
+ * @return the transport, NULL on failure
+ */
+SBMP_Transport *sbmp_tp_open_tty(const char *path, uint32_t baud, uint16_t flags);
+
+/**
+ * @brief Open a pseudo-terminal master, with the slave in the raw mode.
+ *
+ * Another program can open the slave as a serial port.
+ *
+ * @param slave_name : the slave path is stored here (static buffer), can be NULL
+ * @param flags      : SBMP_TP_NONBLOCK or 0
+ * @return the transport, NULL on failure
+ */
+SBMP_Transport *sbmp_tp_open_pty(const char **slave_name, uint16_t flags);
+
+/**
+ * @brief Create a connected pair of transports (pty master & slave), eg. for tests.
+ * @param a     : the master is stored here
+ * @param b     : the slave is stored here
+ * @param flags : SBMP_TP_NONBLOCK or 0
+ * @return success
+ */
+bool sbmp_tp_pty_pair(SBMP_Transport **a, SBMP_Transport **b, uint16_t flags);
+
+/**
+ * @brief Create a connected pair of transports (Unix stream socketpair), eg. for tests.
+ * @param a     : first transport
+ * @param b     : second transport
+ * @param flags : SBMP_TP_NONBLOCK or 0
+ * @return success
+ */
+bool sbmp_tp_socketpair(SBMP_Transport **a, SBMP_Transport **b, uint16_t flags);
+
+/**
+ * @brief Connect to a Unix stream socket.
+ * @param path  : socket path
+ * @param flags : SBMP_TP_NONBLOCK or 0 (the connection is made in the blocking mode)
+ * @return the transport, NULL on failure
+ */
+SBMP_Transport *sbmp_tp_open_unix(const char *path, uint16_t flags);
+
+/**
+ * @brief Connect to a TCP server (with TCP_NODELAY).
+ * @param host  : host name or address
+ * @param port  : port number
+ * @param flags : SBMP_TP_NONBLOCK or 0 (the connection is made in the blocking mode)
+ * @return the transport, NULL on failure
+ */
+SBMP_Transport *sbmp_tp_open_tcp(const char *host, uint16_t port, uint16_t flags);
+
+/**
+ * @brief Set the buffer sizes (before the transport is used).
+ *
+ * In the non-blocking mode, the Tx buffer grows if a frame doesn't fit.
+ *
+ * @param tp      : transport
+ * @param tx_size : Tx buffer size
+ * @param rx_size : Rx buffer size (bytes read at once)
+ * @return success
+ */
+bool sbmp_tp_set_buffers(SBMP_Transport *tp, size_t tx_size, size_t rx_size);
+
+/**
+ * @brief Switch between the blocking and the non-blocking mode
+ * @param tp       : transport
+ * @param nonblock : non-blocking mode
+ * @return success
+ */
+bool sbmp_tp_set_nonblock(SBMP_Transport *tp, bool nonblock);
+
+/**
+ * @brief Connect the transport to a framing layer instance (eg. &ep->frm).
+ *
+ * Sets the instance's output functions; tx_func is not used.
+ *
+ * @param tp  : transport
+ * @param frm : framing layer instance
+ */
+void sbmp_tp_attach(SBMP_Transport *tp, SBMP_FrmInst *frm);
+
+/**
+ * @brief Read what's available (blocking: wait for data) and pass it to the frame parser.
+ *
+ * If the parser is busy (waiting for the Rx handler), the rest of the data
+ * is kept and passed on the next call.
+ *
+ * @param tp : transport
+ * @return bytes read (0 if nothing was available), -1 on EOF or an error (see sbmp_tp_error())
+ */
+ssize_t sbmp_tp_receive(SBMP_Transport *tp);
+
+/**
+ * @brief Write the buffered bytes.
+ *
+ * Called automatically at the end of each frame. In the non-blocking mode,
+ * call it again when the fd becomes writable.
+ *
+ * @param tp : transport
+ * @return false on an error (see sbmp_tp_error())
+ */
+bool sbmp_tp_flush(SBMP_Transport *tp);
+
+/**
+ * @brief Let someone else do the reads and writes (eg. an io_uring loop).
+ *
+ * sbmp_tp_receive() and sbmp_tp_flush() then don't touch the fd; the sent
+ * frames stay in the Tx buffer (it grows as needed) until they're taken with
+ * sbmp_tp_tx_swap(), and the data read by the owner is passed in with
+ * sbmp_tp_feed().
+ *
+ * @param tp       : transport
+ * @param external : enable the external I/O
+ */
+void sbmp_tp_set_external_io(SBMP_Transport *tp, bool external);
+
+/**
+ * @brief Pass the result of an external read to the frame parser.
+ *
+ * If the parser is busy, the rest is kept (see sbmp_tp_rx_pending()).
+ *
+ * @param tp     : transport
+ * @param data   : the bytes read
+ * @param result : byte count, 0 = end of file, -errno = error
+ * @return false on EOF or an error (stored for sbmp_tp_error())
+ */
+bool sbmp_tp_feed(SBMP_Transport *tp, const uint8_t *data, ssize_t result);
+
+/**
+ * @brief Take the bytes waiting to be written, giving the transport another buffer.
+ *
+ * Used for external writes - the taken buffer isn't touched by the
+ * transport, so it can be written asynchronously, and then passed back in
+ * the next call.
+ *
+ * @param tp   : transport
+ * @param buf  : in: an empty buffer (NULL = allocate one), out: the data
+ * @param size : in: size of the empty buffer, out: size of the returned one
+ * @param len  : the data length is stored here
+ * @return true if there was data to take
+ */
+bool sbmp_tp_tx_swap(SBMP_Transport *tp, uint8_t **buf, size_t *size, size_t *len);
+
+/**
+ * @brief Report the result of an external write (for the stats and sbmp_tp_error())
+ * @param tp     : transport
+ * @param result : bytes written, -errno = error
+ * @return false on an error
+ */
+bool sbmp_tp_written(SBMP_Transport *tp, ssize_t result);
+
+/**
+ * @brief Get the number of bytes waiting to be written
+ * @param tp : transport
+ * @return byte count
+ */
+size_t sbmp_tp_tx_pending(SBMP_Transport *tp);
+
+/**
+ * @brief Get the number of received bytes not yet accepted by the frame parser
+ * @param tp : transport
+ * @return byte count
+ */
+size_t sbmp_tp_rx_pending(SBMP_Transport *tp);
+
+/**
+ * @brief Get the file descriptor (for poll() / epoll)
+ * @param tp : transport
+ * @return the fd
+ */
+int sbmp_tp_fd(SBMP_Transport *tp);
+
+/**
+ * @brief Get the error of the last failed call
+ * @param tp : transport
+ * @return errno value, 0 = end of file
+ */
+int sbmp_tp_error(SBMP_Transport *tp);
+
+/**
+ * @brief Get the statistics
+ * @param tp : transport
+ * @return the stats
+ */
+const SBMP_TransportStats *sbmp_tp_stats(SBMP_Transport *tp);
+
+/**
+ * @brief Detach the transport, close the fd and free it.
+ * @param tp : transport
+ */
+void sbmp_tp_close(SBMP_Transport *tp);
+
+#endif // SBMP_TRANSPORT_POSIX_H
@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sbmp_config.h"
+#include "sbmp_txq.h"
+#include "sbmp_datagram.h"
+
+#if !SBMP_HAS_THREADS
+#error "The transmit queue needs SBMP_HAS_THREADS"
+#endif
+
+// Datagram header length - 2 B sesn, 1 B type
+#define DG_HEADER_LEN 3
+// Frame header (5 B) + the longest checksum (4 B)
+#define FRAME_OVERHEAD 9
+// Initial buffer size for the owner's frames (grows if needed)
+#define OWNER_FRAME_SIZE 256
+
+/** A queued frame */
+typedef struct TxNode_struct {
+	struct TxNode_struct *next; /*!< Towards the tail, set by the producer after linking */
+	size_t len;
+	size_t size;
+	uint8_t data[];
+} TxNode;
+
+struct SBMP_TxQueue_struct {
+	SBMP_Endpoint *ep;
+
+	// The queue (intrusive MPSC - Vyukov). The stub keeps it non-empty.
+	TxNode *tail;               /*!< Last pushed node, swapped by the producers */
+	uint8_t pad1[64];
+	TxNode *head;               /*!< Next node to pop, used by the writer only */
+	TxNode stub;
+	uint8_t pad2[64];
+
+	size_t queued;              /*!< Frames pushed and not written yet */
+	bool writing;               /*!< A thread is writing to the output */
+
+	// the endpoint's own output
+	void (*tx_func)(uint8_t byte);
+	SBMP_FrmTxOutFunc tx_out;
+	SBMP_FrmTxEndFunc tx_end;
+	void *tx_token;
+
+	TxNode *owner_frame;        /*!< Frame being sent by the owner thread */
+
+	bool has_writer;
+	bool running;               /*!< Writer thread should run */
+	pthread_t writer;
+	pthread_mutex_t lock;       /*!< Only for sleeping / waking the writer */
+	pthread_cond_t cond;
+
+	SBMP_TxQueueStats stats;
+};
+
+
+static TxNode *node_new(size_t size)
+{
+	TxNode *n = malloc(sizeof(TxNode) + size);
+	if (n == NULL) {
+		sbmp_error("No memory for a queued frame.");
+		return NULL;
+	}
+
+	n->next = NULL;
+	n->len = 0;
+	n->size = size;
+	return n;
+}
+
+/** Add a node at the tail (any thread) */
+static void push(SBMP_TxQueue *q, TxNode *n)
+{
+	__atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+	TxNode *prev = __atomic_exchange_n(&q->tail, n, __ATOMIC_ACQ_REL);
+	// until this store, the consumer can't see n (nor the nodes pushed after it)
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take a node from the head (the writing thread only).
+ * @return the node, NULL if empty or a push is half-way
+ */
+static TxNode *pop(SBMP_TxQueue *q)
+{
+	TxNode *head = q->head;
+	TxNode *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+	if (head == &q->stub) {
+		if (next == NULL) return NULL;
+		q->head = next;
+		head = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next != NULL) {
+		q->head = next;
+		return head;
+	}
+
+	// head is the last one - put the stub behind it, so it can be taken
+	if (head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) return NULL;
+
+	push(q, &q->stub);
+
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (next != NULL) {
+		q->head = next;
+		return head;
+	}
+
+	return NULL;
+}
+
+/** Pass a frame to the endpoint's output */
+static void write_frame(SBMP_TxQueue *q, TxNode *n)
+{
+	if (q->tx_out != NULL) {
+		for (size_t i = 0; i < n->len; i++) q->tx_out(n->data[i], q->tx_token);
+	} else {
+		for (size_t i = 0; i < n->len; i++) q->tx_func(n->data[i]);
+	}
+
+	if (q->tx_end != NULL) q->tx_end(q->tx_token);
+
+	// other threads may read the stats
+	__atomic_fetch_add(&q->stats.frames, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&q->stats.bytes, n->len, __ATOMIC_RELAXED);
+}
+
+/** Write all the frames that can be taken now (the writing thread only) */
+static void write_all(SBMP_TxQueue *q)
+{
+	TxNode *n;
+	bool any = false;
+
+	while ((n = pop(q)) != NULL) {
+		write_frame(q, n);
+		free(n);
+		__atomic_fetch_sub(&q->queued, 1, __ATOMIC_RELEASE);
+		any = true;
+	}
+
+	if (any) __atomic_fetch_add(&q->stats.drains, 1, __ATOMIC_RELAXED);
+}
+
+/** Write the queue if no other thread does */
+static void drain(SBMP_TxQueue *q)
+{
+	// queued is raised before the flag is tried, and checked after it's cleared,
+	// so a frame left for the writing thread is never missed
+	while (__atomic_load_n(&q->queued, __ATOMIC_SEQ_CST) > 0) {
+		if (__atomic_exchange_n(&q->writing, true, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_add(&q->stats.handoffs, 1, __ATOMIC_RELAXED);
+			return; // it'll write ours too
+		}
+
+		write_all(q);
+		__atomic_store_n(&q->writing, false, __ATOMIC_SEQ_CST);
+	}
+}
+
+/** Queue a finished frame and get it written */
+static void enqueue(SBMP_TxQueue *q, TxNode *n)
+{
+	size_t was = __atomic_fetch_add(&q->queued, 1, __ATOMIC_SEQ_CST);
+	push(q, n);
+
+	if (!q->has_writer) {
+		drain(q);
+	} else if (was == 0) {
+		// the writer may be going to sleep
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+static void *writer_thread(void *arg)
+{
+	SBMP_TxQueue *q = arg;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->running) {
+		if (__atomic_load_n(&q->queued, __ATOMIC_SEQ_CST) == 0) {
+			pthread_cond_wait(&q->cond, &q->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&q->lock);
+		write_all(q); // can stop short while a push is half-way, then we come back
+		pthread_mutex_lock(&q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+// --- Owner's frames (the endpoint's framing layer) ---
+
+static void owner_out(uint8_t byte, void *token)
+{
+	SBMP_TxQueue *q = token;
+	TxNode *n = q->owner_frame;
+
+	if (n == NULL) {
+		n = q->owner_frame = node_new(OWNER_FRAME_SIZE);
+		if (n == NULL) return;
+	} else if (n->len == n->size) {
+		TxNode *bigger = realloc(n, sizeof(TxNode) + n->size * 2);
+		if (bigger == NULL) {
+			sbmp_error("No memory for a queued frame.");
+			return;
+		}
+		n = q->owner_frame = bigger;
+		n->size *= 2;
+	}
+
+	n->data[n->len++] = byte;
+}
+
+static void owner_end(void *token)
+{
+	SBMP_TxQueue *q = token;
+
+	if (q->owner_frame != NULL) {
+		enqueue(q, q->owner_frame);
+		q->owner_frame = NULL;
+	}
+}
+
+// --- Other threads' frames ---
+
+static void node_out(uint8_t byte, void *token)
+{
+	TxNode *n = token;
+	if (n->len < n->size) n->data[n->len++] = byte;
+}
+
+bool sbmp_txq_send_response(SBMP_TxQueue *q, SBMP_DgType type, const uint8_t *buffer, uint16_t length,
+							uint16_t sesn)
+{
+	SBMP_Endpoint *ep = q->ep;
+
+	bool flow_control = false;
+#if SBMP_HAS_CREDIT
+	flow_control = ep->credit.active;
+#endif
+
+	if (sbmp_ep_is_reliable(ep) || flow_control) {
+		sbmp_error("Can't send from other threads in reliable / flow controlled mode.");
+		return false;
+	}
+
+	if (length > ep->peer_buffer_size - DG_HEADER_LEN) {
+		sbmp_error("Msg too long (%"PRIu16" B), peer accepts max %"PRIu16" B.",
+				   length, (uint16_t)(ep->peer_buffer_size - DG_HEADER_LEN));
+		return false;
+	}
+
+	TxNode *n = node_new((size_t) length + DG_HEADER_LEN + FRAME_OVERHEAD);
+	if (n == NULL) return false;
+
+	// a framing layer of our own, writing into the node
+	uint8_t no_rx;
+	SBMP_FrmInst frm;
+	sbmp_frm_init(&frm, &no_rx, 1, NULL, NULL);
+	sbmp_frm_set_tx_output(&frm, node_out, NULL, n);
+	sbmp_frm_enable_tx(&frm, true);
+
+	if (!sbmp_dg_start(&frm, ep->peer_pref_cksum, sesn, type, length)
+		|| sbmp_frm_send_buffer(&frm, buffer, length) != length) {
+		free(n);
+		return false;
+	}
+
+	enqueue(q, n);
+	return true;
+}
+
+bool sbmp_txq_send_message(SBMP_TxQueue *q, SBMP_DgType type, const uint8_t *buffer, uint16_t length,
+						   uint16_t *sesn_ptr)
+{
+	uint16_t sn = sbmp_ep_new_session(q->ep);
+
+	// set before sending - the response can come before we return
+	uint16_t old_sesn = 0;
+	if (sesn_ptr != NULL) {
+		old_sesn = *sesn_ptr;
+		*sesn_ptr = sn;
+	}
+
+	bool suc = sbmp_txq_send_response(q, type, buffer, length, sn);
+
+	if (!suc && sesn_ptr != NULL) *sesn_ptr = old_sesn; // restore
+
+	return suc;
+}
+
+// ---
+
+SBMP_TxQueue *sbmp_txq_create(SBMP_Endpoint *ep)
+{
+	SBMP_FrmInst *frm = &ep->frm;
+
+	if (frm->tx_out == NULL && frm->tx_func == NULL) {
+		sbmp_error("Set the endpoint's output before adding a queue.");
+		return NULL;
+	}
+
+	SBMP_TxQueue *q = calloc(1, sizeof(SBMP_TxQueue));
+	if (q == NULL) {
+		sbmp_error("No memory for the transmit queue.");
+		return NULL;
+	}
+
+	q->ep = ep;
+	q->tail = q->head = &q->stub;
+
+	q->tx_func = frm->tx_func;
+	q->tx_out = frm->tx_out;
+	q->tx_end = frm->tx_end;
+	q->tx_token = frm->tx_token;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+
+	sbmp_frm_set_tx_output(frm, owner_out, owner_end, q);
+
+	return q;
+}
+
+bool sbmp_txq_start_writer(SBMP_TxQueue *q)
+{
+	if (q->has_writer) return true;
+
+	q->running = true;
+	if (pthread_create(&q->writer, NULL, writer_thread, q) != 0) {
+		sbmp_error("Can't start the writer thread.");
+		q->running = false;
+		return false;
+	}
+
+	q->has_writer = true;
+	return true;
+}
+
+size_t sbmp_txq_pending(SBMP_TxQueue *q)
+{
+	return __atomic_load_n(&q->queued, __ATOMIC_ACQUIRE);
+}
+
+const SBMP_TxQueueStats *sbmp_txq_stats(SBMP_TxQueue *q)
+{
+	return &q->stats;
+}
+
+void sbmp_txq_close(SBMP_TxQueue *q)
+{
+	if (q == NULL) return;
+
+	if (q->has_writer) {
+		pthread_mutex_lock(&q->lock);
+		q->running = false;
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+
+		pthread_join(q->writer, NULL);
+		q->has_writer = false;
+	}
+
+	drain(q);
+
+	SBMP_FrmInst *frm = &q->ep->frm;
+	frm->tx_func = q->tx_func;
+	sbmp_frm_set_tx_output(frm, q->tx_out, q->tx_end, q->tx_token);
+
+	free(q->owner_frame);
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+}
@@ -0,0 +1,126 @@
+#ifndef SBMP_TXQ_H
+#define SBMP_TXQ_H
+
+/**
+ * Multi-threaded transmit queue (POSIX threads - not included from sbmp.h).
+ *
+ * The endpoint and the framing layer are not thread-safe: the bytes of two
+ * messages sent at the same time would interleave. With a transmit queue,
+ * any number of threads can send messages on one endpoint at once:
+ *
+ * - Each sending thread encodes its whole frame into a private buffer,
+ *   with its own framing layer instance - nothing is shared while encoding.
+ * - The finished frames go into a lock-free multi-producer queue.
+ * - One thread at a time writes the queued frames to the transport:
+ *   either a writer thread (sbmp_txq_start_writer()), or whichever sender
+ *   wins a flag - the others just leave their frame in the queue.
+ *
+ * The thread that receives (the "owner" - eg. the one calling
+ * sbmp_tp_receive()) keeps using the endpoint as usual, including the
+ * sbmp_ep_send_*() functions, handshake, reliable mode and flow control;
+ * its frames go through the same queue. Only the owner may use those.
+ * Receiving and sending run in parallel - the transport's Rx and Tx sides
+ * are independent.
+ *
+ * Other threads send with sbmp_txq_send_message() / sbmp_txq_send_response().
+ * These make plain datagrams: they fail if the endpoint uses reliable mode
+ * or flow control (both need the owner's state), and aren't counted in the
+ * endpoint statistics. Start them after the handshake.
+ *
+ * Needs SBMP_HAS_THREADS (atomic session numbers) and GCC / Clang atomics.
+ *
+ *   sbmp_tp_attach(tp, &ep->frm);
+ *   q = sbmp_txq_create(ep);     // takes over the output set by the transport
+ *   any thread:  sbmp_txq_send_message(q, type, buf, len, &sesn);
+ *   owner:       while (sbmp_tp_receive(tp) >= 0) { ... }
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sbmp_config.h"
+#include "sbmp_session.h"
+
+/** Transmit queue of an endpoint */
+typedef struct SBMP_TxQueue_struct SBMP_TxQueue;
+
+/** Transmit queue statistics */
+typedef struct {
+	uint64_t frames;        /*!< Frames written to the output */
+	uint64_t bytes;         /*!< Bytes written to the output */
+	uint64_t drains;        /*!< Times the queue was emptied by one writer */
+	uint64_t handoffs;      /*!< Frames left in the queue for the thread already writing */
+} SBMP_TxQueueStats;
+
+
+/**
+ * @brief Put a transmit queue between the endpoint and its output.
+ *
+ * The output (tx_func, or the one set by sbmp_frm_set_tx_output(), eg. by
+ * a transport) must be set before, and is called by one thread at a time.
+ *
+ * @param ep : endpoint, initialized and with its output set
+ * @return the queue, NULL on failure
+ */
+SBMP_TxQueue *sbmp_txq_create(SBMP_Endpoint *ep);
+
+/**
+ * @brief Write the frames from a dedicated thread.
+ *
+ * The senders then never write to the output themselves.
+ * Without it, the sender that finds nobody writing writes all queued frames.
+ *
+ * @param q : queue
+ * @return success
+ */
+bool sbmp_txq_start_writer(SBMP_TxQueue *q);
+
+/**
+ * @brief Send a message in a new session (from any thread).
+ * @param q        : queue
+ * @param type     : datagram type
+ * @param buffer   : payload
+ * @param length   : payload length
+ * @param sesn_ptr : the session number is stored here, can be NULL
+ * @return success (the frame is queued)
+ */
+bool sbmp_txq_send_message(SBMP_TxQueue *q, SBMP_DgType type, const uint8_t *buffer, uint16_t length,
+						   uint16_t *sesn_ptr);
+
+/**
+ * @brief Send a message in a session (from any thread).
+ * @param q      : queue
+ * @param type   : datagram type
+ * @param buffer : payload
+ * @param length : payload length
+ * @param sesn   : session number
+ * @return success (the frame is queued)
+ */
+bool sbmp_txq_send_response(SBMP_TxQueue *q, SBMP_DgType type, const uint8_t *buffer, uint16_t length,
+							uint16_t sesn);
+
+/**
+ * @brief Get the number of frames waiting in the queue
+ * @param q : queue
+ * @return frame count
+ */
+size_t sbmp_txq_pending(SBMP_TxQueue *q);
+
+/**
+ * @brief Get the statistics (updated atomically, read them with __atomic_load_n() while sending)
+ * @param q : queue
+ * @return the stats
+ */
+const SBMP_TxQueueStats *sbmp_txq_stats(SBMP_TxQueue *q);
+
+/**
+ * @brief Write the queued frames, give the output back to the endpoint, and free the queue.
+ *
+ * No other thread may send at this point.
+ *
+ * @param q : queue
+ */
+void sbmp_txq_close(SBMP_TxQueue *q);
+
+#endif // SBMP_TXQ_H